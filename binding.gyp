@@ -6,12 +6,26 @@
         'open-vcdiff',
       ],
       'sources': [
+        'src/vcd_code_table_trainer.cc',
+        'src/vcd_code_table_trainer.h',
         'src/vcd_decoder.cc',
         'src/vcd_decoder.h',
+        'src/vcd_diff.cc',
+        'src/vcd_diff.h',
+        'src/vcd_dictionary_analyzer.cc',
+        'src/vcd_dictionary_analyzer.h',
+        'src/vcd_dictionary_builder.cc',
+        'src/vcd_dictionary_builder.h',
+        'src/vcd_encode_cache.cc',
+        'src/vcd_encode_cache.h',
         'src/vcd_encoder.cc',
         'src/vcd_encoder.h',
         'src/vcd_hashed_dictionary.cc',
         'src/vcd_hashed_dictionary.h',
+        'src/vcd_range_decoder.cc',
+        'src/vcd_range_decoder.h',
+        'src/vcd_zlib.cc',
+        'src/vcd_zlib.h',
         'src/vcdiff.cc',
         'src/vcdiff.h',
       ],
@@ -24,11 +24,30 @@ exports.MIN_MIN_ENCODE_WINDOW_SIZE = 64;
 exports.MAX_MIN_ENCODE_WINDOW_SIZE = Infinity;
 exports.DEFAULT_MIN_ENCODE_WINDOW_SIZE = 4 * 1024;  // 4Kb
 
+// 0 means no limit.
+exports.DEFAULT_ENCODE_TIME_LIMIT = 0;
+exports.DEFAULT_MAX_DELTA_RATIO = 0;
+
+// Size of a code table, as defined in section 7 of RFC 3284.
+exports.CODE_TABLE_SIZE = 1536;
+
+// Address cache sizes, as defined in section 5.1 of RFC 3284. Both caches
+// together may have at most MAX_ADDRESS_CACHE_SIZE entries.
+exports.DEFAULT_NEAR_CACHE_SIZE = 4;
+exports.DEFAULT_SAME_CACHE_SIZE = 3;
+exports.MAX_ADDRESS_CACHE_SIZE = 252;
+
 
 exports.codes = {
   VCD_INIT_ERROR : binding.INIT_ERROR,
   VCD_ENCODE_ERROR : binding.ENCODE_ERROR,
   VCD_DECODE_ERROR : binding.DECODE_ERROR,
+  VCD_ZLIB_ERROR : binding.ZLIB_ERROR,
+};
+
+var compressions = {
+  deflate: binding.COMPRESSION_DEFLATE,
+  gzip: binding.COMPRESSION_GZIP,
 };
 
 Object.keys(exports.codes).forEach(function(k) {
@@ -36,6 +55,9 @@ Object.keys(exports.codes).forEach(function(k) {
 });
 
 exports.HashedDictionary = binding.HashedDictionary;
+exports.EncodeCache = binding.EncodeCache;
+exports.DictionaryAnalyzer = DictionaryAnalyzer;
+exports.CodeTableTrainer = CodeTableTrainer;
 exports.VcdiffEncoder = VcdiffEncoder;
 exports.VcdiffDecoder = VcdiffDecoder;
 
@@ -63,6 +85,349 @@ exports.vcdiffDecodeSync = function(buffer, opts) {
   return vcdiffBufferSync(new VcdiffDecoder(opts), buffer);
 };
 
+// Encodes newBuffer against oldBuffer, for sources that are used only once.
+// Cheaper than building a HashedDictionary for oldBuffer. Decode the result
+// with { dictionary: oldBuffer }.
+exports.diff = function(oldBuffer, newBuffer, opts, callback) {
+  if (opts instanceof Function) {
+    callback = opts;
+    opts = {};
+  }
+  if (!(callback instanceof Function))
+    throw new Error('callback should be a Function instance');
+  var args = diffArgs(oldBuffer, newBuffer, opts);
+  binding.diff(args[0], args[1], args[2], args[3], function(err, delta) {
+    callback(err, delta);
+  });
+};
+
+exports.diffSync = function(oldBuffer, newBuffer, opts) {
+  var args = diffArgs(oldBuffer, newBuffer, opts);
+  return binding.diffSync(args[0], args[1], args[2], args[3]);
+};
+
+function diffArgs(oldBuffer, newBuffer, opts) {
+  opts = opts || {};
+  if (typeof oldBuffer === 'string')
+    oldBuffer = new Buffer(oldBuffer);
+  if (typeof newBuffer === 'string')
+    newBuffer = new Buffer(newBuffer);
+  if (!Buffer.isBuffer(oldBuffer) || !Buffer.isBuffer(newBuffer))
+    throw new TypeError('Not a string or buffer');
+
+  var flags = binding.VCD_STANDARD_FORMAT;
+  if (opts.interleaved === true)
+    flags |= binding.VCD_FORMAT_INTERLEAVED;
+  if (opts.checksum === true)
+    flags |= binding.VCD_FORMAT_CHECKSUM;
+  if (opts.json === true)
+    flags |= binding.VCD_FORMAT_JSON;
+
+  return [oldBuffer, newBuffer, flags, opts.targetMatches === true];
+}
+
+// Lists the windows of delta, whose target must not be copied from across
+// windows, as encoders with the encodeWindowSize option write them. Each
+// window decodes to the bytes [targetOffset, targetOffset + targetLength) of
+// the target; with the delta header, the bytes [deltaOffset, deltaOffset +
+// deltaLength) of any subset of windows form a valid delta on their own.
+exports.indexDelta = function(delta, dictionary, opts) {
+  opts = opts || {};
+  if (!Buffer.isBuffer(delta))
+    throw new TypeError('Not a buffer');
+  var index = binding.indexDelta(delta, dictionaryOption(dictionary),
+                                 codeTableOption(opts.codeTable));
+  var windows = [];
+  for (var i = 1; i < index.length; i += 4) {
+    windows.push({
+      deltaOffset: index[i],
+      deltaLength: index[i + 1],
+      targetOffset: index[i + 2],
+      targetLength: index[i + 3]
+    });
+  }
+  return { headerLength: index[0], windows: windows };
+};
+
+// Decodes the bytes [start, end) of the target of delta, and only the
+// windows that hold them (see indexDelta).
+exports.decodeRange = function(delta, dictionary, start, end, opts,
+                               callback) {
+  if (opts instanceof Function) {
+    callback = opts;
+    opts = {};
+  }
+  if (!(callback instanceof Function))
+    throw new Error('callback should be a Function instance');
+  var args = rangeArgs(delta, dictionary, start, end, opts);
+  binding.decodeRange(args[0], args[1], args[2], args[3], args[4], args[5],
+                      args[6], function(err, target) {
+    callback(err, target);
+  });
+};
+
+exports.decodeRangeSync = function(delta, dictionary, start, end, opts) {
+  var args = rangeArgs(delta, dictionary, start, end, opts);
+  return binding.decodeRangeSync(args[0], args[1], args[2], args[3], args[4],
+                                 args[5], args[6]);
+};
+
+function rangeArgs(delta, dictionary, start, end, opts) {
+  opts = opts || {};
+  if (!Buffer.isBuffer(delta))
+    throw new TypeError('Not a buffer');
+  if (start !== Math.floor(start) || end !== Math.floor(end) ||
+      !(start >= 0) || !(end >= start))
+    throw new RangeError('Invalid range: ' + start + '-' + end);
+
+  var maxTargetFileSize = exports.DEFAULT_MAX_TARGET_FILE_SIZE;
+  if (opts.maxTargetFileSize) {
+    if (opts.maxTargetFileSize < exports.MIN_MAX_TARGET_FILE_SIZE ||
+        opts.maxTargetFileSize > exports.MAX_MAX_TARGET_FILE_SIZE)
+      throw new Error('Invalid max target file size: ' +
+                      opts.maxTargetFileSize);
+    maxTargetFileSize = opts.maxTargetFileSize;
+  }
+  var maxTargetWindowSize = exports.DEFAULT_MAX_TARGET_WINDOW_SIZE;
+  if (opts.maxTargetWindowSize) {
+    if (opts.maxTargetWindowSize < exports.MIN_MAX_TARGET_WINDOW_SIZE ||
+        opts.maxTargetWindowSize > exports.MAX_MAX_TARGET_WINDOW_SIZE)
+      throw new Error('Invalid max target window size: ' +
+                      opts.maxTargetWindowSize);
+    maxTargetWindowSize = opts.maxTargetWindowSize;
+  }
+
+  return [delta, dictionaryOption(dictionary), start, end, maxTargetFileSize,
+          maxTargetWindowSize, codeTableOption(opts.codeTable)];
+}
+
+exports.DEFAULT_DICTIONARY_SIZE = 64 * 1024;  // 64Kb
+exports.DEFAULT_DICTIONARY_MIN_FREQUENCY = 2;
+
+exports.buildDictionary = function(samples, opts, callback) {
+  if (opts instanceof Function) {
+    callback = opts;
+    opts = {};
+  }
+  if (!(callback instanceof Function))
+    throw new Error('callback should be a Function instance');
+  var args = dictionaryBuilderArgs(samples, opts);
+  binding.buildDictionary(args[0], args[1], args[2], args[3],
+                          function(err, dictionary) {
+    callback(err, dictionary);
+  });
+};
+
+exports.buildDictionarySync = function(samples, opts) {
+  var args = dictionaryBuilderArgs(samples, opts);
+  return binding.buildDictionarySync(args[0], args[1], args[2], args[3]);
+};
+
+function dictionaryBuilderArgs(samples, opts) {
+  opts = opts || {};
+  if (!Array.isArray(samples))
+    throw new TypeError('samples should be an Array');
+  samples = samples.map(function(sample) {
+    if (typeof sample === 'string')
+      return new Buffer(sample);
+    if (!Buffer.isBuffer(sample))
+      throw new TypeError('Not a string or buffer');
+    return sample;
+  });
+
+  var maxSize = exports.DEFAULT_DICTIONARY_SIZE;
+  if (opts.maxSize !== undefined) {
+    if (!(opts.maxSize > 0))
+      throw new Error('Invalid dictionary size: ' + opts.maxSize);
+    maxSize = opts.maxSize;
+  }
+
+  var minFrequency = exports.DEFAULT_DICTIONARY_MIN_FREQUENCY;
+  if (opts.minFrequency !== undefined) {
+    if (!(opts.minFrequency >= 1))
+      throw new Error('Invalid min frequency: ' + opts.minFrequency);
+    minFrequency = opts.minFrequency;
+  }
+
+  var threads = 0;
+  if (opts.threads !== undefined) {
+    if (!(opts.threads >= 1))
+      throw new Error('Invalid number of threads: ' + opts.threads);
+    threads = opts.threads;
+  }
+
+  return [samples, maxSize, minFrequency, threads];
+}
+
+// Records which parts of a dictionary a corpus actually uses. Each target
+// passed to analyze() is encoded as a single window.
+function DictionaryAnalyzer(hashedDictionary, opts) {
+  opts = opts || {};
+  if (!(hashedDictionary instanceof binding.HashedDictionary))
+    throw new Error('Must provide HashedDictionary');
+  this._handle = new binding.DictionaryAnalyzer(hashedDictionary,
+                                                opts.targetMatches === true);
+}
+
+DictionaryAnalyzer.prototype.analyze = function(target) {
+  if (typeof target === 'string')
+    target = new Buffer(target);
+  if (!Buffer.isBuffer(target))
+    throw new TypeError('Not a string or buffer');
+  if (!this._handle.analyze(target))
+    throw new Error('Failed to encode target');
+};
+
+DictionaryAnalyzer.prototype.stats = function() {
+  return this._handle.stats();
+};
+
+// Returns the used parts of the dictionary, hottest first if they do not
+// fit into maxSize bytes. No limit if maxSize is omitted.
+DictionaryAnalyzer.prototype.compact = function(maxSize) {
+  return this._handle.compact(dictionaryLimit(maxSize));
+};
+
+// Estimated ratio of encoded to original corpus size for each of the
+// given dictionary sizes.
+DictionaryAnalyzer.prototype.report = function(sizes) {
+  if (!Array.isArray(sizes))
+    throw new TypeError('sizes should be an Array');
+  var targetSize = this._handle.stats().targetSize;
+  return sizes.map(function(size) {
+    var encodedSize = this._handle.estimate(dictionaryLimit(size));
+    return {
+      dictionarySize: size,
+      encodedSize: encodedSize,
+      ratio: targetSize ? encodedSize / targetSize : 0,
+    };
+  }, this);
+};
+
+// Builds a code table that gives single-byte opcodes to the instructions
+// most common in the deltas of a corpus. Each target passed to analyze()
+// is encoded as a single window.
+function CodeTableTrainer(hashedDictionary, opts) {
+  opts = opts || {};
+  if (!(hashedDictionary instanceof binding.HashedDictionary))
+    throw new Error('Must provide HashedDictionary');
+  var sizes = addressCacheSizes(opts);
+  this._handle = new binding.CodeTableTrainer(hashedDictionary,
+                                              opts.targetMatches === true,
+                                              sizes[0], sizes[1]);
+}
+
+CodeTableTrainer.prototype.analyze = function(target) {
+  if (typeof target === 'string')
+    target = new Buffer(target);
+  if (!Buffer.isBuffer(target))
+    throw new TypeError('Not a string or buffer');
+  if (!this._handle.analyze(target))
+    throw new Error('Failed to encode target');
+};
+
+CodeTableTrainer.prototype.stats = function() {
+  return this._handle.stats();
+};
+
+// Returns the code table, to be passed as the codeTable option of both
+// the encoder and the decoder, and the number of bytes it is estimated to
+// save on the analyzed corpus. The default code table is returned if it
+// would save nothing.
+CodeTableTrainer.prototype.build = function() {
+  var result = this._handle.build();
+  return { codeTable: result[0], estimatedSaving: result[1] };
+};
+
+function addressCacheSizes(opts) {
+  var near = exports.DEFAULT_NEAR_CACHE_SIZE;
+  var same = exports.DEFAULT_SAME_CACHE_SIZE;
+  if (opts.nearCacheSize !== undefined)
+    near = opts.nearCacheSize;
+  if (opts.sameCacheSize !== undefined)
+    same = opts.sameCacheSize;
+  if (near !== (near | 0) || same !== (same | 0) || near < 0 || same < 0 ||
+      near + same > exports.MAX_ADDRESS_CACHE_SIZE)
+    throw new Error('Invalid address cache sizes: ' + near + ', ' + same);
+  return [near, same];
+}
+
+exports.DEFAULT_ADDRESS_CACHE_CANDIDATES = [
+  [0, 0], [2, 1], [4, 3], [6, 3], [8, 3], [12, 3], [16, 3], [8, 0], [16, 0],
+];
+
+// Picks the address cache sizes that make the deltas of samples the
+// smallest, by encoding all of them with each of opts.candidates, an Array
+// of [nearCacheSize, sameCacheSize]. The other encoder options in opts
+// apply to every encoding. Runs synchronously.
+exports.tuneAddressCache = function(hashedDictionary, samples, opts) {
+  opts = opts || {};
+  if (!(hashedDictionary instanceof binding.HashedDictionary))
+    throw new Error('Must provide HashedDictionary');
+  if (!Array.isArray(samples))
+    throw new TypeError('samples should be an Array');
+  var candidates = opts.candidates || exports.DEFAULT_ADDRESS_CACHE_CANDIDATES;
+  if (!Array.isArray(candidates) || candidates.length === 0)
+    throw new TypeError('candidates should be a non-empty Array');
+
+  var encodeOpts = {};
+  Object.keys(opts).forEach(function(k) {
+    encodeOpts[k] = opts[k];
+  });
+  encodeOpts.hashedDictionary = hashedDictionary;
+  delete encodeOpts.candidates;
+  delete encodeOpts.cache;
+
+  var results = candidates.map(function(candidate) {
+    encodeOpts.nearCacheSize = candidate[0];
+    encodeOpts.sameCacheSize = candidate[1];
+    addressCacheSizes(encodeOpts);
+    var encodedSize = 0;
+    samples.forEach(function(sample) {
+      encodedSize += exports.vcdiffEncodeSync(sample, encodeOpts).length;
+    });
+    return {
+      nearCacheSize: candidate[0],
+      sameCacheSize: candidate[1],
+      encodedSize: encodedSize,
+    };
+  });
+  // The first of the smallest, so that ties keep the earlier candidate.
+  return results.reduce(function(best, result) {
+    return result.encodedSize < best.encodedSize ? result : best;
+  });
+};
+
+function codeTableOption(codeTable) {
+  if (codeTable === undefined)
+    return undefined;
+  if (!Buffer.isBuffer(codeTable) ||
+      codeTable.length !== exports.CODE_TABLE_SIZE)
+    throw new Error('Invalid code table: it should be a Buffer of ' +
+                    exports.CODE_TABLE_SIZE + ' bytes');
+  return codeTable;
+}
+
+function dictionaryOption(dictionary) {
+  if (Array.isArray(dictionary)) {
+    // Copied, so that the caller may reuse the array.
+    dictionary = dictionary.slice();
+    if (!dictionary.every(Buffer.isBuffer))
+      throw new Error('Invalid dictionary: segments should be Buffers');
+  } else if (!Buffer.isBuffer(dictionary)) {
+    throw new Error('Invalid dictionary: it should be a Buffer instance');
+  }
+  return dictionary;
+}
+
+function dictionaryLimit(maxSize) {
+  if (maxSize === undefined)
+    return 0;
+  if (!(maxSize > 0))
+    throw new Error('Invalid dictionary size: ' + maxSize);
+  return maxSize;
+}
+
 function vcdiffBuffer(engine, buffer, callback) {
   if (!(callback instanceof Function))
     throw new Error('callback should be a Function instance');
@@ -144,18 +509,73 @@ function Vcdiff(opts, mode) {
     if (opts.targetMatches === true)
       targetMatches = true;
 
+    var optimalParse = false;
+    if (opts.optimalParse === true)
+      optimalParse = true;
+
+    var encodeTimeLimit = exports.DEFAULT_ENCODE_TIME_LIMIT;
+    if (opts.encodeTimeLimit !== undefined) {
+      if (typeof opts.encodeTimeLimit !== 'number' ||
+          !(opts.encodeTimeLimit >= 0))
+        throw new Error('Invalid encode time limit: ' + opts.encodeTimeLimit);
+      encodeTimeLimit = opts.encodeTimeLimit;
+    }
+
+    var maxDeltaRatio = exports.DEFAULT_MAX_DELTA_RATIO;
+    if (opts.maxDeltaRatio !== undefined) {
+      if (typeof opts.maxDeltaRatio !== 'number' ||
+          !(opts.maxDeltaRatio >= 0))
+        throw new Error('Invalid max delta ratio: ' + opts.maxDeltaRatio);
+      maxDeltaRatio = opts.maxDeltaRatio;
+    }
+
+    var compression = binding.COMPRESSION_NONE;
+    var compressLevel = -1;  // Z_DEFAULT_COMPRESSION
+    if (opts.compress !== undefined) {
+      if (!compressions.hasOwnProperty(opts.compress))
+        throw new Error('Invalid compression: ' + opts.compress);
+      compression = compressions[opts.compress];
+    }
+    if (opts.compressLevel !== undefined) {
+      if (opts.compressLevel !== (opts.compressLevel | 0) ||
+          opts.compressLevel < -1 || opts.compressLevel > 9)
+        throw new Error('Invalid compression level: ' + opts.compressLevel);
+      compressLevel = opts.compressLevel;
+    }
+
+    var cache;
+    if (opts.cache !== undefined) {
+      if (!(opts.cache instanceof binding.EncodeCache))
+        throw new Error('Invalid cache: it should be an EncodeCache instance');
+      cache = opts.cache;
+    }
+
+    var cacheSizes = addressCacheSizes(opts);
+
+    // Without embedding, the decoder needs the same codeTable option.
+    var codeTable = codeTableOption(opts.codeTable);
+    var embedCodeTable = opts.embedCodeTable !== false;
+
+    // 0 means one window per chunk written.
+    var encodeWindowSize = 0;
     if (opts.encodeWindowSize) {
       if (opts.encodeWindowSize < exports.MIN_MIN_ENCODE_WINDOW_SIZE ||
           opts.encodeWindowSize > exports.MAX_MIN_ENCODE_WINDOW_SIZE)
         throw new Error('Invalid encode window size: ' +
                         opts.encodeWindowSize);
+      if (isFinite(opts.encodeWindowSize))
+        encodeWindowSize = Math.floor(opts.encodeWindowSize);
     }
 
+    // The binding expects microseconds.
     this._handle = new binding.Vcdiff(
-        mode, opts.hashedDictionary, targetMatches, flags);
+        mode, opts.hashedDictionary, targetMatches, flags,
+        Math.round(encodeTimeLimit * 1000), maxDeltaRatio,
+        compression, compressLevel, cache, optimalParse,
+        codeTable, embedCodeTable, cacheSizes[0], cacheSizes[1],
+        encodeWindowSize);
   } else if (mode === binding.DECODE) {
-    if (!Buffer.isBuffer(opts.dictionary))
-      throw new Error('Invalid dictionary: it should be a Buffer instance');
+    var dictionary = dictionaryOption(opts.dictionary);
     var allowVcd = true;
     var maxTargetFileSize = exports.DEFAULT_MAX_TARGET_FILE_SIZE;
     var maxTargetWindowSize = exports.DEFAULT_MAX_TARGET_WINDOW_SIZE;
@@ -178,10 +598,13 @@ function Vcdiff(opts, mode) {
     }
 
     this._handle = new binding.Vcdiff(mode,
-                                      opts.dictionary,
+                                      dictionary,
                                       allowVcd,
                                       maxTargetFileSize,
-                                      maxTargetWindowSize);
+                                      maxTargetWindowSize,
+                                      opts.decompress === true,
+                                      codeTableOption(opts.codeTable),
+                                      opts.trustedInput === true);
   } else {
     throw new Error('invalid mode: neither ENCODE nor DECODE');
   }
@@ -201,6 +624,9 @@ function Vcdiff(opts, mode) {
     self.emit('error', error);
   };
 
+  this.timeLimitReached = false;
+  this.incompressible = false;
+
   this._closed = false;
   this._forceFlush = false;
   this._nread = 0;
@@ -291,6 +717,8 @@ Vcdiff.prototype._processChunk = function(chunk, isLast, forceFlush, cb) {
 
     assert(res[1] === true, 'sync should finish in one pass');
 
+    this._updateStatus(res[2]);
+
     this.close();
 
     return res[0];
@@ -314,15 +742,29 @@ Vcdiff.prototype._processChunk = function(chunk, isLast, forceFlush, cb) {
     });
   }
 
-  function callback(out, finished) {
+  function callback(out, finished, status) {
     if (self._hadError)
       return;
 
+    self._updateStatus(status);
     self.push(out);
 
     cb();
   }
 };
 
+Vcdiff.prototype._updateStatus = function(status) {
+  if ((status & binding.VCD_ENCODE_TIME_LIMIT_REACHED) &&
+      !this.timeLimitReached) {
+    this.timeLimitReached = true;
+    this.emit('timeLimitReached');
+  }
+  if ((status & binding.VCD_ENCODE_TARGET_INCOMPRESSIBLE) &&
+      !this.incompressible) {
+    this.incompressible = true;
+    this.emit('incompressible');
+  }
+};
+
 util.inherits(VcdiffEncoder, Vcdiff);
 util.inherits(VcdiffDecoder, Vcdiff);
@@ -1,6 +1,10 @@
 /* src/config.h.  Generated from config.h.in by configure.  */
 /* src/config.h.in.  Generated from configure.ac by autoheader.  */
 
+/* Define to 1 if you have the `clock_gettime' function. */
+/* Manual edit: not before OS X 10.12, and the deployment target is 10.7. */
+/* #undef HAVE_CLOCK_GETTIME */
+
 /* Define to 1 if you have the <dlfcn.h> header file. */
 #define HAVE_DLFCN_H 1
 
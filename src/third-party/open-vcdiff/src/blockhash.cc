@@ -27,15 +27,28 @@ typedef unsigned long uword_t;  // a machine word                         NOLINT
 
 BlockHash::BlockHash(const char* source_data,
                      size_t source_size,
-                     int starting_offset)
+                     int starting_offset,
+                     VCDiffHashType hash_type)
     : source_data_(source_data),
       source_size_(source_size),
+      next_entries_(NULL),
+      narrow_next_entries_(NULL),
+      frozen_(false),
+      narrow_(false),
+      borrowed_tables_(NULL),
       hash_table_mask_(0),
+      hash_tag_shift_(0),
       starting_offset_(starting_offset),
+      hash_type_(hash_type),
       last_block_added_(-1) {
 }
 
-BlockHash::~BlockHash() { }
+BlockHash::~BlockHash() {
+  if (borrowed_tables_) {
+    borrowed_tables_->hash_table.swap(hash_table_);
+    borrowed_tables_->next_block_table.swap(next_block_table_);
+  }
+}
 
 // kBlockSize must be at least 2 to be meaningful.  Since it's a compile-time
 // constant, check its value at compile time rather than wasting CPU cycles
@@ -52,10 +65,21 @@ VCD_COMPILE_ASSERT(BlockHash::kBlockSize >= 2, kBlockSize_must_be_at_least_2);
 VCD_COMPILE_ASSERT((BlockHash::kBlockSize & (BlockHash::kBlockSize - 1)) == 0,
                    kBlockSize_must_be_a_power_of_2);
 
+void BlockHash::SetHashTableSize(size_t table_size) {
+  // Since table_size is a power of 2, (table_size - 1) is a bit mask
+  // containing all the bits below table_size.
+  hash_table_mask_ = static_cast<uint32_t>(table_size - 1);
+  hash_tag_shift_ = 0;
+  while ((static_cast<size_t>(1) << hash_tag_shift_) < table_size) {
+    ++hash_tag_shift_;
+  }
+}
+
 bool BlockHash::Init(bool populate_hash_table) {
   if (!hash_table_.empty() ||
       !next_block_table_.empty() ||
-      !last_block_table_.empty()) {
+      !last_block_table_.empty() ||
+      frozen_) {
     VCD_DFATAL << "Init() called twice for same BlockHash object" << VCD_ENDL;
     return false;
   }
@@ -65,11 +89,10 @@ bool BlockHash::Init(bool populate_hash_table) {
                << VCD_ENDL;
     return false;
   }
-  // Since table_size is a power of 2, (table_size - 1) is a bit mask
-  // containing all the bits below table_size.
-  hash_table_mask_ = static_cast<uint32_t>(table_size - 1);
+  SetHashTableSize(table_size);
   hash_table_.resize(table_size, -1);
   next_block_table_.resize(GetNumberOfBlocks(), -1);
+  UseNextBlockTable();
   last_block_table_.resize(GetNumberOfBlocks(), -1);
   if (populate_hash_table) {
     AddAllBlocks();
@@ -77,25 +100,242 @@ bool BlockHash::Init(bool populate_hash_table) {
   return true;
 }
 
+bool BlockHash::InitFromBase(const BlockHash& base) {
+  if (!hash_table_.empty() ||
+      !next_block_table_.empty() ||
+      !last_block_table_.empty() ||
+      frozen_) {
+    VCD_DFATAL << "InitFromBase() called for initialized BlockHash object"
+               << VCD_ENDL;
+    return false;
+  }
+  if ((base.starting_offset_ != starting_offset_) ||
+      (base.hash_type_ != hash_type_) ||
+      (base.source_size_ > source_size_) ||
+      (base.hash_table_.empty() && !base.narrow_)) {
+    VCD_DFATAL << "InitFromBase() called with incompatible base BlockHash"
+               << VCD_ENDL;
+    return false;
+  }
+  const size_t table_size = CalcTableSize(source_size_);
+  if (table_size == 0) {
+    VCD_DFATAL << "Error finding table size for source size " << source_size_
+               << VCD_ENDL;
+    return false;
+  }
+  // A frozen base will be compared with the size of the frozen result.
+  const size_t base_table_size = base.hash_table_mask_ + 1;
+  if ((base_table_size * 2 <
+           (base.frozen_ ? CalcFrozenTableSize(GetNumberOfBlocks())
+                         : table_size)) ||
+      base.borrowed_tables_) {
+    // The old table is too small for the new data, or it is a one-shot hash
+    // whose chains cannot be appended to.  Since its hash values are not
+    // stored, all of the blocks must be hashed again.
+    return Init(/* populate_hash_table = */ true);
+  }
+  const size_t base_blocks = base.GetNumberOfBlocks();
+  SetHashTableSize(base_table_size);
+  next_block_table_.reserve(GetNumberOfBlocks());
+  if (base.narrow_) {
+    hash_table_.resize(base_table_size);
+    for (size_t i = 0; i < base_table_size; ++i) {
+      hash_table_[i] = base.WidenNarrowEntry(base.narrow_table_[i]);
+    }
+    next_block_table_.resize(base_blocks);
+    for (size_t i = 0; i < base_blocks; ++i) {
+      next_block_table_[i] =
+          base.WidenNarrowEntry(base.narrow_next_entries_[i]);
+    }
+  } else {
+    hash_table_.assign(base.hash_table_.begin(),
+                       base.hash_table_.begin() + base_table_size);
+    next_block_table_.assign(base.next_entries_,
+                             base.next_entries_ + base_blocks);
+  }
+  next_block_table_.resize(GetNumberOfBlocks(), -1);
+  UseNextBlockTable();
+  if (base.frozen_) {
+    // Find the end of each chain again.
+    last_block_table_.resize(GetNumberOfBlocks(), -1);
+    for (size_t i = 0; i < base_table_size; ++i) {
+      if (hash_table_[i] < 0) {
+        continue;
+      }
+      const int first_block = EntryBlockNumber(hash_table_[i]);
+      int last_block = first_block;
+      while (next_block_table_[last_block] >= 0) {
+        last_block = EntryBlockNumber(next_block_table_[last_block]);
+      }
+      last_block_table_[first_block] = last_block;
+    }
+  } else {
+    last_block_table_.reserve(GetNumberOfBlocks());
+    last_block_table_ = base.last_block_table_;
+    last_block_table_.resize(GetNumberOfBlocks(), -1);
+  }
+  last_block_added_ = base.last_block_added_;
+  AddAllBlocks();
+  return true;
+}
+
+bool BlockHash::InitOneShot(BlockHashTables* tables) {
+  if (!hash_table_.empty() ||
+      !next_block_table_.empty() ||
+      !last_block_table_.empty() ||
+      frozen_) {
+    VCD_DFATAL << "InitOneShot() called for initialized BlockHash object"
+               << VCD_ENDL;
+    return false;
+  }
+  // One int per block rather than per sizeof(int) bytes of source data.
+  const size_t table_size = CalcTableSize(GetNumberOfBlocks() * sizeof(int));
+  if (table_size == 0) {
+    VCD_DFATAL << "Error finding table size for source size " << source_size_
+               << VCD_ENDL;
+    return false;
+  }
+  hash_table_.swap(tables->hash_table);
+  next_block_table_.swap(tables->next_block_table);
+  borrowed_tables_ = tables;
+  SetHashTableSize(table_size);
+  hash_table_.assign(table_size, -1);
+  // Every element is written below.
+  next_block_table_.resize(GetNumberOfBlocks());
+  UseNextBlockTable();
+  // Pushing each block to the front of its chain, last block first, leaves
+  // the chains in increasing order, as AddBlock() would.
+  const int total_blocks = static_cast<int>(GetNumberOfBlocks());
+  for (int block_number = total_blocks - 1; block_number >= 0;
+       --block_number) {
+    const uint32_t hash_value =
+        HashBlock(source_data_ + block_number * kBlockSize);
+    const uint32_t hash_table_index = GetHashTableIndex(hash_value);
+    next_block_table_[block_number] = hash_table_[hash_table_index];
+    hash_table_[hash_table_index] = MakeEntry(block_number, hash_value);
+  }
+  last_block_added_ = total_blocks - 1;
+  return true;
+}
+
+void BlockHash::Freeze() {
+  if (frozen_ || hash_table_.empty() || borrowed_tables_) {
+    VCD_DFATAL << "Freeze() called for uninitialized, frozen or one-shot"
+                  " BlockHash object" << VCD_ENDL;
+    return;
+  }
+  std::vector<int>().swap(last_block_table_);
+  const size_t number_of_blocks = GetNumberOfBlocks();
+  const size_t frozen_table_size = CalcFrozenTableSize(number_of_blocks);
+  while (hash_table_.size() > frozen_table_size) {
+    HalveHashTable();
+  }
+  const size_t table_size = hash_table_.size();
+  if (number_of_blocks < kNarrowNotFound) {
+    narrow_table_.resize(table_size + number_of_blocks);
+    narrow_tags_.assign((number_of_blocks + 1) / 2, 0);
+    // Every block is referenced by exactly one entry, either in the hash
+    // table or in next_block_table_.
+    for (size_t i = 0; i < table_size + number_of_blocks; ++i) {
+      const int entry = (i < table_size) ? hash_table_[i]
+                                         : next_block_table_[i - table_size];
+      if (entry < 0) {
+        narrow_table_[i] = kNarrowNotFound;
+        continue;
+      }
+      const int block_number = EntryBlockNumber(entry);
+      narrow_table_[i] = static_cast<uint16_t>(block_number);
+      narrow_tags_[block_number / 2] |=
+          static_cast<uint8_t>(EntryHashTag(entry) << ((block_number & 1) * 4));
+    }
+    narrow_next_entries_ = &narrow_table_[table_size];
+    narrow_ = true;
+    HashTableVector().swap(hash_table_);
+    next_entries_ = NULL;
+  } else {
+    HashTableVector packed_table;
+    packed_table.reserve(table_size + number_of_blocks);
+    packed_table.assign(hash_table_.begin(), hash_table_.end());
+    packed_table.insert(packed_table.end(),
+                        next_block_table_.begin(),
+                        next_block_table_.end());
+    hash_table_.swap(packed_table);
+    next_entries_ = &hash_table_[table_size];
+  }
+  std::vector<int>().swap(next_block_table_);
+  frozen_ = true;
+}
+
+int BlockHash::WidenNarrowEntry(uint16_t narrow_entry) const {
+  if (narrow_entry == kNarrowNotFound) {
+    return -1;
+  }
+  return narrow_entry | (NarrowHashTag(narrow_entry) << kBlockNumberBits);
+}
+
+void BlockHash::HalveHashTable() {
+  const size_t half_size = hash_table_.size() / 2;
+  for (size_t i = 0; i < half_size; ++i) {
+    // Both chains are in increasing order of block numbers; so is their
+    // merge.  The highest bit of the old index becomes the lowest bit of
+    // the tags, which lose their highest bit.
+    int low_entry = hash_table_[i];
+    int high_entry = hash_table_[i + half_size];
+    int* link = &hash_table_[i];
+    while ((low_entry >= 0) || (high_entry >= 0)) {
+      const bool take_low =
+          (high_entry < 0) ||
+          ((low_entry >= 0) &&
+           (EntryBlockNumber(low_entry) < EntryBlockNumber(high_entry)));
+      int* const entry = take_low ? &low_entry : &high_entry;
+      const int block_number = EntryBlockNumber(*entry);
+      const int hash_tag =
+          ((EntryHashTag(*entry) << 1) | (take_low ? 0 : 1)) & kHashTagMask;
+      *link = block_number | (hash_tag << kBlockNumberBits);
+      link = &next_block_table_[block_number];
+      *entry = *link;
+    }
+    *link = -1;
+  }
+  hash_table_.resize(half_size);
+  SetHashTableSize(half_size);
+}
+
+void BlockHash::UseNextBlockTable() {
+  next_entries_ = next_block_table_.empty() ? NULL : &next_block_table_[0];
+}
+
+uint32_t BlockHash::HashBlock(const char* block_ptr) const {
+  if (hash_type_ == VCD_HASH_GEAR) {
+    return GearHash<kBlockSize>::Hash(block_ptr);
+  }
+  return RollingHash<kBlockSize>::Hash(block_ptr);
+}
+
 const BlockHash* BlockHash::CreateDictionaryHash(const char* dictionary_data,
-                                                 size_t dictionary_size) {
+                                                 size_t dictionary_size,
+                                                 VCDiffHashType hash_type) {
   BlockHash* new_dictionary_hash = new BlockHash(dictionary_data,
                                                  dictionary_size,
-                                                 0);
+                                                 0,
+                                                 hash_type);
   if (!new_dictionary_hash->Init(/* populate_hash_table = */ true)) {
     delete new_dictionary_hash;
     return NULL;
   } else {
+    new_dictionary_hash->Freeze();
     return new_dictionary_hash;
   }
 }
 
 BlockHash* BlockHash::CreateTargetHash(const char* target_data,
                                        size_t target_size,
-                                       size_t dictionary_size) {
+                                       size_t dictionary_size,
+                                       VCDiffHashType hash_type) {
   BlockHash* new_target_hash = new BlockHash(target_data,
                                              target_size,
-                                             static_cast<int>(dictionary_size));
+                                             static_cast<int>(dictionary_size),
+                                             hash_type);
   if (!new_target_hash->Init(/* populate_hash_table = */ false)) {
     delete new_target_hash;
     return NULL;
@@ -104,6 +344,40 @@ BlockHash* BlockHash::CreateTargetHash(const char* target_data,
   }
 }
 
+const BlockHash* BlockHash::CreateExtendedDictionaryHash(
+    const BlockHash& base,
+    const char* dictionary_data,
+    size_t dictionary_size) {
+  BlockHash* new_dictionary_hash = new BlockHash(dictionary_data,
+                                                 dictionary_size,
+                                                 0,
+                                                 base.hash_type_);
+  if (!new_dictionary_hash->InitFromBase(base)) {
+    delete new_dictionary_hash;
+    return NULL;
+  } else {
+    new_dictionary_hash->Freeze();
+    return new_dictionary_hash;
+  }
+}
+
+const BlockHash* BlockHash::CreateOneShotDictionaryHash(
+    const char* dictionary_data,
+    size_t dictionary_size,
+    BlockHashTables* tables,
+    VCDiffHashType hash_type) {
+  BlockHash* new_dictionary_hash = new BlockHash(dictionary_data,
+                                                 dictionary_size,
+                                                 0,
+                                                 hash_type);
+  if (!new_dictionary_hash->InitOneShot(tables)) {
+    delete new_dictionary_hash;
+    return NULL;
+  } else {
+    return new_dictionary_hash;
+  }
+}
+
 // Returns zero if an error occurs.
 size_t BlockHash::CalcTableSize(const size_t dictionary_size) {
   // Overallocate the hash table by making it the same size (in bytes)
@@ -147,12 +421,20 @@ size_t BlockHash::CalcTableSize(const size_t dictionary_size) {
   return table_size;
 }
 
+size_t BlockHash::CalcFrozenTableSize(const size_t number_of_blocks) {
+  size_t table_size = 1;
+  while (table_size < number_of_blocks * 2) {
+    table_size <<= 1;
+  }
+  return table_size;
+}
+
 // If the hash value is already available from the rolling hash,
 // call this function to save time.
 void BlockHash::AddBlock(uint32_t hash_value) {
-  if (hash_table_.empty()) {
+  if (hash_table_.empty() || frozen_) {
     VCD_DFATAL << "BlockHash::AddBlock() called before BlockHash::Init()"
-               << VCD_ENDL;
+                  " or after BlockHash::Freeze()" << VCD_ENDL;
     return;
   }
   // The initial value of last_block_added_ is -1.
@@ -174,13 +456,14 @@ void BlockHash::AddBlock(uint32_t hash_value) {
     return;
   }
   const uint32_t hash_table_index = GetHashTableIndex(hash_value);
-  const int first_matching_block = hash_table_[hash_table_index];
-  if (first_matching_block < 0) {
+  const int first_matching_entry = hash_table_[hash_table_index];
+  if (first_matching_entry < 0) {
     // This is the first entry with this hash value
-    hash_table_[hash_table_index] = block_number;
+    hash_table_[hash_table_index] = MakeEntry(block_number, hash_value);
     last_block_table_[block_number] = block_number;
   } else {
     // Add this entry at the end of the chain of matching blocks
+    const int first_matching_block = EntryBlockNumber(first_matching_entry);
     const int last_matching_block = last_block_table_[first_matching_block];
     if (next_block_table_[last_matching_block] != -1) {
       VCD_DFATAL << "Internal error in BlockHash::AddBlock(): "
@@ -190,7 +473,8 @@ void BlockHash::AddBlock(uint32_t hash_value) {
                  << next_block_table_[last_matching_block] << VCD_ENDL;
       return;
     }
-    next_block_table_[last_matching_block] = block_number;
+    next_block_table_[last_matching_block] = MakeEntry(block_number,
+                                                       hash_value);
     last_block_table_[first_matching_block] = block_number;
   }
   last_block_added_ = block_number;
@@ -232,7 +516,7 @@ void BlockHash::AddAllBlocksThroughIndex(int end_index) {
   const char* block_ptr = source_data() + NextIndexToAdd();
   const char* const end_ptr = source_data() + end_limit;
   while (block_ptr < end_ptr) {
-    AddBlock(RollingHash<kBlockSize>::Hash(block_ptr));
+    AddBlock(HashBlock(block_ptr));
     block_ptr += kBlockSize;
   }
 }
@@ -300,18 +584,53 @@ bool BlockHash::BlockContentsMatch(const char* block1, const char* block2) {
   return BlockContentsMatchInline(block1, block2);
 }
 
-inline int BlockHash::SkipNonMatchingBlocks(int block_number,
+inline int BlockHash::SkipNonMatchingBlocks(int entry,
+                                            int hash_tag,
                                             const char* block_ptr) const {
   int probes = 0;
-  while ((block_number >= 0) &&
-         !BlockContentsMatchInline(block_ptr,
+  int entries = 0;
+  while (entry >= 0) {
+    const int block_number = EntryBlockNumber(entry);
+    // Comparing the tags first saves reading the block data of most
+    // false matches.
+    if (EntryHashTag(entry) == hash_tag) {
+      if (BlockContentsMatchInline(block_ptr,
                                    &source_data_[block_number * kBlockSize])) {
-    if (++probes > kMaxProbes) {
-      return -1;  // Avoid too much chaining
+        return block_number;
+      }
+      if (++probes > kMaxProbes) {
+        return -1;  // Avoid too much chaining
+      }
     }
-    block_number = next_block_table_[block_number];
+    if (++entries > kMaxChainEntries) {
+      return -1;
+    }
+    entry = next_entries_[block_number];
+  }
+  return -1;
+}
+
+inline int BlockHash::SkipNonMatchingNarrowBlocks(int entry,
+                                                  int hash_tag,
+                                                  const char* block_ptr) const {
+  int probes = 0;
+  int entries = 0;
+  while (entry != kNarrowNotFound) {
+    if (NarrowHashTag(entry) == hash_tag) {
+      if (BlockContentsMatchInline(block_ptr,
+                                   &source_data_[entry * kBlockSize])) {
+        return entry;
+      }
+      if (++probes > kMaxProbes) {
+        return -1;  // Avoid too much chaining
+      }
+    }
+    if (++entries > kMaxChainEntries) {
+      return -1;
+    }
+    entry = narrow_next_entries_[entry];
   }
-  return block_number;
+  return -1;
 }
 
 // Init() must have been called and returned true before using
@@ -319,7 +638,14 @@ inline int BlockHash::SkipNonMatchingBlocks(int block_number,
 // for this condition; the code will crash if this condition is violated.
 inline int BlockHash::FirstMatchingBlockInline(uint32_t hash_value,
                                                const char* block_ptr) const {
-  return SkipNonMatchingBlocks(hash_table_[GetHashTableIndex(hash_value)],
+  const uint32_t hash_table_index = GetHashTableIndex(hash_value);
+  if (narrow_) {
+    return SkipNonMatchingNarrowBlocks(narrow_table_[hash_table_index],
+                                       GetHashTag(hash_value),
+                                       block_ptr);
+  }
+  return SkipNonMatchingBlocks(hash_table_[hash_table_index],
+                               GetHashTag(hash_value),
                                block_ptr);
 }
 
@@ -335,7 +661,23 @@ int BlockHash::NextMatchingBlock(int block_number,
                << block_number << VCD_ENDL;
     return -1;
   }
-  return SkipNonMatchingBlocks(next_block_table_[block_number], block_ptr);
+  return NextMatchingBlockInline(
+      block_number,
+      GetHashTag(HashBlock(block_ptr)),
+      block_ptr);
+}
+
+inline int BlockHash::NextMatchingBlockInline(int block_number,
+                                              int hash_tag,
+                                              const char* block_ptr) const {
+  if (narrow_) {
+    return SkipNonMatchingNarrowBlocks(narrow_next_entries_[block_number],
+                                       hash_tag,
+                                       block_ptr);
+  }
+  return SkipNonMatchingBlocks(next_entries_[block_number],
+                               hash_tag,
+                               block_ptr);
 }
 
 // Keep a count of the number of matches found.  This will throttle the
@@ -400,10 +742,12 @@ void BlockHash::FindBestMatch(uint32_t hash_value,
                               size_t target_size,
                               Match* best_match) const {
   int match_counter = 0;
+  const int hash_tag = GetHashTag(hash_value);
   for (int block_number = FirstMatchingBlockInline(hash_value,
                                                    target_candidate_start);
        (block_number >= 0) && !TooManyMatches(&match_counter);
-       block_number = NextMatchingBlock(block_number, target_candidate_start)) {
+       block_number = NextMatchingBlockInline(block_number, hash_tag,
+                                              target_candidate_start)) {
     int source_match_offset = block_number * kBlockSize;
     const int source_match_end = source_match_offset + kBlockSize;
 
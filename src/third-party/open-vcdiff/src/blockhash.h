@@ -23,9 +23,34 @@
 #include <stddef.h>  // size_t
 #include <stdint.h>  // uint32_t
 #include <vector>
+#include "compile_assert.h"
+#include "google/vcencoder.h"  // VCDiffHashType
+#include "large_page.h"
+
+// Hints the processor to start loading the cache line that contains address.
+// This never changes the behavior of the program, only its speed.
+#if defined(__GNUC__)
+#define VCD_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define VCD_PREFETCH(address) ((void) (address))
+#endif
 
 namespace open_vcdiff {
 
+// The storage of a hash table and, once a hash is frozen, of its whole index.
+// For a multi-megabyte dictionary, it is read at random positions for every
+// block of every target, so it is allocated with AllocateLargePages().
+typedef std::vector<int, LargePageAllocator<int> > HashTableVector;
+
+// The memory of the tables of a one-shot dictionary BlockHash.  It is lent
+// to each hash created by BlockHash::CreateOneShotDictionaryHash(), and given
+// back when that hash is deleted, so that a series of one-shot hashes can
+// reuse the same allocation.
+struct BlockHashTables {
+  HashTableVector hash_table;
+  std::vector<int> next_block_table;
+};
+
 // A generic hash table which will be used to keep track of byte runs
 // of size kBlockSize in both the incrementally processed target data
 // and the preprocessed source dictionary.
@@ -119,7 +144,14 @@ class BlockHash {
   // starting_offset_ will be zero; for a hash of previously encoded
   // target data, starting_offset_ will be equal to the dictionary size.
   //
-  BlockHash(const char* source_data, size_t source_size, int starting_offset);
+  // hash_type selects the rolling hash with which the blocks are hashed.
+  // The hash values passed to the other functions must come from the same
+  // hash: RollingHash for VCD_HASH_POLYNOMIAL, GearHash for VCD_HASH_GEAR.
+  //
+  BlockHash(const char* source_data,
+            size_t source_size,
+            int starting_offset,
+            VCDiffHashType hash_type);
 
   ~BlockHash();
 
@@ -138,6 +170,29 @@ class BlockHash {
   //
   bool Init(bool populate_hash_table);
 
+  // Like Init(true), but starts from a copy of the hash entries of base.
+  // See CreateExtendedDictionaryHash() for the requirements.
+  bool InitFromBase(const BlockHash& base);
+
+  // Like Init(true), but builds the lighter tables described in
+  // CreateOneShotDictionaryHash(), in memory borrowed from *tables.
+  bool InitOneShot(BlockHashTables* tables);
+
+  // Converts a fully populated hash into a compact, read-only layout, after
+  // which no more blocks can be added:
+  //   * last_block_table_, which is only needed to append to the chains,
+  //     is released.
+  //   * The hash table is shrunk to about two elements per block.  Shrinking
+  //     it merges pairs of chains, and the hash tags of the entries (see
+  //     kBlockNumberBits) keep telling their blocks apart.
+  //   * The hash table and next_block_table_ are stored in one allocation,
+  //     with 16-bit entries if there are fewer than kNarrowNotFound blocks.
+  //     Narrow entries have no room for hash tags, which are kept aside,
+  //     4 bits per block, for lookups and CreateExtendedDictionaryHash().
+  // CreateDictionaryHash() and CreateExtendedDictionaryHash() return frozen
+  // hashes.  Freeze() cannot be used on a one-shot hash.
+  void Freeze();
+
   // In the context of the open-vcdiff encoder, BlockHash is used for two
   // purposes: to hash the source (dictionary) data, and to hash
   // the previously encoded target data.  The main differences between
@@ -165,10 +220,51 @@ class BlockHash {
   // The caller is responsible for deleting the returned object
   // (using the C++ delete operator) once it is no longer needed.
   static const BlockHash* CreateDictionaryHash(const char* dictionary_data,
-                                               size_t dictionary_size);
+                                               size_t dictionary_size,
+                                               VCDiffHashType hash_type);
   static BlockHash* CreateTargetHash(const char* target_data,
                                      size_t target_size,
-                                     size_t dictionary_size);
+                                     size_t dictionary_size,
+                                     VCDiffHashType hash_type);
+
+  // Creates a dictionary BlockHash for a dictionary that was produced by
+  // appending data to the dictionary of base: the first base.source_size_
+  // bytes of dictionary_data must be identical to the data that base was
+  // created from.  This is not checked.  The hash entries of base are copied
+  // rather than recomputed, so only the appended blocks need to be hashed.
+  // base is not modified and may be deleted afterwards.  The new hash uses
+  // the hash type of base.
+  //
+  // The hash table of base is kept as long as it is at least half the size
+  // that Freeze() would shrink the new table to; this saves rehashing all of
+  // the old blocks at the cost of a few more collisions.
+  static const BlockHash* CreateExtendedDictionaryHash(
+      const BlockHash& base,
+      const char* dictionary_data,
+      size_t dictionary_size);
+
+  // Creates a dictionary BlockHash for a source that will be used to encode
+  // a single target, such as the previous version of a document.  It finds
+  // practically the same matches as CreateDictionaryHash(), but is cheaper
+  // to build:
+  //   * The hash table has about one entry per block instead of one entry
+  //     per sizeof(int) bytes, at the cost of a few more hash collisions.
+  //   * The blocks are added from last to first, so the chains of matching
+  //     blocks can be built LIFO and still come out in increasing order.
+  //     No last_block_table_ is needed.
+  //   * The tables are borrowed from *tables and given back to it when the
+  //     BlockHash is deleted, so that their memory is not allocated again
+  //     for every source.
+  // *tables must outlive the returned object, and must not be lent to two
+  // BlockHash objects at the same time.  The result cannot be extended by
+  // CreateExtendedDictionaryHash() without hashing it again.
+  static const BlockHash* CreateOneShotDictionaryHash(
+      const char* dictionary_data,
+      size_t dictionary_size,
+      BlockHashTables* tables,
+      VCDiffHashType hash_type);
+
+  VCDiffHashType hash_type() const { return hash_type_; }
 
   // This function will be called to add blocks incrementally to the target hash
   // as the encoding position advances through the target data.  It will be
@@ -243,6 +339,7 @@ class BlockHash {
   //     open_vcdiff::BlockHash::Match best_match;
   //     uint32_t hash_value =
   //         RollingHash<BlockHash::kBlockSize>::Hash(target_candidate_start);
+  //     // (or GearHash for bh1 and bh2 of hash type VCD_HASH_GEAR)
   //     bh1.FindBestMatch(hash_value,
   //                       target_candidate_start,
   //                       target_start,
@@ -296,6 +393,36 @@ class BlockHash {
                      size_t target_size,
                      Match* best_match) const;
 
+  // Starts loading the hash table element for hash_value into the cache,
+  // so that a FindBestMatch() for that hash value a few positions later
+  // does not wait for memory.
+  void PrefetchHashTableEntry(uint32_t hash_value) const {
+    const uint32_t hash_table_index = GetHashTableIndex(hash_value);
+    if (narrow_) {
+      VCD_PREFETCH(&narrow_table_[hash_table_index]);
+    } else {
+      VCD_PREFETCH(&hash_table_[hash_table_index]);
+    }
+  }
+
+  // Starts loading the source data of the first block in the chain for
+  // hash_value.  This reads the hash table element, which should have been
+  // prefetched with PrefetchHashTableEntry() some time before.
+  void PrefetchFirstBlock(uint32_t hash_value) const {
+    const uint32_t hash_table_index = GetHashTableIndex(hash_value);
+    int block_number = -1;
+    if (narrow_) {
+      if (narrow_table_[hash_table_index] != kNarrowNotFound) {
+        block_number = narrow_table_[hash_table_index];
+      }
+    } else if (hash_table_[hash_table_index] >= 0) {
+      block_number = EntryBlockNumber(hash_table_[hash_table_index]);
+    }
+    if (block_number >= 0) {
+      VCD_PREFETCH(&source_data_[block_number * kBlockSize]);
+    }
+  }
+
  protected:
   // FindBestMatch() will not process more than this number
   // of matching hash entries.
@@ -325,25 +452,108 @@ class BlockHash {
                                             (32 * (32 / kBlockSize));
 
   // Do not skip more than this number of non-matching hash collisions
-  // to find the next matching entry in the hash chain.
+  // to find the next matching entry in the hash chain.  Only entries whose
+  // hash tag matches are counted: the others are not really collisions,
+  // and Freeze() merges many more of them into each chain.
   static const int kMaxProbes = 16;
 
+  // The elements of hash_table_ and next_block_table_ are entries rather
+  // than plain block numbers.  The lowest kBlockNumberBits bits of an entry
+  // hold the block number, and the bits above it hold a tag taken from the
+  // hash value of the block: the bits just above the ones that
+  // GetHashTableIndex() uses.  A block whose tag differs from that of the
+  // hash value being looked up cannot match, and is skipped without reading
+  // its contents from the source data; in a large dictionary, that read is
+  // usually a cache miss.  Entries of -1 (== not found) are still negative.
+  //
+  // Since source sizes fit in an int and kBlockSize is at least
+  // (1 << kHashTagBits), kBlockNumberBits bits are enough for any block number.
+  static const int kHashTagBits = 4;
+  static const int kHashTagMask = (1 << kHashTagBits) - 1;
+  static const int kBlockNumberBits = 31 - kHashTagBits;
+  static const int kBlockNumberMask = (1 << kBlockNumberBits) - 1;
+  VCD_COMPILE_ASSERT(kBlockSize >= (1 << kHashTagBits),
+                     kBlockSize_must_leave_room_for_the_hash_tag);
+  // narrow_tags_ holds two hash tags per byte.
+  VCD_COMPILE_ASSERT(kHashTagBits <= 4, hash_tags_must_fit_in_half_a_byte);
+
+  // Entries skipped for their hash tags are cheap, but a crafted source or
+  // target could still chain up a great many of them; do not walk more than
+  // this number of entries in all.  The tags split a chain about
+  // (1 << kHashTagBits) ways, so this leaves room for about kMaxProbes
+  // collisions with the right tag.
+  static const int kMaxChainEntries = kMaxProbes << kHashTagBits;
+
+  // The value of a narrow (16-bit) entry that is not found.  Narrow entries
+  // hold plain block numbers, so they are used for sources of fewer than
+  // kNarrowNotFound blocks.
+  static const uint16_t kNarrowNotFound = 0xFFFF;
+
   // Internal routine which calculates a hash table size based on kBlockSize and
   // the dictionary_size.  Will return a power of two if successful, or 0 if an
   // internal error occurs.  Some calculations (such as GetHashTableIndex())
   // depend on the table size being a power of two.
   static size_t CalcTableSize(const size_t dictionary_size);
 
+  // The size to which Freeze() shrinks the hash table: the smallest power of
+  // two that is at least twice number_of_blocks.
+  static size_t CalcFrozenTableSize(const size_t number_of_blocks);
+
+  // Merges the chains of each pair of hash table elements whose indexes
+  // differ only in their highest bit, halving the size of the hash table.
+  void HalveHashTable();
+
+  // Points next_entries_ at next_block_table_.
+  void UseNextBlockTable();
+
+  // Returns the hash tag of block_number, for a hash frozen with narrow
+  // entries.
+  int NarrowHashTag(int block_number) const {
+    return (narrow_tags_[block_number / 2] >> ((block_number & 1) * 4)) &
+        kHashTagMask;
+  }
+
+  // Returns the 32-bit entry, with its hash tag, for an entry of a hash
+  // frozen with narrow entries.
+  int WidenNarrowEntry(uint16_t narrow_entry) const;
+
   size_t GetNumberOfBlocks() const {
     return source_size_ / kBlockSize;
   }
 
+  // Computes the hash value of the kBlockSize bytes at block_ptr from
+  // scratch, using the hash selected by hash_type_.
+  uint32_t HashBlock(const char* block_ptr) const;
+
   // Use the lowest-order bits of the hash value
   // as the index into the hash table.
   uint32_t GetHashTableIndex(uint32_t hash_value) const {
     return hash_value & hash_table_mask_;
   }
 
+  // Sets hash_table_mask_ and hash_tag_shift_ for a hash table of table_size
+  // elements, which must be a power of two.
+  void SetHashTableSize(size_t table_size);
+
+  // Use the bits of the hash value above those of GetHashTableIndex()
+  // as the tag of the entries for blocks with that hash value.
+  int GetHashTag(uint32_t hash_value) const {
+    return static_cast<int>(hash_value >> hash_tag_shift_) & kHashTagMask;
+  }
+
+  int MakeEntry(int block_number, uint32_t hash_value) const {
+    return block_number | (GetHashTag(hash_value) << kBlockNumberBits);
+  }
+
+  // The following two functions must not be called for an entry of -1.
+  static int EntryBlockNumber(int entry) {
+    return entry & kBlockNumberMask;
+  }
+
+  static int EntryHashTag(int entry) {
+    return entry >> kBlockNumberBits;
+  }
+
   // The index within source_data_ of the next block
   // for which AddBlock() should be called.
   int NextIndexToAdd() const {
@@ -408,19 +618,33 @@ class BlockHash {
   // Returns -1 if no match was found.
   int NextMatchingBlock(int block_number, const char* block_ptr) const;
 
+  // Same as NextMatchingBlock(), for a block_ptr whose hash value has the tag
+  // hash_tag.  This saves hashing block_ptr again within the module.
+  inline int NextMatchingBlockInline(int block_number,
+                                     int hash_tag,
+                                     const char* block_ptr) const;
+
   // Inline version of FirstMatchingBlock.  This saves the cost of a function
   // call when this routine is called from within the module.  The external
   // (non-inlined) version is called only by unit tests.
   inline int FirstMatchingBlockInline(uint32_t hash_value,
                                       const char* block_ptr) const;
 
-  // Walk through the hash entry chain, skipping over any false matches
-  // (for which the lowest bits of the fingerprints match,
-  // but the actual block data does not.)  Returns the block number of
-  // the first true match found, or -1 if no true match was found.
-  // If block_number is a matching block, the function will return block_number
-  // without skipping to the next block.
-  int SkipNonMatchingBlocks(int block_number, const char* block_ptr) const;
+  // Walk through the hash entry chain, starting at entry, skipping over any
+  // false matches (for which the lowest bits of the fingerprints match,
+  // but the actual block data does not.)  Entries whose tag is not hash_tag
+  // are skipped without comparing the block data.  Returns the block number
+  // of the first true match found, or -1 if no true match was found.
+  // If entry is for a matching block, the function will return its block
+  // number without skipping to the next block.
+  int SkipNonMatchingBlocks(int entry,
+                            int hash_tag,
+                            const char* block_ptr) const;
+
+  // The same for a chain of narrow entries, whose tags are in narrow_tags_.
+  int SkipNonMatchingNarrowBlocks(int entry,
+                                  int hash_tag,
+                                  const char* block_ptr) const;
 
   // Returns the number of bytes to the left of source_match_start
   // that match the corresponding bytes to the left of target_match_start.
@@ -450,15 +674,15 @@ class BlockHash {
   // The size of this array is determined using CalcTableSize().  It has at
   // least one element for each kBlockSize-byte block in the source data.
   // GetHashTableIndex() returns an index into this table for a given hash
-  // value.  The value of each element of hash_table_ is the lowest block
-  // number in the source data whose hash value would return the same value from
-  // GetHashTableIndex(), or -1 if there is no matching block.  This value can
-  // then be used as an index into next_block_table_ to retrieve the entire set
-  // of matching block numbers.
-  std::vector<int> hash_table_;
+  // value.  The value of each element of hash_table_ is the entry (see
+  // kBlockNumberBits) for the lowest block number in the source data whose
+  // hash value would return the same value from GetHashTableIndex(), or -1 if
+  // there is no matching block.  Its block number can then be used as an index
+  // into next_block_table_ to retrieve the entire set of matching blocks.
+  HashTableVector hash_table_;
 
   // An array containing one element for each source block.  Each element is
-  // either -1 (== not found) or the index of the next block whose hash value
+  // either -1 (== not found) or the entry for the next block whose hash value
   // would produce a matching result from GetHashTableIndex().
   std::vector<int> next_block_table_;
 
@@ -473,12 +697,41 @@ class BlockHash {
   // lists, so that the match with the lowest index is returned first.  This
   // should result in a more compact encoding because the VCDIFF format favors
   // smaller index values and repeated index values.
+  // It is empty for a one-shot hash, which is populated in reverse instead,
+  // and for a frozen hash.
   std::vector<int> last_block_table_;
 
+  // The elements of next_block_table_.  Once a hash is frozen with 32-bit
+  // entries, next_block_table_ is released and its elements are stored
+  // after those of hash_table_.
+  const int* next_entries_;
+
+  // For a hash frozen with narrow entries, the narrow elements of the hash
+  // table followed by those of the next block table, and a pointer to the
+  // latter.  hash_table_ and next_block_table_ are then released.
+  std::vector<uint16_t> narrow_table_;
+  const uint16_t* narrow_next_entries_;
+
+  // For a hash frozen with narrow entries, the hash tag of the entry of each
+  // block, two blocks per byte (the even one in the low bits).  They serve
+  // lookups as the tags of 32-bit entries do, and restore those entries
+  // when the hash is extended.
+  std::vector<uint8_t> narrow_tags_;
+
+  bool frozen_;
+  bool narrow_;
+
+  // For a one-shot hash, the object that hash_table_ and next_block_table_
+  // were borrowed from; otherwise NULL.
+  BlockHashTables* borrowed_tables_;
+
   // Performing a bitwise AND with hash_table_mask_ will produce a value ranging
   // from 0 to the number of elements in hash_table_.
   uint32_t hash_table_mask_;
 
+  // The number of bits in hash_table_mask_, which GetHashTag() shifts out.
+  int hash_tag_shift_;
+
   // The offset of the first byte of source data (the data at source_data_[0]).
   // For the purpose of computing offsets, the source data and target data
   // are considered to be concatenated -- not literally in a single memory
@@ -491,6 +744,9 @@ class BlockHash {
   // equal to the dictionary size.
   const int starting_offset_;
 
+  // The rolling hash that the blocks are hashed with.
+  const VCDiffHashType hash_type_;
+
   // The last index added by AddBlock().  This determines the block number
   // for successive calls to AddBlock(), and is also
   // used to determine the starting block for AddAllBlocksThroughIndex().
@@ -15,8 +15,11 @@
 #include <config.h>
 #include "blockhash.h"
 #include <limits.h>  // INT_MIN
+#include <stdlib.h>  // rand, srand
 #include <string.h>  // memcpy, memcmp, strlen
 #include <iostream>
+#include <string>
+#include <vector>
 #include "encodetable.h"
 #include "rolling_hash.h"
 #include "testing.h"
@@ -30,11 +33,14 @@ class BlockHashTest : public testing::Test {
  protected:
   static const int kTimingTestSize = 1 << 21;  // 2M
   static const int kTimingTestIterations = 32;
+  static const int kMaxProbes = BlockHash::kMaxProbes;
 
   BlockHashTest() {
     dh_.reset(BlockHash::CreateDictionaryHash(sample_text,
-                                              strlen(sample_text)));
-    th_.reset(BlockHash::CreateTargetHash(sample_text, strlen(sample_text), 0));
+                                              strlen(sample_text),
+                                              VCD_HASH_POLYNOMIAL));
+    th_.reset(BlockHash::CreateTargetHash(sample_text, strlen(sample_text), 0,
+                                          VCD_HASH_POLYNOMIAL));
     EXPECT_TRUE(dh_.get() != NULL);
     EXPECT_TRUE(th_.get() != NULL);
   }
@@ -73,6 +79,85 @@ class BlockHashTest : public testing::Test {
                                            max_bytes);
   }
 
+  static uint32_t GetHashTableIndex(const BlockHash& block_hash,
+                                    uint32_t hash_value) {
+    return block_hash.GetHashTableIndex(hash_value);
+  }
+
+  static int GetHashTag(const BlockHash& block_hash, uint32_t hash_value) {
+    return block_hash.GetHashTag(hash_value);
+  }
+
+  // Expects every block of data to have the same chain of true matches
+  // in both BlockHash objects.
+  void ExpectSameMatches(const BlockHash& expected,
+                         const BlockHash& actual,
+                         const char* data,
+                         size_t size) const {
+    for (size_t i = 0; i + kBlockSize <= size; i += kBlockSize) {
+      const char* block = &data[i];
+      const uint32_t hash = RollingHash<kBlockSize>::Hash(block);
+      int expected_block = FirstMatchingBlock(expected, hash, block);
+      int actual_block = FirstMatchingBlock(actual, hash, block);
+      EXPECT_EQ(expected_block, actual_block);
+      while ((expected_block != -1) && (expected_block == actual_block)) {
+        expected_block = NextMatchingBlock(expected, expected_block, block);
+        actual_block = NextMatchingBlock(actual, actual_block, block);
+        EXPECT_EQ(expected_block, actual_block);
+      }
+    }
+  }
+
+  // Returns the blocks of block_hash whose contents are the same as those
+  // of block, hashing block with the hash of block_hash.
+  static std::vector<int> MatchingBlocks(const BlockHash& block_hash,
+                                         const char* block) {
+    std::vector<int> blocks;
+    int block_number =
+        block_hash.FirstMatchingBlock(block_hash.HashBlock(block), block);
+    while (block_number != -1) {
+      blocks.push_back(block_number);
+      block_number = block_hash.NextMatchingBlock(block_number, block);
+    }
+    return blocks;
+  }
+
+  // Text of size bytes made of a few repeated words, so that
+  // blocks have several matches.
+  static std::string MakeRepetitiveText(size_t size) {
+    static const char* const kWords[] = { "fear ", "itself ", "only ",
+                                          "thing ", "we ", "have " };
+    std::string text;
+    for (size_t i = 0; text.size() < size; i = i * 7 + 3) {
+      text.append(kWords[i % 6]);
+    }
+    text.resize(size);
+    return text;
+  }
+
+  // Text of size random letters, whose blocks are practically all distinct.
+  static std::string MakeRandomText(size_t size) {
+    std::string text;
+    srand(1);
+    while (text.size() < size) {
+      text.push_back(static_cast<char>('a' + rand() % 26));
+    }
+    return text;
+  }
+
+  // The bytes allocated for the index of block_hash.
+  static size_t IndexBytes(const BlockHash& block_hash) {
+    return (block_hash.hash_table_.capacity() +
+            block_hash.next_block_table_.capacity() +
+            block_hash.last_block_table_.capacity()) * sizeof(int) +
+           block_hash.narrow_table_.capacity() * sizeof(uint16_t) +
+           block_hash.narrow_tags_.capacity();
+  }
+
+  static bool HasNarrowEntries(const BlockHash& block_hash) {
+    return block_hash.narrow_;
+  }
+
   static int StringLengthAsInt(const char* s) {
     return static_cast<int>(strlen(s));
   }
@@ -721,13 +806,13 @@ TEST_F(BlockHashTest, AddEntireRangeFindSixMatches) {
 }
 
 TEST_F(BlockHashTest, ZeroSizeSourceAccepted) {
-  BlockHash zero_sized_hash(sample_text, 0, 0);
+  BlockHash zero_sized_hash(sample_text, 0, 0, VCD_HASH_POLYNOMIAL);
   EXPECT_EQ(true, zero_sized_hash.Init(true));
   EXPECT_EQ(-1, FirstMatchingBlock(zero_sized_hash, hashed_y, test_string_y));
 }
 
 TEST_F(BlockHashTest, NullSource) {
-  BlockHash null_source_hash(NULL, 0, 0);
+  BlockHash null_source_hash(NULL, 0, 0, VCD_HASH_POLYNOMIAL);
   EXPECT_EQ(true, null_source_hash.Init(true));
   EXPECT_EQ(-1, FirstMatchingBlock(null_source_hash, hashed_y, test_string_y));
 }
@@ -739,13 +824,13 @@ TEST_F(BlockHashDeathTest, BadNextMatchingBlockReturnsNoMatch) {
 }
 
 TEST_F(BlockHashDeathTest, CallingInitTwiceIsIllegal) {
-  BlockHash bh(sample_text, strlen(sample_text), 0);
+  BlockHash bh(sample_text, strlen(sample_text), 0, VCD_HASH_POLYNOMIAL);
   EXPECT_TRUE(bh.Init(false));
   EXPECT_DEBUG_DEATH(EXPECT_FALSE(bh.Init(false)), "twice");
 }
 
 TEST_F(BlockHashDeathTest, CallingAddBlockBeforeInitIsIllegal) {
-  BlockHash bh(sample_text, strlen(sample_text), 0);
+  BlockHash bh(sample_text, strlen(sample_text), 0, VCD_HASH_POLYNOMIAL);
   EXPECT_DEBUG_DEATH(bh.AddAllBlocksThroughIndex(index_of_first_e),
                      "called before");
 }
@@ -776,7 +861,8 @@ TEST_F(BlockHashTest, FindBestMatch) {
 }
 
 TEST_F(BlockHashTest, FindBestMatchWithStartingOffset) {
-  BlockHash th2(sample_text, strlen(sample_text), 0x10000);
+  BlockHash th2(sample_text, strlen(sample_text), 0x10000,
+                VCD_HASH_POLYNOMIAL);
   th2.Init(true);  // hash all blocks
   th2.FindBestMatch(hashed_f,
                     &search_string[index_of_f_in_fearsome],
@@ -827,7 +913,8 @@ TEST_F(BlockHashTest, BestMatchReachesStartOfDictionary) {
 TEST_F(BlockHashTest, BestMatchWithManyMatches) {
   BlockHash many_matches_hash(sample_text_many_matches,
                               strlen(sample_text_many_matches),
-                              0);
+                              0,
+                              VCD_HASH_POLYNOMIAL);
   EXPECT_TRUE(many_matches_hash.Init(true));
   // Hash the "   a" at the beginning of the search string "ababc"
   uint32_t hash_value =
@@ -895,7 +982,7 @@ TEST_F(BlockHashTest, SearchStringFindsTooManyMatches) {
   const int kTestSize = 1 << 20;  // 1M
   char* huge_dictionary = new char[kTestSize];
   memset(huge_dictionary, 'Q', kTestSize);
-  BlockHash huge_bh(huge_dictionary, kTestSize, 0);
+  BlockHash huge_bh(huge_dictionary, kTestSize, 0, VCD_HASH_POLYNOMIAL);
   EXPECT_TRUE(huge_bh.Init(/* populate_hash_table = */ true));
   char* huge_target = new char[kTestSize];
   memset(huge_target, 'Q', kTestSize);
@@ -925,7 +1012,328 @@ TEST_F(BlockHashTest, SearchStringFindsTooManyMatches) {
   delete[] huge_dictionary;
 }
 
+TEST_F(BlockHashTest, ExtendedDictionaryHashReusesBaseTable) {
+  // 4000 bytes and 5003 bytes need frozen tables of 512 and 1024 entries.
+  const std::string base_text = MakeRepetitiveText(4000);
+  const std::string text = base_text + MakeRepetitiveText(1003);
+  UNIQUE_PTR<const BlockHash> base(
+      BlockHash::CreateDictionaryHash(base_text.data(), base_text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  ASSERT_TRUE(HasNarrowEntries(*base));
+  UNIQUE_PTR<const BlockHash> full(
+      BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> extended(
+      BlockHash::CreateExtendedDictionaryHash(*base, text.data(),
+                                              text.size()));
+  ASSERT_TRUE(extended.get() != NULL);
+  ExpectSameMatches(*full, *extended, text.data(), text.size());
+  // The base is unaffected.
+  ExpectSameMatches(*base, *base, base_text.data(), base_text.size());
+  EXPECT_EQ(-1, FirstMatchingBlock(*base, hashed_y, test_string_y));
+}
+
+// The entries of the base are copied rather than computed from the new
+// dictionary data, whose first bytes are not checked.  Giving it different
+// first bytes shows which: their blocks are not found.
+TEST_F(BlockHashTest, ExtendedDictionaryHashCopiesBaseEntries) {
+  // With narrow and with 32-bit entries.
+  const size_t base_sizes[] = { 4000, 1100000 };
+  for (size_t i = 0; i < sizeof(base_sizes) / sizeof(base_sizes[0]); ++i) {
+    const size_t base_size = base_sizes[i];
+    const std::string base_text = MakeRepetitiveText(base_size);
+    const std::string text =
+        MakeRandomText(base_size) + MakeRepetitiveText(base_size / 10);
+    UNIQUE_PTR<const BlockHash> base(
+        BlockHash::CreateDictionaryHash(base_text.data(), base_text.size(),
+                                        VCD_HASH_POLYNOMIAL));
+    EXPECT_EQ(base_size < 65535 * kBlockSize, HasNarrowEntries(*base));
+    UNIQUE_PTR<const BlockHash> full(
+        BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                        VCD_HASH_POLYNOMIAL));
+    UNIQUE_PTR<const BlockHash> extended(
+        BlockHash::CreateExtendedDictionaryHash(*base, text.data(),
+                                                text.size()));
+    ASSERT_TRUE(extended.get() != NULL);
+    const char* const block = &text[kBlockSize];
+    const uint32_t hash = RollingHash<kBlockSize>::Hash(block);
+    EXPECT_EQ(1, FirstMatchingBlock(*full, hash, block));
+    EXPECT_EQ(-1, FirstMatchingBlock(*extended, hash, block));
+  }
+}
+
+TEST_F(BlockHashTest, ExtendedDictionaryHashRehashesWhenTooSmall) {
+  const std::string base_text = MakeRepetitiveText(1001);
+  const std::string text = base_text + MakeRepetitiveText(9000);
+  UNIQUE_PTR<const BlockHash> base(
+      BlockHash::CreateDictionaryHash(base_text.data(), base_text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> full(
+      BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> extended(
+      BlockHash::CreateExtendedDictionaryHash(*base, text.data(),
+                                              text.size()));
+  ASSERT_TRUE(extended.get() != NULL);
+  ExpectSameMatches(*full, *extended, text.data(), text.size());
+}
+
+TEST_F(BlockHashTest, ExtendedDictionaryHashFromEmptyBase) {
+  UNIQUE_PTR<const BlockHash> base(
+      BlockHash::CreateDictionaryHash("", 0, VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> extended(
+      BlockHash::CreateExtendedDictionaryHash(*base, sample_text,
+                                              strlen(sample_text)));
+  ASSERT_TRUE(extended.get() != NULL);
+  ExpectSameMatches(*dh_, *extended, sample_text, strlen(sample_text));
+  EXPECT_EQ(block_of_y_in_only, FirstMatchingBlock(*extended, hashed_y,
+                                                   test_string_y));
+}
+
+// Fills the chain of the first hash table element with blocks whose hash
+// values differ, so that most of them are skipped by their hash tags.
+TEST_F(BlockHashTest, CollidingBlocksWithDifferentHashTagsAreFound) {
+  const int kBlocks = 64;
+  const int kCollidingBlocks = 12;
+  std::string text;
+  srand(1);
+  UNIQUE_PTR<const BlockHash> sizing_hash(
+      BlockHash::CreateDictionaryHash(std::string(kBlocks * kBlockSize, ' ')
+                                          .data(),
+                                      kBlocks * kBlockSize,
+                                      VCD_HASH_POLYNOMIAL));
+  bool tag_seen[16] = { false };
+  int distinct_tags = 0;
+  while (text.size() < kCollidingBlocks * kBlockSize) {
+    std::string block;
+    for (int i = 0; i < kBlockSize; ++i) {
+      block.push_back(static_cast<char>('a' + rand() % 26));
+    }
+    const uint32_t hash_value = RollingHash<kBlockSize>::Hash(block.data());
+    if (GetHashTableIndex(*sizing_hash, hash_value) == 0) {
+      text += block;
+      const int tag = GetHashTag(*sizing_hash, hash_value);
+      if (!tag_seen[tag]) {
+        tag_seen[tag] = true;
+        ++distinct_tags;
+      }
+    }
+  }
+  EXPECT_GT(distinct_tags, 1);
+  while (text.size() < kBlocks * kBlockSize) {
+    text.push_back(static_cast<char>('a' + rand() % 26));
+  }
+  BlockHashTables tables;
+  UNIQUE_PTR<const BlockHash> hashes[2];
+  hashes[0].reset(BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                                  VCD_HASH_POLYNOMIAL));
+  hashes[1].reset(BlockHash::CreateOneShotDictionaryHash(text.data(),
+                                                         text.size(),
+                                                         &tables,
+                                                         VCD_HASH_POLYNOMIAL));
+  for (int h = 0; h < 2; ++h) {
+    for (int block = 0; block < kBlocks; ++block) {
+      const char* block_ptr = &text[block * kBlockSize];
+      EXPECT_EQ(block,
+                FirstMatchingBlock(*hashes[h],
+                                   RollingHash<kBlockSize>::Hash(block_ptr),
+                                   block_ptr));
+      EXPECT_EQ(-1, NextMatchingBlock(*hashes[h], block, block_ptr));
+    }
+  }
+}
+
+TEST_F(BlockHashTest, ExtendedDictionaryHashReusesFrozenBaseTable) {
+  // More blocks than narrow entries can hold.
+  const std::string text = MakeRandomText(1200000);
+  const size_t base_size = 1100000;
+  UNIQUE_PTR<const BlockHash> base(
+      BlockHash::CreateDictionaryHash(text.data(), base_size,
+                                      VCD_HASH_POLYNOMIAL));
+  ASSERT_FALSE(HasNarrowEntries(*base));
+  UNIQUE_PTR<const BlockHash> full(
+      BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> extended(
+      BlockHash::CreateExtendedDictionaryHash(*base, text.data(),
+                                              text.size()));
+  ASSERT_TRUE(extended.get() != NULL);
+  ExpectSameMatches(*full, *extended, text.data(), text.size());
+  ExpectSameMatches(*base, *base, text.data(), base_size);
+}
+
+TEST_F(BlockHashTest, FrozenDictionaryHashFindsSameMatches) {
+  const std::string texts[] = { MakeRepetitiveText(5003),
+                                MakeRandomText(5003),
+                                MakeRandomText(1200000) };
+  for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i) {
+    const std::string& text = texts[i];
+    BlockHash unfrozen(text.data(), text.size(), 0, VCD_HASH_POLYNOMIAL);
+    ASSERT_TRUE(unfrozen.Init(/* populate_hash_table = */ true));
+    UNIQUE_PTR<const BlockHash> frozen(
+        BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                        VCD_HASH_POLYNOMIAL));
+    EXPECT_EQ(text.size() < 65535 * kBlockSize, HasNarrowEntries(*frozen));
+    ExpectSameMatches(unfrozen, *frozen, text.data(), text.size());
+    // At least a third smaller.
+    EXPECT_LE(IndexBytes(*frozen) * 3, IndexBytes(unfrozen) * 2);
+  }
+}
+
+// Freeze() merges chains, so the chain of the last block of these texts
+// gets many more collisions than kMaxProbes in front of it: blocks whose
+// hashes have the same frozen table index, but a different hash tag.
+TEST_F(BlockHashTest, FrozenDictionaryHashFindsSameMatchesPastCollisions) {
+  const size_t sizes[] = { 5003, 1200000 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    std::string text = MakeRandomText(sizes[i]);
+    // The table size, and so the index and tag, depend only on the size.
+    UNIQUE_PTR<const BlockHash> layout(
+        BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                        VCD_HASH_POLYNOMIAL));
+    const size_t last_block = text.size() / kBlockSize - 1;
+    const uint32_t last_hash =
+        RollingHash<kBlockSize>::Hash(&text[last_block * kBlockSize]);
+    const int colliding_blocks = 3 * kMaxProbes;
+    char block[kBlockSize];
+    for (int collisions = 0; collisions < colliding_blocks; ) {
+      for (int j = 0; j < kBlockSize; ++j) {
+        block[j] = static_cast<char>('a' + rand() % 26);
+      }
+      const uint32_t hash = RollingHash<kBlockSize>::Hash(block);
+      if ((GetHashTableIndex(*layout, hash) ==
+           GetHashTableIndex(*layout, last_hash)) &&
+          (GetHashTag(*layout, hash) != GetHashTag(*layout, last_hash))) {
+        text.replace(collisions * kBlockSize, kBlockSize, block, kBlockSize);
+        ++collisions;
+      }
+    }
+    BlockHash unfrozen(text.data(), text.size(), 0, VCD_HASH_POLYNOMIAL);
+    ASSERT_TRUE(unfrozen.Init(/* populate_hash_table = */ true));
+    UNIQUE_PTR<const BlockHash> frozen(
+        BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                        VCD_HASH_POLYNOMIAL));
+    EXPECT_EQ(text.size() < 65535 * kBlockSize, HasNarrowEntries(*frozen));
+    EXPECT_EQ(static_cast<int>(last_block),
+              FirstMatchingBlock(*frozen, last_hash,
+                                 &text[last_block * kBlockSize]));
+    ExpectSameMatches(unfrozen, *frozen, text.data(), text.size());
+  }
+}
+
+TEST_F(BlockHashTest, FrozenDictionaryHashCannotBeModified) {
+  BlockHash frozen(sample_text, strlen(sample_text), 0, VCD_HASH_POLYNOMIAL);
+  ASSERT_TRUE(frozen.Init(/* populate_hash_table = */ false));
+  frozen.Freeze();
+  EXPECT_DEBUG_DEATH(
+      frozen.AddOneIndexHash(0, RollingHash<kBlockSize>::Hash(sample_text)),
+      "Freeze");
+  EXPECT_DEBUG_DEATH(frozen.Freeze(), "Freeze");
+  EXPECT_DEBUG_DEATH(EXPECT_FALSE(frozen.Init(true)), "twice");
+  EXPECT_EQ(-1, FirstMatchingBlock(frozen, hashed_y, test_string_y));
+}
+
+TEST_F(BlockHashTest, OneShotDictionaryHashFindsSameMatches) {
+  const std::string text = MakeRepetitiveText(5003);
+  UNIQUE_PTR<const BlockHash> full(
+      BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  BlockHashTables tables;
+  UNIQUE_PTR<const BlockHash> one_shot(
+      BlockHash::CreateOneShotDictionaryHash(text.data(), text.size(),
+                                             &tables,
+                                             VCD_HASH_POLYNOMIAL));
+  ASSERT_TRUE(one_shot.get() != NULL);
+  ExpectSameMatches(*full, *one_shot, text.data(), text.size());
+  // The tables are given back when the hash is deleted.
+  EXPECT_TRUE(tables.hash_table.empty());
+  one_shot.reset();
+  EXPECT_EQ(text.size() / kBlockSize, tables.next_block_table.size());
+  EXPECT_FALSE(tables.hash_table.empty());
+}
+
+TEST_F(BlockHashTest, OneShotDictionaryHashReusesTables) {
+  const std::string text = MakeRepetitiveText(5003);
+  BlockHashTables tables;
+  delete BlockHash::CreateOneShotDictionaryHash(text.data(), text.size(),
+                                                &tables,
+                                                VCD_HASH_POLYNOMIAL);
+  const int* const hash_table_memory = &tables.hash_table[0];
+  const int* const next_block_table_memory = &tables.next_block_table[0];
+  // A smaller source fits into the same memory, and stale entries from the
+  // previous source are not found.
+  UNIQUE_PTR<const BlockHash> one_shot(
+      BlockHash::CreateOneShotDictionaryHash(sample_text, strlen(sample_text),
+                                             &tables,
+                                             VCD_HASH_POLYNOMIAL));
+  ASSERT_TRUE(one_shot.get() != NULL);
+  ExpectSameMatches(*dh_, *one_shot, sample_text, strlen(sample_text));
+  EXPECT_EQ(block_of_y_in_only, FirstMatchingBlock(*one_shot, hashed_y,
+                                                   test_string_y));
+  EXPECT_EQ(-1, FirstMatchingBlock(*one_shot,
+                                   RollingHash<kBlockSize>::Hash(text.data()),
+                                   text.data()));
+  one_shot.reset();
+  EXPECT_EQ(hash_table_memory, &tables.hash_table[0]);
+  EXPECT_EQ(next_block_table_memory, &tables.next_block_table[0]);
+}
+
+TEST_F(BlockHashTest, ExtendedDictionaryHashFromOneShotBase) {
+  const std::string base_text = MakeRepetitiveText(4000);
+  const std::string text = base_text + MakeRepetitiveText(1003);
+  BlockHashTables tables;
+  UNIQUE_PTR<const BlockHash> base(
+      BlockHash::CreateOneShotDictionaryHash(base_text.data(),
+                                             base_text.size(), &tables,
+                                             VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> full(
+      BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> extended(
+      BlockHash::CreateExtendedDictionaryHash(*base, text.data(),
+                                              text.size()));
+  ASSERT_TRUE(extended.get() != NULL);
+  ExpectSameMatches(*full, *extended, text.data(), text.size());
+}
+
+TEST_F(BlockHashTest, GearHashFindsSameBlocks) {
+  const std::string text = MakeRepetitiveText(5003) + MakeRandomText(20000);
+  UNIQUE_PTR<const BlockHash> polynomial(
+      BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                      VCD_HASH_POLYNOMIAL));
+  UNIQUE_PTR<const BlockHash> gear(
+      BlockHash::CreateDictionaryHash(text.data(), text.size(),
+                                      VCD_HASH_GEAR));
+  BlockHashTables tables;
+  UNIQUE_PTR<const BlockHash> one_shot_gear(
+      BlockHash::CreateOneShotDictionaryHash(text.data(), text.size(),
+                                             &tables, VCD_HASH_GEAR));
+  UNIQUE_PTR<const BlockHash> gear_base(
+      BlockHash::CreateDictionaryHash(text.data(), 5003, VCD_HASH_GEAR));
+  UNIQUE_PTR<const BlockHash> extended_gear(
+      BlockHash::CreateExtendedDictionaryHash(*gear_base, text.data(),
+                                              text.size()));
+  ASSERT_TRUE(gear.get() != NULL);
+  ASSERT_TRUE(one_shot_gear.get() != NULL);
+  ASSERT_TRUE(extended_gear.get() != NULL);
+  EXPECT_EQ(VCD_HASH_GEAR, gear->hash_type());
+  EXPECT_EQ(VCD_HASH_GEAR, extended_gear->hash_type());
+  for (size_t i = 0; i + kBlockSize <= text.size(); i += kBlockSize) {
+    const char* block = &text[i];
+    const std::vector<int> expected = MatchingBlocks(*polynomial, block);
+    EXPECT_TRUE(expected == MatchingBlocks(*gear, block));
+    EXPECT_TRUE(expected == MatchingBlocks(*one_shot_gear, block));
+    EXPECT_TRUE(expected == MatchingBlocks(*extended_gear, block));
+  }
+}
+
 #ifdef GTEST_HAS_DEATH_TEST
+TEST_F(BlockHashDeathTest, ExtendingWithDifferentHashTypeIsIllegal) {
+  BlockHash extended(sample_text, strlen(sample_text), 0, VCD_HASH_GEAR);
+  EXPECT_DEBUG_DEATH(EXPECT_FALSE(extended.InitFromBase(*dh_)),
+                     "incompatible");
+}
+
 TEST_F(BlockHashDeathTest, AddTooManyBlocks) {
   for (int i = 0; i < StringLengthAsInt(sample_text_without_spaces); ++i) {
     th_->AddOneIndexHash(i * kBlockSize, hashed_e);
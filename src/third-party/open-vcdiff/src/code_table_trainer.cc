@@ -0,0 +1,511 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <config.h>
+#include "google/code_table_trainer.h"
+#include <string.h>  // memset
+#include <map>
+#include <queue>
+#include <set>
+#include <utility>  // std::pair
+#include <vector>
+#include "addrcache.h"
+#include "codetable.h"
+#include "encodetable.h"
+#include "google/output_string.h"
+#include "google/vcencoder.h"
+#include "logging.h"
+#include "varint_bigendian.h"
+#include "vcdiffengine.h"
+
+namespace open_vcdiff {
+
+namespace {
+
+// Sizes up to this value can be implied by an opcode.
+const size_t kMaxImpliedSize = 255;
+
+// Set in the candidate IDs of BuildCodeTable() that stand for pairs.
+const uint64_t kPairCandidate = 1ULL << 63;
+
+uint32_t MakeInstructionKey(unsigned char inst,
+                            size_t size,
+                            unsigned char mode) {
+  const uint32_t inst_mode = (inst == VCD_COPY) ? (inst + mode) : inst;
+  const uint32_t implied_size =
+      (size <= kMaxImpliedSize) ? static_cast<uint32_t>(size) : 0;
+  return (inst_mode << 8) | implied_size;
+}
+
+uint64_t MakePairKey(uint32_t first, uint32_t second) {
+  return (static_cast<uint64_t>(first) << 32) | second;
+}
+
+uint32_t FirstOfPair(uint64_t pair) {
+  return static_cast<uint32_t>(pair >> 32);
+}
+
+uint32_t SecondOfPair(uint64_t pair) {
+  return static_cast<uint32_t>(pair);
+}
+
+uint32_t KeySize(uint32_t key) {
+  return key & 0xFF;
+}
+
+// The key of the same instruction with its size written after the opcode.
+uint32_t KeyWithoutSize(uint32_t key) {
+  return key & ~0xFFU;
+}
+
+unsigned char KeyInstruction(uint32_t key) {
+  const uint32_t inst_mode = key >> 8;
+  return static_cast<unsigned char>(
+      (inst_mode >= VCD_COPY) ? static_cast<uint32_t>(VCD_COPY) : inst_mode);
+}
+
+unsigned char KeyMode(uint32_t key) {
+  const uint32_t inst_mode = key >> 8;
+  return static_cast<unsigned char>(
+      (inst_mode >= VCD_COPY) ? (inst_mode - VCD_COPY) : 0);
+}
+
+// The number of bytes that an opcode saves by implying the size of key.
+uint64_t SizeLength(uint32_t key) {
+  return VarintBE<int32_t>::Length(static_cast<int32_t>(KeySize(key)));
+}
+
+// An upper bound of the saving of a pair that occurs count times: its
+// opcode and the size of its second instruction, which takes at most
+// two bytes.  The actual saving is computed when it reaches the top
+// of the queue.
+uint64_t PairSavingBound(uint64_t count) {
+  return count * 3;
+}
+
+// Writes the instructions of entry, as made by GetTableEntries(), to the
+// given opcode of *table.
+void SetTableEntry(uint64_t entry, int opcode, VCDiffCodeTableData* table) {
+  const uint32_t first = FirstOfPair(entry);
+  const uint32_t second = SecondOfPair(entry);
+  table->inst1[opcode] = KeyInstruction(first);
+  table->size1[opcode] = static_cast<unsigned char>(KeySize(first));
+  table->mode1[opcode] = KeyMode(first);
+  table->inst2[opcode] = KeyInstruction(second);
+  table->size2[opcode] = static_cast<unsigned char>(KeySize(second));
+  table->mode2[opcode] = KeyMode(second);
+}
+
+}  // anonymous namespace
+
+// A VCDiffCodeTableWriter that reports every instruction to the trainer,
+// with the address mode that the writer chooses for it, and measures the
+// delta size with the code table that the encoder uses by default for the
+// cache sizes.
+class CodeTableTrainer::RecordingCodeTableWriter
+    : public VCDiffCodeTableWriter {
+ public:
+  RecordingCodeTableWriter(CodeTableTrainer* trainer,
+                           const VCDiffCodeTableData& code_table_data)
+      : VCDiffCodeTableWriter(
+            false,
+            trainer->near_cache_size_,
+            trainer->same_cache_size_,
+            code_table_data,
+            static_cast<unsigned char>(trainer->near_cache_size_ +
+                                       trainer->same_cache_size_ + 1)),
+        trainer_(trainer),
+        address_cache_(trainer->near_cache_size_, trainer->same_cache_size_),
+        dictionary_size_(0),
+        target_length_(0) { }
+
+  // Also called by Output() at the end of every delta window, which resets
+  // the address cache of the writer.
+  virtual bool Init(size_t dictionary_size) {
+    dictionary_size_ = dictionary_size;
+    target_length_ = 0;
+    trainer_->has_last_instruction_ = false;
+    return address_cache_.Init() &&
+           VCDiffCodeTableWriter::Init(dictionary_size);
+  }
+
+  virtual void Add(const char* data, size_t size) {
+    trainer_->RecordInstruction(VCD_ADD, size, 0);
+    target_length_ += size;
+    VCDiffCodeTableWriter::Add(data, size);
+  }
+
+  virtual void Copy(int32_t offset, size_t size) {
+    int32_t encoded_addr = 0;
+    const unsigned char mode = address_cache_.EncodeAddress(
+        offset,
+        static_cast<VCDAddress>(dictionary_size_ + target_length_),
+        &encoded_addr);
+    trainer_->RecordInstruction(VCD_COPY, size, mode);
+    target_length_ += size;
+    VCDiffCodeTableWriter::Copy(offset, size);
+  }
+
+  virtual void Run(size_t size, unsigned char byte) {
+    trainer_->RecordInstruction(VCD_RUN, size, 0);
+    target_length_ += size;
+    VCDiffCodeTableWriter::Run(size, byte);
+  }
+
+ private:
+  CodeTableTrainer* const trainer_;
+
+  // A copy of the address cache of the writer, which is private to it.
+  VCDiffAddressCache address_cache_;
+
+  size_t dictionary_size_;
+  size_t target_length_;
+};
+
+CodeTableTrainer::CodeTableTrainer(const HashedDictionary* dictionary,
+                                   bool look_for_target_matches)
+    : dictionary_(dictionary),
+      look_for_target_matches_(look_for_target_matches),
+      near_cache_size_(VCDiffAddressCache::kDefaultNearCacheSize),
+      same_cache_size_(VCDiffAddressCache::kDefaultSameCacheSize),
+      last_instruction_(0),
+      has_last_instruction_(false),
+      targets_analyzed_(0),
+      total_target_size_(0),
+      total_encoded_size_(0),
+      instructions_recorded_(0) { }
+
+CodeTableTrainer::~CodeTableTrainer() { }
+
+bool CodeTableTrainer::SetAddressCacheSizes(int near_cache_size,
+                                            int same_cache_size) {
+  if (targets_analyzed_ > 0) {
+    VCD_ERROR << "SetAddressCacheSizes called after AnalyzeTarget" << VCD_ENDL;
+    return false;
+  }
+  VCDiffCodeTableData code_table;
+  if (!VCDiffCodeTableData::BuildForCacheSizes(near_cache_size,
+                                               same_cache_size,
+                                               &code_table)) {
+    return false;
+  }
+  near_cache_size_ = near_cache_size;
+  same_cache_size_ = same_cache_size;
+  return true;
+}
+
+bool CodeTableTrainer::GetBaseCodeTable(VCDiffCodeTableData* code_table) const {
+  return VCDiffCodeTableData::BuildForCacheSizes(near_cache_size_,
+                                                 same_cache_size_,
+                                                 code_table);
+}
+
+bool CodeTableTrainer::AnalyzeTarget(const char* target_data,
+                                     size_t target_size) {
+  const VCDiffEngine* engine = dictionary_->engine();
+  VCDiffCodeTableData base_code_table;
+  if (!GetBaseCodeTable(&base_code_table)) {
+    return false;
+  }
+  // The default code table is recognized by its address, which makes the
+  // writer omit it from the header.
+  const bool default_cache_sizes =
+      (near_cache_size_ == VCDiffAddressCache::kDefaultNearCacheSize) &&
+      (same_cache_size_ == VCDiffAddressCache::kDefaultSameCacheSize);
+  RecordingCodeTableWriter coder(
+      this,
+      default_cache_sizes ? VCDiffCodeTableData::kDefaultCodeTableData
+                          : base_code_table);
+  if (!coder.Init(engine->dictionary_size())) {
+    VCD_DFATAL << "Internal error: "
+                  "Initialization of code table writer failed" << VCD_ENDL;
+    return false;
+  }
+  if (!coder.VerifyChunk(target_data, target_size)) {
+    VCD_ERROR << "Target not valid for writer" << VCD_ENDL;
+    return false;
+  }
+  std::string delta;
+  OutputString<std::string> out(&delta);
+  coder.WriteHeader(&out, VCD_STANDARD_FORMAT);
+  engine->Encode(target_data, target_size, look_for_target_matches_, &out,
+                 &coder);
+  coder.FinishEncoding(&out);
+  ++targets_analyzed_;
+  total_target_size_ += target_size;
+  total_encoded_size_ += delta.size();
+  return true;
+}
+
+void CodeTableTrainer::RecordInstruction(unsigned char inst,
+                                         size_t size,
+                                         unsigned char mode) {
+  const InstructionKey key = MakeInstructionKey(inst, size, mode);
+  ++instruction_counts_[key];
+  if (has_last_instruction_) {
+    // Pairs are counted even where the first instruction was itself the
+    // second one of a pair, so they are slightly overestimated.
+    ++pair_counts_[MakePairKey(last_instruction_, key)];
+  }
+  last_instruction_ = key;
+  has_last_instruction_ = true;
+  ++instructions_recorded_;
+}
+
+// Every opcode of a code table is represented by a PairKey, where a single
+// instruction has the NOOP key, 0, as its second one.
+static void GetTableEntries(const VCDiffCodeTableData& table,
+                            std::map<uint64_t, int>* entries) {
+  for (int opcode = VCDiffCodeTableData::kCodeTableSize - 1; opcode >= 0;
+       --opcode) {
+    const uint32_t first = MakeInstructionKey(table.inst1[opcode],
+                                              table.size1[opcode],
+                                              table.mode1[opcode]);
+    const uint32_t second = MakeInstructionKey(table.inst2[opcode],
+                                               table.size2[opcode],
+                                               table.mode2[opcode]);
+    // The lowest opcode is kept, as in VCDiffInstructionMap.
+    (*entries)[MakePairKey(first, second)] = opcode;
+  }
+}
+
+// The bytes saved on the recorded instructions by the implied sizes and
+// pairs of table, compared to a code table that has neither.  This follows
+// VCDiffCodeTableWriter::EncodeInstruction(): a pair can only follow the
+// opcode of its first instruction, which has the size 0 if the size of the
+// first instruction is not implied.
+uint64_t CodeTableTrainer::EstimateSaving(
+    const VCDiffCodeTableData& table) const {
+  std::map<uint64_t, int> entries;
+  GetTableEntries(table, &entries);
+  uint64_t saving = 0;
+  for (InstructionCounts::const_iterator it = instruction_counts_.begin();
+       it != instruction_counts_.end(); ++it) {
+    if ((KeySize(it->first) != 0) &&
+        entries.count(MakePairKey(it->first, 0))) {
+      saving += it->second * SizeLength(it->first);
+    }
+  }
+  for (PairCounts::const_iterator it = pair_counts_.begin();
+       it != pair_counts_.end(); ++it) {
+    uint32_t first = FirstOfPair(it->first);
+    const uint32_t second = SecondOfPair(it->first);
+    if (!entries.count(MakePairKey(first, 0))) {
+      first = KeyWithoutSize(first);
+    }
+    if ((KeySize(second) != 0) && entries.count(MakePairKey(first, second))) {
+      saving += it->second *
+          (1 + (entries.count(MakePairKey(second, 0)) ? 0 : SizeLength(second)));
+    } else if (entries.count(MakePairKey(first, KeyWithoutSize(second)))) {
+      saving += it->second;
+    }
+  }
+  return saving;
+}
+
+// The opcodes are given greedily to the candidate that saves the most bytes,
+// given the opcodes chosen so far.  The saving of a candidate can only
+// decrease as others are chosen, so each one is only reevaluated when it
+// reaches the top of the queue.
+//
+// * An instruction with an implied size saves the bytes of that size.
+// * A pair with an implied second size saves the opcode of the second
+//   instruction, and its size unless that instruction has its own opcode.
+// * A pair followed by the second size saves the opcode of the second
+//   instruction, for every size that has no pair of its own.
+//
+// A pair can only be used after the opcode of its first instruction, so
+// pairs enter the queue once that opcode has been chosen; those of
+// instructions with a written size are available from the start.
+// Candidates seen fewer than kMinimumCount times are left out, and the
+// opcodes that remain are given to the entries of the default code table
+// (the one built for the cache sizes), which suit the instructions that the
+// corpus happened not to contain.
+//
+// Every entry that is also in the default code table keeps its opcode, so
+// that the table takes few bytes when it is embedded in a delta file.
+uint64_t CodeTableTrainer::BuildCodeTable(std::string* code_table) const {
+  static const uint64_t kMinimumCount = 2;
+  VCDiffCodeTableData default_table;
+  if (!GetBaseCodeTable(&default_table)) {
+    VCD_DFATAL << "Internal error: no code table for the cache sizes"
+               << VCD_ENDL;
+  }
+  const unsigned char max_mode =
+      static_cast<unsigned char>(near_cache_size_ + same_cache_size_ + 1);
+  // The opcodes that every code table needs.
+  std::set<uint64_t> chosen;
+  chosen.insert(MakePairKey(MakeInstructionKey(VCD_RUN, 0, 0), 0));
+  chosen.insert(MakePairKey(MakeInstructionKey(VCD_ADD, 0, 0), 0));
+  for (int mode = 0; mode <= max_mode; ++mode) {
+    chosen.insert(MakePairKey(
+        MakeInstructionKey(VCD_COPY, 0, static_cast<unsigned char>(mode)), 0));
+  }
+  // The number of pairs of each first instruction and type and mode of the
+  // second one, whatever its size.
+  PairCounts any_size_counts;
+  for (PairCounts::const_iterator it = pair_counts_.begin();
+       it != pair_counts_.end(); ++it) {
+    any_size_counts[MakePairKey(FirstOfPair(it->first),
+                                KeyWithoutSize(SecondOfPair(it->first)))] +=
+        it->second;
+  }
+  // For each pair followed by the second size, the count of the pairs with
+  // the same instructions and an implied size that were chosen.
+  PairCounts covered_counts;
+
+  typedef std::pair<uint64_t, uint64_t> Candidate;  // saving, ID
+  std::priority_queue<Candidate> queue;
+  for (InstructionCounts::const_iterator it = instruction_counts_.begin();
+       it != instruction_counts_.end(); ++it) {
+    if ((KeySize(it->first) != 0) && (it->second >= kMinimumCount)) {
+      queue.push(Candidate(it->second * SizeLength(it->first), it->first));
+    }
+  }
+  for (PairCounts::const_iterator it = pair_counts_.begin();
+       it != pair_counts_.end(); ++it) {
+    if ((KeySize(FirstOfPair(it->first)) == 0) &&
+        (KeySize(SecondOfPair(it->first)) != 0) &&
+        (it->second >= kMinimumCount)) {
+      queue.push(Candidate(PairSavingBound(it->second),
+                           it->first | kPairCandidate));
+    }
+  }
+  for (PairCounts::const_iterator it = any_size_counts.begin();
+       it != any_size_counts.end(); ++it) {
+    if ((KeySize(FirstOfPair(it->first)) == 0) &&
+        (it->second >= kMinimumCount)) {
+      queue.push(Candidate(PairSavingBound(it->second),
+                           it->first | kPairCandidate));
+    }
+  }
+
+  size_t free_opcodes = VCDiffCodeTableData::kCodeTableSize - chosen.size();
+  while ((free_opcodes > 0) && !queue.empty()) {
+    const Candidate top = queue.top();
+    queue.pop();
+    const bool is_pair = (top.second & kPairCandidate) != 0;
+    const PairKey pair = top.second & ~kPairCandidate;
+    uint64_t saving = top.first;
+    if (is_pair) {
+      const InstructionKey second = SecondOfPair(pair);
+      if (KeySize(second) != 0) {
+        saving = pair_counts_.find(pair)->second *
+            (1 + (chosen.count(MakePairKey(second, 0)) ? 0
+                                                      : SizeLength(second)));
+      } else {
+        PairCounts::const_iterator covered = covered_counts.find(pair);
+        saving = any_size_counts.find(pair)->second -
+            ((covered != covered_counts.end()) ? covered->second : 0);
+      }
+    }
+    if (saving < kMinimumCount) {
+      continue;
+    }
+    if (saving < top.first) {
+      queue.push(Candidate(saving, top.second));
+      continue;
+    }
+    --free_opcodes;
+    if (is_pair) {
+      chosen.insert(pair);
+      const InstructionKey second = SecondOfPair(pair);
+      if (KeySize(second) != 0) {
+        covered_counts[MakePairKey(FirstOfPair(pair),
+                                   KeyWithoutSize(second))] +=
+            pair_counts_.find(pair)->second;
+      }
+      continue;
+    }
+    const InstructionKey single = static_cast<InstructionKey>(top.second);
+    chosen.insert(MakePairKey(single, 0));
+    // The pairs that start with this instruction are contiguous.
+    for (PairCounts::const_iterator it =
+             pair_counts_.lower_bound(MakePairKey(single, 0));
+         (it != pair_counts_.end()) && (FirstOfPair(it->first) == single);
+         ++it) {
+      if ((KeySize(SecondOfPair(it->first)) != 0) &&
+          (it->second >= kMinimumCount)) {
+        queue.push(Candidate(PairSavingBound(it->second),
+                             it->first | kPairCandidate));
+      }
+    }
+    for (PairCounts::const_iterator it =
+             any_size_counts.lower_bound(MakePairKey(single, 0));
+         (it != any_size_counts.end()) && (FirstOfPair(it->first) == single);
+         ++it) {
+      if (it->second >= kMinimumCount) {
+        queue.push(Candidate(PairSavingBound(it->second),
+                             it->first | kPairCandidate));
+      }
+    }
+  }
+
+  // Fill the remaining opcodes from the default code table, and lay out the
+  // entries.  Unused opcodes are left as NOOP + NOOP.
+  std::map<uint64_t, int> default_entries;
+  GetTableEntries(default_table, &default_entries);
+  for (int opcode = 0; (opcode < VCDiffCodeTableData::kCodeTableSize) &&
+                       (free_opcodes > 0); ++opcode) {
+    const uint64_t entry = MakePairKey(
+        MakeInstructionKey(default_table.inst1[opcode],
+                           default_table.size1[opcode],
+                           default_table.mode1[opcode]),
+        MakeInstructionKey(default_table.inst2[opcode],
+                           default_table.size2[opcode],
+                           default_table.mode2[opcode]));
+    if (chosen.insert(entry).second) {
+      --free_opcodes;
+    }
+  }
+  VCDiffCodeTableData table;
+  memset(&table, 0, sizeof(table));
+  bool used[VCDiffCodeTableData::kCodeTableSize] = { false };
+  std::vector<uint64_t> unplaced;
+  for (std::set<uint64_t>::const_iterator it = chosen.begin();
+       it != chosen.end(); ++it) {
+    std::map<uint64_t, int>::const_iterator in_default =
+        default_entries.find(*it);
+    if (in_default == default_entries.end()) {
+      unplaced.push_back(*it);
+    } else {
+      used[in_default->second] = true;
+      SetTableEntry(*it, in_default->second, &table);
+    }
+  }
+  int opcode = 0;
+  for (size_t i = 0; i < unplaced.size(); ++i) {
+    while (used[opcode]) {
+      ++opcode;
+    }
+    used[opcode] = true;
+    SetTableEntry(unplaced[i], opcode, &table);
+  }
+  if (!table.Validate(max_mode)) {
+    VCD_DFATAL << "Internal error: trained code table is not valid"
+               << VCD_ENDL;
+  }
+  // The estimates are only comparable on the corpus itself.
+  const uint64_t trained_saving = EstimateSaving(table);
+  const uint64_t default_saving = EstimateSaving(default_table);
+  if (trained_saving <= default_saving) {
+    code_table->assign(reinterpret_cast<const char*>(&default_table),
+                       sizeof(default_table));
+    return 0;
+  }
+  code_table->assign(reinterpret_cast<const char*>(&table), sizeof(table));
+  return trained_saving - default_saving;
+}
+
+}  // namespace open_vcdiff
@@ -0,0 +1,271 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <config.h>
+#include "google/code_table_trainer.h"
+#include <stdlib.h>  // rand
+#include <string>
+#include <vector>
+#include "codetable.h"
+#include "testing.h"
+#include "google/output_string.h"
+#include "google/vcdecoder.h"
+#include "google/vcencoder.h"
+#include "unique_ptr.h"  // auto_ptr, unique_ptr
+
+namespace open_vcdiff {
+namespace {
+
+class CodeTableTrainerTest : public testing::Test {
+ protected:
+  typedef std::string string;
+
+  static const int kCorpusSize = 40;
+
+  CodeTableTrainerTest() {
+    srand(1);
+    for (int i = 0; i < 16 * 1024; ++i) {
+      dictionary_.push_back(static_cast<char>('a' + rand() % 26));
+    }
+    hashed_dictionary_.reset(
+        new HashedDictionary(dictionary_.data(), dictionary_.size()));
+    EXPECT_TRUE(hashed_dictionary_->Init());
+    // Records that copy 32 to 48 bytes of the dictionary at a time, with a
+    // few edited bytes in between: many small COPY/ADD pairs, whose sizes
+    // the default code table does not imply.
+    for (int i = 0; i < kCorpusSize; ++i) {
+      string target;
+      while (target.size() < 4096) {
+        const size_t size = 32 + rand() % 17;
+        target.append(dictionary_, rand() % (dictionary_.size() - size), size);
+        const int edited = 1 + rand() % 3;
+        for (int k = 0; k < edited; ++k) {
+          target.push_back(static_cast<char>('0' + rand() % 10));
+        }
+      }
+      corpus_.push_back(target);
+    }
+  }
+
+  // Trains on the first half of the corpus.
+  void Train(string* code_table) {
+    CodeTableTrainer trainer(hashed_dictionary_.get(), true);
+    for (int i = 0; i < kCorpusSize / 2; ++i) {
+      EXPECT_TRUE(trainer.AnalyzeTarget(corpus_[i].data(), corpus_[i].size()));
+    }
+    EXPECT_GT(trainer.BuildCodeTable(code_table), 0U);
+  }
+
+  // Returns false if the code table was not accepted.
+  bool Encode(const string& target,
+              const string* code_table,
+              bool embed_code_table,
+              VCDiffFormatExtensionFlags flags,
+              string* delta) {
+    VCDiffStreamingEncoder encoder(hashed_dictionary_.get(), flags, true);
+    if (code_table &&
+        !encoder.SetCodeTable(code_table->data(), code_table->size(),
+                              embed_code_table)) {
+      return false;
+    }
+    delta->clear();
+    EXPECT_TRUE(encoder.StartEncoding(delta));
+    EXPECT_TRUE(encoder.EncodeChunk(target.data(), target.size(), delta));
+    EXPECT_TRUE(encoder.FinishEncoding(delta));
+    return true;
+  }
+
+  bool Decode(const string& delta,
+              const string* known_code_table,
+              string* target) {
+    VCDiffStreamingDecoder decoder;
+    if (known_code_table) {
+      EXPECT_TRUE(decoder.SetKnownCodeTable(known_code_table->data(),
+                                            known_code_table->size()));
+    }
+    target->clear();
+    decoder.StartDecoding(dictionary_.data(), dictionary_.size());
+    return decoder.DecodeChunk(delta.data(), delta.size(), target) &&
+           decoder.FinishDecoding();
+  }
+
+  string dictionary_;
+  UNIQUE_PTR<HashedDictionary> hashed_dictionary_;
+  std::vector<string> corpus_;
+};
+
+TEST_F(CodeTableTrainerTest, NothingAnalyzedGivesTheDefaultTable) {
+  CodeTableTrainer trainer(hashed_dictionary_.get(), true);
+  string code_table;
+  EXPECT_EQ(0U, trainer.BuildCodeTable(&code_table));
+  EXPECT_EQ(string(reinterpret_cast<const char*>(
+                       &VCDiffCodeTableData::kDefaultCodeTableData),
+                   sizeof(VCDiffCodeTableData::kDefaultCodeTableData)),
+            code_table);
+  EXPECT_EQ(0U, trainer.instructions_recorded());
+}
+
+TEST_F(CodeTableTrainerTest, MeasuresTheSameDeltaAsTheEncoder) {
+  CodeTableTrainer trainer(hashed_dictionary_.get(), true);
+  EXPECT_TRUE(trainer.AnalyzeTarget(corpus_[0].data(), corpus_[0].size()));
+  string delta;
+  EXPECT_TRUE(Encode(corpus_[0], NULL, false, VCD_STANDARD_FORMAT, &delta));
+  EXPECT_EQ(1U, trainer.targets_analyzed());
+  EXPECT_EQ(corpus_[0].size(), trainer.total_target_size());
+  EXPECT_EQ(delta.size(), trainer.total_encoded_size());
+  EXPECT_GT(trainer.instructions_recorded(), 100U);
+}
+
+TEST_F(CodeTableTrainerTest, TrainedTableIsValid) {
+  string code_table;
+  Train(&code_table);
+  ASSERT_EQ(sizeof(VCDiffCodeTableData), code_table.size());
+  VCDiffCodeTableData table;
+  memcpy(&table, code_table.data(), code_table.size());
+  EXPECT_TRUE(table.Validate());
+}
+
+// The table is trained on one half of the corpus, and makes the deltas
+// of the other half smaller.
+TEST_F(CodeTableTrainerTest, TrainedTableMakesDeltasSmaller) {
+  string code_table;
+  Train(&code_table);
+  size_t default_size = 0;
+  size_t trained_size = 0;
+  size_t embedded_size = 0;
+  string delta, target;
+  for (int i = kCorpusSize / 2; i < kCorpusSize; ++i) {
+    EXPECT_TRUE(Encode(corpus_[i], NULL, false, VCD_STANDARD_FORMAT, &delta));
+    default_size += delta.size();
+    EXPECT_TRUE(Encode(corpus_[i], &code_table, false, VCD_STANDARD_FORMAT,
+                       &delta));
+    trained_size += delta.size();
+    EXPECT_TRUE(Decode(delta, &code_table, &target));
+    EXPECT_EQ(corpus_[i], target);
+    EXPECT_TRUE(Encode(corpus_[i], &code_table, true, VCD_STANDARD_FORMAT,
+                       &delta));
+    embedded_size += delta.size();
+    // Any decoder can read an embedded code table.
+    EXPECT_TRUE(Decode(delta, NULL, &target));
+    EXPECT_EQ(corpus_[i], target);
+  }
+  EXPECT_LT(trained_size, default_size * 9 / 10);
+  // The embedded table is encoded against the default one.
+  EXPECT_LT(embedded_size - trained_size,
+            (kCorpusSize / 2) * sizeof(VCDiffCodeTableData));
+}
+
+TEST_F(CodeTableTrainerTest, TrainedTableWorksWithFormatExtensions) {
+  string code_table;
+  Train(&code_table);
+  string delta, target;
+  EXPECT_TRUE(Encode(corpus_.back(), &code_table, false,
+                     VCD_FORMAT_INTERLEAVED | VCD_FORMAT_CHECKSUM, &delta));
+  EXPECT_TRUE(Decode(delta, &code_table, &target));
+  EXPECT_EQ(corpus_.back(), target);
+  EXPECT_TRUE(Encode(corpus_.back(), &code_table, true,
+                     VCD_FORMAT_INTERLEAVED, &delta));
+  EXPECT_TRUE(Decode(delta, NULL, &target));
+  EXPECT_EQ(corpus_.back(), target);
+}
+
+TEST_F(CodeTableTrainerTest, FingerprintMustMatchTheKnownTable) {
+  string code_table;
+  Train(&code_table);
+  string delta, target;
+  EXPECT_TRUE(Encode(corpus_.back(), &code_table, false, VCD_STANDARD_FORMAT,
+                     &delta));
+  EXPECT_FALSE(Decode(delta, NULL, &target));
+  const string default_table(
+      reinterpret_cast<const char*>(&VCDiffCodeTableData::kDefaultCodeTableData),
+      sizeof(VCDiffCodeTableData::kDefaultCodeTableData));
+  EXPECT_FALSE(Decode(delta, &default_table, &target));
+  // A known table does not affect delta files that use the default one.
+  EXPECT_TRUE(Encode(corpus_.back(), NULL, false, VCD_STANDARD_FORMAT, &delta));
+  EXPECT_TRUE(Decode(delta, &code_table, &target));
+  EXPECT_EQ(corpus_.back(), target);
+}
+
+TEST_F(CodeTableTrainerTest, DecoderGoesBackToTheDefaultTable) {
+  string code_table;
+  Train(&code_table);
+  string custom_delta, default_delta, target;
+  EXPECT_TRUE(Encode(corpus_[0], &code_table, true, VCD_STANDARD_FORMAT,
+                     &custom_delta));
+  EXPECT_TRUE(Encode(corpus_[1], NULL, false, VCD_STANDARD_FORMAT,
+                     &default_delta));
+  VCDiffDecoder decoder;
+  EXPECT_TRUE(decoder.Decode(dictionary_.data(), dictionary_.size(),
+                             custom_delta, &target));
+  EXPECT_EQ(corpus_[0], target);
+  EXPECT_TRUE(decoder.Decode(dictionary_.data(), dictionary_.size(),
+                             default_delta, &target));
+  EXPECT_EQ(corpus_[1], target);
+}
+
+TEST_F(CodeTableTrainerTest, TrainsForAddressCacheSizes) {
+  CodeTableTrainer trainer(hashed_dictionary_.get(), true);
+  EXPECT_TRUE(trainer.SetAddressCacheSizes(8, 3));
+  for (int i = 0; i < kCorpusSize / 2; ++i) {
+    EXPECT_TRUE(trainer.AnalyzeTarget(corpus_[i].data(), corpus_[i].size()));
+  }
+  EXPECT_FALSE(trainer.SetAddressCacheSizes(4, 3));
+  string code_table;
+  EXPECT_GT(trainer.BuildCodeTable(&code_table), 0U);
+  VCDiffCodeTableData table;
+  memcpy(&table, code_table.data(), code_table.size());
+  EXPECT_TRUE(table.Validate(8 + 3 + 1));
+  // The table has opcodes for modes that the default cache sizes lack.
+  EXPECT_FALSE(table.Validate());
+
+  VCDiffStreamingEncoder encoder(hashed_dictionary_.get(),
+                                 VCD_STANDARD_FORMAT, true);
+  EXPECT_FALSE(encoder.SetCodeTable(code_table.data(), code_table.size(),
+                                    false));
+  EXPECT_TRUE(encoder.SetAddressCacheSizes(8, 3));
+  EXPECT_TRUE(encoder.SetCodeTable(code_table.data(), code_table.size(),
+                                   false));
+  string delta, target;
+  EXPECT_TRUE(encoder.StartEncoding(&delta));
+  EXPECT_TRUE(encoder.EncodeChunk(corpus_.back().data(),
+                                  corpus_.back().size(), &delta));
+  EXPECT_TRUE(encoder.FinishEncoding(&delta));
+  EXPECT_TRUE(Decode(delta, &code_table, &target));
+  EXPECT_EQ(corpus_.back(), target);
+  // Going back to the default cache sizes requires a table for them.
+  EXPECT_FALSE(encoder.SetAddressCacheSizes(4, 3));
+}
+
+TEST_F(CodeTableTrainerTest, EncoderRejectsInvalidTables) {
+  string code_table;
+  Train(&code_table);
+  string delta;
+  EXPECT_FALSE(Encode(corpus_[0], &dictionary_, true, VCD_STANDARD_FORMAT,
+                      &delta));
+  // No opcode for ADD with an explicit size.
+  string no_add = code_table;
+  VCDiffCodeTableData* table = reinterpret_cast<VCDiffCodeTableData*>(
+      &no_add[0]);
+  for (int i = 0; i < VCDiffCodeTableData::kCodeTableSize; ++i) {
+    if ((table->inst1[i] == VCD_ADD) && (table->size1[i] == 0)) {
+      table->inst1[i] = VCD_RUN;
+    }
+  }
+  EXPECT_FALSE(Encode(corpus_[0], &no_add, true, VCD_STANDARD_FORMAT,
+                      &delta));
+  EXPECT_FALSE(Encode(corpus_[0], &code_table, true, VCD_FORMAT_JSON, &delta));
+}
+
+}  // anonymous namespace
+}  // namespace open_vcdiff
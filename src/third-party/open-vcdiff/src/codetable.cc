@@ -19,6 +19,7 @@
 //     The RFC text can be found at http://www.faqs.org/rfcs/rfc3284.html
 
 #include <config.h>
+#include <string.h>  // memset
 #include "addrcache.h"
 #include "codetable.h"
 #include "logging.h"
@@ -26,6 +27,33 @@
 
 namespace open_vcdiff {
 
+namespace {
+
+// Appends an entry to a code table that is being built, at *opcode.
+// Returns false if the table is full.
+bool AppendEntry(VCDiffCodeTableData* table,
+                 int* opcode,
+                 unsigned char inst1,
+                 unsigned char size1,
+                 unsigned char mode1,
+                 unsigned char inst2,
+                 unsigned char size2,
+                 unsigned char mode2) {
+  if (*opcode >= VCDiffCodeTableData::kCodeTableSize) {
+    return false;
+  }
+  table->inst1[*opcode] = inst1;
+  table->size1[*opcode] = size1;
+  table->mode1[*opcode] = mode1;
+  table->inst2[*opcode] = inst2;
+  table->size2[*opcode] = size2;
+  table->mode2[*opcode] = mode2;
+  ++*opcode;
+  return true;
+}
+
+}  // anonymous namespace
+
 const char* VCDiffInstructionName(VCDiffInstructionType inst) {
   switch (inst) {
     case VCD_NOOP:
@@ -275,4 +303,55 @@ bool VCDiffCodeTableData::Validate() const {
   return Validate(VCDiffAddressCache::DefaultLastMode());
 }
 
+bool VCDiffCodeTableData::BuildForCacheSizes(int near_cache_size,
+                                             int same_cache_size,
+                                             VCDiffCodeTableData* table) {
+  // RUN and ADD with size 0, then COPY with size 0 in every mode.
+  if ((near_cache_size < 0) || (same_cache_size < 0) ||
+      (near_cache_size > kCodeTableSize - 4 - same_cache_size)) {
+    VCD_ERROR << "No code table can hold the opcodes for near cache size "
+              << near_cache_size << " and same cache size "
+              << same_cache_size << VCD_ENDL;
+    return false;
+  }
+  const int modes = near_cache_size + same_cache_size + 2;
+  // SELF, HERE and the NEAR modes get ADD+COPY pairs of three sizes,
+  // the SAME modes of one size.
+  const int first_same_mode = near_cache_size + 2;
+  const int free_opcodes = kCodeTableSize - 2 - modes;
+  const int max_add_size = (free_opcodes < 17) ? free_opcodes : 17;
+  int copy_sizes = (kCodeTableSize - 2 - max_add_size) / modes - 1;
+  if (copy_sizes > 15) {
+    copy_sizes = 15;
+  }
+  memset(table, 0, sizeof(*table));
+  int opcode = 0;
+  AppendEntry(table, &opcode, VCD_RUN, 0, 0, VCD_NOOP, 0, 0);
+  for (int size = 0; size <= max_add_size; ++size) {
+    AppendEntry(table, &opcode, VCD_ADD, size, 0, VCD_NOOP, 0, 0);
+  }
+  for (int mode = 0; mode < modes; ++mode) {
+    AppendEntry(table, &opcode, VCD_COPY, 0, mode, VCD_NOOP, 0, 0);
+    for (int size = 4; size < 4 + copy_sizes; ++size) {
+      AppendEntry(table, &opcode, VCD_COPY, size, mode, VCD_NOOP, 0, 0);
+    }
+  }
+  // The pairs fill whatever opcodes remain, in order.
+  bool full = false;
+  for (int mode = 0; (mode < modes) && !full; ++mode) {
+    const int last_copy_size = (mode < first_same_mode) ? 6 : 4;
+    for (int add_size = 1; (add_size <= 4) && !full; ++add_size) {
+      for (int copy_size = 4; (copy_size <= last_copy_size) && !full;
+           ++copy_size) {
+        full = !AppendEntry(table, &opcode, VCD_ADD, add_size, 0,
+                            VCD_COPY, copy_size, mode);
+      }
+    }
+  }
+  for (int mode = 0; (mode < modes) && !full; ++mode) {
+    full = !AppendEntry(table, &opcode, VCD_COPY, 4, mode, VCD_ADD, 1, 0);
+  }
+  return true;
+}
+
 }  // namespace open_vcdiff
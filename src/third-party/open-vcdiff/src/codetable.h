@@ -89,6 +89,19 @@ struct VCDiffCodeTableData {
   // are being used, and calculates max_mode based on that assumption.
   bool Validate() const;
 
+  // Fills *table with a code table for the given address cache sizes, laid
+  // out like the default code table of RFC section 5.6: single ADDs of sizes
+  // 1 to 17, COPYs of sizes 4 to 18 in every mode, then ADD+COPY and
+  // COPY+ADD pairs, with fewer sizes when there are more modes than the
+  // default 9.  The result for the default cache sizes is the default code
+  // table.  Because the table only depends on the cache sizes, an encoder and
+  // a decoder that agree on those can build the same table independently.
+  // Returns false if the cache sizes are invalid, or if there are too many
+  // modes for every one to have an opcode.
+  static bool BuildForCacheSizes(int near_cache_size,
+                                 int same_cache_size,
+                                 VCDiffCodeTableData* table);
+
   // The names of these elements are taken from RFC 3284 section 5.4
   // (Instruction Codes), which contains the following specification:
   //
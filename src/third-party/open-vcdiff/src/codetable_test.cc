@@ -16,6 +16,7 @@
 
 #include <config.h>
 #include "codetable.h"
+#include <string.h>  // memcmp
 #include "addrcache.h"
 #include "testing.h"
 
@@ -249,5 +250,32 @@ TEST_F(CodeTableTest, ValidateExerciseCodeTable) {
   EXPECT_TRUE(g_exercise_code_table_->Validate(kLastExerciseMode));
 }
 
+TEST_F(CodeTableTest, BuildForDefaultCacheSizes) {
+  VCDiffCodeTableData table;
+  EXPECT_TRUE(VCDiffCodeTableData::BuildForCacheSizes(
+      VCDiffAddressCache::kDefaultNearCacheSize,
+      VCDiffAddressCache::kDefaultSameCacheSize,
+      &table));
+  EXPECT_EQ(0, memcmp(&table, &VCDiffCodeTableData::kDefaultCodeTableData,
+                      sizeof(table)));
+}
+
+TEST_F(CodeTableTest, BuildForOtherCacheSizes) {
+  VCDiffCodeTableData table;
+  EXPECT_TRUE(VCDiffCodeTableData::BuildForCacheSizes(8, 3, &table));
+  EXPECT_TRUE(table.Validate(8 + 3 + 1));
+  EXPECT_TRUE(VCDiffCodeTableData::BuildForCacheSizes(0, 0, &table));
+  EXPECT_TRUE(table.Validate(1));
+  EXPECT_TRUE(VCDiffCodeTableData::BuildForCacheSizes(100, 152, &table));
+  EXPECT_TRUE(table.Validate(253));
+}
+
+TEST_F(CodeTableTest, BuildForTooManyModes) {
+  VCDiffCodeTableData table;
+  EXPECT_FALSE(VCDiffCodeTableData::BuildForCacheSizes(100, 153, &table));
+  EXPECT_FALSE(VCDiffCodeTableData::BuildForCacheSizes(-1, 3, &table));
+  EXPECT_FALSE(VCDiffCodeTableData::BuildForCacheSizes(4, -1, &table));
+}
+
 }  // unnamed namespace
 }  // namespace open_vcdiff
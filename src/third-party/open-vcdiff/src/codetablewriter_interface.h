@@ -52,7 +52,8 @@ class CodeTableWriterInterface {
   virtual void WriteHeader(OutputStringInterface* out,
                            VCDiffFormatExtensionFlags format_extensions) = 0;
 
-  // Encode an ADD opcode with the "size" bytes starting at data
+  // Encode an ADD opcode with the "size" bytes starting at data.
+  // The data must remain valid until the next call to Output().
   virtual void Add(const char* data, size_t size) = 0;
 
   // Encode a COPY opcode with args "offset" (into dictionary) and "size" bytes.
@@ -89,24 +89,29 @@ VCDiffInstructionType VCDiffCodeTableReader::GetNextInstruction(
   // that was actually used in the encoding.  That case is unusual, but it
   // is not prohibited by the standard.
   } while (instruction_type == VCD_NOOP);
+  *mode = instruction_mode;
   if (instruction_size == 0) {
-    // Parse the size as a Varint in the instruction stream.
-    switch (*size = VarintBE<int32_t>::Parse(instructions_and_sizes_end_,
-                                             instructions_and_sizes_)) {
-      case RESULT_ERROR:
-        VCD_ERROR << "Instruction size is not a valid variable-length integer"
-                  << VCD_ENDL;
-        return VCD_INSTRUCTION_ERROR;
-      case RESULT_END_OF_DATA:
-        UnGetInstruction();  // Rewind to instruction start
-        return VCD_INSTRUCTION_END_OF_DATA;
-      default:
-        break;  // Successfully parsed Varint
-    }
-  } else {
-    *size = instruction_size;
+    return ParseInstructionSize(instruction_type, size);
+  }
+  *size = instruction_size;
+  return static_cast<VCDiffInstructionType>(instruction_type);
+}
+
+VCDiffInstructionType VCDiffCodeTableReader::ParseInstructionSize(
+    unsigned char instruction_type,
+    int32_t* size) {
+  switch (*size = VarintBE<int32_t>::Parse(instructions_and_sizes_end_,
+                                           instructions_and_sizes_)) {
+    case RESULT_ERROR:
+      VCD_ERROR << "Instruction size is not a valid variable-length integer"
+                << VCD_ENDL;
+      return VCD_INSTRUCTION_ERROR;
+    case RESULT_END_OF_DATA:
+      UnGetInstruction();  // Rewind to instruction start
+      return VCD_INSTRUCTION_END_OF_DATA;
+    default:
+      break;  // Successfully parsed Varint
   }
-  *mode = instruction_mode;
   return static_cast<VCDiffInstructionType>(instruction_type);
 }
 
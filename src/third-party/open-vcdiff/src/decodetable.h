@@ -51,6 +51,19 @@ class VCDiffCodeTableReader {
   bool UseCodeTable(const VCDiffCodeTableData& code_table_data,
                     unsigned char max_mode);
 
+  // Goes back to the default code table after UseCodeTable() was called,
+  // for the next delta file.
+  void UseDefaultCodeTable() {
+    code_table_data_ = &VCDiffCodeTableData::kDefaultCodeTableData;
+  }
+
+  // Returns true unless UseCodeTable() was called since the last call to
+  // UseDefaultCodeTable(), in which case the opcodes must be read with
+  // GetNextInstruction() rather than GetNextDefaultInstruction().
+  bool UsingDefaultCodeTable() const {
+    return code_table_data_ == &VCDiffCodeTableData::kDefaultCodeTableData;
+  }
+
   // Defines the buffer containing the instructions and sizes.
   // This method must be called before GetNextInstruction() may be used.
   // Init() may be called any number of times to reset the state of
@@ -98,6 +111,48 @@ class VCDiffCodeTableReader {
   //
   VCDiffInstructionType GetNextInstruction(int32_t* size, unsigned char* mode);
 
+  // Same as GetNextInstruction(), but only valid while UsingDefaultCodeTable()
+  // is true, and Init() has been called.  The opcodes are looked up in the
+  // constant kDefaultCodeTableData rather than through code_table_data_, and
+  // since no opcode of the default code table has VCD_NOOP as its first
+  // instruction, there is nothing to skip.  This is inlined into the decoder
+  // loop that DecodeBody() uses for the default code table.
+  //
+  VCDiffInstructionType GetNextDefaultInstruction(int32_t* size,
+                                                  unsigned char* mode) {
+    const VCDiffCodeTableData& code_table =
+        VCDiffCodeTableData::kDefaultCodeTableData;
+    last_instruction_start_ = *instructions_and_sizes_;
+    last_pending_second_instruction_ = pending_second_instruction_;
+    unsigned char instruction_type = VCD_NOOP;
+    unsigned char instruction_size = 0;
+    if (pending_second_instruction_ != kNoOpcode) {
+      const unsigned char opcode =
+          static_cast<unsigned char>(pending_second_instruction_);
+      pending_second_instruction_ = kNoOpcode;
+      instruction_type = code_table.inst2[opcode];
+      instruction_size = code_table.size2[opcode];
+      *mode = code_table.mode2[opcode];
+    } else {
+      if (*instructions_and_sizes_ >= instructions_and_sizes_end_) {
+        return VCD_INSTRUCTION_END_OF_DATA;
+      }
+      const unsigned char opcode = **instructions_and_sizes_;
+      if (code_table.inst2[opcode] != VCD_NOOP) {
+        pending_second_instruction_ = opcode;
+      }
+      ++(*instructions_and_sizes_);
+      instruction_type = code_table.inst1[opcode];
+      instruction_size = code_table.size1[opcode];
+      *mode = code_table.mode1[opcode];
+    }
+    if (instruction_size == 0) {
+      return ParseInstructionSize(instruction_type, size);
+    }
+    *size = instruction_size;
+    return static_cast<VCDiffInstructionType>(instruction_type);
+  }
+
   // Puts a single instruction back onto the front of the
   // instruction stream.  The next call to GetNextInstruction()
   // will return the same value that was returned by the last
@@ -122,6 +177,14 @@ class VCDiffCodeTableReader {
   }
 
  private:
+  // Parses the size of an instruction of the given type, whose opcode does
+  // not imply its size, as a Varint in the instruction stream.  Returns the
+  // instruction type, or VCD_INSTRUCTION_END_OF_DATA (after rewinding to the
+  // start of the instruction) or VCD_INSTRUCTION_ERROR.
+  //
+  VCDiffInstructionType ParseInstructionSize(unsigned char instruction_type,
+                                             int32_t* size);
+
   // A pointer to the code table.  This is the object that will be used
   // to interpret opcodes in GetNextInstruction().
   const VCDiffCodeTableData* code_table_data_;
@@ -386,6 +386,54 @@ TEST_F(DecodeTableTest, ReReadIncomplete) {
   EXPECT_EQ(&instructions_and_sizes_[4], instructions_and_sizes_ptr_);
 }
 
+TEST_F(DecodeTableTest, DefaultReaderMatchesGenericReader) {
+  const VCDiffCodeTableData& code_table =
+      VCDiffCodeTableData::kDefaultCodeTableData;
+  char* instruction_ptr = &instructions_and_sizes_[0];
+  for (int opcode = 0; opcode < VCDiffCodeTableData::kCodeTableSize; ++opcode) {
+    *instruction_ptr = opcode;
+    ++instruction_ptr;
+    if (code_table.size1[opcode] == 0) {
+      instruction_ptr += VarintBE<VCDAddress>::Encode(1000 + opcode,
+                                                      instruction_ptr);
+    }
+    if ((code_table.inst2[opcode] != VCD_NOOP) &&
+        (code_table.size2[opcode] == 0)) {
+      instruction_ptr += VarintBE<VCDAddress>::Encode(2000 + opcode,
+                                                      instruction_ptr);
+    }
+  }
+  // The last size is cut short, so that both readers must rewind to it.
+  const char* const instructions_end = instruction_ptr;
+  instruction_ptr[0] = 1;  // Add(0)
+  instruction_ptr[1] = static_cast<char>(0x81);
+  const char* generic_ptr = &instructions_and_sizes_[0];
+  VCDiffCodeTableReader generic_reader;
+  generic_reader.Init(&generic_ptr, instructions_end + 2);
+  reader_.Init(&instructions_and_sizes_ptr_, instructions_end + 2);
+  EXPECT_TRUE(reader_.UsingDefaultCodeTable());
+  VCDiffInstructionType found_inst = VCD_INSTRUCTION_ERROR;
+  do {
+    int32_t expected_size = 0;
+    unsigned char expected_mode = 0;
+    const VCDiffInstructionType expected_inst =
+        generic_reader.GetNextInstruction(&expected_size, &expected_mode);
+    found_inst = reader_.GetNextDefaultInstruction(&found_size_, &found_mode_);
+    EXPECT_EQ(expected_inst, found_inst);
+    EXPECT_EQ(generic_ptr, instructions_and_sizes_ptr_);
+    if (found_inst <= VCD_LAST_INSTRUCTION_TYPE) {
+      EXPECT_EQ(expected_size, found_size_);
+      EXPECT_EQ(expected_mode, found_mode_);
+    }
+  } while (found_inst <= VCD_LAST_INSTRUCTION_TYPE);
+  EXPECT_EQ(VCD_INSTRUCTION_END_OF_DATA, found_inst);
+  EXPECT_EQ(instructions_end, instructions_and_sizes_ptr_);
+  EXPECT_TRUE(reader_.UseCodeTable(*g_exercise_code_table_, kLastExerciseMode));
+  EXPECT_FALSE(reader_.UsingDefaultCodeTable());
+  reader_.UseDefaultCodeTable();
+  EXPECT_TRUE(reader_.UsingDefaultCodeTable());
+}
+
 TEST_F(DecodeTableTest, ExerciseCodeTableReader) {
   char* instruction_ptr = &instructions_and_sizes_[0];
   for (int opcode = 0; opcode < VCDiffCodeTableData::kCodeTableSize; ++opcode) {
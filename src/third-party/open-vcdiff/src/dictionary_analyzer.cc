@@ -0,0 +1,204 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <config.h>
+#include "google/dictionary_analyzer.h"
+#include <algorithm>  // std::min, std::sort
+#include "encodetable.h"
+#include "google/output_string.h"
+#include "google/vcencoder.h"
+#include "logging.h"
+#include "vcdiffengine.h"
+
+namespace open_vcdiff {
+
+namespace {
+
+// Orders granule indices by decreasing weight.  Equal weights keep the
+// dictionary order, so that the selection is deterministic.
+class HeavierGranule {
+ public:
+  explicit HeavierGranule(const std::vector<uint64_t>& weights)
+      : weights_(weights) { }
+
+  bool operator()(size_t a, size_t b) const {
+    if (weights_[a] != weights_[b]) {
+      return weights_[a] > weights_[b];
+    }
+    return a < b;
+  }
+
+ private:
+  const std::vector<uint64_t>& weights_;
+};
+
+}  // anonymous namespace
+
+// A VCDiffCodeTableWriter that reports every COPY from the dictionary
+// to the analyzer, so that the measured delta size is exactly what the
+// standard encoder would produce.
+class DictionaryAnalyzer::RecordingCodeTableWriter
+    : public VCDiffCodeTableWriter {
+ public:
+  explicit RecordingCodeTableWriter(DictionaryAnalyzer* analyzer)
+      : VCDiffCodeTableWriter(false),
+        analyzer_(analyzer),
+        dictionary_size_(0) { }
+
+  virtual bool Init(size_t dictionary_size) {
+    dictionary_size_ = dictionary_size;
+    return VCDiffCodeTableWriter::Init(dictionary_size);
+  }
+
+  virtual void Copy(int32_t offset, size_t size) {
+    // Matches found within the target have addresses past the dictionary.
+    if (static_cast<size_t>(offset) < dictionary_size_) {
+      analyzer_->RecordCopy(offset,
+                            std::min(size, dictionary_size_ - offset));
+    }
+    VCDiffCodeTableWriter::Copy(offset, size);
+  }
+
+ private:
+  DictionaryAnalyzer* const analyzer_;
+  size_t dictionary_size_;
+};
+
+DictionaryAnalyzer::DictionaryAnalyzer(const HashedDictionary* dictionary,
+                                       bool look_for_target_matches)
+    : dictionary_(dictionary),
+      look_for_target_matches_(look_for_target_matches),
+      used_(dictionary->engine()->dictionary_size(), false),
+      granule_weights_((dictionary->engine()->dictionary_size()
+                            + kGranuleSize - 1) / kGranuleSize, 0),
+      targets_analyzed_(0),
+      total_target_size_(0),
+      total_encoded_size_(0),
+      total_copied_size_(0) { }
+
+DictionaryAnalyzer::~DictionaryAnalyzer() { }
+
+size_t DictionaryAnalyzer::dictionary_size() const {
+  return used_.size();
+}
+
+size_t DictionaryAnalyzer::used_size() const {
+  return std::count(used_.begin(), used_.end(), true);
+}
+
+bool DictionaryAnalyzer::AnalyzeTarget(const char* target_data,
+                                       size_t target_size) {
+  const VCDiffEngine* engine = dictionary_->engine();
+  RecordingCodeTableWriter coder(this);
+  if (!coder.Init(engine->dictionary_size())) {
+    VCD_DFATAL << "Internal error: "
+                  "Initialization of code table writer failed" << VCD_ENDL;
+    return false;
+  }
+  if (!coder.VerifyChunk(target_data, target_size)) {
+    VCD_ERROR << "Target not valid for writer" << VCD_ENDL;
+    return false;
+  }
+  std::string delta;
+  OutputString<std::string> out(&delta);
+  coder.WriteHeader(&out, VCD_STANDARD_FORMAT);
+  engine->Encode(target_data, target_size, look_for_target_matches_, &out,
+                 &coder);
+  coder.FinishEncoding(&out);
+  ++targets_analyzed_;
+  total_target_size_ += target_size;
+  total_encoded_size_ += delta.size();
+  return true;
+}
+
+void DictionaryAnalyzer::RecordCopy(size_t offset, size_t size) {
+  const size_t end = offset + size;
+  std::fill(used_.begin() + offset, used_.begin() + end, true);
+  while (offset < end) {
+    const size_t granule = offset / kGranuleSize;
+    const size_t granule_end = std::min((granule + 1) * kGranuleSize, end);
+    granule_weights_[granule] += granule_end - offset;
+    offset = granule_end;
+  }
+  total_copied_size_ += size;
+}
+
+size_t DictionaryAnalyzer::GranuleUsedSize(size_t granule) const {
+  const size_t start = granule * kGranuleSize;
+  const size_t end = std::min(start + kGranuleSize, used_.size());
+  return std::count(used_.begin() + start, used_.begin() + end, true);
+}
+
+uint64_t DictionaryAnalyzer::SelectGranules(size_t max_size,
+                                            std::vector<bool>* keep) const {
+  std::vector<size_t> order;
+  for (size_t g = 0; g < granule_weights_.size(); ++g) {
+    if (granule_weights_[g] > 0) {
+      order.push_back(g);
+    }
+  }
+  std::sort(order.begin(), order.end(), HeavierGranule(granule_weights_));
+  keep->assign(granule_weights_.size(), false);
+  uint64_t dropped_weight = 0;
+  size_t kept_size = 0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    const size_t granule = order[i];
+    const size_t granule_size = GranuleUsedSize(granule);
+    if ((max_size == 0) || (kept_size + granule_size <= max_size)) {
+      (*keep)[granule] = true;
+      kept_size += granule_size;
+    } else {
+      dropped_weight += granule_weights_[granule];
+    }
+  }
+  return dropped_weight;
+}
+
+uint64_t DictionaryAnalyzer::EstimateEncodedSize(size_t max_size) const {
+  std::vector<bool> keep;
+  return total_encoded_size_ + SelectGranules(max_size, &keep);
+}
+
+size_t DictionaryAnalyzer::CompactDictionary(size_t max_size,
+                                             std::string* compacted) const {
+  const VCDiffEngine* engine = dictionary_->engine();
+  std::vector<bool> keep;
+  SelectGranules(max_size, &keep);
+  compacted->clear();
+  size_t granules_kept = 0;
+  for (size_t g = 0; g < keep.size(); ++g) {
+    if (!keep[g]) {
+      continue;
+    }
+    ++granules_kept;
+    // Append each run of used bytes within the granule.
+    const size_t end = std::min((g + 1) * kGranuleSize, used_.size());
+    size_t i = g * kGranuleSize;
+    while (i < end) {
+      if (!used_[i]) {
+        ++i;
+        continue;
+      }
+      size_t run_end = i + 1;
+      while ((run_end < end) && used_[run_end]) {
+        ++run_end;
+      }
+      engine->AppendDictionary(i, run_end - i, compacted);
+      i = run_end;
+    }
+  }
+  return granules_kept;
+}
+
+}  // namespace open_vcdiff
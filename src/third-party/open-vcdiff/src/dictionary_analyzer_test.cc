@@ -0,0 +1,147 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <config.h>
+#include "google/dictionary_analyzer.h"
+#include <stdlib.h>  // rand
+#include <string>
+#include "testing.h"
+#include "google/output_string.h"
+#include "google/vcdecoder.h"
+#include "google/vcencoder.h"
+#include "unique_ptr.h"  // auto_ptr, unique_ptr
+
+namespace open_vcdiff {
+namespace {
+
+class DictionaryAnalyzerTest : public testing::Test {
+ protected:
+  typedef std::string string;
+
+  DictionaryAnalyzerTest() {
+    // Three distinct 1KB regions.  The targets only use the first and
+    // the last one, the first one more heavily than the last.
+    srand(1);
+    for (int i = 0; i < 3 * 1024; ++i) {
+      dictionary_.push_back(static_cast<char>('a' + rand() % 26));
+    }
+    hot_ = dictionary_.substr(0, 1024);
+    warm_ = dictionary_.substr(2048, 1024);
+    hashed_dictionary_.reset(
+        new HashedDictionary(dictionary_.data(), dictionary_.size()));
+    EXPECT_TRUE(hashed_dictionary_->Init());
+  }
+
+  string Encode(const string& dictionary, const string& target) {
+    HashedDictionary hashed_dictionary(dictionary.data(), dictionary.size());
+    EXPECT_TRUE(hashed_dictionary.Init());
+    VCDiffStreamingEncoder encoder(&hashed_dictionary, VCD_STANDARD_FORMAT,
+                                   true);
+    string delta;
+    EXPECT_TRUE(encoder.StartEncoding(&delta));
+    EXPECT_TRUE(encoder.EncodeChunk(target.data(), target.size(), &delta));
+    EXPECT_TRUE(encoder.FinishEncoding(&delta));
+    return delta;
+  }
+
+  void AnalyzeCorpus(DictionaryAnalyzer* analyzer) {
+    EXPECT_TRUE(analyzer->AnalyzeTarget(hot_.data(), hot_.size()));
+    const string both = "header" + hot_ + "middle" + warm_.substr(0, 512);
+    EXPECT_TRUE(analyzer->AnalyzeTarget(both.data(), both.size()));
+  }
+
+  string dictionary_;
+  string hot_;
+  string warm_;
+  UNIQUE_PTR<HashedDictionary> hashed_dictionary_;
+};
+
+TEST_F(DictionaryAnalyzerTest, NothingAnalyzed) {
+  DictionaryAnalyzer analyzer(hashed_dictionary_.get(), true);
+  EXPECT_EQ(dictionary_.size(), analyzer.dictionary_size());
+  EXPECT_EQ(0U, analyzer.used_size());
+  EXPECT_EQ(0U, analyzer.targets_analyzed());
+  string compacted("garbage");
+  EXPECT_EQ(0U, analyzer.CompactDictionary(0, &compacted));
+  EXPECT_EQ("", compacted);
+}
+
+TEST_F(DictionaryAnalyzerTest, MeasuresTheSameDeltaAsTheEncoder) {
+  DictionaryAnalyzer analyzer(hashed_dictionary_.get(), true);
+  EXPECT_TRUE(analyzer.AnalyzeTarget(hot_.data(), hot_.size()));
+  EXPECT_EQ(1U, analyzer.targets_analyzed());
+  EXPECT_EQ(hot_.size(), analyzer.total_target_size());
+  EXPECT_EQ(Encode(dictionary_, hot_).size(), analyzer.total_encoded_size());
+  EXPECT_EQ(hot_.size(), analyzer.total_copied_size());
+  EXPECT_EQ(hot_.size(), analyzer.used_size());
+}
+
+TEST_F(DictionaryAnalyzerTest, CompactDictionaryDropsUnusedRegions) {
+  DictionaryAnalyzer analyzer(hashed_dictionary_.get(), true);
+  AnalyzeCorpus(&analyzer);
+  EXPECT_EQ(hot_.size() + 512, analyzer.used_size());
+  string compacted;
+  analyzer.CompactDictionary(0, &compacted);
+  EXPECT_EQ(hot_ + warm_.substr(0, 512), compacted);
+  // Nothing is lost by dropping the unused region.
+  EXPECT_EQ(analyzer.total_encoded_size(),
+            analyzer.EstimateEncodedSize(0));
+  EXPECT_EQ(analyzer.total_encoded_size(),
+            analyzer.EstimateEncodedSize(compacted.size()));
+}
+
+TEST_F(DictionaryAnalyzerTest, CompactDictionaryKeepsHottestGranules) {
+  DictionaryAnalyzer analyzer(hashed_dictionary_.get(), true);
+  AnalyzeCorpus(&analyzer);
+  string compacted;
+  EXPECT_EQ(hot_.size() / DictionaryAnalyzer::kGranuleSize,
+            analyzer.CompactDictionary(hot_.size(), &compacted));
+  EXPECT_EQ(hot_, compacted);
+  EXPECT_EQ(analyzer.total_encoded_size() + 512,
+            analyzer.EstimateEncodedSize(hot_.size()));
+  EXPECT_LT(analyzer.EstimateEncodedSize(hot_.size()),
+            analyzer.EstimateEncodedSize(hot_.size() / 2));
+}
+
+TEST_F(DictionaryAnalyzerTest, CompactedDictionaryStillEncodesCorpus) {
+  DictionaryAnalyzer analyzer(hashed_dictionary_.get(), true);
+  AnalyzeCorpus(&analyzer);
+  string compacted;
+  analyzer.CompactDictionary(0, &compacted);
+  EXPECT_GE(Encode(dictionary_, hot_).size(),
+            Encode(compacted, hot_).size());
+  VCDiffDecoder decoder;
+  string result;
+  EXPECT_TRUE(decoder.Decode(compacted.data(), compacted.size(),
+                             Encode(compacted, hot_), &result));
+  EXPECT_EQ(hot_, result);
+}
+
+TEST_F(DictionaryAnalyzerTest, IgnoresTargetMatches) {
+  DictionaryAnalyzer analyzer(hashed_dictionary_.get(), true);
+  // The dictionary has no upper-case letters, so the second half of the
+  // target can only be copied from the first half.
+  string unique;
+  for (int i = 0; i < 100; ++i) {
+    unique.push_back(static_cast<char>('A' + rand() % 26));
+  }
+  const string repeated = unique + unique;
+  EXPECT_TRUE(analyzer.AnalyzeTarget(repeated.data(), repeated.size()));
+  EXPECT_LT(analyzer.total_encoded_size(), repeated.size());
+  EXPECT_EQ(0U, analyzer.total_copied_size());
+  EXPECT_EQ(0U, analyzer.used_size());
+}
+
+}  // anonymous namespace
+}  // namespace open_vcdiff
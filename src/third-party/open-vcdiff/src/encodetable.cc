@@ -16,6 +16,7 @@
 #include <limits.h>  // UCHAR_MAX
 #include <string>
 #include "addrcache.h"
+#include "checksum.h"
 #include "codetable.h"
 #include "encodetable.h"
 #include "instruction_map.h"
@@ -55,9 +56,11 @@ static const DeltaFileHeader kHeaderExtendedFormat = {
 //
 VCDiffCodeTableWriter::VCDiffCodeTableWriter(bool interleaved)
     : max_mode_(VCDiffAddressCache::DefaultLastMode()),
+      deferred_add_size_(0),
       dictionary_size_(0),
       target_length_(0),
       code_table_data_(&VCDiffCodeTableData::kDefaultCodeTableData),
+      use_code_table_fingerprint_(false),
       instruction_map_(NULL),
       last_opcode_index_(-1),
       add_checksum_(false),
@@ -72,10 +75,12 @@ VCDiffCodeTableWriter::VCDiffCodeTableWriter(
     const VCDiffCodeTableData& code_table_data,
     unsigned char max_mode)
     : max_mode_(max_mode),
+      deferred_add_size_(0),
       address_cache_(near_cache_size, same_cache_size),
       dictionary_size_(0),
       target_length_(0),
       code_table_data_(&code_table_data),
+      use_code_table_fingerprint_(false),
       instruction_map_(NULL),
       last_opcode_index_(-1),
       add_checksum_(false),
@@ -122,17 +127,79 @@ bool VCDiffCodeTableWriter::Init(size_t dictionary_size) {
 void VCDiffCodeTableWriter::WriteHeader(
     OutputStringInterface* out,
     VCDiffFormatExtensionFlags format_extensions) {
-  if (format_extensions == VCD_STANDARD_FORMAT) {
-    out->append(reinterpret_cast<const char*>(&kHeaderStandardFormat),
-                sizeof(kHeaderStandardFormat));
+  const bool custom_code_table =
+      (code_table_data_ != &VCDiffCodeTableData::kDefaultCodeTableData) ||
+      (address_cache_.near_cache_size() !=
+          VCDiffAddressCache::kDefaultNearCacheSize) ||
+      (address_cache_.same_cache_size() !=
+          VCDiffAddressCache::kDefaultSameCacheSize);
+  const bool fingerprint = custom_code_table && use_code_table_fingerprint_;
+  DeltaFileHeader header = (format_extensions == VCD_STANDARD_FORMAT) &&
+                           !fingerprint ? kHeaderStandardFormat
+                                        : kHeaderExtendedFormat;
+  if (custom_code_table) {
+    header.hdr_indicator = fingerprint ? VCD_CODETABLE_FINGERPRINT
+                                       : VCD_CODETABLE;
+  }
+  out->append(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!custom_code_table) {
+    return;
+  }
+  AppendSizeToOutputString(address_cache_.near_cache_size(), out);
+  AppendSizeToOutputString(address_cache_.same_cache_size(), out);
+  if (fingerprint) {
+    // As for the window checksum, use a 64-bit signed integer to store
+    // the 32-bit unsigned checksum.
+    const VCDChecksum code_table_checksum =
+        ComputeAdler32(reinterpret_cast<const char*>(code_table_data_),
+                       sizeof(*code_table_data_));
+    VarintBE<int64_t>::AppendToOutputString(
+        static_cast<int64_t>(code_table_checksum), out);
   } else {
-    out->append(reinterpret_cast<const char*>(&kHeaderExtendedFormat),
-                sizeof(kHeaderExtendedFormat));
+    string encoded_code_table;
+    EncodeCodeTable(&encoded_code_table);
+    out->append(encoded_code_table.data(), encoded_code_table.size());
+  }
+}
+
+void VCDiffCodeTableWriter::EncodeCodeTable(string* out) const {
+  // Runs of unchanged bytes shorter than this are cheaper to ADD than to COPY.
+  static const size_t kMinimumCopySize = 4;
+  const char* const default_table =
+      reinterpret_cast<const char*>(&VCDiffCodeTableData::kDefaultCodeTableData);
+  const char* const table = reinterpret_cast<const char*>(code_table_data_);
+  const size_t table_size = sizeof(*code_table_data_);
+  VCDiffCodeTableWriter coder(false);
+  if (!coder.Init(table_size)) {
+    VCD_DFATAL << "Internal error: "
+                  "Initialization of code table writer failed" << VCD_ENDL;
+    return;
+  }
+  OutputString<string> output(out);
+  coder.WriteHeader(&output, VCD_STANDARD_FORMAT);
+  size_t add_start = 0;
+  size_t pos = 0;
+  while (pos < table_size) {
+    size_t same_end = pos;
+    while ((same_end < table_size) &&
+           (table[same_end] == default_table[same_end])) {
+      ++same_end;
+    }
+    if ((same_end - pos >= kMinimumCopySize) || (same_end == table_size)) {
+      if (pos > add_start) {
+        coder.Add(table + add_start, pos - add_start);
+      }
+      if (same_end > pos) {
+        coder.Copy(static_cast<int32_t>(pos), same_end - pos);
+      }
+      add_start = same_end;
+    }
+    pos = (same_end > pos) ? same_end : pos + 1;
   }
-  // If custom cache table sizes or a custom code table were used
-  // for encoding, here is where they would be appended to *output.
-  // This implementation of the encoder does not use those features,
-  // although the decoder can understand and interpret them.
+  if (table_size > add_start) {
+    coder.Add(table + add_start, table_size - add_start);
+  }
+  coder.Output(&output);
 }
 
 // The VCDiff format allows each opcode to represent either
@@ -238,37 +305,6 @@ void VCDiffCodeTableWriter::EncodeInstruction(VCDiffInstructionType inst,
   AppendSizeToString(size, &instructions_and_sizes_);
 }
 
-void VCDiffCodeTableWriter::Add(const char* data, size_t size) {
-  EncodeInstruction(VCD_ADD, size);
-  data_for_add_and_run_->append(data, size);
-  target_length_ += size;
-}
-
-void VCDiffCodeTableWriter::Copy(int32_t offset, size_t size) {
-  if (!instruction_map_) {
-    VCD_DFATAL << "VCDiffCodeTableWriter::Copy() called without calling Init()"
-               << VCD_ENDL;
-    return;
-  }
-  // If a single interleaved stream of encoded values is used
-  // instead of separate sections for instructions, addresses, and data,
-  // then the string instructions_and_sizes_ may be the same as
-  // addresses_for_copy_.  The address should therefore be encoded
-  // *after* the instruction and its size.
-  int32_t encoded_addr = 0;
-  const unsigned char mode = address_cache_.EncodeAddress(
-      offset,
-      static_cast<VCDAddress>(dictionary_size_ + target_length_),
-      &encoded_addr);
-  EncodeInstruction(VCD_COPY, size, mode);
-  if (address_cache_.WriteAddressAsVarintForMode(mode)) {
-    VarintBE<int32_t>::AppendToString(encoded_addr, addresses_for_copy_);
-  } else {
-    addresses_for_copy_->push_back(static_cast<unsigned char>(encoded_addr));
-  }
-  target_length_ += size;
-}
-
 void VCDiffCodeTableWriter::Run(size_t size, unsigned char byte) {
   EncodeInstruction(VCD_RUN, size);
   data_for_add_and_run_->push_back(byte);
@@ -289,18 +325,43 @@ void VCDiffCodeTableWriter::AppendSizeToOutputString(
   VarintBE<int32_t>::AppendToOutputString(static_cast<int32_t>(size), out);
 }
 
+size_t VCDiffCodeTableWriter::SectionSize(const string& section) const {
+  if (&section == data_for_add_and_run_) {
+    return section.size() + deferred_add_size_;
+  }
+  return section.size();
+}
+
+void VCDiffCodeTableWriter::AppendSectionToOutputString(
+    const string& section,
+    OutputStringInterface* out) const {
+  size_t section_pos = 0;
+  if (&section == data_for_add_and_run_) {
+    for (std::vector<DeferredAdd>::const_iterator it = deferred_adds_.begin();
+         it != deferred_adds_.end(); ++it) {
+      out->append(section.data() + section_pos, it->position - section_pos);
+      out->append(it->data, it->size);
+      section_pos = it->position;
+    }
+  }
+  out->append(section.data() + section_pos, section.size() - section_pos);
+}
+
 // This calculation must match the items added between "Start of Delta Encoding"
 // and "End of Delta Encoding" in Output(), below.
 size_t VCDiffCodeTableWriter::CalculateLengthOfTheDeltaEncoding() const {
+  const size_t data_size = SectionSize(separate_data_for_add_and_run_);
+  const size_t instructions_size = SectionSize(instructions_and_sizes_);
+  const size_t addresses_size = SectionSize(separate_addresses_for_copy_);
   size_t length_of_the_delta_encoding =
     CalculateLengthOfSizeAsVarint(target_length_) +
     1 +  // Delta_Indicator
-    CalculateLengthOfSizeAsVarint(separate_data_for_add_and_run_.size()) +
-    CalculateLengthOfSizeAsVarint(instructions_and_sizes_.size()) +
-    CalculateLengthOfSizeAsVarint(separate_addresses_for_copy_.size()) +
-    separate_data_for_add_and_run_.size() +
-    instructions_and_sizes_.size() +
-    separate_addresses_for_copy_.size();
+    CalculateLengthOfSizeAsVarint(data_size) +
+    CalculateLengthOfSizeAsVarint(instructions_size) +
+    CalculateLengthOfSizeAsVarint(addresses_size) +
+    data_size +
+    instructions_size +
+    addresses_size;
   if (add_checksum_) {
     length_of_the_delta_encoding +=
         VarintBE<int64_t>::Length(static_cast<int64_t>(checksum_));
@@ -343,21 +404,18 @@ void VCDiffCodeTableWriter::Output(OutputStringInterface* out) {
     const size_t size_before_delta_encoding = out->size();
     AppendSizeToOutputString(target_length_, out);
     out->push_back(0x00);  // Delta_Indicator: no compression
-    AppendSizeToOutputString(separate_data_for_add_and_run_.size(), out);
-    AppendSizeToOutputString(instructions_and_sizes_.size(), out);
-    AppendSizeToOutputString(separate_addresses_for_copy_.size(), out);
+    AppendSizeToOutputString(SectionSize(separate_data_for_add_and_run_), out);
+    AppendSizeToOutputString(SectionSize(instructions_and_sizes_), out);
+    AppendSizeToOutputString(SectionSize(separate_addresses_for_copy_), out);
     if (add_checksum_) {
       // The checksum is a 32-bit *unsigned* integer.  VarintBE requires a
       // signed type, so use a 64-bit signed integer to store the checksum.
       VarintBE<int64_t>::AppendToOutputString(static_cast<int64_t>(checksum_),
                                               out);
     }
-    out->append(separate_data_for_add_and_run_.data(),
-                separate_data_for_add_and_run_.size());
-    out->append(instructions_and_sizes_.data(),
-                instructions_and_sizes_.size());
-    out->append(separate_addresses_for_copy_.data(),
-                separate_addresses_for_copy_.size());
+    AppendSectionToOutputString(separate_data_for_add_and_run_, out);
+    AppendSectionToOutputString(instructions_and_sizes_, out);
+    AppendSectionToOutputString(separate_addresses_for_copy_, out);
     // End of Delta Encoding
     const size_t size_after_delta_encoding = out->size();
     if (length_of_the_delta_encoding !=
@@ -371,6 +429,8 @@ void VCDiffCodeTableWriter::Output(OutputStringInterface* out) {
     separate_data_for_add_and_run_.clear();
     instructions_and_sizes_.clear();
     separate_addresses_for_copy_.clear();
+    deferred_adds_.clear();
+    deferred_add_size_ = 0;
     if (target_length_ == 0) {
       VCD_WARNING << "Empty target window" << VCD_ENDL;
     }
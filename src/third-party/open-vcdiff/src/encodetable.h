@@ -19,10 +19,13 @@
 #include <stddef.h>  // size_t
 #include <stdint.h>  // int32_t
 #include <string>
+#include <vector>
 #include "addrcache.h"
 #include "checksum.h"
 #include "codetable.h"
 #include "codetablewriter_interface.h"
+#include "logging.h"
+#include "varint_bigendian.h"
 
 namespace open_vcdiff {
 
@@ -37,7 +40,8 @@ class VCDiffInstructionMap;
 // (as defined in RFC 3284 section 4.3) will have been appended to
 // out (unless no calls to Add, Run, or Copy were made, in which
 // case Output will do nothing.)  The output will not be available for use
-// until after each call to Output().
+// until after each call to Output().  The data passed to Add() is not
+// necessarily copied, and must remain valid until the next call to Output().
 //
 // NOT threadsafe.
 //
@@ -72,6 +76,17 @@ class VCDiffCodeTableWriter : public CodeTableWriterInterface {
 
   virtual ~VCDiffCodeTableWriter();
 
+  // By default, WriteHeader() writes a non-standard code table into the
+  // header of the delta file as described in section 7 of the RFC, encoded
+  // as a delta against the default code table, so that any decoder can read
+  // it.  After this call, WriteHeader() only writes the Adler32 checksum of
+  // the code table (VCD_CODETABLE_FINGERPRINT) instead, and the decoder must
+  // have been given the same code table in advance.  This requires the
+  // extended ('S') format, which WriteHeader() then uses regardless of the
+  // format_extensions it is given.  No effect when the default code table
+  // and cache sizes are used.
+  void UseCodeTableFingerprint() { use_code_table_fingerprint_ = true; }
+
   // Initializes the constructed object for use.
   // This method must be called after a VCDiffCodeTableWriter is constructed
   // and before any of its other methods can be called.  It will return
@@ -83,7 +98,8 @@ class VCDiffCodeTableWriter : public CodeTableWriterInterface {
 
   // Write the header (as defined in section 4.1 of the RFC) to *out.
   // This includes information that can be gathered
-  // before the first chunk of input is available.
+  // before the first chunk of input is available, such as a non-standard
+  // code table and cache sizes.
   virtual void WriteHeader(OutputStringInterface* out,
                            VCDiffFormatExtensionFlags format_extensions);
 
@@ -135,6 +151,12 @@ class VCDiffCodeTableWriter : public CodeTableWriterInterface {
   //
   void InitSectionPointers(bool interleaved);
 
+  // Appends the VCDIFF encoding of *code_table_data_, using the default code
+  // table as the dictionary, to *out, in the form that section 7 of the RFC
+  // prescribes for the header of a delta file.  Bytes that are unchanged from
+  // the default code table are COPYed, and the others are ADDed.
+  void EncodeCodeTable(string* out) const;
+
   // Determines the best opcode to encode an instruction, and appends
   // or substitutes that opcode and its size into the
   // instructions_and_sizes_ string.
@@ -162,6 +184,31 @@ class VCDiffCodeTableWriter : public CodeTableWriterInterface {
   // elements.
   size_t CalculateLengthOfTheDeltaEncoding() const;
 
+  // Returns the size that the given section string will have in the delta
+  // window, including the data of the deferred ADDs that belong to it.
+  size_t SectionSize(const string& section) const;
+
+  // Appends the given section string to *out, inserting the data of the
+  // deferred ADDs that belong to it at their positions.
+  void AppendSectionToOutputString(const string& section,
+                                   OutputStringInterface* out) const;
+
+  // ADDs of at least this many bytes are not copied into the data section,
+  // but straight from the target into the output string.  Smaller ones are
+  // cheaper to copy twice than to keep track of.
+  static const size_t kMinimumDeferredAddSize = 32;
+
+  // The data of an ADD instruction that was not appended to
+  // *data_for_add_and_run_ by Add(), and which Output() copies directly
+  // from the target into the output string instead, so that large ADDs
+  // are copied only once.
+  struct DeferredAdd {
+    // The position within *data_for_add_and_run_ at which the data belongs.
+    size_t position;
+    const char* data;
+    size_t size;
+  };
+
   // None of the following 'string' objects are null-terminated.
 
   // A series of instruction opcodes, each of which may be followed
@@ -184,6 +231,14 @@ class VCDiffCodeTableWriter : public CodeTableWriterInterface {
   string *addresses_for_copy_;
   string separate_addresses_for_copy_;
 
+  // The ADDs of the current window whose data has not been copied into
+  // *data_for_add_and_run_, in order, and the total size of their data.
+  // Like the strings above, this keeps its capacity from one window to the
+  // next, so that encoding a window does not allocate memory once the
+  // writer has encoded a window of similar size.
+  std::vector<DeferredAdd> deferred_adds_;
+  size_t deferred_add_size_;
+
   VCDiffAddressCache address_cache_;
 
   size_t dictionary_size_;
@@ -198,6 +253,9 @@ class VCDiffCodeTableWriter : public CodeTableWriterInterface {
 
   const VCDiffCodeTableData* code_table_data_;
 
+  // Set by UseCodeTableFingerprint().
+  bool use_code_table_fingerprint_;
+
   // The instruction map facilitates finding an opcode quickly given an
   // instruction inst, size, and mode.  This is an alternate representation
   // of the same information that is found in code_table_data_.
@@ -236,6 +294,48 @@ class VCDiffCodeTableWriter : public CodeTableWriterInterface {
   void operator=(const VCDiffCodeTableWriter&);
 };
 
+// Add() and Copy() are defined here so that VCDiffEngine can inline them
+// into its match loop; please see VCDiffEngine::EncodeToVCDiffWriter().
+
+inline void VCDiffCodeTableWriter::Add(const char* data, size_t size) {
+  EncodeInstruction(VCD_ADD, size);
+  if (size < kMinimumDeferredAddSize) {
+    data_for_add_and_run_->append(data, size);
+  } else {
+    const DeferredAdd deferred_add = { data_for_add_and_run_->size(),
+                                       data,
+                                       size };
+    deferred_adds_.push_back(deferred_add);
+    deferred_add_size_ += size;
+  }
+  target_length_ += size;
+}
+
+inline void VCDiffCodeTableWriter::Copy(int32_t offset, size_t size) {
+  if (!instruction_map_) {
+    VCD_DFATAL << "VCDiffCodeTableWriter::Copy() called without calling Init()"
+               << VCD_ENDL;
+    return;
+  }
+  // If a single interleaved stream of encoded values is used
+  // instead of separate sections for instructions, addresses, and data,
+  // then the string instructions_and_sizes_ may be the same as
+  // addresses_for_copy_.  The address should therefore be encoded
+  // *after* the instruction and its size.
+  int32_t encoded_addr = 0;
+  const unsigned char mode = address_cache_.EncodeAddress(
+      offset,
+      static_cast<VCDAddress>(dictionary_size_ + target_length_),
+      &encoded_addr);
+  EncodeInstruction(VCD_COPY, size, mode);
+  if (address_cache_.WriteAddressAsVarintForMode(mode)) {
+    VarintBE<int32_t>::AppendToString(encoded_addr, addresses_for_copy_);
+  } else {
+    addresses_for_copy_->push_back(static_cast<unsigned char>(encoded_addr));
+  }
+  target_length_ += size;
+}
+
 };  // namespace open_vcdiff
 
 #endif  // OPEN_VCDIFF_ENCODETABLE_H_
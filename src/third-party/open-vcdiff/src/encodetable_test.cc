@@ -400,6 +400,69 @@ TEST_F(CodeTableWriterTest, InterleavedWriterEncodeComboWithChecksum) {
   ExpectNoMoreBytes();
 }
 
+// ADDs as large as this one are copied into the output only by Output().
+static const char kLargeAdd[] = "0123456789012345678901234567890123456789";
+
+TEST_F(CodeTableWriterTest, StandardWriterEncodeLargeAdd) {
+  // Encode the same window twice, to check that nothing is left behind.
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(standard_writer.Init(0x11));
+    standard_writer.Add(kLargeAdd, 40);
+    standard_writer.Copy(2, 5);
+    standard_writer.Run(3, 'z');
+    standard_writer.Add("X", 1);
+    standard_writer.Output(&output_string);
+    ExpectByte(VCD_SOURCE);  // Win_Indicator: VCD_SOURCE (dictionary)
+    ExpectByte(0x11);  // Source segment size: dictionary length
+    ExpectByte(0x00);  // Source segment position: start of dictionary
+    ExpectByte(0x36);  // Length of the delta encoding
+    ExpectByte(0x31);  // Size of the target window
+    ExpectByte(0x00);  // Delta_indicator (no compression)
+    ExpectByte(0x2A);  // length of data for ADDs and RUNs
+    ExpectByte(0x06);  // length of instructions section
+    ExpectByte(0x01);  // length of addresses for COPYs
+    ExpectString(kLargeAdd);
+    ExpectString("zX");
+    ExpectByte(0x01);  // ADD size 0
+    ExpectByte(0x28);  // Size of ADD (40)
+    ExpectByte(0x15);  // COPY mode SELF, size 5
+    ExpectByte(0x00);  // RUN size 0
+    ExpectByte(0x03);  // Size of RUN (3)
+    ExpectByte(0x02);  // ADD size 1
+    ExpectByte(0x02);  // COPY address (2)
+  }
+  ExpectNoMoreBytes();
+}
+
+TEST_F(CodeTableWriterTest, InterleavedWriterEncodeLargeAdd) {
+  EXPECT_TRUE(interleaved_writer.Init(0x11));
+  interleaved_writer.Add(kLargeAdd, 40);
+  interleaved_writer.Copy(2, 5);
+  interleaved_writer.Run(3, 'z');
+  interleaved_writer.Add("X", 1);
+  interleaved_writer.Output(&output_string);
+  ExpectByte(VCD_SOURCE);  // Win_Indicator: VCD_SOURCE (dictionary)
+  ExpectByte(0x11);  // Source segment size: dictionary length
+  ExpectByte(0x00);  // Source segment position: start of dictionary
+  ExpectByte(0x36);  // Length of the delta encoding
+  ExpectByte(0x31);  // Size of the target window
+  ExpectByte(0x00);  // Delta_indicator (no compression)
+  ExpectByte(0x00);  // length of data for ADDs and RUNs
+  ExpectByte(0x31);  // length of instructions section
+  ExpectByte(0x00);  // length of addresses for COPYs
+  ExpectByte(0x01);  // ADD size 0
+  ExpectByte(0x28);  // Size of ADD (40)
+  ExpectString(kLargeAdd);
+  ExpectByte(0x15);  // COPY mode SELF, size 5
+  ExpectByte(0x02);  // COPY address (2)
+  ExpectByte(0x00);  // RUN size 0
+  ExpectByte(0x03);  // Size of RUN (3)
+  ExpectByte('z');
+  ExpectByte(0x02);  // ADD size 1
+  ExpectByte('X');
+  ExpectNoMoreBytes();
+}
+
 TEST_F(CodeTableWriterTest, ReallyBigDictionary) {
   EXPECT_TRUE(interleaved_writer.Init(0x3FFFFFFF));
   interleaved_writer.Copy(2, 8);
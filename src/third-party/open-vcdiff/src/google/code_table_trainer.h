@@ -0,0 +1,137 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OPEN_VCDIFF_CODE_TABLE_TRAINER_H_
+#define OPEN_VCDIFF_CODE_TABLE_TRAINER_H_
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t, uint64_t
+#include <map>
+#include <string>
+
+namespace open_vcdiff {
+
+class HashedDictionary;
+struct VCDiffCodeTableData;
+
+// Builds a code table that suits the deltas of a corpus of targets better
+// than the default code table of RFC 3284.
+//
+// Each target passed to AnalyzeTarget() is encoded against the dictionary
+// exactly as VCDiffStreamingEncoder would encode it, and the type, size and
+// address mode of every instruction are counted, as well as those of every
+// pair of consecutive instructions.  BuildCodeTable() then gives the
+// single-byte opcodes to the instructions whose sizes cost the most bytes
+// in the deltas of the corpus, and to the most common pairs, so that the
+// size of those no longer has to be written, or two instructions share one
+// opcode.  The result can be passed to VCDiffStreamingEncoder::SetCodeTable().
+//
+// Usage:
+//   CodeTableTrainer trainer(&hashed_dictionary, true);
+//   for (each target in corpus) {
+//     if (!trainer.AnalyzeTarget(target.data(), target.size())) { ... }
+//   }
+//   std::string code_table;
+//   trainer.BuildCodeTable(&code_table);
+//
+class CodeTableTrainer {
+ public:
+  // The HashedDictionary object must remain valid for the lifetime of the
+  // CodeTableTrainer.  look_for_target_matches should match the setting
+  // used by the production encoder.
+  CodeTableTrainer(const HashedDictionary* dictionary,
+                   bool look_for_target_matches);
+  ~CodeTableTrainer();
+
+  // Encodes one target of the corpus and records its instructions.
+  // Returns false if the target could not be encoded.
+  bool AnalyzeTarget(const char* target_data, size_t target_size);
+
+  // Trains a code table for the given address cache sizes, to be used with
+  // VCDiffStreamingEncoder::SetAddressCacheSizes().  Must be called before
+  // AnalyzeTarget().  Returns false if the sizes are not valid.
+  bool SetAddressCacheSizes(int near_cache_size, int same_cache_size);
+
+  size_t targets_analyzed() const { return targets_analyzed_; }
+
+  uint64_t total_target_size() const { return total_target_size_; }
+
+  // The total size of the delta files produced for the corpus with the
+  // default code table.
+  uint64_t total_encoded_size() const { return total_encoded_size_; }
+
+  uint64_t instructions_recorded() const { return instructions_recorded_; }
+
+  // Writes a code table for the recorded instructions to *code_table, in the
+  // format of section 7 of RFC 3284.  Returns an estimate of the number of
+  // bytes it saves on the deltas of the analyzed corpus, compared to the
+  // default code table (or the one built for the cache sizes), not counting
+  // the code table itself when it is embedded in each delta file.  If it
+  // would not save anything, that code table is written, and 0 is returned.
+  uint64_t BuildCodeTable(std::string* code_table) const;
+
+ private:
+  class RecordingCodeTableWriter;
+
+  // Identifies an instruction with its size, if the size is small enough
+  // to be implied by an opcode, or with size 0 otherwise.
+  typedef uint32_t InstructionKey;
+
+  // Identifies a pair of consecutive instructions: the key of the first
+  // one, and that of the second one.  In a code table, a second size of 0
+  // stands for any size, which is then written after the opcode.
+  typedef uint64_t PairKey;
+
+  typedef std::map<InstructionKey, uint64_t> InstructionCounts;
+  typedef std::map<PairKey, uint64_t> PairCounts;
+
+  // Records an instruction with the given type, size and COPY address mode.
+  void RecordInstruction(unsigned char inst, size_t size, unsigned char mode);
+
+  // Builds the code table that the encoder uses for the cache sizes unless
+  // it is given another one.
+  bool GetBaseCodeTable(VCDiffCodeTableData* code_table) const;
+
+  // Estimates the number of bytes that the implied sizes and the pairs
+  // of table save on the recorded instructions.
+  uint64_t EstimateSaving(const VCDiffCodeTableData& table) const;
+
+  const HashedDictionary* dictionary_;
+
+  const bool look_for_target_matches_;
+
+  int near_cache_size_;
+  int same_cache_size_;
+
+  InstructionCounts instruction_counts_;
+
+  PairCounts pair_counts_;
+
+  // The key of the previous instruction of the same delta window.
+  InstructionKey last_instruction_;
+  bool has_last_instruction_;
+
+  size_t targets_analyzed_;
+  uint64_t total_target_size_;
+  uint64_t total_encoded_size_;
+  uint64_t instructions_recorded_;
+
+  // Making these private avoids implicit copy constructor & assignment operator
+  CodeTableTrainer(const CodeTableTrainer&);  // NOLINT
+  void operator=(const CodeTableTrainer&);
+};
+
+}  // namespace open_vcdiff
+
+#endif  // OPEN_VCDIFF_CODE_TABLE_TRAINER_H_
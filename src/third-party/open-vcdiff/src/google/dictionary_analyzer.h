@@ -0,0 +1,127 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OPEN_VCDIFF_DICTIONARY_ANALYZER_H_
+#define OPEN_VCDIFF_DICTIONARY_ANALYZER_H_
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+#include <string>
+#include <vector>
+
+namespace open_vcdiff {
+
+class HashedDictionary;
+
+// Measures how a dictionary is used when encoding a corpus of targets.
+//
+// Each target passed to AnalyzeTarget() is encoded against the dictionary
+// exactly as VCDiffStreamingEncoder would encode it, and the dictionary
+// ranges referenced by COPY instructions are recorded.  Once the corpus has
+// been analyzed, CompactDictionary() produces a smaller dictionary with the
+// unreferenced bytes removed, and EstimateEncodedSize() predicts the total
+// encoded size of the corpus for a given dictionary size budget.
+//
+// The dictionary is divided into kGranuleSize-byte granules.  Each granule
+// is weighed by the number of target bytes copied from it; when a size
+// budget is given, the heaviest granules are kept first.  Within a kept
+// granule only the bytes that were actually copied are retained.
+//
+// Usage:
+//   DictionaryAnalyzer analyzer(&hashed_dictionary, true);
+//   for (each target in corpus) {
+//     if (!analyzer.AnalyzeTarget(target.data(), target.size())) { ... }
+//   }
+//   std::string compacted;
+//   analyzer.CompactDictionary(max_size, &compacted);
+//
+class DictionaryAnalyzer {
+ public:
+  static const size_t kGranuleSize = 64;
+
+  // The HashedDictionary object must remain valid for the lifetime of the
+  // DictionaryAnalyzer.  look_for_target_matches should match the setting
+  // used by the production encoder, since target matches reduce the number
+  // of bytes that are copied from the dictionary.
+  DictionaryAnalyzer(const HashedDictionary* dictionary,
+                     bool look_for_target_matches);
+  ~DictionaryAnalyzer();
+
+  // Encodes one target of the corpus and records its use of the dictionary.
+  // Returns false if the target could not be encoded.
+  bool AnalyzeTarget(const char* target_data, size_t target_size);
+
+  size_t dictionary_size() const;
+
+  // The number of dictionary bytes referenced by at least one COPY.
+  size_t used_size() const;
+
+  size_t targets_analyzed() const { return targets_analyzed_; }
+
+  uint64_t total_target_size() const { return total_target_size_; }
+
+  // The total size of the delta files produced for the corpus.
+  uint64_t total_encoded_size() const { return total_encoded_size_; }
+
+  // The total number of target bytes that were copied from the dictionary.
+  uint64_t total_copied_size() const { return total_copied_size_; }
+
+  // Predicts the total delta size of the corpus if the dictionary were
+  // compacted by CompactDictionary(max_size).  Target bytes that were copied
+  // from dropped granules are assumed to be ADDed instead, which slightly
+  // overestimates the size when other matches for them exist.
+  uint64_t EstimateEncodedSize(size_t max_size) const;
+
+  // Writes the referenced parts of the dictionary, in their original order,
+  // to *compacted.  If max_size is nonzero, the result is no larger than
+  // max_size bytes.  Returns the number of granules that were kept.
+  size_t CompactDictionary(size_t max_size, std::string* compacted) const;
+
+ private:
+  class RecordingCodeTableWriter;
+
+  // Records a COPY of size bytes from the dictionary at offset.
+  void RecordCopy(size_t offset, size_t size);
+
+  // Number of used bytes within granule.
+  size_t GranuleUsedSize(size_t granule) const;
+
+  // Sets (*keep)[g] for every granule that fits into max_size, heaviest
+  // first.  Returns the number of copied target bytes that the dropped
+  // granules account for.
+  uint64_t SelectGranules(size_t max_size, std::vector<bool>* keep) const;
+
+  const HashedDictionary* dictionary_;
+
+  const bool look_for_target_matches_;
+
+  // One bit per dictionary byte, set if the byte was referenced by a COPY.
+  std::vector<bool> used_;
+
+  // Number of target bytes that were copied from each granule.
+  std::vector<uint64_t> granule_weights_;
+
+  size_t targets_analyzed_;
+  uint64_t total_target_size_;
+  uint64_t total_encoded_size_;
+  uint64_t total_copied_size_;
+
+  // Making these private avoids implicit copy constructor & assignment operator
+  DictionaryAnalyzer(const DictionaryAnalyzer&);  // NOLINT
+  void operator=(const DictionaryAnalyzer&);
+};
+
+}  // namespace open_vcdiff
+
+#endif  // OPEN_VCDIFF_DICTIONARY_ANALYZER_H_
@@ -17,12 +17,24 @@
 
 #include <stddef.h>  // size_t
 #include <string>
+#include <vector>
 #include "google/output_string.h"
 
 namespace open_vcdiff {
 
 class VCDiffStreamingDecoderImpl;
 
+// Where a delta window lies within a delta file, and where the target window
+// that it decodes to lies within the target file, as listed by
+// VCDiffStreamingDecoder::IndexWindows().  All offsets and lengths are in
+// bytes.
+struct VCDiffWindowInfo {
+  size_t delta_offset;
+  size_t delta_length;
+  size_t target_offset;
+  size_t target_length;
+};
+
 // A streaming decoder class.  Takes a dictionary (source) file and a delta
 // file, and produces the original target file.  It is intended to process
 // the partial contents of the delta file as they arrive, in "chunks".
@@ -62,6 +74,16 @@ class VCDiffStreamingDecoder {
   //
   void StartDecoding(const char* dictionary_ptr, size_t dictionary_size);
 
+  // Like StartDecoding(), but the dictionary is the concatenation of
+  // segment_ptrs[i][0,segment_sizes[i]-1] for each i below segment_count,
+  // in that order, as produced by a HashedDictionary made of segments.
+  // The segments are not copied or concatenated; all of them must remain
+  // valid until FinishDecoding is called.
+  //
+  void StartDecodingWithSegments(const char* const* segment_ptrs,
+                                 const size_t* segment_sizes,
+                                 size_t segment_count);
+
   // Accepts "data[0,len-1]" as additional data received in the
   // compressed stream.  If any chunks of data can be fully decoded,
   // they are appended to output_string.
@@ -93,6 +115,25 @@ class VCDiffStreamingDecoder {
   //
   bool FinishDecoding();
 
+  // Lists the delta windows of the whole delta file "data[0,len-1]" in
+  // *windows, without decoding them, for random access to the target file.
+  // It must be called right after StartDecoding(), and reads the delta file
+  // header as DecodeChunk() would.  Then any of the windows may be decoded
+  // on its own, in any order, by passing its delta_length bytes from
+  // delta_offset to DecodeChunk(); they decode to the target_length bytes at
+  // target_offset in the target file.  This relies on each window copying
+  // only from the dictionary and from its own target, as the windows written
+  // by VCDiffStreamingEncoder do.  A window with the VCD_TARGET flag, which
+  // copies from the target of earlier windows, is an error.
+  //
+  // Returns false if "data" is not a whole, well-formed sequence of windows,
+  // in which case the decoder is reset as after DecodeChunk() fails.  The
+  // windows themselves are checked as they are decoded.
+  //
+  bool IndexWindows(const char* data,
+                    size_t len,
+                    std::vector<VCDiffWindowInfo>* windows);
+
   // *** Adjustable parameters ***
 
   // Specifies the maximum allowable target file size.  If the decoder
@@ -125,6 +166,26 @@ class VCDiffStreamingDecoder {
   // decoded target data prior to the current window.
   void SetAllowVcdTarget(bool allow_vcd_target);
 
+  // This interface must be called before StartDecoding().  If its argument
+  // is true, the delta file is expected to come from a trusted encoder that
+  // used VCD_FORMAT_CHECKSUM: every delta window must have a checksum, or
+  // decoding fails.  In exchange, each window whose instructions are all
+  // available is decoded with a lighter loop, which writes the target window
+  // in place and only checks what keeps it from reading or writing out of
+  // bounds; a window that is otherwise malformed is caught by its checksum.
+  // The default (false) checks every instruction, as untrusted input needs.
+  void SetTrustedInput(bool trusted_input);
+
+  // Gives the decoder a code table that was agreed upon out of band, for
+  // delta files that were encoded with VCDiffStreamingEncoder::SetCodeTable()
+  // without embedding it.  Such delta files only contain a checksum of their
+  // code table, and cannot be decoded unless it matches this one.  Delta files
+  // that embed their code table, or use the default one, are not affected.
+  // code_table is copied; it must be 1536 bytes long, in the format of
+  // section 7 of RFC 3284, like the tables that CodeTableTrainer builds.
+  // Returns false if it is not.  Takes effect at the next delta file.
+  bool SetKnownCodeTable(const char* code_table, size_t code_table_size);
+
  private:
   VCDiffStreamingDecoderImpl* const impl_;
 
@@ -16,14 +16,49 @@
 #define OPEN_VCDIFF_VCENCODER_H_
 
 #include <stddef.h>  // size_t
+#include <stdint.h>  // int64_t
+#include <vector>
 #include "google/format_extension_flags.h"
 #include "google/output_string.h"
 
 namespace open_vcdiff {
 
+struct BlockHashTables;
 class VCDiffEngine;
 class VCDiffStreamingEncoderImpl;
 
+// These flags are returned by VCDiffStreamingEncoder::EncodeStatus() to
+// report any shortcuts that the encoder took in order to honor the limits
+// it was given.  The encoded output is a valid delta file regardless of
+// which flags are set; the flags only indicate that it may be larger than
+// it would have been without those limits.
+enum VCDiffEncodeStatusFlagValues {
+  // The encoder searched every target window for matches as usual.
+  VCD_ENCODE_OK = 0x00,
+  // At least one target window could not be searched completely within
+  // the time limit set by SetMaximumEncodeTime(), so the remainder of that
+  // window was encoded using a single ADD instruction.
+  VCD_ENCODE_TIME_LIMIT_REACHED = 0x01,
+  // At least one target window had too little in common with the dictionary
+  // to be encoded within the ratio set by SetMaximumDeltaRatio().  The encoder
+  // may have stopped searching that window early and ADDed the rest of it.
+  VCD_ENCODE_TARGET_INCOMPRESSIBLE = 0x02
+};
+
+typedef int VCDiffEncodeStatusFlags;
+
+// The rolling hash that a HashedDictionary uses to find the blocks of the
+// target data that may match the dictionary.  The choice affects the speed
+// of encoding, and may make the encoder find slightly different matches,
+// but the output is a valid delta file either way and decodes the same.
+enum VCDiffHashType {
+  // The polynomial hash of the original open-vcdiff encoder.
+  VCD_HASH_POLYNOMIAL = 0,
+  // A gear hash, which takes fewer operations to update at every position
+  // of the target data.
+  VCD_HASH_GEAR = 1
+};
+
 // A HashedDictionary must be constructed from the dictionary data
 // in order to use VCDiffStreamingEncoder.  If the same dictionary will
 // be used to perform several encoding operations, then the caller should
@@ -38,6 +73,27 @@ class HashedDictionary {
  public:
   HashedDictionary(const char* dictionary_contents,
                    size_t dictionary_size);
+
+  // The same as above, but hashes the dictionary with hash_type instead of
+  // VCD_HASH_POLYNOMIAL.  The dictionary remembers which hash it was built
+  // with, and the encoders use that hash for the target data.
+  HashedDictionary(const char* dictionary_contents,
+                   size_t dictionary_size,
+                   VCDiffHashType hash_type);
+
+  // Creates a dictionary whose contents are the concatenation of the
+  // contents of the given segments, without copying or hashing them again.
+  // This allows, for example, a large shared dictionary to be combined with
+  // a small per-user one.  The delta files produced with it
+  // must be decoded against the same concatenation, see
+  // VCDiffStreamingDecoder::StartDecodingWithSegments().
+  //
+  // Each segment must have been initialized, and must remain valid for the
+  // lifetime of this object.  Init() must still be called, and fails if
+  // the segments were not all built with the same VCDiffHashType.
+  explicit HashedDictionary(
+      const std::vector<const HashedDictionary*>& segments);
+
   ~HashedDictionary();
 
   // Init() must be called before using the HashedDictionary as an argument
@@ -47,8 +103,19 @@ class HashedDictionary {
   // without using it.
   bool Init();
 
+  // May be called instead of Init() to create a new version of a dictionary
+  // that was extended by appending data to it: if the contents of base are
+  // a prefix of the contents of this dictionary, the work base has already
+  // done is reused, and only the appended data is hashed.  Otherwise, or if
+  // base was built with a different VCDiffHashType, this is the same as
+  // Init().  base must have been initialized; it is not
+  // modified and need not outlive this object.
+  bool InitFromBase(const HashedDictionary& base);
+
   const VCDiffEngine* engine() const { return engine_; }
 
+  VCDiffHashType hash_type() const;
+
  private:
   const VCDiffEngine* engine_;
 
@@ -193,6 +260,102 @@ class VCDiffStreamingEncoder {
 
   bool FinishEncodingToInterface(OutputStringInterface* output_string);
 
+  // Limits the time that each call to EncodeChunk() may spend searching
+  // for matches.  When the limit is reached, the encoder stops searching and
+  // encodes the rest of the chunk as a single ADD instruction, so that the
+  // latency of encoding a chunk stays close to the limit no matter how
+  // expensive the input turns out to be.  The elapsed time is only checked
+  // periodically, so the limit may be exceeded by a few microseconds.
+  // A value of 0 (the default) means that there is no limit.
+  // This function may be called at any time, and takes effect
+  // at the next call to EncodeChunk().
+  void SetMaximumEncodeTime(int64_t maximum_encode_time_usec);
+
+  // Sets the largest acceptable ratio between the size of an encoded delta
+  // window and the size of the target data it represents.  Once a quarter of
+  // a chunk has been searched, if the encoding so far exceeds this ratio, the
+  // encoder stops searching and encodes the rest of the chunk as a single ADD
+  // instruction; it also sets VCD_ENCODE_TARGET_INCOMPRESSIBLE in
+  // EncodeStatus() whenever the encoding of a chunk exceeds the ratio.  A
+  // caller that sees that flag may prefer to send the target data without
+  // VCDIFF encoding at all.  A value of 0 (the default) means that there
+  // is no limit.  Like SetMaximumEncodeTime(), this takes effect at the next
+  // call to EncodeChunk().
+  void SetMaximumDeltaRatio(double maximum_delta_ratio);
+
+  // By default, the encoder is greedy: it takes the longest match it finds at
+  // the first position where there is one, and moves past it.  With optimal
+  // parsing, it finds the longest match at every position, and chooses the
+  // sequence of ADD and COPY instructions with the smallest size, counting
+  // the lengths of the varints of their sizes and addresses.  This is tens
+  // of times slower, and is meant for deltas that are encoded once and
+  // served many times.  The gain is largest with target matching and with
+  // dictionaries that repeat themselves, where the greedy encoder settles
+  // for the first long enough match.  The estimate ignores the address
+  // caches, so each window is also encoded greedily and the smaller
+  // encoding is kept: the delta is never larger than without optimal
+  // parsing.  Like SetMaximumEncodeTime(), this takes effect at the next
+  // call to EncodeChunk().
+  void SetOptimalParsing(bool optimal_parsing);
+
+  // Splits the data given to each call to EncodeChunk() into delta windows
+  // of at most maximum_window_size target bytes.  The encoder never uses
+  // VCD_TARGET, so every window only copies from the dictionary and from its
+  // own target data, and can be decoded on its own after
+  // VCDiffStreamingDecoder::IndexWindows(); smaller windows let a reader
+  // decode a part of the target with less waste, but each window starts
+  // with empty address caches and only finds target matches within itself.
+  // The time and ratio limits apply to each window.  A value of 0 (the
+  // default) encodes each chunk as a single window.  Like
+  // SetMaximumEncodeTime(), this takes effect at the next call to
+  // EncodeChunk().
+  void SetMaximumWindowSize(size_t maximum_window_size);
+
+  // Makes the encoder use an application-defined code table, which maps the
+  // instructions that are most common in the caller's deltas to single-byte
+  // opcodes, instead of the default code table of RFC 3284.  CodeTableTrainer
+  // builds such tables from a corpus of targets.  code_table is copied; it
+  // must be 1536 bytes long, in the format of section 7 of the RFC, and
+  // contain an opcode for every instruction and mode with size 0.
+  //
+  // If embed_code_table is true, the code table is written into the header
+  // of every delta file, encoded against the default code table, and any
+  // VCDIFF decoder can read it.  A trained table usually differs from the
+  // default one in most of its opcodes, and then adds more than 1 KB to
+  // every delta file.  Otherwise, only its Adler32 checksum is written,
+  // using the VCDIFF/SDCH extended format regardless of format_extensions,
+  // and the decoder must be given the same table with
+  // VCDiffStreamingDecoder::SetKnownCodeTable().
+  //
+  // Returns false, and keeps the current code table, if code_table is not
+  // valid, if the JSON format is used, or if called between StartEncoding()
+  // and FinishEncoding().
+  bool SetCodeTable(const char* code_table,
+                    size_t code_table_size,
+                    bool embed_code_table);
+
+  // Makes COPY addresses use NEAR and SAME caches of the given sizes (section
+  // 5.3 of RFC 3284) instead of the default 4 and 3.  A larger NEAR cache
+  // suits targets that copy from a few regions of the dictionary over and
+  // over, such as pages filled from the same template.  Every cache entry is
+  // an address mode that needs its own opcodes, so unless SetCodeTable() was
+  // called, a code table is built for the cache sizes with
+  // VCDiffCodeTableData::BuildForCacheSizes().  In the standard format, that
+  // table is written into the header of every delta file, like the one of
+  // SetCodeTable() with embed_code_table; with format extensions, only the
+  // cache sizes and its checksum are, since VCDiffStreamingDecoder builds
+  // the same table.  A table given to SetCodeTable(), before or after this
+  // call, must have opcodes for all the modes.
+  //
+  // Returns false, and keeps the current settings, if the sizes are not
+  // valid, if the JSON format is used, or if called between StartEncoding()
+  // and FinishEncoding().
+  bool SetAddressCacheSizes(int near_cache_size, int same_cache_size);
+
+  // Returns a combination of VCDiffEncodeStatusFlagValues describing all
+  // chunks encoded since the last call to StartEncoding().
+  VCDiffEncodeStatusFlags EncodeStatus() const;
+
  private:
   VCDiffStreamingEncoderImpl* const impl_;
 
@@ -256,6 +419,61 @@ class VCDiffEncoder {
   void operator=(const VCDiffEncoder&);
 };
 
+// A non-streaming interface to the VCDIFF encoder for sources that are used
+// only once, such as the previous version of a document when encoding the
+// next one.  Building a HashedDictionary for such a source would cost more
+// than the encoding itself.  Instead, the source is neither copied nor kept,
+// and a lighter index of it is built for each call to Encode() and then
+// discarded.  The memory of that index is kept for the next call, so one
+// VCDiffOneShotEncoder should be reused for many sources.
+//
+// This object is not thread-safe: each thread needs its own.
+//
+class VCDiffOneShotEncoder {
+ public:
+  VCDiffOneShotEncoder();
+  ~VCDiffOneShotEncoder();
+
+  // See VCDiffEncoder::SetFormatFlags().
+  void SetFormatFlags(VCDiffFormatExtensionFlags flags) { flags_ = flags; }
+
+  // See VCDiffEncoder::SetTargetMatching().  Target matching is enabled
+  // by default.
+  void SetTargetMatching(bool look_for_target_matches) {
+    look_for_target_matches_ = look_for_target_matches;
+  }
+
+  // Replaces old contents of output_string with the encoded form of
+  // target_data, using source_data as the dictionary.  source_data is only
+  // read during the call.
+  template<class OutputType>
+  bool Encode(const char* source_data,
+              size_t source_len,
+              const char* target_data,
+              size_t target_len,
+              OutputType* output) {
+    OutputString<OutputType> output_string(output);
+    return EncodeToInterface(source_data, source_len,
+                             target_data, target_len, &output_string);
+  }
+
+ private:
+  bool EncodeToInterface(const char* source_data,
+                         size_t source_len,
+                         const char* target_data,
+                         size_t target_len,
+                         OutputStringInterface* output_string);
+
+  BlockHashTables* const tables_;
+  VCDiffFormatExtensionFlags flags_;
+  bool look_for_target_matches_;
+
+  // Make the copy constructor and assignment operator private
+  // so that they don't inadvertently get used.
+  VCDiffOneShotEncoder(const VCDiffOneShotEncoder&);  // NOLINT
+  void operator=(const VCDiffOneShotEncoder&);
+};
+
 }  // namespace open_vcdiff
 
 #endif  // OPEN_VCDIFF_VCENCODER_H_
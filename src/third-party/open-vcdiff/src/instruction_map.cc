@@ -14,23 +14,19 @@
 
 #include <config.h>
 #include "instruction_map.h"
-#include <string.h>  // memset
-#include "addrcache.h"
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint16_t
 #include "vcdiff_defs.h"
 
 namespace open_vcdiff {
 
 // VCDiffInstructionMap members and methods
 
-VCDiffInstructionMap* VCDiffInstructionMap::default_instruction_map = NULL;
-
-VCDiffInstructionMap* VCDiffInstructionMap::GetDefaultInstructionMap() {
-  if (!default_instruction_map) {
-    default_instruction_map = new VCDiffInstructionMap(
-        VCDiffCodeTableData::kDefaultCodeTableData,
-        VCDiffAddressCache::DefaultLastMode());
-  }
-  return default_instruction_map;
+const VCDiffInstructionMap* VCDiffInstructionMap::GetDefaultInstructionMap() {
+  // Only the pointers to the tables are copied when this is initialized,
+  // which C++11 guarantees to happen once even if several threads get here.
+  static const VCDiffInstructionMap default_instruction_map(kDefaultTables);
+  return &default_instruction_map;
 }
 
 static unsigned char FindMaxSize(
@@ -44,104 +40,41 @@ static unsigned char FindMaxSize(
   return max_size;
 }
 
-static void ClearSizeOpcodeArray(int length, OpcodeOrNone* array) {
-  for (int i = 0; i < length; ++i) {
-    array[i] = kNoOpcode;
-  }
-}
-
-static OpcodeOrNone* NewSizeOpcodeArray(int length) {
-  OpcodeOrNone* array = new OpcodeOrNone[length];
-  ClearSizeOpcodeArray(length, array);
-  return array;
-}
-
-VCDiffInstructionMap::FirstInstructionMap::FirstInstructionMap(
-    int num_insts_and_modes,
-    int max_size_1)
-    : num_instruction_type_modes_(num_insts_and_modes),
-      max_size_1_(max_size_1) {
-  first_opcodes_ = new OpcodeOrNone*[num_instruction_type_modes_];
-  for (int i = 0; i < num_instruction_type_modes_; ++i) {
-    // There must be at least (max_size_1_ + 1) elements in first_opcodes_
-    // because the element first_opcodes[max_size_1_] will be referenced.
-    first_opcodes_[i] = NewSizeOpcodeArray(max_size_1_ + 1);
-  }
-}
-
-VCDiffInstructionMap::FirstInstructionMap::~FirstInstructionMap() {
-  for (int i = 0; i < num_instruction_type_modes_; ++i) {
-    delete[] first_opcodes_[i];
-  }
-  delete[] first_opcodes_;
-}
-
-VCDiffInstructionMap::SecondInstructionMap::SecondInstructionMap(
-    int num_insts_and_modes,
-    int max_size_2)
-    : num_instruction_type_modes_(num_insts_and_modes),
-      max_size_2_(max_size_2) {
-  memset(second_opcodes_, 0, sizeof(second_opcodes_));
-}
-
-
-VCDiffInstructionMap::SecondInstructionMap::~SecondInstructionMap() {
-  for (int opcode = 0; opcode < VCDiffCodeTableData::kCodeTableSize; ++opcode) {
-    if (second_opcodes_[opcode] != NULL) {
-      for (int inst_mode = 0;
-           inst_mode < num_instruction_type_modes_;
-           ++inst_mode) {
-        // No need to check for NULL
-        delete[] second_opcodes_[opcode][inst_mode];
-      }
-      delete[] second_opcodes_[opcode];
-    }
-  }
-}
-
-void VCDiffInstructionMap::SecondInstructionMap::Add(
-    unsigned char first_opcode,
-    unsigned char inst,
-    unsigned char size,
-    unsigned char mode,
-    unsigned char second_opcode) {
-  OpcodeOrNone**& inst_mode_array = second_opcodes_[first_opcode];
-  if (!inst_mode_array) {
-    inst_mode_array = new OpcodeOrNone*[num_instruction_type_modes_];
-    memset(inst_mode_array,
-           0,
-           num_instruction_type_modes_ * sizeof(inst_mode_array[0]));
-  }
-  OpcodeOrNone*& size_array = inst_mode_array[inst + mode];
-  if (!size_array) {
-    // There must be at least (max_size_2_ + 1) elements in size_array
-    // because the element size_array[max_size_2_] will be referenced.
-    size_array = NewSizeOpcodeArray(max_size_2_ + 1);
-  }
-  if (size_array[size] == kNoOpcode) {
-    size_array[size] = second_opcode;
+void VCDiffInstructionMap::AddFirstOpcode(unsigned char inst,
+                                          unsigned char size,
+                                          unsigned char mode,
+                                          unsigned char opcode) {
+  OpcodeOrNone* opcode_slot =
+      &first_opcodes_[(inst + mode) * (tables_.max_size_1 + 1) + size];
+  if (*opcode_slot == kNoOpcode) {
+    *opcode_slot = opcode;
   }
 }
 
-OpcodeOrNone VCDiffInstructionMap::SecondInstructionMap::Lookup(
-    unsigned char first_opcode,
-    unsigned char inst,
-    unsigned char size,
-    unsigned char mode) const {
-  if (size > max_size_2_) {
-    return kNoOpcode;
+void VCDiffInstructionMap::AddSecondOpcode(unsigned char first_opcode,
+                                           unsigned char inst,
+                                           unsigned char size,
+                                           unsigned char mode,
+                                           unsigned char second_opcode) {
+  const int num_modes = tables_.num_instruction_type_modes;
+  const int block_size = tables_.max_size_2 + 1;
+  if (second_opcode_rows_[first_opcode] == 0) {
+    second_opcode_rows_[first_opcode] =
+        static_cast<uint16_t>(second_opcode_blocks_.size() / num_modes);
+    second_opcode_blocks_.resize(second_opcode_blocks_.size() + num_modes, 0);
   }
-  const OpcodeOrNone* const * const inst_mode_array =
-    second_opcodes_[first_opcode];
-  if (!inst_mode_array) {
-    return kNoOpcode;
+  const size_t block_index =
+      second_opcode_rows_[first_opcode] * num_modes + inst + mode;
+  if (second_opcode_blocks_[block_index] == 0) {
+    second_opcode_blocks_[block_index] =
+        static_cast<uint16_t>(second_opcodes_.size() / block_size);
+    second_opcodes_.resize(second_opcodes_.size() + block_size, kNoOpcode);
   }
-  int inst_mode = (inst == VCD_COPY) ? (inst + mode) : inst;
-  const OpcodeOrNone* const size_array = inst_mode_array[inst_mode];
-  if (!size_array) {
-    return kNoOpcode;
+  OpcodeOrNone* opcode_slot =
+      &second_opcodes_[second_opcode_blocks_[block_index] * block_size + size];
+  if (*opcode_slot == kNoOpcode) {
+    *opcode_slot = second_opcode;
   }
-  return size_array[size];
 }
 
 // Because a constructor should never fail, the caller must already
@@ -149,32 +82,41 @@ OpcodeOrNone VCDiffInstructionMap::SecondInstructionMap::Lookup(
 //
 VCDiffInstructionMap::VCDiffInstructionMap(
     const VCDiffCodeTableData& code_table_data,
-    unsigned char max_mode)
-    : first_instruction_map_(VCD_LAST_INSTRUCTION_TYPE + max_mode + 1,
-                             FindMaxSize(code_table_data.size1)),
-      second_instruction_map_(VCD_LAST_INSTRUCTION_TYPE + max_mode + 1,
-                              FindMaxSize(code_table_data.size2)) {
-  // First pass to fill up first_instruction_map_
+    unsigned char max_mode) {
+  tables_.num_instruction_type_modes = VCD_LAST_INSTRUCTION_TYPE + max_mode + 1;
+  tables_.max_size_1 = FindMaxSize(code_table_data.size1);
+  tables_.max_size_2 = FindMaxSize(code_table_data.size2);
+  // There must be at least (max_size_1 + 1) elements for each inst_mode
+  // because the element for size max_size_1 will be referenced.
+  first_opcodes_.assign(
+      tables_.num_instruction_type_modes * (tables_.max_size_1 + 1),
+      kNoOpcode);
+  // Row 0 and block 0, for the combinations that have no opcode.
+  second_opcode_rows_.assign(VCDiffCodeTableData::kCodeTableSize, 0);
+  second_opcode_blocks_.assign(tables_.num_instruction_type_modes, 0);
+  second_opcodes_.assign(tables_.max_size_2 + 1, kNoOpcode);
+  // First pass to fill up first_opcodes_
   for (int opcode = 0; opcode < VCDiffCodeTableData::kCodeTableSize; ++opcode) {
     if (code_table_data.inst2[opcode] == VCD_NOOP) {
       // Single instruction.  If there is more than one opcode for the same
       // inst, mode, and size, then the lowest-numbered opcode will always
       // be used by the encoder, because of the descending loop.
-      first_instruction_map_.Add(code_table_data.inst1[opcode],
-                                 code_table_data.size1[opcode],
-                                 code_table_data.mode1[opcode],
-                                 opcode);
+      AddFirstOpcode(code_table_data.inst1[opcode],
+                     code_table_data.size1[opcode],
+                     code_table_data.mode1[opcode],
+                     opcode);
     } else if (code_table_data.inst1[opcode] == VCD_NOOP) {
       // An unusual case where inst1 == NOOP and inst2 == ADD, RUN, or COPY.
       // This is valid under the standard, but unlikely to be used.
       // Add it to the first instruction map as if inst1 and inst2 were swapped.
-      first_instruction_map_.Add(code_table_data.inst2[opcode],
-                                 code_table_data.size2[opcode],
-                                 code_table_data.mode2[opcode],
-                                 opcode);
+      AddFirstOpcode(code_table_data.inst2[opcode],
+                     code_table_data.size2[opcode],
+                     code_table_data.mode2[opcode],
+                     opcode);
     }
   }
-  // Second pass to fill up second_instruction_map_ (depends on first pass)
+  tables_.first_opcodes = &first_opcodes_[0];
+  // Second pass to fill up the second opcode tables (depends on first pass)
   for (int opcode = 0; opcode < VCDiffCodeTableData::kCodeTableSize; ++opcode) {
     if ((code_table_data.inst1[opcode] != VCD_NOOP) &&
         (code_table_data.inst2[opcode] != VCD_NOOP)) {
@@ -184,13 +126,95 @@ VCDiffInstructionMap::VCDiffInstructionMap(
                             code_table_data.size1[opcode],
                             code_table_data.mode1[opcode]);
       if (single_opcode == kNoOpcode) continue;  // No single opcode found
-      second_instruction_map_.Add(static_cast<unsigned char>(single_opcode),
-                                  code_table_data.inst2[opcode],
-                                  code_table_data.size2[opcode],
-                                  code_table_data.mode2[opcode],
-                                  opcode);
+      AddSecondOpcode(static_cast<unsigned char>(single_opcode),
+                      code_table_data.inst2[opcode],
+                      code_table_data.size2[opcode],
+                      code_table_data.mode2[opcode],
+                      opcode);
     }
   }
+  tables_.second_opcode_rows = &second_opcode_rows_[0];
+  tables_.second_opcode_blocks = &second_opcode_blocks_[0];
+  tables_.second_opcodes = &second_opcodes_[0];
 }
 
+// The tables of the default instruction map, which are those of
+//     VCDiffInstructionMap(VCDiffCodeTableData::kDefaultCodeTableData,
+//                          VCDiffAddressCache::DefaultLastMode())
+// generated ahead of time so that they need not be built at run time.
+// instruction_map_test checks that they match.  N stands for kNoOpcode.
+
+#define N kNoOpcode
+
+static const OpcodeOrNone kDefaultFirstOpcodes[228] = {
+    N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, N, 1, 2, 3, 4, 5, 6,
+    7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, N, 0, N, N, N, N, N, N, N, N,
+    N, N, N, N, N, N, N, N, N, N, 19, N, N, N, 20, 21, 22, 23, 24, 25, 26, 27,
+    28, 29, 30, 31, 32, 33, 34, 35, N, N, N, 36, 37, 38, 39, 40, 41, 42, 43,
+    44, 45, 46, 47, 48, 49, 50, 51, N, N, N, 52, 53, 54, 55, 56, 57, 58, 59,
+    60, 61, 62, 63, 64, 65, 66, 67, N, N, N, 68, 69, 70, 71, 72, 73, 74, 75,
+    76, 77, 78, 79, 80, 81, 82, 83, N, N, N, 84, 85, 86, 87, 88, 89, 90, 91,
+    92, 93, 94, 95, 96, 97, 98, 99, N, N, N, 100, 101, 102, 103, 104, 105,
+    106, 107, 108, 109, 110, 111, 112, 113, 114, 115, N, N, N, 116, 117, 118,
+    119, 120, 121, 122, 123, 124, 125, 126, 127, 128, 129, 130, 131, N, N, N,
+    132, 133, 134, 135, 136, 137, 138, 139, 140, 141, 142, 143, 144, 145, 146,
+    147, N, N, N, 148, 149, 150, 151, 152, 153, 154, 155, 156, 157, 158, 159,
+    160, 161, 162
+};
+
+static const uint16_t kDefaultSecondOpcodeRows[256] = {
+    0, 0, 1, 2, 3, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 6, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    13, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+static const uint16_t kDefaultSecondOpcodeBlocks[168] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 5, 9, 13, 17, 21, 25, 29,
+    33, 0, 0, 0, 2, 6, 10, 14, 18, 22, 26, 30, 34, 0, 0, 0, 3, 7, 11, 15, 19,
+    23, 27, 31, 35, 0, 0, 0, 4, 8, 12, 16, 20, 24, 28, 32, 36, 0, 37, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 38, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 39, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 40, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 41, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 42, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 43, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 44, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 45, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0
+};
+
+static const OpcodeOrNone kDefaultSecondOpcodes[322] = {
+    N, N, N, N, N, N, N, N, N, N, N, 163, 164, 165, N, N, N, N, 166, 167, 168,
+    N, N, N, N, 169, 170, 171, N, N, N, N, 172, 173, 174, N, N, N, N, 175,
+    176, 177, N, N, N, N, 178, 179, 180, N, N, N, N, 181, 182, 183, N, N, N,
+    N, 184, 185, 186, N, N, N, N, 187, 188, 189, N, N, N, N, 190, 191, 192, N,
+    N, N, N, 193, 194, 195, N, N, N, N, 196, 197, 198, N, N, N, N, 199, 200,
+    201, N, N, N, N, 202, 203, 204, N, N, N, N, 205, 206, 207, N, N, N, N,
+    208, 209, 210, N, N, N, N, 211, 212, 213, N, N, N, N, 214, 215, 216, N, N,
+    N, N, 217, 218, 219, N, N, N, N, 220, 221, 222, N, N, N, N, 223, 224, 225,
+    N, N, N, N, 226, 227, 228, N, N, N, N, 229, 230, 231, N, N, N, N, 232,
+    233, 234, N, N, N, N, 235, N, N, N, N, N, N, 236, N, N, N, N, N, N, 237,
+    N, N, N, N, N, N, 238, N, N, N, N, N, N, 239, N, N, N, N, N, N, 240, N, N,
+    N, N, N, N, 241, N, N, N, N, N, N, 242, N, N, N, N, N, N, 243, N, N, N, N,
+    N, N, 244, N, N, N, N, N, N, 245, N, N, N, N, N, N, 246, N, N, N, 247, N,
+    N, N, N, N, N, 248, N, N, N, N, N, N, 249, N, N, N, N, N, N, 250, N, N, N,
+    N, N, N, 251, N, N, N, N, N, N, 252, N, N, N, N, N, N, 253, N, N, N, N, N,
+    N, 254, N, N, N, N, N, N, 255, N, N, N, N, N
+};
+#undef N
+
+const VCDiffInstructionMap::Tables VCDiffInstructionMap::kDefaultTables = {
+  12,  // num_instruction_type_modes: NOOP, ADD, RUN and 9 COPY modes
+  18,  // max_size_1
+  6,   // max_size_2
+  kDefaultFirstOpcodes,
+  kDefaultSecondOpcodeRows,
+  kDefaultSecondOpcodeBlocks,
+  kDefaultSecondOpcodes
+};
+
 };  // namespace open_vcdiff
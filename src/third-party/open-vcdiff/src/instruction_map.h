@@ -26,6 +26,8 @@
 #define OPEN_VCDIFF_INSTRUCTION_MAP_H_
 
 #include <config.h>
+#include <stdint.h>  // uint16_t
+#include <vector>
 #include "codetable.h"
 #include "vcdiff_defs.h"
 
@@ -48,7 +50,11 @@ class VCDiffInstructionMap {
   VCDiffInstructionMap(const VCDiffCodeTableData& code_table_data,
                        unsigned char max_mode);
 
-  static VCDiffInstructionMap* GetDefaultInstructionMap();
+  // Returns the instruction map of the default code table.  Its tables are
+  // generated ahead of time (see instruction_map.cc), so that they are
+  // constant data that any number of threads can share, and this function
+  // does not build anything.
+  static const VCDiffInstructionMap* GetDefaultInstructionMap();
 
   // Finds an opcode that has the given inst, size, and mode for its first
   // instruction  and NOOP for its second instruction (or vice versa.)
@@ -66,7 +72,12 @@ class VCDiffInstructionMap {
   OpcodeOrNone LookupFirstOpcode(unsigned char inst,
                                  unsigned char size,
                                  unsigned char mode) const {
-    return first_instruction_map_.Lookup(inst, size, mode);
+    if (size > tables_.max_size_1) {
+      return kNoOpcode;
+    }
+    const int inst_mode = (inst == VCD_COPY) ? (inst + mode) : inst;
+    // Lookup specific-sized opcode
+    return tables_.first_opcodes[inst_mode * (tables_.max_size_1 + 1) + size];
   }
 
   // Given a first opcode (presumed to have been returned by a previous call to
@@ -82,120 +93,84 @@ class VCDiffInstructionMap {
                                   unsigned char inst,
                                   unsigned char size,
                                   unsigned char mode) const {
-    return second_instruction_map_.Lookup(first_opcode, inst, size, mode);
+    if (size > tables_.max_size_2) {
+      return kNoOpcode;
+    }
+    const int inst_mode = (inst == VCD_COPY) ? (inst + mode) : inst;
+    const int row = tables_.second_opcode_rows[first_opcode];
+    const int block =
+        tables_.second_opcode_blocks[row * tables_.num_instruction_type_modes
+                                     + inst_mode];
+    return tables_.second_opcodes[block * (tables_.max_size_2 + 1) + size];
   }
 
  private:
-  // Data structure used to implement LookupFirstOpcode efficiently.
+  // The lookup tables, as flat arrays.  For a map built from a code table
+  // they point into the vectors below, and for the default map they point
+  // to generated constant arrays.
   //
-  class FirstInstructionMap {
-   public:
-    FirstInstructionMap(int num_insts_and_modes, int max_size_1);
-    ~FirstInstructionMap();
-
-    void Add(unsigned char inst,
-             unsigned char size,
-             unsigned char mode,
-             unsigned char opcode) {
-      OpcodeOrNone* opcode_slot = &first_opcodes_[inst + mode][size];
-      if (*opcode_slot == kNoOpcode) {
-        *opcode_slot = opcode;
-      }
-    }
-
-    // See comments for LookupFirstOpcode, above.
-    //
-    OpcodeOrNone Lookup(unsigned char inst,
-                        unsigned char size,
-                        unsigned char mode) const {
-      int inst_mode = (inst == VCD_COPY) ? (inst + mode) : inst;
-      if (size > max_size_1_) {
-        return kNoOpcode;
-      }
-      // Lookup specific-sized opcode
-      return first_opcodes_[inst_mode][size];
-    }
-
-   private:
-    // The number of possible combinations of inst (a VCDiffInstructionType) and
-    // mode.  Since the mode is only used for COPY instructions, this number
-    // is not (number of VCDiffInstructionType values) * (number of modes), but
-    // rather (number of VCDiffInstructionType values other than VCD_COPY)
-    // + (number of COPY modes).
-    //
-    // Compressing inst and mode into a single integer relies on
-    // VCD_COPY being the last instruction type.  The inst+mode values are:
-    // 0 (NOOP), 1 (ADD), 2 (RUN), 3 (COPY mode 0), 4 (COPY mode 1), ...
-    //
-    const int num_instruction_type_modes_;
-
-    // The maximum value of a size1 element in code_table_data
-    //
-    const int max_size_1_;
-
-    // There are two levels to first_opcodes_:
-    // 1) A dynamically-allocated pointer array of size
-    //    num_instruction_type_modes_ (one element for each combination of inst
-    //    and mode.)  Every element of this array is non-NULL and contains
-    //    a pointer to:
-    // 2) A dynamically-allocated array of OpcodeOrNone values, with one element
-    //    for each possible first instruction size (size1) in the code table.
-    //    (In the default code table, for example, the maximum size used is 18,
-    //    so these arrays would have 19 elements representing values 0
-    //    through 18.)
-    //
-    OpcodeOrNone** first_opcodes_;
-
-    // Making these private avoids implicit copy constructor
-    // and assignment operator
-    FirstInstructionMap(const FirstInstructionMap&);  // NOLINT
-    void operator=(const FirstInstructionMap&);
-  } first_instruction_map_;
-
-  // Data structure used to implement LookupSecondOpcode efficiently.
+  // Compressing inst and mode into a single integer (inst_mode) relies on
+  // VCD_COPY being the last instruction type.  The inst_mode values are:
+  // 0 (NOOP), 1 (ADD), 2 (RUN), 3 (COPY mode 0), 4 (COPY mode 1), ...
   //
-  class SecondInstructionMap {
-   public:
-    SecondInstructionMap(int num_insts_and_modes, int max_size_2);
-    ~SecondInstructionMap();
-    void Add(unsigned char first_opcode,
-             unsigned char inst,
-             unsigned char size,
-             unsigned char mode,
-             unsigned char second_opcode);
-
-    // See comments for LookupSecondOpcode, above.
-    OpcodeOrNone Lookup(unsigned char first_opcode,
-                        unsigned char inst,
-                        unsigned char size,
-                        unsigned char mode) const;
-   private:
-    // See the member of the same name in FirstInstructionMap.
-    const int num_instruction_type_modes_;
-
-    // The maximum value of a size2 element in code_table_data
-    const int max_size_2_;
-
-    // There are three levels to second_opcodes_:
-    // 1) A statically-allocated pointer array with one element
-    //    for each possible opcode.  Each element can be NULL, or can point to:
-    // 2) A dynamically-allocated pointer array of size
-    //    num_instruction_type_modes_ (one element for each combination of inst
-    //    and mode.)  Each element can be NULL, or can point to:
-    // 3) A dynamically-allocated array with one element for each possible
-    //    second instruction size in the code table.  (In the default code
-    //    table, for example, the maximum size used is 6, so these arrays would
-    //    have 7 elements representing values 0 through 6.)
-    //
-    OpcodeOrNone** second_opcodes_[VCDiffCodeTableData::kCodeTableSize];
-
-    // Making these private avoids implicit copy constructor
-    // and assignment operator
-    SecondInstructionMap(const SecondInstructionMap&);  // NOLINT
-    void operator=(const SecondInstructionMap&);
-  } second_instruction_map_;
-
-  static VCDiffInstructionMap* default_instruction_map;
+  struct Tables {
+    // The number of possible combinations of inst (a VCDiffInstructionType)
+    // and mode.  Since the mode is only used for COPY instructions, this
+    // number is not (number of VCDiffInstructionType values) * (number of
+    // modes), but rather (number of VCDiffInstructionType values other than
+    // VCD_COPY) + (number of COPY modes).
+    int num_instruction_type_modes;
+
+    // The maximum values of the size1 and size2 elements in code_table_data.
+    // (In the default code table, for example, these are 18 and 6.)
+    int max_size_1;
+    int max_size_2;
+
+    // The single-instruction opcode for each inst_mode and size, at
+    // first_opcodes[inst_mode * (max_size_1 + 1) + size].
+    const OpcodeOrNone* first_opcodes;
+
+    // The double-instruction opcodes are found in three steps, which keeps
+    // the tables small even when max_size_2 and the number of modes are
+    // large, since few opcodes are the first half of a double instruction:
+    // 1) second_opcode_rows has one element for each possible first opcode,
+    //    which is the number of a row of second_opcode_blocks.
+    // 2) second_opcode_blocks has num_instruction_type_modes elements in
+    //    each row, one for each inst_mode of the second instruction, which
+    //    are the numbers of blocks of second_opcodes.
+    // 3) second_opcodes has (max_size_2 + 1) elements in each block, one for
+    //    each size of the second instruction.
+    // Row 0 and block 0 are used for the combinations that have no opcode,
+    // and only contain zeros and kNoOpcode respectively.
+    const uint16_t* second_opcode_rows;
+    const uint16_t* second_opcode_blocks;
+    const OpcodeOrNone* second_opcodes;
+  };
+
+  static const Tables kDefaultTables;
+
+  // Uses the given tables, which must remain valid for the lifetime
+  // of the map.
+  explicit VCDiffInstructionMap(const Tables& tables) : tables_(tables) { }
+
+  void AddFirstOpcode(unsigned char inst,
+                      unsigned char size,
+                      unsigned char mode,
+                      unsigned char opcode);
+
+  void AddSecondOpcode(unsigned char first_opcode,
+                       unsigned char inst,
+                       unsigned char size,
+                       unsigned char mode,
+                       unsigned char second_opcode);
+
+  Tables tables_;
+
+  // The storage of tables_ when the map is built from a code table.
+  std::vector<OpcodeOrNone> first_opcodes_;
+  std::vector<uint16_t> second_opcode_rows_;
+  std::vector<uint16_t> second_opcode_blocks_;
+  std::vector<OpcodeOrNone> second_opcodes_;
 
   // Making these private avoids implicit copy constructor & assignment operator
   VCDiffInstructionMap(const VCDiffInstructionMap&);  // NOLINT
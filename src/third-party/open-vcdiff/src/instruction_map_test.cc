@@ -16,6 +16,7 @@
 
 #include <config.h>
 #include "instruction_map.h"
+#include "addrcache.h"
 #include "codetable.h"
 #include "testing.h"
 #include "vcdiff_defs.h"
@@ -177,6 +178,34 @@ void InstructionMapTest::VerifyExerciseSecondInstruction(
                                              mode2));
 }
 
+// The default map is generated ahead of time; it must give the same opcodes
+// as a map built from the default code table.
+TEST_F(InstructionMapTest, DefaultMapMatchesDefaultCodeTable) {
+  const unsigned char max_mode = VCDiffAddressCache::DefaultLastMode();
+  const VCDiffInstructionMap built_map(
+      VCDiffCodeTableData::kDefaultCodeTableData, max_mode);
+  int mismatches = 0;
+  for (int inst = VCD_NOOP; inst <= VCD_LAST_INSTRUCTION_TYPE; ++inst) {
+    const int last_mode = (inst == VCD_COPY) ? max_mode : 0;
+    for (int mode = 0; mode <= last_mode; ++mode) {
+      for (int size = 0; size <= 255; ++size) {
+        if (default_map->LookupFirstOpcode(inst, size, mode) !=
+            built_map.LookupFirstOpcode(inst, size, mode)) {
+          ++mismatches;
+        }
+        for (int opcode = 0; opcode < VCDiffCodeTableData::kCodeTableSize;
+             ++opcode) {
+          if (default_map->LookupSecondOpcode(opcode, inst, size, mode) !=
+              built_map.LookupSecondOpcode(opcode, inst, size, mode)) {
+            ++mismatches;
+          }
+        }
+      }
+    }
+  }
+  EXPECT_EQ(0, mismatches);
+}
+
 TEST_F(InstructionMapTest, DefaultMapLookupFirstNoop) {
   EXPECT_EQ(kNoOpcode, default_map->LookupFirstOpcode(VCD_NOOP, 0, 0));
   EXPECT_EQ(kNoOpcode, default_map->LookupFirstOpcode(VCD_NOOP, 0, 255));
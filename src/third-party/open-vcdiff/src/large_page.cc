@@ -0,0 +1,68 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <config.h>
+#include "large_page.h"
+#include <stdlib.h>  // free, malloc, posix_memalign
+#include <new>  // std::bad_alloc
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>  // madvise
+#endif  // HAVE_SYS_MMAN_H
+
+#if defined(HAVE_POSIX_MEMALIGN) && defined(MADV_HUGEPAGE)
+#define VCD_LARGE_PAGES 1
+#endif
+
+namespace open_vcdiff {
+
+bool UsesLargePages(size_t size) {
+#ifdef VCD_LARGE_PAGES
+  return size >= kLargePageSize;
+#else
+  (void) size;
+  return false;
+#endif  // VCD_LARGE_PAGES
+}
+
+void* AllocateLargePages(size_t size) {
+  void* p = NULL;
+#ifdef VCD_LARGE_PAGES
+  if (UsesLargePages(size)) {
+    if (posix_memalign(&p, kLargePageSize, size) != 0) {
+      throw std::bad_alloc();
+    }
+    // Only whole huge pages can be advised; a partial last page keeps
+    // ordinary pages.  Failures are harmless: the memory is still usable.
+    const size_t advised_size = size - (size % kLargePageSize);
+    madvise(p, advised_size, MADV_HUGEPAGE);
+#ifdef MADV_POPULATE_WRITE
+    madvise(p, advised_size, MADV_POPULATE_WRITE);
+#endif  // MADV_POPULATE_WRITE
+    return p;
+  }
+#endif  // VCD_LARGE_PAGES
+  // malloc(0) may return NULL.
+  p = malloc((size > 0) ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void FreeLargePages(void* p) {
+  free(p);
+}
+
+}  // namespace open_vcdiff
@@ -0,0 +1,109 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OPEN_VCDIFF_LARGE_PAGE_H_
+#define OPEN_VCDIFF_LARGE_PAGE_H_
+
+#include <config.h>
+#include <stddef.h>  // ptrdiff_t, size_t
+#include <new>  // placement new
+
+namespace open_vcdiff {
+
+// The size of a transparent huge page on x86-64 and most other platforms
+// that have them.
+const size_t kLargePageSize = 2 * 1024 * 1024;
+
+// Allocates memory for a large, long-lived table that will be read at random
+// positions, such as a dictionary or the index of its hash.  Never returns
+// NULL; throws std::bad_alloc like operator new if the memory is exhausted.
+//
+// Where posix_memalign() and madvise() are available, a block of at least
+// kLargePageSize bytes starts on a kLargePageSize boundary and is advised
+// with MADV_HUGEPAGE, so that the kernel can back it with huge pages even when
+// transparent huge pages are only enabled on request.  One TLB entry then
+// covers 2 MB of the table instead of 4 KB, which removes most of the TLB
+// misses of random lookups in a multi-megabyte table.  The block is also
+// prefaulted (MADV_POPULATE_WRITE, Linux 5.14 and later), so that the page
+// faults are paid by this call in one go, and not by the first encodings that
+// happen to touch each page.  The callers fill the whole block right away in
+// any case, so prefaulting only changes how the faults are taken, not how
+// much memory is used.
+//
+// Smaller blocks, and every block on other platforms, come from malloc().
+// The memory must be released using FreeLargePages().
+void* AllocateLargePages(size_t size);
+
+// Releases memory allocated by AllocateLargePages().  Accepts NULL.
+void FreeLargePages(void* p);
+
+// Returns true if the blocks of size bytes returned by AllocateLargePages()
+// are advised to use huge pages.  Whether the kernel actually grants them
+// depends on its configuration and on fragmentation; see AnonHugePages in
+// /proc/<pid>/smaps.
+bool UsesLargePages(size_t size);
+
+// An STL allocator that gets its memory from AllocateLargePages(), for tables
+// held in a std::vector.  It has no state, so that vectors that use it can
+// still be swapped in constant time.
+template<typename T>
+class LargePageAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+
+  template<typename U> struct rebind { typedef LargePageAllocator<U> other; };
+
+  LargePageAllocator() { }
+  LargePageAllocator(const LargePageAllocator&) { }
+  template<typename U> LargePageAllocator(const LargePageAllocator<U>&) { }
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+
+  pointer allocate(size_type n, const void* /* hint */ = 0) {
+    if (n > max_size()) {
+      throw std::bad_alloc();
+    }
+    return static_cast<pointer>(AllocateLargePages(n * sizeof(T)));
+  }
+
+  void deallocate(pointer p, size_type /* n */) { FreeLargePages(p); }
+
+  size_type max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+
+  void construct(pointer p, const T& value) { new(p) T(value); }
+  void destroy(pointer p) { p->~T(); }
+};
+
+template<typename T, typename U>
+inline bool operator==(const LargePageAllocator<T>&,
+                       const LargePageAllocator<U>&) {
+  return true;
+}
+
+template<typename T, typename U>
+inline bool operator!=(const LargePageAllocator<T>&,
+                       const LargePageAllocator<U>&) {
+  return false;
+}
+
+}  // namespace open_vcdiff
+
+#endif  // OPEN_VCDIFF_LARGE_PAGE_H_
@@ -0,0 +1,159 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Unit tests for AllocateLargePages() and LargePageAllocator, found in
+// large_page.h, and a benchmark of random lookups in large-page memory.
+
+#include <config.h>
+#include "large_page.h"
+#include <stdint.h>  // uint32_t, uintptr_t
+#include <stdlib.h>  // free, malloc, posix_memalign, rand, srand
+#include <string.h>  // memcpy, memset
+#include <iostream>
+#include <vector>
+#include "testing.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>  // madvise
+#endif  // HAVE_SYS_MMAN_H
+
+namespace open_vcdiff {
+namespace {
+
+TEST(LargePageTest, SmallBlocksUseOrdinaryPages) {
+  EXPECT_FALSE(UsesLargePages(0));
+  EXPECT_FALSE(UsesLargePages(4096));
+  EXPECT_FALSE(UsesLargePages(kLargePageSize - 1));
+  void* empty = AllocateLargePages(0);
+  EXPECT_TRUE(empty != NULL);
+  FreeLargePages(empty);
+  FreeLargePages(NULL);
+}
+
+TEST(LargePageTest, LargeBlocksAreAlignedToLargePages) {
+  const size_t size = 3 * kLargePageSize + 100;
+  char* const block = static_cast<char*>(AllocateLargePages(size));
+  if (UsesLargePages(size)) {
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(block) % kLargePageSize);
+  }
+  memset(block, 0xBE, size);
+  EXPECT_EQ(static_cast<char>(0xBE), block[size - 1]);
+  FreeLargePages(block);
+}
+
+TEST(LargePageTest, VectorsWithTheAllocatorSwap) {
+  std::vector<int, LargePageAllocator<int> > big(kLargePageSize, -1);
+  std::vector<int, LargePageAllocator<int> > small(10, 7);
+  const int* const big_memory = &big[0];
+  big.swap(small);
+  EXPECT_EQ(big_memory, &small[0]);
+  EXPECT_EQ(10U, big.size());
+  EXPECT_EQ(7, big[9]);
+  EXPECT_EQ(-1, small[kLargePageSize - 1]);
+  small.resize(kLargePageSize / 2);
+  small.push_back(3);
+  EXPECT_EQ(3, small.back());
+}
+
+// Allocates a block of the same kind that a std::vector or new[] would get,
+// for comparison, asking the kernel not to use huge pages for it even if
+// transparent huge pages are enabled for all memory.
+static void* AllocateOrdinaryPages(size_t size) {
+  void* p = NULL;
+#if defined(HAVE_POSIX_MEMALIGN) && defined(MADV_NOHUGEPAGE)
+  EXPECT_EQ(0, posix_memalign(&p, 4096, size));
+  madvise(p, size, MADV_NOHUGEPAGE);
+#else
+  p = malloc(size);
+#endif
+  return p;
+}
+
+// Follows a chain of indexes through a table that is a single random cycle.
+// Every lookup depends on the previous one, so the time per lookup is the
+// latency of a random access, including the TLB miss if there is one, as
+// in BlockHash::FirstMatchingBlock() for a large dictionary.
+static uint32_t FollowChain(const uint32_t* table, int lookups) {
+  uint32_t index = 0;
+  for (int i = 0; i < lookups; ++i) {
+    index = table[index];
+  }
+  return index;
+}
+
+// Prints how long it takes to allocate and fill a table of the size of the
+// index of a large dictionary, and then to look up entries at random, using
+// ordinary pages and AllocateLargePages().  The fill time is what a
+// HashedDictionary pays at load time for page faults; the lookup time is
+// dominated by TLB misses when the table does not use huge pages.
+TEST(LargePageTest, TimingTest) {
+  const size_t kTableEntries = 8 * 1024 * 1024;  // 32 MB
+  const size_t kTableSize = kTableEntries * sizeof(uint32_t);
+  const int kLookups = 2 * 1024 * 1024;
+  // Sattolo's algorithm: a random permutation with a single cycle.
+  std::vector<uint32_t> cycle(kTableEntries);
+  for (size_t i = 0; i < kTableEntries; ++i) {
+    cycle[i] = static_cast<uint32_t>(i);
+  }
+  srand(1);
+  for (size_t i = kTableEntries - 1; i > 0; --i) {
+    const size_t random = (static_cast<size_t>(rand()) << 16) ^
+                          static_cast<size_t>(rand());
+    const size_t j = random % i;
+    const uint32_t swapped = cycle[i];
+    cycle[i] = cycle[j];
+    cycle[j] = swapped;
+  }
+
+  CycleTimer ordinary_fill_timer;
+  ordinary_fill_timer.Start();
+  uint32_t* const ordinary =
+      static_cast<uint32_t*>(AllocateOrdinaryPages(kTableSize));
+  memcpy(ordinary, &cycle[0], kTableSize);
+  ordinary_fill_timer.Stop();
+
+  CycleTimer large_fill_timer;
+  large_fill_timer.Start();
+  uint32_t* const large =
+      static_cast<uint32_t*>(AllocateLargePages(kTableSize));
+  memcpy(large, &cycle[0], kTableSize);
+  large_fill_timer.Stop();
+
+  CycleTimer ordinary_lookup_timer;
+  ordinary_lookup_timer.Start();
+  const uint32_t ordinary_end = FollowChain(ordinary, kLookups);
+  ordinary_lookup_timer.Stop();
+
+  CycleTimer large_lookup_timer;
+  large_lookup_timer.Start();
+  const uint32_t large_end = FollowChain(large, kLookups);
+  large_lookup_timer.Stop();
+
+  EXPECT_EQ(ordinary_end, large_end);
+  std::cout << "Allocating and filling " << (kTableSize >> 20) << " MB: "
+            << ordinary_fill_timer.GetInUsec() << " us with ordinary pages, "
+            << large_fill_timer.GetInUsec() << " us with large pages"
+            << (UsesLargePages(kTableSize) ? "" : " (not supported)")
+            << std::endl;
+  std::cout << "Random lookup: "
+            << (ordinary_lookup_timer.GetInUsec() * 1000.0 / kLookups)
+            << " ns with ordinary pages, "
+            << (large_lookup_timer.GetInUsec() * 1000.0 / kLookups)
+            << " ns with large pages" << std::endl;
+  free(ordinary);
+  FreeLargePages(large);
+}
+
+}  // anonymous namespace
+}  // namespace open_vcdiff
@@ -0,0 +1,91 @@
+// Copyright 2014 The open-vcdiff Authors. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <config.h>
+#include "rolling_hash.h"
+#include <stdint.h>  // uint32_t
+
+namespace open_vcdiff {
+
+// The finalizer of MurmurHash3 applied to (byte_value + 1) times the golden
+// ratio 0x9E3779B9, for each byte value, in 32-bit arithmetic.
+// rolling_hash_test checks that they match.
+const uint32_t kGearHashTable[256] = {
+    0x92CA2F0EU, 0x3CD6E3F3U, 0x1B147DCCU, 0x4C081DBFU,
+    0x487981ABU, 0xDB408C9DU, 0x78BC1B8FU, 0xD83072E5U,
+    0x65CBDD54U, 0x1F4B8CEFU, 0x91783BB0U, 0x0231739BU,
+    0x2AA96DD0U, 0xB42BC0B0U, 0x04E90BF5U, 0xE2AD51BAU,
+    0x79F70494U, 0x010B6880U, 0xA4523835U, 0xCEEB36B7U,
+    0xD939FF68U, 0xB18C6441U, 0xDD507B42U, 0x5DB59265U,
+    0x33469494U, 0xA65D9B7AU, 0x57DCB96BU, 0x1B486183U,
+    0xE411DDC1U, 0x3E2CF241U, 0x9E2EA24FU, 0xB7FBE3E5U,
+    0xA452933AU, 0x1E712332U, 0x52DF2E19U, 0x336BD315U,
+    0x56D396D2U, 0xF857A331U, 0x4FE97DA7U, 0x9B972A46U,
+    0x9D3E0D8AU, 0xA6ECE606U, 0xC5C7990CU, 0x17D886BFU,
+    0x62CE7C21U, 0x827E3843U, 0xB9D7427CU, 0x17891EA1U,
+    0xD0F0E17AU, 0x5139A741U, 0xA3D32F02U, 0xDB12A15CU,
+    0x13B3ABCFU, 0x730C5F25U, 0x1DB71420U, 0xF9435A88U,
+    0x51EE6AF8U, 0xAF1EA67FU, 0x71D9CB92U, 0x3E2C1C4EU,
+    0x1D6722CFU, 0xF9D656F3U, 0x2F16C17EU, 0xF8262992U,
+    0x8E0CE9DFU, 0xAE71F440U, 0x578EC0A1U, 0xFF95D72EU,
+    0x09B28281U, 0xAF7E56B5U, 0x535A0944U, 0xB7E2D8D3U,
+    0xF5E7B311U, 0x974B2094U, 0xC73099C2U, 0xB361D660U,
+    0x171C8432U, 0x7263CAD3U, 0xC661216EU, 0xB1A0EBCAU,
+    0x6B48AA35U, 0x6ED7A14AU, 0xE1FEF49FU, 0x86A1C4E4U,
+    0xF918B5F7U, 0x8A927E91U, 0xCB840F04U, 0xEDDFC8E4U,
+    0xC6A57EEAU, 0x52FB3D10U, 0xA57C5997U, 0x2B1613BCU,
+    0x8A6D276DU, 0x0207F551U, 0xE7A5E850U, 0x13CEA631U,
+    0x1E8C037EU, 0xF2EBE3A2U, 0xEE6E1AC7U, 0x45516E65U,
+    0xF23F1FC4U, 0x40F455EBU, 0xDC72791BU, 0xFC0DF56DU,
+    0xB81049B8U, 0x68F4A814U, 0x7740174DU, 0x8FD60C81U,
+    0x59D7D340U, 0xF20F0D94U, 0xB28913B6U, 0x5B53B292U,
+    0x85F6B629U, 0xF4E7D086U, 0x8D4F664DU, 0x5DEAC120U,
+    0xE12DE03BU, 0x180E3AC5U, 0x53B4B547U, 0x95236D9EU,
+    0xD640B398U, 0x121A5DE7U, 0x00D4705EU, 0xF3ADADE7U,
+    0x394B58D3U, 0x0846CD67U, 0x263FC0DCU, 0x7740D790U,
+    0xEA96DBEEU, 0xC9475489U, 0xD59585DEU, 0x31A2AAEDU,
+    0x27ED7197U, 0x5F277BB1U, 0x99EB0BC5U, 0xFF2AAE5CU,
+    0xDA5A360CU, 0x0AA75661U, 0x649CB1B3U, 0x5EFDAD6BU,
+    0xDD4F68D4U, 0x86A72CA7U, 0x4201F089U, 0xC0CF4C58U,
+    0x4111E2D2U, 0x656DB74EU, 0x20C923ADU, 0x0B1FEAE4U,
+    0x11FC38AFU, 0x75C2DE95U, 0x46511EE8U, 0x1051AB6BU,
+    0x5124132DU, 0xA2BCF41CU, 0x780A25CAU, 0xA77AB8EFU,
+    0x7568DCF2U, 0x0AE6D15BU, 0xCA78A349U, 0xB44BD742U,
+    0x7582DF18U, 0x5411A023U, 0x5A24EC5CU, 0x1B86ACB9U,
+    0xE3045CF5U, 0xC3FCE93EU, 0x68E0E9D5U, 0xB134A60DU,
+    0x473EC5B6U, 0xC7D4310FU, 0x499CE9F2U, 0xE4F07DFEU,
+    0x78C0030CU, 0xD80E4856U, 0x679081D5U, 0x294C18B2U,
+    0xF46A4DA8U, 0x8D4BFDD5U, 0x3CE18773U, 0x164651B0U,
+    0x50ECAF39U, 0x7F54D75FU, 0xE8FA74C9U, 0x55F57765U,
+    0xC1B3D479U, 0xD78EDFBBU, 0xCEE185E4U, 0x8D3308C3U,
+    0xDC5E7B20U, 0x6F8BB72CU, 0x3BA5ECFCU, 0xAA3810B3U,
+    0x8FE02FE6U, 0x59EA6896U, 0x77A409B3U, 0xE4560BA4U,
+    0x1A1CCF8FU, 0x113886BFU, 0xC60F5761U, 0x91B9B088U,
+    0x953A8F2EU, 0xA7322D19U, 0xED6B269AU, 0x81E8ABD6U,
+    0x48ED2806U, 0xFD3CCD9BU, 0xBBB44B1FU, 0x2C74EC81U,
+    0x5E3A84FDU, 0xB16F8D03U, 0xDBB4AD77U, 0xB8A3293BU,
+    0x32128D44U, 0x7E89CBBBU, 0xE974D366U, 0xEB40472BU,
+    0x03896F70U, 0x70194B8FU, 0x1D26D9CAU, 0x25AD6AB3U,
+    0xFE6533B9U, 0xD8791A20U, 0x178C7126U, 0xB6A76525U,
+    0x70A25AF9U, 0xFC638B1DU, 0xE09C6B34U, 0x3AD8CC2FU,
+    0xFEBBF8F6U, 0x1BA4EF3CU, 0xA53929BEU, 0xFCA7A6A6U,
+    0x0B297E98U, 0x1E85EA05U, 0x87937090U, 0x241A1419U,
+    0xFC8E41D5U, 0x7090C36BU, 0xC6FC0ABFU, 0xECFA7355U,
+    0xBCD89F9EU, 0x41CCF740U, 0x5B6FF5E4U, 0xE6E7A8C8U,
+    0xAEA6365AU, 0xC45B4B12U, 0x0DC59E78U, 0x46E44E4CU,
+    0x2F04AEACU, 0xA6F1D794U, 0x8926BC2EU, 0xFF7450DEU,
+    0xED5BCF43U, 0x4C7F81B9U, 0x8987EB0EU, 0x7970D887U
+};
+
+}  // namespace open_vcdiff
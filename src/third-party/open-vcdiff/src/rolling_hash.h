@@ -89,28 +89,34 @@ class RollingHashUtil {
   void operator=(const RollingHashUtil&);
 };
 
+// pow(RollingHashUtil::kMult, exponent) % RollingHashUtil::kBase, as a
+// compile-time constant.  Each step multiplies a value below kBase by kMult,
+// which cannot overflow since kBase <= 2^32/kMult.
+template<int exponent>
+struct RollingHashPower {
+  static const uint32_t value =
+      (RollingHashPower<exponent - 1>::value * RollingHashUtil::kMult) &
+      (RollingHashUtil::kBase - 1);
+};
+
+template<>
+struct RollingHashPower<0> {
+  static const uint32_t value = 1;
+};
+
 // window_size must be >= 2.
 template<int window_size>
 class RollingHash {
  public:
-  // Perform global initialization that is required in order to instantiate a
-  // RollingHash.  This function *must* be called (preferably on startup) by any
-  // program that uses a RollingHash.  It is harmless to call this function more
-  // than once.  It is not thread-safe, but calling it from two different
-  // threads at the same time can only cause a memory leak, not incorrect
-  // behavior.  Make sure to call it before spawning any threads that could use
-  // RollingHash.
-  static void Init();
-
-  // Initialize hasher to maintain a window of the specified size.  You need an
-  // instance of this type to use UpdateHash(), but Hash() does not depend on
-  // remove_table_, so it is static.
-  RollingHash() {
-    if (!remove_table_) {
-      VCD_DFATAL << "RollingHash object instantiated"
-                    " before calling RollingHash::Init()" << VCD_ENDL;
-    }
-  }
+  VCD_COMPILE_ASSERT(window_size >= 2,
+                     RollingHash_window_size_must_be_at_least_2);
+
+  // Nothing needs to be initialized before a RollingHash is used, since the
+  // constant that UpdateHash() needs is computed at compile time.  Init() is
+  // kept so that existing callers need not change.
+  static void Init() { }
+
+  RollingHash() { }
 
   // Compute a hash of the window "ptr[0, window_size - 1]".
   static uint32_t Hash(const char* ptr) {
@@ -144,87 +150,86 @@ class RollingHash {
  protected:
   // Given a full hash value for buffer[0] ... buffer[window_size -1], plus the
   // value of the first byte buffer[0], this function returns a *partial* hash
-  // value for buffer[1] ... buffer[window_size -1].  See the comments in
-  // Init(), below, for a description of how the contents of remove_table_ are
-  // computed.
+  // value for buffer[1] ... buffer[window_size -1].
+  //
+  // The first byte contributed
+  //     (first_byte * pow(kMult, (window_size - 1))) % kBase
+  // to the full hash value, where the power operator "pow" is taken in
+  // integer form, so that is subtracted from it.  The result can then be
+  // merged with the following byte at buffer[window_size] to arrive quickly
+  // at the hash value for a window that has advanced by one byte, to
+  //     buffer[1] ... buffer[window_size]
+  // In fact, that is precisely what happens in UpdateHash, above.
+  //
+  // Since kBase is a power of two that divides 2^32, the unsigned
+  // wraparound of the subtraction does not affect the result of ModBase,
+  // and first_byte * kRemoveMultiplier < 2^8 * kBase does not overflow.
   static uint32_t RemoveFirstByteFromHash(uint32_t full_hash,
                                           unsigned char first_byte) {
-    return RollingHashUtil::ModBase(full_hash + remove_table_[first_byte]);
+    return RollingHashUtil::ModBase(full_hash -
+                                    first_byte * kRemoveMultiplier);
   }
 
  private:
-  // We keep a table that maps from any byte "b" to
-  //    (- b * pow(kMult, window_size - 1)) % kBase
-  static const uint32_t* remove_table_;
+  // pow(kMult, (window_size - 1)) % kBase, computed by the compiler.
+  static const uint32_t kRemoveMultiplier =
+      RollingHashPower<window_size - 1>::value;
 };
 
-// For each window_size, fill a 256-entry table such that
-//        the hash value of buffer[0] ... buffer[window_size - 1]
-//      + remove_table_[buffer[0]]
-//     == the hash value of buffer[1] ... buffer[window_size - 1]
-// See the comments in Init(), below, for a description of how the contents of
-// remove_table_ are computed.
-template<int window_size>
-const uint32_t* RollingHash<window_size>::remove_table_ = NULL;
-
-// Init() checks to make sure that the static object remove_table_ has been
-// initialized; if not, it does the considerable work of populating it.  Once
-// it's ready, the table can be used for any number of RollingHash objects of
-// the same window_size.
+// Maps each byte value to a pseudo-random 32-bit value for GearHash.
+// The values only need to look random, and to be the same in every process.
+// They are generated ahead of time (see rolling_hash.cc).
+extern const uint32_t kGearHashTable[256];
+
+// A hasher with the same interface as RollingHash, whose hash of a window can
+// be updated faster.  Each byte value is mapped to a pseudo-random 32-bit
+// value by kGearHashTable, and the hash value of a window is
+//     XOR over i of (kGearHashTable[ptr[i]] >> (kShift * (window_size-1-i)))
+// Since kShift * window_size == 32, the value of the first byte of the window
+// is shifted out entirely when the next byte is added.  So UpdateHash() does
+// not need the byte that leaves the window nor any modulo arithmetic: the
+// next hash value depends on the previous one through a single shift and XOR,
+// and the table lookup for the new byte is independent of both.
+// The low bits of the hash value, which BlockHash uses as the hash table
+// index, depend on every byte of the window.
 //
+// The hash values are different from those of RollingHash, and are not
+// limited to RollingHashUtil::kBase.  A BlockHash must be searched with
+// hash values from the same hasher that it was built with.
 template<int window_size>
-void RollingHash<window_size>::Init() {
-  VCD_COMPILE_ASSERT(window_size >= 2,
-                     RollingHash_window_size_must_be_at_least_2);
-  if (remove_table_ == NULL) {
-    // The new object is placed into a local pointer instead of directly into
-    // remove_table_, for two reasons:
-    //   1. remove_table_ is a pointer to const.  The table is populated using
-    //      the non-const local pointer and then assigned to the global const
-    //      pointer once it's ready.
-    //   2. No other thread will ever see remove_table_ pointing to a
-    //      partially-initialized table.  If two threads happen to call Init()
-    //      at the same time, two tables with the same contents may be created
-    //      (causing a memory leak), but the results will be consistent
-    //      no matter which of the two tables is used.
-    uint32_t* new_remove_table = new uint32_t[256];
-    // Compute multiplier.  Concisely, it is:
-    //     pow(kMult, (window_size - 1)) % kBase,
-    // but we compute the power in integer form.
-    uint32_t multiplier = 1;
-    for (int i = 0; i < window_size - 1; ++i) {
-      multiplier =
-          RollingHashUtil::ModBase(multiplier * RollingHashUtil::kMult);
-    }
-    // For each character removed_byte, compute
-    //     remove_table_[removed_byte] ==
-    //         (- (removed_byte * pow(kMult, (window_size - 1)))) % kBase
-    // where the power operator "pow" is taken in integer form.
-    //
-    // If you take a hash value fp representing the hash of
-    //     buffer[0] ... buffer[window_size - 1]
-    // and add the value of remove_table_[buffer[0]] to it, the result will be
-    // a partial hash value for
-    //     buffer[1] ... buffer[window_size - 1]
-    // that is to say, it no longer includes buffer[0].
-    //
-    // The following byte at buffer[window_size] can then be merged with this
-    // partial hash value to arrive quickly at the hash value for a window that
-    // has advanced by one byte, to
-    //     buffer[1] ... buffer[window_size]
-    // In fact, that is precisely what happens in UpdateHash, above.
-    uint32_t byte_times_multiplier = 0;
-    for (int removed_byte = 0; removed_byte < 256; ++removed_byte) {
-      new_remove_table[removed_byte] =
-          RollingHashUtil::FindModBaseInverse(byte_times_multiplier);
-      // Iteratively adding the multiplier in this loop is equivalent to
-      // computing (removed_byte * multiplier), and is faster
-      byte_times_multiplier =
-          RollingHashUtil::ModBase(byte_times_multiplier + multiplier);
+class GearHash {
+ public:
+  static const int kShift = 32 / window_size;
+  VCD_COMPILE_ASSERT((window_size >= 2) && (32 % window_size == 0),
+                     GearHash_window_size_must_divide_32);
+
+  // Like RollingHash::Init(), this has nothing left to initialize.
+  static void Init() { }
+
+  GearHash() { }
+
+  // Compute a hash of the window "ptr[0, window_size - 1]".
+  static uint32_t Hash(const char* ptr) {
+    uint32_t h = 0;
+    for (int i = 0; i < window_size; ++i) {
+      h = HashStep(h, ptr[i]);
     }
-    remove_table_ = new_remove_table;
+    return h;
   }
-}
+
+  // The same as RollingHash::UpdateHash().  old_first_byte is not needed,
+  // but is accepted so that both hashers can be used by the same code.
+  uint32_t UpdateHash(uint32_t old_hash,
+                      const char /* old_first_byte */,
+                      const char new_last_byte) const {
+    return HashStep(old_hash, new_last_byte);
+  }
+
+ private:
+  static uint32_t HashStep(uint32_t partial_hash, unsigned char next_byte) {
+    return (partial_hash >> kShift) ^ kGearHashTable[next_byte];
+  }
+};
 
 }  // namespace open_vcdiff
 
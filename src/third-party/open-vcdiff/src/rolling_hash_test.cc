@@ -16,6 +16,7 @@
 #include "rolling_hash.h"
 #include <stdint.h>  // uint32_t
 #include <stdlib.h>  // rand, srand
+#include <string.h>  // memset
 #include <vector>
 #include "testing.h"
 
@@ -51,10 +52,6 @@ class RollingHashSimpleTest : public testing::Test {
   }
 };
 
-#ifdef GTEST_HAS_DEATH_TEST
-typedef RollingHashSimpleTest RollingHashDeathTest;
-#endif  // GTEST_HAS_DEATH_TEST
-
 TEST_F(RollingHashSimpleTest, KBaseIsAPowerOfTwo) {
   EXPECT_EQ(0U, kBase & (kBase - 1));
 }
@@ -83,11 +80,18 @@ TEST_F(RollingHashSimpleTest, VerifyHashFirstTwoBytes) {
   TestHashFirstTwoBytes(0x01, 0x8F);
 }
 
-#ifdef GTEST_HAS_DEATH_TEST
-TEST_F(RollingHashDeathTest, InstantiateRollingHashWithoutCallingInit) {
-  EXPECT_DEBUG_DEATH(RollingHash<16> bad_hash, "Init");
+// kGearHashTable is generated ahead of time from this formula.
+TEST_F(RollingHashSimpleTest, GearHashTableMatchesGenerator) {
+  for (uint32_t byte_value = 0; byte_value < 256; ++byte_value) {
+    uint32_t value = (byte_value + 1) * 0x9E3779B9U;
+    value ^= value >> 16;
+    value *= 0x85EBCA6BU;
+    value ^= value >> 13;
+    value *= 0xC2B2AE35U;
+    value ^= value >> 16;
+    EXPECT_EQ(value, kGearHashTable[byte_value]) << "byte " << byte_value;
+  }
 }
-#endif  // GTEST_HAS_DEATH_TEST
 
 class RollingHashTest : public testing::Test {
  public:
@@ -161,6 +165,23 @@ class RollingHashTest : public testing::Test {
     }
   }
 
+  template<int kBlockSize> void GearUpdateHashMatchesHashForBlockSize() {
+    GearHash<kBlockSize>::Init();
+    GearHash<kBlockSize> hasher;
+    for (int x = 0; x < kUpdateHashTestIterations; ++x) {
+      int random_buffer_size =
+          PortableRandomInRange(kUpdateHashBlocks - 1) + kBlockSize;
+      MakeRandomBuffer(buffer_, random_buffer_size);
+      uint32_t running_hash = hasher.Hash(buffer_);
+      for (int i = kBlockSize; i < random_buffer_size; ++i) {
+        running_hash = hasher.UpdateHash(running_hash,
+                                         buffer_[i - kBlockSize],
+                                         buffer_[i]);
+        EXPECT_EQ(running_hash, hasher.Hash(&buffer_[i + 1 - kBlockSize]));
+      }
+    }
+  }
+
   template<int kBlockSize> double DefaultHashTimingTest() {
     // Execution time is expected to be O(kBlockSize) per hash operation,
     // so scale the number of iterations accordingly
@@ -223,6 +244,34 @@ TEST_F(RollingHashTest, UpdateHashMatchesHashFromScratch) {
   UpdateHashMatchesHashForBlockSize<128>();
 }
 
+TEST_F(RollingHashTest, GearUpdateHashMatchesHashFromScratch) {
+  srand(1);  // test should be deterministic, including calls to rand()
+  GearUpdateHashMatchesHashForBlockSize<4>();
+  GearUpdateHashMatchesHashForBlockSize<8>();
+  GearUpdateHashMatchesHashForBlockSize<16>();
+  GearUpdateHashMatchesHashForBlockSize<32>();
+}
+
+// BlockHash uses the lowest bits of the hash value as the hash table index,
+// so they must not ignore the first bytes of the window.
+TEST_F(RollingHashTest, GearHashLowBitsDependOnEveryByte) {
+  GearHash<16>::Init();
+  char window[16];
+  memset(window, 'a', sizeof(window));
+  const uint32_t original_low_bits = GearHash<16>::Hash(window) & 0xFF;
+  for (int i = 0; i < 16; ++i) {
+    bool low_bits_changed = false;
+    for (int byte_value = 0; byte_value < 256; ++byte_value) {
+      window[i] = static_cast<char>(byte_value);
+      if ((GearHash<16>::Hash(window) & 0xFF) != original_low_bits) {
+        low_bits_changed = true;
+      }
+    }
+    window[i] = 'a';
+    EXPECT_TRUE(low_bits_changed) << "byte " << i;
+  }
+}
+
 TEST_F(RollingHashTest, TimingTests) {
   srand(1);  // test should be deterministic, including calls to rand()
   printf("BlkSize\tHash (us)\tUpdateHash (us)\n");
@@ -14,7 +14,8 @@
 
 #include <config.h>
 #include "varint_bigendian.h"
-#include <stdint.h>  // int32_t, int64_t
+#include <stddef.h>  // ptrdiff_t
+#include <stdint.h>  // int32_t, int64_t, uint64_t
 #include <string.h>  // memcpy
 #include <string>
 #include "logging.h"
@@ -25,6 +26,47 @@ namespace open_vcdiff {
 template<> const int32_t VarintBE<int32_t>::kMaxVal = 0x7FFFFFFF;
 template<> const int64_t VarintBE<int64_t>::kMaxVal = 0x7FFFFFFFFFFFFFFFULL;
 
+// Varints of up to 8 bytes can be parsed and encoded as 64-bit words, by
+// loading or storing all of their bytes at once and moving the 7-bit groups
+// into place with shifts and masks.  This needs the GCC builtins for byte
+// swapping and bit scanning, and a little-endian target, on which the first
+// byte of the varint is the least significant byte of the word.
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define VCD_VARINT_WORD_KERNELS 1
+
+// The high bit of each byte of a word.
+static const uint64_t kContinuationBits = 0x8080808080808080ULL;
+
+// Returns the number of 7-bit groups needed to hold value.
+static inline int VarintLength(uint64_t value) {
+  const int bits = value ? (64 - __builtin_clzll(value)) : 1;
+  return (bits + 6) / 7;
+}
+
+// Takes the bytes of a varint of 8 bytes or less, the last one being the
+// least significant byte of word, and packs their low 7 bits together.
+static inline uint64_t PackVarintGroups(uint64_t word) {
+  word &= ~kContinuationBits;
+  word = (word & 0x007F007F007F007FULL) | ((word & 0x7F007F007F007F00ULL) >> 1);
+  word = (word & 0x00003FFF00003FFFULL) | ((word & 0x3FFF00003FFF0000ULL) >> 2);
+  word = (word & 0x000000000FFFFFFFULL) | ((word & 0x0FFFFFFF00000000ULL) >> 4);
+  return word;
+}
+
+// The reverse of PackVarintGroups(): spreads the low 56 bits of value
+// into the low 7 bits of each byte, without continuation bits.
+static inline uint64_t UnpackVarintGroups(uint64_t value) {
+  value = (value & 0x000000000FFFFFFFULL) |
+          ((value << 4) & 0x0FFFFFFF00000000ULL);
+  value = (value & 0x00003FFF00003FFFULL) |
+          ((value << 2) & 0x3FFF00003FFF0000ULL);
+  value = (value & 0x007F007F007F007FULL) |
+          ((value << 1) & 0x7F007F007F007F00ULL);
+  return value;
+}
+#endif  // __GNUC__ && little-endian
+
 // Reads a variable-length integer from **varint_ptr
 // and returns it in a fixed-length representation.  Increments
 // *varint_ptr by the number of bytes read.  Will not read
@@ -39,6 +81,29 @@ SignedIntegerType VarintBE<SignedIntegerType>::Parse(const char* limit,
   if (!limit) {
     return RESULT_ERROR;
   }
+#ifdef VCD_VARINT_WORD_KERNELS
+  // If there are 8 bytes to read, find the end of the varint among them
+  // without checking the bounds of each byte.  A varint that does not end
+  // within them, because it is 9 bytes long or has leading zero groups,
+  // is left to the loop below.
+  if (limit - *varint_ptr >= static_cast<ptrdiff_t>(sizeof(uint64_t))) {
+    uint64_t word;
+    memcpy(&word, *varint_ptr, sizeof(word));
+    const uint64_t last_bytes = ~word & kContinuationBits;
+    if (last_bytes) {
+      const int length = (__builtin_ctzll(last_bytes) >> 3) + 1;
+      const uint64_t value =
+          PackVarintGroups(__builtin_bswap64(word) >> (64 - 8 * length));
+      // The loop below would find this overflow at one of the continuation
+      // bytes, since the value only grows from one byte to the next.
+      if (value > static_cast<uint64_t>(kMaxVal)) {
+        return RESULT_ERROR;
+      }
+      *varint_ptr += length;
+      return static_cast<SignedIntegerType>(value);
+    }
+  }
+#endif  // VCD_VARINT_WORD_KERNELS
   SignedIntegerType result = 0;
   for (const char* parse_ptr = *varint_ptr; parse_ptr < limit; ++parse_ptr) {
     result += *parse_ptr & 0x7F;
@@ -65,8 +130,20 @@ int VarintBE<SignedIntegerType>::EncodeInternal(SignedIntegerType v,
                   " which requires non-negative argument" << VCD_ENDL;
     return 0;
   }
+#ifdef VCD_VARINT_WORD_KERNELS
+  const int word_length = VarintLength(static_cast<uint64_t>(v));
+  if (word_length <= 8) {
+    // Sets the continuation bit of every byte but the last one.
+    const uint64_t continuation_bits =
+        (kContinuationBits >> (8 * (8 - word_length))) & ~0x80ULL;
+    const uint64_t word = __builtin_bswap64(
+        UnpackVarintGroups(static_cast<uint64_t>(v)) | continuation_bits);
+    memcpy(&varint_buf[kBufferBytes - sizeof(word)], &word, sizeof(word));
+    return word_length;
+  }
+#endif  // VCD_VARINT_WORD_KERNELS
   int length = 1;
-  char* buf_ptr = &varint_buf[kMaxBytes - 1];
+  char* buf_ptr = &varint_buf[kBufferBytes - 1];
   *buf_ptr = static_cast<char>(v & 0x7F);
   --buf_ptr;
   v >>= 7;
@@ -81,27 +158,27 @@ int VarintBE<SignedIntegerType>::EncodeInternal(SignedIntegerType v,
 
 template <typename SignedIntegerType>
 int VarintBE<SignedIntegerType>::Encode(SignedIntegerType v, char* ptr) {
-  char varint_buf[kMaxBytes];
+  char varint_buf[kBufferBytes];
   const int length = EncodeInternal(v, varint_buf);
-  memcpy(ptr, &varint_buf[kMaxBytes - length], length);
+  memcpy(ptr, &varint_buf[kBufferBytes - length], length);
   return length;
 }
 
 template <typename SignedIntegerType>
 void VarintBE<SignedIntegerType>::AppendToString(SignedIntegerType value,
                                                  string* s) {
-  char varint_buf[kMaxBytes];
+  char varint_buf[kBufferBytes];
   const int length = EncodeInternal(value, varint_buf);
-  s->append(&varint_buf[kMaxBytes - length], length);
+  s->append(&varint_buf[kBufferBytes - length], length);
 }
 
 template <typename SignedIntegerType>
 void VarintBE<SignedIntegerType>::AppendToOutputString(
     SignedIntegerType value,
     OutputStringInterface* output_string) {
-  char varint_buf[kMaxBytes];
+  char varint_buf[kBufferBytes];
   const int length = EncodeInternal(value, varint_buf);
-  output_string->append(&varint_buf[kMaxBytes - length], length);
+  output_string->append(&varint_buf[kBufferBytes - length], length);
 }
 
 // Returns the encoding length of the specified value.
@@ -113,12 +190,16 @@ int VarintBE<SignedIntegerType>::Length(SignedIntegerType v) {
                   " which requires non-negative argument" << VCD_ENDL;
     return 0;
   }
+#ifdef VCD_VARINT_WORD_KERNELS
+  return VarintLength(static_cast<uint64_t>(v));
+#else
   int length = 0;
   do {
     v >>= 7;
     ++length;
   } while (v);
   return length;
+#endif  // VCD_VARINT_WORD_KERNELS
 }
 
 template class VarintBE<int32_t>;
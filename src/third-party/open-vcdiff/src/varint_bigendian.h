@@ -22,7 +22,9 @@
 //
 // The implementation found in this file contains buffer bounds checks
 // (not available in sqlite) and its goal is to improve speed
-// by using as few test-and-branch instructions as possible.
+// by using as few test-and-branch instructions as possible.  Where the
+// compiler and byte order allow it, varints of up to 8 bytes are parsed and
+// encoded a word at a time, without a loop over their bytes.
 //
 // The Sqlite format has the refinement that, if a 64-bit value is expected,
 // the ninth byte of the varint does not have a continuation bit, but instead
@@ -112,9 +114,14 @@ class VarintBE {  // BE stands for Big-Endian
                                    OutputStringInterface* output_string);
 
  private:
+  // The size of the buffer passed to EncodeInternal(), which is large enough
+  // for a varint and for an 8-byte word.
+  static const int kBufferBytes = (kMaxBytes > 8) ? kMaxBytes : 8;
+
   // Encodes "v" into the LAST few bytes of varint_buf (which is a char array
-  // of size kMaxBytes) and returns the length of the encoding.
-  // The result will be stored in buf[(kMaxBytes - length) : (kMaxBytes - 1)],
+  // of size kBufferBytes) and returns the length of the encoding.
+  // The result will be stored in
+  // buf[(kBufferBytes - length) : (kBufferBytes - 1)],
   // rather than in buf[0 : length].
   // The value of v must not be negative.
   static int EncodeInternal(SignedIntegerType v, char* varint_buf);
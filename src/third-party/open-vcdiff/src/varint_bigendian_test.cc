@@ -94,6 +94,8 @@ class VarintBETestTemplate : public VarintBETestCommon {
   void TemplateTestDecode31Bits();
   void TemplateTestEncodeDecodeRandom();
   void TemplateTestContinuationBytesPastEndOfInput();
+  void TemplateTestEncodeDecodeWithTrailingData();
+  void TemplateTestParseLeadingZeroGroups();
 };
 
 typedef VarintBETestTemplate<int32_t> VarintBEInt32Test;
@@ -347,5 +349,50 @@ TEMPLATE_TEST_F(Test, ContinuationBytesPastEndOfInput) {
                               &parse_data_ptr_));
 }
 
+// When enough bytes follow a varint, Parse() may read them all at once;
+// it must still stop at the end of the varint.  Tries each value at the
+// boundaries of the varint lengths, followed by continuation bytes.
+TEMPLATE_TEST_F(Test, EncodeDecodeWithTrailingData) {
+  const string trailing_data(parse_data_all_FFs, sizeof(parse_data_all_FFs));
+  for (int bits = 0; bits < static_cast<int>(sizeof(SignedIntType) * 8 - 1);
+       ++bits) {
+    const SignedIntType boundary = static_cast<SignedIntType>(1) << bits;
+    const SignedIntType values[] = { boundary - 1, boundary, boundary + 1 };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+      s_.clear();
+      VarintType::AppendToString(values[i], &s_);
+      const int varint_length = static_cast<int>(s_.length());
+      EXPECT_EQ(VarintType::Length(values[i]), varint_length);
+      s_.append(trailing_data);
+      const char* parse_pointer = s_.data();
+      EXPECT_EQ(values[i], VarintType::Parse(s_.data() + s_.size(),
+                                             &parse_pointer));
+      EXPECT_EQ(s_.data() + varint_length, parse_pointer);
+    }
+  }
+}
+
+TEMPLATE_TEST_F(Test, ParseLeadingZeroGroups) {
+  const char parse_data_leading_zeros[] =
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x81, 0x00,
+      0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+  parse_data_ptr_ = parse_data_leading_zeros;
+  EXPECT_EQ(0x80,
+            VarintType::Parse(parse_data_leading_zeros
+                                  + sizeof(parse_data_leading_zeros),
+                              &parse_data_ptr_));
+  EXPECT_EQ(parse_data_leading_zeros + 11, parse_data_ptr_);
+}
+
+TEST_F(VarintBEInt32Test, Decode32BitsWithTrailingData) {
+  const char parse_data_32_bits[] =
+    { 0x88, 0x80, 0x80, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+  parse_data_ptr_ = parse_data_32_bits;
+  EXPECT_EQ(RESULT_ERROR,
+            VarintType::Parse(parse_data_32_bits + sizeof(parse_data_32_bits),
+                              &parse_data_ptr_));
+  EXPECT_EQ(parse_data_32_bits, parse_data_ptr_);
+}
+
 }  // anonymous namespace
 }  // namespace open_vcdiff
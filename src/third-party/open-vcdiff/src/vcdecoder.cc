@@ -31,7 +31,9 @@
 #include <stddef.h>  // size_t, ptrdiff_t
 #include <stdint.h>  // int32_t
 #include <string.h>  // memcpy, memset
+#include <algorithm>  // std::min, std::upper_bound
 #include <string>
+#include <vector>
 #include "addrcache.h"
 #include "checksum.h"
 #include "codetable.h"
@@ -117,6 +119,8 @@ class VCDiffDeltaFileWindow {
     return reader_.UseCodeTable(code_table_data, max_mode);
   }
 
+  void UseDefaultCodeTable() { reader_.UseDefaultCodeTable(); }
+
   // Decodes a single delta window using the input data from *parseable_chunk.
   // Appends the decoded target window to parent_->decoded_target().  Returns
   // RESULT_SUCCESS if an entire window was decoded, or RESULT_END_OF_DATA if
@@ -153,6 +157,12 @@ class VCDiffDeltaFileWindow {
   // If not in the process of decoding a window, returns 0.
   size_t TargetBytesRemaining();
 
+  // Returns the number of input bytes, counted from the start of the window
+  // header, that the current standard-format window occupies, once its header
+  // has been seen but the rest of the window has not yet arrived.  Otherwise,
+  // returns 0.
+  size_t window_bytes_needed() const { return window_bytes_needed_; }
+
  private:
   // Reads the header of the window section as described in RFC sections 4.2 and
   // 4.3, up to and including the value "Length of addresses for COPYs".  If the
@@ -199,6 +209,29 @@ class VCDiffDeltaFileWindow {
   //
   int DecodeBody(ParseableChunk* parseable_chunk);
 
+  // The instruction loop of DecodeBody(), which runs until the whole target
+  // window has been decoded (returning RESULT_SUCCESS) or cannot go on.  It is
+  // instantiated once for the default code table, whose opcodes are decoded
+  // inline by VCDiffCodeTableReader::GetNextDefaultInstruction(), and once for
+  // custom code tables, which go through GetNextInstruction().
+  template <bool kDefaultCodeTable>
+  int DecodeInstructions(ParseableChunk* parseable_chunk);
+
+  // The loop used instead of DecodeInstructions() for trusted input (please
+  // see VCDiffStreamingDecoder::SetTrustedInput()) once the rest of the
+  // window is available and the source segment is contiguous.  The target
+  // window is sized once, and the instructions write into it through a
+  // pointer.  Only the bounds that keep the reads and writes within the
+  // window, its sections and the source segment are checked; there is no
+  // end-of-data handling, and anything else wrong with the window is left
+  // to the checksum.  Returns RESULT_SUCCESS or RESULT_ERROR.
+  template <bool kDefaultCodeTable>
+  int DecodeTrustedInstructions();
+
+  // Returns true if DecodeTrustedInstructions() may be used for the rest of
+  // the window.
+  bool CanDecodeTrusted() const;
+
   // Returns the number of bytes already decoded into the target window.
   size_t TargetBytesDecoded();
 
@@ -246,6 +279,10 @@ class VCDiffDeltaFileWindow {
   // parent_->decoded_target().
   void CopyBytes(const char* data, size_t size);
 
+  // Executes the part of a COPY instruction that reads from the source
+  // segment, starting size bytes at address within the source segment.
+  void CopySourceBytes(size_t address, size_t size);
+
   // Executes a single RUN instruction, appending data to
   // parent_->decoded_target().
   void RunByte(unsigned char byte, size_t size);
@@ -271,6 +308,11 @@ class VCDiffDeltaFileWindow {
   const char* source_segment_ptr_;
   size_t source_segment_length_;
 
+  // If the source segment spans more than one piece of a segmented
+  // dictionary, source_segment_ptr_ is NULL and this is the position of the
+  // source segment within the dictionary.
+  size_t source_segment_position_;
+
   // The delta encoding window sections as defined in RFC section 4.3.
   // The pointer for each section will be incremented as data is consumed and
   // decoded from that section.  If the interleaved format is used,
@@ -298,6 +340,11 @@ class VCDiffDeltaFileWindow {
   bool has_checksum_;
   VCDChecksum expected_checksum_;
 
+  // See window_bytes_needed().  DecodeWindow() returns RESULT_END_OF_DATA
+  // without parsing the window header again until this much input is
+  // available.
+  size_t window_bytes_needed_;
+
   VCDiffCodeTableReader reader_;
 
   // Making these private avoids implicit copy constructor & assignment operator
@@ -345,12 +392,20 @@ class VCDiffStreamingDecoderImpl {
   //
   void StartDecoding(const char* dictionary_ptr, size_t dictionary_size);
 
+  void StartDecodingWithSegments(const char* const* segment_ptrs,
+                                 const size_t* segment_sizes,
+                                 size_t segment_count);
+
   bool DecodeChunk(const char* data,
                    size_t len,
                    OutputStringInterface* output_string);
 
   bool FinishDecoding();
 
+  bool IndexWindows(const char* data,
+                    size_t len,
+                    std::vector<VCDiffWindowInfo>* windows);
+
   // If true, the version of VCDIFF used in the current delta file allows
   // for the interleaved format, in which instructions, addresses and data
   // are all sent interleaved in the instructions section of each window
@@ -469,6 +524,11 @@ class VCDiffStreamingDecoderImpl {
 
   const char* dictionary_ptr() const { return dictionary_ptr_; }
 
+  // Returns a pointer to the dictionary byte at position, and sets
+  // *available to the number of bytes that follow it contiguously (itself
+  // included).  Returns NULL if position is past the end of the dictionary.
+  const char* DictionaryPiece(size_t position, size_t* available) const;
+
   size_t dictionary_size() const { return dictionary_size_; }
 
   VCDiffAddressCache* addr_cache() { return addr_cache_.get(); }
@@ -486,6 +546,19 @@ class VCDiffStreamingDecoderImpl {
     allow_vcd_target_ = allow_vcd_target;
   }
 
+  bool trusted_input() const { return trusted_input_; }
+
+  void SetTrustedInput(bool trusted_input) {
+    if (start_decoding_was_called_) {
+      VCD_DFATAL << "SetTrustedInput() called after StartDecoding()"
+                 << VCD_ENDL;
+      return;
+    }
+    trusted_input_ = trusted_input;
+  }
+
+  bool SetKnownCodeTable(const char* code_table, size_t code_table_size);
+
  private:
   // Reads the VCDiff delta file header section as described in RFC section 4.1,
   // except the custom code table data.  Returns RESULT_ERROR if an error
@@ -509,6 +582,12 @@ class VCDiffStreamingDecoderImpl {
   //
   int InitCustomCodeTable(const char* data_start, const char* data_end);
 
+  // The same as InitCustomCodeTable(), for the VCD_CODETABLE_FINGERPRINT
+  // flag: parses the custom cache sizes and the checksum of the code table,
+  // and starts using known_code_table_, or the code table built for the
+  // cache sizes, whichever the checksum matches.
+  int InitKnownCodeTable(const char* data_start, const char* data_end);
+
   // If a custom code table was specified in the header section that was parsed
   // by ReadDeltaFileHeader(), this function makes a recursive call to another
   // VCDiffStreamingDecoderImpl object (custom_code_table_decoder_), since the
@@ -535,15 +614,28 @@ class VCDiffStreamingDecoderImpl {
   // target data from any window except the current window.
   void FlushDecodedTarget(OutputStringInterface* output_string);
 
-  // Contents and length of the source (dictionary) data.
+  // Called at the end of a successful DecodeChunk() to keep the input that
+  // parseable_chunk has not consumed yet in unparsed_bytes_.
+  void KeepUnparsedBytes(const ParseableChunk& parseable_chunk);
+
+  // Contents and length of the source (dictionary) data.  dictionary_ptr_
+  // is NULL if the dictionary was given in more than one segment.
   const char* dictionary_ptr_;
   size_t dictionary_size_;
 
+  // The non-empty segments of a segmented dictionary, and their positions
+  // within the dictionary.  Empty unless StartDecodingWithSegments() was
+  // called with more than one segment.
+  std::vector<const char*> dictionary_segment_ptrs_;
+  std::vector<size_t> dictionary_segment_starts_;
+
   // This string will be used to store any unparsed bytes left over when
   // DecodeChunk() reaches the end of its input and returns RESULT_END_OF_DATA.
   // It will also be used to concatenate those unparsed bytes with the data
   // supplied to the next call to DecodeChunk(), so that they appear in
-  // contiguous memory.
+  // contiguous memory.  Once the size of a pending window is known, enough
+  // space is reserved for all of it, so that each input byte is copied into
+  // this string at most once.
   string unparsed_bytes_;
 
   // The portion of the target file that has been decoded so far.  This will be
@@ -565,6 +657,10 @@ class VCDiffStreamingDecoderImpl {
   // Will be NULL unless a custom code table has been defined.
   UNIQUE_PTR<VCDiffCodeTableData> custom_code_table_;
 
+  // The code table given to SetKnownCodeTable(), if any, for delta files
+  // that use VCD_CODETABLE_FINGERPRINT.
+  UNIQUE_PTR<VCDiffCodeTableData> known_code_table_;
+
   // Used to receive the decoded custom code table.
   string custom_code_table_string_;
 
@@ -612,6 +708,10 @@ class VCDiffStreamingDecoderImpl {
   // keep in memory any decoded target data prior to the current window.
   bool allow_vcd_target_;
 
+  // If true, every delta window must have a checksum, which validates what
+  // the lighter checks of DecodeTrustedInstructions() let through.
+  bool trusted_input_;
+
   // Making these private avoids implicit copy constructor & assignment operator
   VCDiffStreamingDecoderImpl(const VCDiffStreamingDecoderImpl&);  // NOLINT
   void operator=(const VCDiffStreamingDecoderImpl&);
@@ -625,7 +725,8 @@ const size_t VCDiffStreamingDecoderImpl::kUnlimitedBytes;
 VCDiffStreamingDecoderImpl::VCDiffStreamingDecoderImpl()
     : maximum_target_file_size_(kDefaultMaximumTargetFileSize),
       maximum_target_window_size_(kDefaultMaximumTargetFileSize),
-      allow_vcd_target_(true) {
+      allow_vcd_target_(true),
+      trusted_input_(false) {
   delta_window_.Init(this);
   Reset();
 }
@@ -637,6 +738,8 @@ void VCDiffStreamingDecoderImpl::Reset() {
   start_decoding_was_called_ = false;
   dictionary_ptr_ = NULL;
   dictionary_size_ = 0;
+  dictionary_segment_ptrs_.clear();
+  dictionary_segment_starts_.clear();
   vcdiff_version_code_ = '\0';
   planned_target_file_size_ = kUnlimitedBytes;
   total_of_target_window_sizes_ = 0;
@@ -662,6 +765,54 @@ void VCDiffStreamingDecoderImpl::StartDecoding(const char* dictionary_ptr,
   start_decoding_was_called_ = true;
 }
 
+void VCDiffStreamingDecoderImpl::StartDecodingWithSegments(
+    const char* const* segment_ptrs,
+    const size_t* segment_sizes,
+    size_t segment_count) {
+  std::vector<const char*> ptrs;
+  std::vector<size_t> starts;
+  size_t dictionary_size = 0;
+  for (size_t i = 0; i < segment_count; ++i) {
+    if (segment_sizes[i] > 0) {
+      ptrs.push_back(segment_ptrs[i]);
+      starts.push_back(dictionary_size);
+      dictionary_size += segment_sizes[i];
+    }
+  }
+  if (start_decoding_was_called_ || (ptrs.size() <= 1)) {
+    // A single piece is an ordinary contiguous dictionary.  (If decoding has
+    // already started, StartDecoding() reports the error.)
+    StartDecoding(ptrs.empty() ? "" : ptrs[0], dictionary_size);
+    return;
+  }
+  StartDecoding(NULL, dictionary_size);
+  dictionary_segment_ptrs_.swap(ptrs);
+  dictionary_segment_starts_.swap(starts);
+}
+
+const char* VCDiffStreamingDecoderImpl::DictionaryPiece(
+    size_t position,
+    size_t* available) const {
+  if (position >= dictionary_size_) {
+    *available = 0;
+    return NULL;
+  }
+  if (dictionary_segment_ptrs_.empty()) {
+    *available = dictionary_size_ - position;
+    return dictionary_ptr_ + position;
+  }
+  // Find the last segment that starts at or before position.
+  const size_t segment = (std::upper_bound(dictionary_segment_starts_.begin(),
+                                           dictionary_segment_starts_.end(),
+                                           position)
+                          - dictionary_segment_starts_.begin()) - 1;
+  const size_t segment_end = (segment + 1 < dictionary_segment_starts_.size())
+      ? dictionary_segment_starts_[segment + 1] : dictionary_size_;
+  *available = segment_end - position;
+  return dictionary_segment_ptrs_[segment]
+      + (position - dictionary_segment_starts_[segment]);
+}
+
 // Reads the VCDiff delta file header section as described in RFC section 4.1:
 //
 //     Header1                                  - byte = 0xD6 (ASCII 'V' | 0x80)
@@ -735,10 +886,20 @@ VCDiffResult VCDiffStreamingDecoderImpl::ReadDeltaFileHeader(
     VCD_ERROR << "Secondary compression is not supported" << VCD_ENDL;
     return RESULT_ERROR;
   }
-  if (header->hdr_indicator & VCD_CODETABLE) {
-    int bytes_parsed = InitCustomCodeTable(
-        data->UnparsedData() + sizeof(DeltaFileHeader),
-        data->End());
+  if (header->hdr_indicator & (VCD_CODETABLE | VCD_CODETABLE_FINGERPRINT)) {
+    int bytes_parsed = RESULT_ERROR;
+    if (header->hdr_indicator & VCD_CODETABLE) {
+      bytes_parsed = InitCustomCodeTable(
+          data->UnparsedData() + sizeof(DeltaFileHeader),
+          data->End());
+    } else if (vcdiff_version_code_ != 'S') {
+      VCD_ERROR << "Code table fingerprint found in a delta file "
+                   "in the standard format" << VCD_ENDL;
+    } else {
+      bytes_parsed = InitKnownCodeTable(
+          data->UnparsedData() + sizeof(DeltaFileHeader),
+          data->End());
+    }
     switch (bytes_parsed) {
       case RESULT_ERROR:
         return RESULT_ERROR;
@@ -751,11 +912,75 @@ VCDiffResult VCDiffStreamingDecoderImpl::ReadDeltaFileHeader(
     addr_cache_.reset(new VCDiffAddressCache);
     // addr_cache_->Init() will be called
     // from VCDiffStreamingDecoderImpl::DecodeChunk()
+    delta_window_.UseDefaultCodeTable();
     data->Advance(sizeof(DeltaFileHeader));
   }
   return RESULT_SUCCESS;
 }
 
+bool VCDiffStreamingDecoderImpl::SetKnownCodeTable(const char* code_table,
+                                                   size_t code_table_size) {
+  if (code_table_size != sizeof(VCDiffCodeTableData)) {
+    VCD_ERROR << "Code table size (" << code_table_size
+              << ") does not match size of a code table ("
+              << sizeof(VCDiffCodeTableData) << ")" << VCD_ENDL;
+    return false;
+  }
+  known_code_table_.reset(new VCDiffCodeTableData);
+  memcpy(known_code_table_.get(), code_table, code_table_size);
+  return true;
+}
+
+int VCDiffStreamingDecoderImpl::InitKnownCodeTable(const char* data_start,
+                                                   const char* data_end) {
+  int32_t near_cache_size = 0, same_cache_size = 0;
+  VCDChecksum code_table_checksum = 0;
+  VCDiffHeaderParser header_parser(data_start, data_end);
+  if (!header_parser.ParseInt32("size of near cache", &near_cache_size)) {
+    return header_parser.GetResult();
+  }
+  if (!header_parser.ParseInt32("size of same cache", &same_cache_size)) {
+    return header_parser.GetResult();
+  }
+  if (!header_parser.ParseChecksum("code table checksum",
+                                   &code_table_checksum)) {
+    return header_parser.GetResult();
+  }
+  // Either the code table given to SetKnownCodeTable(), or the one that
+  // VCDiffStreamingEncoder::SetAddressCacheSizes() builds for the cache sizes.
+  const VCDiffCodeTableData* code_table = NULL;
+  VCDiffCodeTableData built_code_table;
+  if (known_code_table_.get() &&
+      (ComputeAdler32(reinterpret_cast<const char*>(known_code_table_.get()),
+                      sizeof(*known_code_table_)) == code_table_checksum)) {
+    code_table = known_code_table_.get();
+  } else if (VCDiffCodeTableData::BuildForCacheSizes(near_cache_size,
+                                                     same_cache_size,
+                                                     &built_code_table) &&
+             (ComputeAdler32(reinterpret_cast<const char*>(&built_code_table),
+                             sizeof(built_code_table)) ==
+                 code_table_checksum)) {
+    code_table = &built_code_table;
+  } else if (!known_code_table_.get()) {
+    VCD_ERROR << "Delta file uses a code table that was not given "
+                 "to the decoder" << VCD_ENDL;
+    return RESULT_ERROR;
+  } else {
+    VCD_ERROR << "Delta file uses a different code table than the one "
+                 "given to the decoder" << VCD_ENDL;
+    return RESULT_ERROR;
+  }
+  addr_cache_.reset(new VCDiffAddressCache(near_cache_size, same_cache_size));
+  // addr_cache_->Init() will be called
+  // from VCDiffStreamingDecoderImpl::DecodeChunk(), which also rejects
+  // invalid cache sizes; the code table is validated against them here.
+  // UseCodeTable() copies it.
+  if (!delta_window_.UseCodeTable(*code_table, addr_cache_->LastMode())) {
+    return RESULT_ERROR;
+  }
+  return static_cast<int>(header_parser.ParsedSize());
+}
+
 int VCDiffStreamingDecoderImpl::InitCustomCodeTable(const char* data_start,
                                                     const char* data_end) {
   // A custom code table is being specified.  Parse the variable-length
@@ -863,6 +1088,30 @@ void VCDiffStreamingDecoderImpl::AppendNewOutputText(
   }
 }
 
+void VCDiffStreamingDecoderImpl::KeepUnparsedBytes(
+    const ParseableChunk& parseable_chunk) {
+  // Room for the rest of a standard-format window whose header has been seen,
+  // unless that is beyond what any target window may decode to; such a window
+  // is more likely to be bogus, and the string grows only as data arrives.
+  const size_t wanted_capacity = delta_window_.window_bytes_needed();
+  const bool reserve_window = (wanted_capacity > unparsed_bytes_.capacity()) &&
+                              (wanted_capacity <= maximum_target_window_size_);
+  if (!unparsed_bytes_.empty()) {
+    // The chunk was parsed from unparsed_bytes_ itself.  Only drop what was
+    // consumed; while a window is incomplete, that is nothing at all.
+    unparsed_bytes_.erase(0, parseable_chunk.ParsedSize());
+    if (reserve_window) {
+      unparsed_bytes_.reserve(wanted_capacity);
+    }
+  } else {
+    if (reserve_window) {
+      unparsed_bytes_.reserve(wanted_capacity);
+    }
+    unparsed_bytes_.assign(parseable_chunk.UnparsedData(),
+                           parseable_chunk.UnparsedSize());
+  }
+}
+
 bool VCDiffStreamingDecoderImpl::DecodeChunk(
     const char* data,
     size_t len,
@@ -904,12 +1153,79 @@ bool VCDiffStreamingDecoderImpl::DecodeChunk(
     Reset();  // Don't allow further DecodeChunk calls
     return false;
   }
-  unparsed_bytes_.assign(parseable_chunk.UnparsedData(),
-                         parseable_chunk.UnparsedSize());
+  KeepUnparsedBytes(parseable_chunk);
   AppendNewOutputText(output_string);
   return true;
 }
 
+bool VCDiffStreamingDecoderImpl::IndexWindows(
+    const char* data,
+    size_t len,
+    std::vector<VCDiffWindowInfo>* windows) {
+  if (!start_decoding_was_called_) {
+    VCD_DFATAL << "IndexWindows() called without StartDecoding()" << VCD_ENDL;
+    Reset();
+    return false;
+  }
+  if (FoundFileHeader() || !unparsed_bytes_.empty()) {
+    VCD_DFATAL << "IndexWindows() called after DecodeChunk()" << VCD_ENDL;
+    Reset();
+    return false;
+  }
+  windows->clear();
+  ParseableChunk parseable_chunk(data, len);
+  VCDiffResult result = ReadDeltaFileHeader(&parseable_chunk);
+  if (RESULT_SUCCESS == result) {
+    result = ReadCustomCodeTable(&parseable_chunk);
+  }
+  size_t target_offset = 0;
+  while ((RESULT_SUCCESS == result) && !parseable_chunk.Empty()) {
+    // Only the fields up to the length of the delta encoding are needed to
+    // find the next window.
+    VCDiffHeaderParser header_parser(parseable_chunk.UnparsedData(),
+                                     parseable_chunk.End());
+    unsigned char win_indicator = 0;
+    size_t source_segment_length = 0;
+    size_t source_segment_position = 0;
+    size_t target_window_length = 0;
+    if (!header_parser.ParseWinIndicatorAndSourceSegment(
+            dictionary_size_,
+            0,
+            false,  // The target of other windows is not there
+            &win_indicator,
+            &source_segment_length,
+            &source_segment_position) ||
+        !header_parser.ParseWindowLengths(&target_window_length)) {
+      result = header_parser.GetResult();
+      break;
+    }
+    const char* const window_end = header_parser.EndOfDeltaWindow();
+    if (window_end > parseable_chunk.End()) {
+      result = RESULT_END_OF_DATA;
+      break;
+    }
+    VCDiffWindowInfo window;
+    window.delta_offset = parseable_chunk.ParsedSize();
+    window.delta_length = window_end - parseable_chunk.UnparsedData();
+    window.target_offset = target_offset;
+    window.target_length = target_window_length;
+    windows->push_back(window);
+    target_offset += target_window_length;
+    parseable_chunk.SetPosition(window_end);
+  }
+  if (RESULT_END_OF_DATA == result) {
+    VCD_ERROR << "End of data reached while indexing VCDIFF delta file"
+              << VCD_ENDL;
+    result = RESULT_ERROR;
+  }
+  if (RESULT_ERROR == result) {
+    Reset();  // Don't allow further DecodeChunk calls
+    windows->clear();
+    return false;
+  }
+  return true;
+}
+
 // Finishes decoding after all data has been received.  Returns true
 // if decoding of the entire stream was successful.
 bool VCDiffStreamingDecoderImpl::FinishDecoding() {
@@ -980,6 +1296,7 @@ void VCDiffDeltaFileWindow::Reset() {
 
   source_segment_ptr_ = NULL;
   source_segment_length_ = 0;
+  source_segment_position_ = 0;
 
   instructions_and_sizes_.Invalidate();
   data_for_add_and_run_.Invalidate();
@@ -989,6 +1306,8 @@ void VCDiffDeltaFileWindow::Reset() {
 
   has_checksum_ = false;
   expected_checksum_ = 0;
+
+  window_bytes_needed_ = 0;
 }
 
 VCDiffResult VCDiffDeltaFileWindow::SetUpWindowSections(
@@ -1014,11 +1333,14 @@ VCDiffResult VCDiffDeltaFileWindow::SetUpWindowSections(
   } else {
     // If interleaved format is not used, then the whole window contents
     // must be available before decoding can begin.  If only part of
-    // the current window is available, then report end of data
-    // and re-parse the whole header when DecodeChunk() is called again.
-    if (header_parser->UnparsedSize() < (add_and_run_data_length +
-                                         instructions_and_sizes_length +
-                                         addresses_length)) {
+    // the current window is available, then report end of data, and
+    // remember how much input the window needs so that the header is only
+    // parsed again once all of it has arrived.
+    const size_t window_body_length = add_and_run_data_length +
+                                      instructions_and_sizes_length +
+                                      addresses_length;
+    if (header_parser->UnparsedSize() < window_body_length) {
+      window_bytes_needed_ = header_parser->ParsedSize() + window_body_length;
       return RESULT_END_OF_DATA;
     }
     data_for_add_and_run_.Init(header_parser->UnparsedData(),
@@ -1073,6 +1395,11 @@ VCDiffResult VCDiffDeltaFileWindow::ReadHeader(
     return header_parser.GetResult();
   }
   has_checksum_ = parent_->AllowChecksum() && (win_indicator & VCD_CHECKSUM);
+  if (parent_->trusted_input() && !has_checksum_) {
+    VCD_ERROR << "Trusted input requires a checksum in every delta window"
+              << VCD_ENDL;
+    return RESULT_ERROR;
+  }
   if (!header_parser.ParseWindowLengths(&target_window_length_)) {
     return header_parser.GetResult();
   }
@@ -1093,7 +1420,14 @@ VCDiffResult VCDiffDeltaFileWindow::ReadHeader(
   }
   // Get a pointer to the start of the source segment.
   if (win_indicator & VCD_SOURCE) {
-    source_segment_ptr_ = parent_->dictionary_ptr() + source_segment_position;
+    size_t available = 0;
+    source_segment_ptr_ = parent_->DictionaryPiece(source_segment_position,
+                                                   &available);
+    if (available < source_segment_length_) {
+      // The source segment spans several pieces of a segmented dictionary.
+      source_segment_ptr_ = NULL;
+      source_segment_position_ = source_segment_position;
+    }
   } else if (win_indicator & VCD_TARGET) {
     // This assignment must happen after the reserve().
     // decoded_target should not be resized again while processing this window,
@@ -1134,6 +1468,29 @@ inline void VCDiffDeltaFileWindow::CopyBytes(const char* data, size_t size) {
   parent_->decoded_target()->append(data, size);
 }
 
+inline void VCDiffDeltaFileWindow::CopySourceBytes(size_t address,
+                                                   size_t size) {
+  if (source_segment_ptr_) {
+    CopyBytes(&source_segment_ptr_[address], size);
+    return;
+  }
+  size_t position = source_segment_position_ + address;
+  while (size > 0) {
+    size_t available = 0;
+    const char* piece = parent_->DictionaryPiece(position, &available);
+    if (!piece) {
+      // ReadHeader() checked that the source segment fits the dictionary.
+      VCD_DFATAL << "Internal error: COPY past the end of the dictionary"
+                 << VCD_ENDL;
+      return;
+    }
+    const size_t piece_size = (size < available) ? size : available;
+    CopyBytes(piece, piece_size);
+    position += piece_size;
+    size -= piece_size;
+  }
+}
+
 inline void VCDiffDeltaFileWindow::RunByte(unsigned char byte, size_t size) {
   parent_->decoded_target()->append(size, byte);
 }
@@ -1188,14 +1545,14 @@ VCDiffResult VCDiffDeltaFileWindow::DecodeCopy(size_t size,
   size_t address = static_cast<size_t>(decoded_address);
   if ((address + size) <= source_segment_length_) {
     // Copy all data from source segment
-    CopyBytes(&source_segment_ptr_[address], size);
+    CopySourceBytes(address, size);
     return RESULT_SUCCESS;
   }
   // Copy some data from target window...
   if (address < source_segment_length_) {
     // ... plus some data from source segment
     const size_t partial_copy_size = source_segment_length_ - address;
-    CopyBytes(&source_segment_ptr_[address], partial_copy_size);
+    CopySourceBytes(address, partial_copy_size);
     target_bytes_decoded += partial_copy_size;
     address += partial_copy_size;
     size -= partial_copy_size;
@@ -1216,19 +1573,19 @@ VCDiffResult VCDiffDeltaFileWindow::DecodeCopy(size_t size,
   return RESULT_SUCCESS;
 }
 
-int VCDiffDeltaFileWindow::DecodeBody(ParseableChunk* parseable_chunk) {
-  if (IsInterleaved() && (instructions_and_sizes_.UnparsedData()
-                              != parseable_chunk->UnparsedData())) {
-    VCD_DFATAL << "Internal error: interleaved format is used, but the"
-                  " input pointer does not point to the instructions section"
-               << VCD_ENDL;
-    return RESULT_ERROR;
-  }
-  while (TargetBytesDecoded() < target_window_length_) {
+template <bool kDefaultCodeTable>
+int VCDiffDeltaFileWindow::DecodeInstructions(
+    ParseableChunk* parseable_chunk) {
+  // Every instruction that succeeds appends exactly its size to the target,
+  // so the count is kept here rather than asking the output string each time.
+  size_t target_bytes_decoded = TargetBytesDecoded();
+  while (target_bytes_decoded < target_window_length_) {
     int32_t decoded_size = VCD_INSTRUCTION_ERROR;
     unsigned char mode = 0;
     VCDiffInstructionType instruction =
-        reader_.GetNextInstruction(&decoded_size, &mode);
+        kDefaultCodeTable ? reader_.GetNextDefaultInstruction(&decoded_size,
+                                                              &mode)
+                          : reader_.GetNextInstruction(&decoded_size, &mode);
     switch (instruction) {
       case VCD_INSTRUCTION_END_OF_DATA:
         UpdateInstructionPointer(parseable_chunk);
@@ -1243,10 +1600,10 @@ int VCDiffDeltaFileWindow::DecodeBody(ParseableChunk* parseable_chunk) {
     // so check it individually against the limit to protect against
     // overflow when adding it to something else.
     if ((size > target_window_length_) ||
-        ((size + TargetBytesDecoded()) > target_window_length_)) {
+        ((size + target_bytes_decoded) > target_window_length_)) {
       VCD_ERROR << VCDiffInstructionName(instruction)
                 << " with size " << size
-                << " plus existing " << TargetBytesDecoded()
+                << " plus existing " << target_bytes_decoded
                 << " bytes of target data exceeds length of target"
                    " window (" << target_window_length_ << " bytes)"
                 << VCD_ENDL;
@@ -1278,6 +1635,121 @@ int VCDiffDeltaFileWindow::DecodeBody(ParseableChunk* parseable_chunk) {
       case RESULT_SUCCESS:
         break;
     }
+    target_bytes_decoded += size;
+  }
+  return RESULT_SUCCESS;
+}
+
+bool VCDiffDeltaFileWindow::CanDecodeTrusted() const {
+  if (!parent_->trusted_input() ||
+      (!source_segment_ptr_ && (source_segment_length_ > 0))) {
+    return false;
+  }
+  // The interleaved sections are limited to the data received so far.
+  return !IsInterleaved() ||
+         (instructions_and_sizes_.UnparsedSize() >=
+              static_cast<size_t>(interleaved_bytes_expected_));
+}
+
+template <bool kDefaultCodeTable>
+int VCDiffDeltaFileWindow::DecodeTrustedInstructions() {
+  std::string* const decoded_target = parent_->decoded_target();
+  const size_t target_bytes_decoded = TargetBytesDecoded();
+  // ReadHeader() reserved the capacity, so this does not move the target,
+  // to which source_segment_ptr_ may point.
+  decoded_target->resize(target_window_start_pos_ + target_window_length_);
+  char* const target_start = &(*decoded_target)[target_window_start_pos_];
+  char* const target_end = target_start + target_window_length_;
+  char* out = target_start + target_bytes_decoded;
+  while (out < target_end) {
+    int32_t decoded_size = VCD_INSTRUCTION_ERROR;
+    unsigned char mode = 0;
+    const VCDiffInstructionType instruction =
+        kDefaultCodeTable ? reader_.GetNextDefaultInstruction(&decoded_size,
+                                                              &mode)
+                          : reader_.GetNextInstruction(&decoded_size, &mode);
+    size_t size = static_cast<size_t>(decoded_size);
+    if ((instruction > VCD_LAST_INSTRUCTION_TYPE) ||
+        (size > static_cast<size_t>(target_end - out))) {
+      break;
+    }
+    if (instruction == VCD_COPY) {
+      const VCDAddress here_address = static_cast<VCDAddress>(
+          source_segment_length_ + (out - target_start));
+      const VCDAddress decoded_address =
+          parent_->addr_cache()->DecodeAddress(
+              here_address,
+              mode,
+              addresses_for_copy_.UnparsedDataAddr(),
+              addresses_for_copy_.End());
+      if (decoded_address < 0) {
+        break;
+      }
+      size_t address = static_cast<size_t>(decoded_address);
+      if (address < source_segment_length_) {
+        const size_t source_size =
+            std::min(size, source_segment_length_ - address);
+        memcpy(out, &source_segment_ptr_[address], source_size);
+        out += source_size;
+        address += source_size;
+        size -= source_size;
+      }
+      if (size > 0) {
+        const char* from = target_start + (address - source_segment_length_);
+        if (from + size <= out) {
+          memcpy(out, from, size);
+        } else {
+          // The copy overlaps the data it produces.
+          for (size_t i = 0; i < size; ++i) {
+            out[i] = from[i];
+          }
+        }
+        out += size;
+      }
+    } else if (instruction == VCD_ADD) {
+      if (size > data_for_add_and_run_.UnparsedSize()) {
+        break;
+      }
+      memcpy(out, data_for_add_and_run_.UnparsedData(), size);
+      data_for_add_and_run_.Advance(size);
+      out += size;
+    } else if ((instruction == VCD_RUN) && !data_for_add_and_run_.Empty()) {
+      memset(out, *data_for_add_and_run_.UnparsedData(), size);
+      data_for_add_and_run_.Advance(1);
+      out += size;
+    } else {
+      break;
+    }
+  }
+  if (out != target_end) {
+    VCD_ERROR << "Invalid instruction after decoding "
+              << (out - target_start) << " bytes of a trusted target window"
+                 " of " << target_window_length_ << " bytes" << VCD_ENDL;
+    return RESULT_ERROR;
+  }
+  return RESULT_SUCCESS;
+}
+
+int VCDiffDeltaFileWindow::DecodeBody(ParseableChunk* parseable_chunk) {
+  if (IsInterleaved() && (instructions_and_sizes_.UnparsedData()
+                              != parseable_chunk->UnparsedData())) {
+    VCD_DFATAL << "Internal error: interleaved format is used, but the"
+                  " input pointer does not point to the instructions section"
+               << VCD_ENDL;
+    return RESULT_ERROR;
+  }
+  int result = RESULT_SUCCESS;
+  if (CanDecodeTrusted()) {
+    result = reader_.UsingDefaultCodeTable()
+                 ? DecodeTrustedInstructions<true>()
+                 : DecodeTrustedInstructions<false>();
+  } else {
+    result = reader_.UsingDefaultCodeTable()
+                 ? DecodeInstructions<true>(parseable_chunk)
+                 : DecodeInstructions<false>(parseable_chunk);
+  }
+  if (result != RESULT_SUCCESS) {
+    return result;
   }
   if (TargetBytesDecoded() != target_window_length_) {
     VCD_ERROR << "Decoded target window size (" << TargetBytesDecoded()
@@ -1330,6 +1802,9 @@ VCDiffResult VCDiffDeltaFileWindow::DecodeWindow(
     return RESULT_ERROR;
   }
   if (!found_header_) {
+    if (parseable_chunk->UnparsedSize() < window_bytes_needed_) {
+      return RESULT_END_OF_DATA;
+    }
     switch (ReadHeader(parseable_chunk)) {
       case RESULT_END_OF_DATA:
         return RESULT_END_OF_DATA;
@@ -1386,6 +1861,14 @@ void VCDiffStreamingDecoder::StartDecoding(const char* source, size_t len) {
   impl_->StartDecoding(source, len);
 }
 
+void VCDiffStreamingDecoder::StartDecodingWithSegments(
+    const char* const* segment_ptrs,
+    const size_t* segment_sizes,
+    size_t segment_count) {
+  impl_->StartDecodingWithSegments(segment_ptrs, segment_sizes,
+                                   segment_count);
+}
+
 bool VCDiffStreamingDecoder::DecodeChunkToInterface(
     const char* data,
     size_t len,
@@ -1397,6 +1880,13 @@ bool VCDiffStreamingDecoder::FinishDecoding() {
   return impl_->FinishDecoding();
 }
 
+bool VCDiffStreamingDecoder::IndexWindows(
+    const char* data,
+    size_t len,
+    std::vector<VCDiffWindowInfo>* windows) {
+  return impl_->IndexWindows(data, len, windows);
+}
+
 bool VCDiffStreamingDecoder::SetMaximumTargetFileSize(
     size_t new_maximum_target_file_size) {
   return impl_->SetMaximumTargetFileSize(new_maximum_target_file_size);
@@ -1411,6 +1901,15 @@ void VCDiffStreamingDecoder::SetAllowVcdTarget(bool allow_vcd_target) {
   impl_->SetAllowVcdTarget(allow_vcd_target);
 }
 
+void VCDiffStreamingDecoder::SetTrustedInput(bool trusted_input) {
+  impl_->SetTrustedInput(trusted_input);
+}
+
+bool VCDiffStreamingDecoder::SetKnownCodeTable(const char* code_table,
+                                               size_t code_table_size) {
+  return impl_->SetKnownCodeTable(code_table, code_table_size);
+}
+
 bool VCDiffDecoder::DecodeToInterface(const char* dictionary_ptr,
                                       size_t dictionary_size,
                                       const string& encoding,
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <config.h>
+#include <algorithm>  // std::min
 #include "google/vcdecoder.h"
 #include "testing.h"
 #include "vcdecoder_test.h"
@@ -55,6 +56,24 @@ TEST_F(VCDiffStandardDecoderTestByteByByte, DecodeNoVcdTarget) {
   EXPECT_EQ(expected_target_.c_str(), output_);
 }
 
+// Splits a delta file of two windows into chunks of every size, so that a
+// chunk can end anywhere in a window header or body and can also hold the end
+// of one window and the start of the next.
+TEST_F(VCDiffStandardDecoderTestByteByByte, DecodeTwoWindowsInChunks) {
+  const string window = delta_window_header_ + delta_window_body_;
+  delta_file_ = delta_file_header_ + window + window;
+  for (size_t chunk_size = 1; chunk_size <= delta_file_.size(); ++chunk_size) {
+    output_.clear();
+    decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+    for (size_t i = 0; i < delta_file_.size(); i += chunk_size) {
+      const size_t len = std::min(chunk_size, delta_file_.size() - i);
+      EXPECT_TRUE(decoder_.DecodeChunk(&delta_file_[i], len, &output_));
+    }
+    EXPECT_TRUE(decoder_.FinishDecoding());
+    EXPECT_EQ(expected_target_ + expected_target_, output_);
+  }
+}
+
 // Remove one byte from the length of the chunk to process, and
 // verify that an error is returned for FinishDecoding().
 TEST_F(VCDiffStandardDecoderTestByteByByte, FinishAfterDecodingPartialWindow) {
@@ -15,6 +15,8 @@
 #include <config.h>
 #include "google/vcdecoder.h"
 #include <string>
+#include <vector>
+#include "checksum.h"
 #include "codetable.h"
 #include "testing.h"
 #include "vcdecoder_test.h"
@@ -53,6 +55,28 @@ TEST_F(VCDiffDecoderInterleavedAllowedButNotUsed, DecodeWithChecksum) {
   EXPECT_EQ(expected_target_.c_str(), output_);
 }
 
+TEST_F(VCDiffDecoderInterleavedAllowedButNotUsed, DecodeTrusted) {
+  ComputeAndAddChecksum();
+  InitializeDeltaFile();
+  decoder_.SetTrustedInput(true);
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_TRUE(decoder_.DecodeChunk(delta_file_.data(),
+                                   delta_file_.size(),
+                                   &output_));
+  EXPECT_TRUE(decoder_.FinishDecoding());
+  EXPECT_EQ(expected_target_.c_str(), output_);
+}
+
+TEST_F(VCDiffDecoderInterleavedAllowedButNotUsed,
+       DecodeTrustedWithoutChecksumShouldFail) {
+  decoder_.SetTrustedInput(true);
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_FALSE(decoder_.DecodeChunk(delta_file_.data(),
+                                    delta_file_.size(),
+                                    &output_));
+  EXPECT_EQ("", output_);
+}
+
 typedef VCDiffDecoderInterleavedAllowedButNotUsed
     VCDiffDecoderInterleavedAllowedButNotUsedByteByByte;
 
@@ -297,6 +321,49 @@ TEST_F(VCDiffStandardWindowDecoderTest, DecodeChunkNoVcdTargetAllowed) {
   EXPECT_EQ(expected_target_.substr(0, 89).c_str(), output_);
 }
 
+TEST_F(VCDiffStandardWindowDecoderTest, IndexWindowsAndDecodeOneWindow) {
+  // The file header and the first two windows, which take their source from
+  // the dictionary.
+  const size_t delta_size = delta_file_header_.size() + 83;
+  std::vector<VCDiffWindowInfo> windows;
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_TRUE(decoder_.IndexWindows(delta_file_.data(), delta_size, &windows));
+  ASSERT_EQ(2U, windows.size());
+  EXPECT_EQ(delta_file_header_.size(), windows[0].delta_offset);
+  EXPECT_EQ(windows[0].delta_offset + windows[0].delta_length,
+            windows[1].delta_offset);
+  EXPECT_EQ(delta_size, windows[1].delta_offset + windows[1].delta_length);
+  EXPECT_EQ(0U, windows[0].target_offset);
+  EXPECT_EQ(windows[0].target_length, windows[1].target_offset);
+  EXPECT_EQ(89U, windows[1].target_offset + windows[1].target_length);
+  EXPECT_TRUE(decoder_.DecodeChunk(&delta_file_[windows[1].delta_offset],
+                                   windows[1].delta_length,
+                                   &output_));
+  EXPECT_TRUE(decoder_.FinishDecoding());
+  EXPECT_EQ(expected_target_.substr(windows[1].target_offset,
+                                    windows[1].target_length).c_str(),
+            output_);
+}
+
+// The third window copies from the target of the first two, so it cannot be
+// decoded on its own.
+TEST_F(VCDiffStandardWindowDecoderTest, IndexWindowsRejectsVcdTarget) {
+  std::vector<VCDiffWindowInfo> windows;
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_FALSE(decoder_.IndexWindows(delta_file_.data(),
+                                     delta_file_.size(),
+                                     &windows));
+  EXPECT_TRUE(windows.empty());
+}
+
+TEST_F(VCDiffStandardWindowDecoderTest, IndexWindowsOfTruncatedFile) {
+  std::vector<VCDiffWindowInfo> windows;
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_FALSE(decoder_.IndexWindows(delta_file_.data(),
+                                     delta_file_header_.size() + 82,
+                                     &windows));
+}
+
 TEST_F(VCDiffStandardWindowDecoderTest, DecodeInTwoParts) {
   const size_t delta_file_size = delta_file_.size();
   for (size_t i = 1; i < delta_file_size; i++) {
@@ -769,6 +836,44 @@ TEST_F(VCDiffInterleavedCrossDecoderTest, DecodeWithChecksum) {
   EXPECT_EQ(expected_target_.c_str(), output_);
 }
 
+TEST_F(VCDiffInterleavedCrossDecoderTest, DecodeTrusted) {
+  ComputeAndAddChecksum();
+  InitializeDeltaFile();
+  decoder_.SetTrustedInput(true);
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_TRUE(decoder_.DecodeChunk(delta_file_.data(),
+                                   delta_file_.size(),
+                                   &output_));
+  EXPECT_TRUE(decoder_.FinishDecoding());
+  EXPECT_EQ(expected_target_.c_str(), output_);
+}
+
+TEST_F(VCDiffInterleavedCrossDecoderTest,
+       DecodeTrustedWithWrongChecksumShouldFail) {
+  AddChecksum(ComputeAdler32(expected_target_.data(),
+                             expected_target_.size()) ^ 1);
+  InitializeDeltaFile();
+  decoder_.SetTrustedInput(true);
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_FALSE(decoder_.DecodeChunk(delta_file_.data(),
+                                    delta_file_.size(),
+                                    &output_));
+  EXPECT_EQ("", output_);
+}
+
+TEST_F(VCDiffInterleavedCrossDecoderTest,
+       DecodeTrustedAddPastEndOfWindowShouldFail) {
+  ComputeAndAddChecksum();
+  delta_window_body_[1] = 0x7F;  // Size of ADD (127)
+  InitializeDeltaFile();
+  decoder_.SetTrustedInput(true);
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  EXPECT_FALSE(decoder_.DecodeChunk(delta_file_.data(),
+                                    delta_file_.size(),
+                                    &output_));
+  EXPECT_EQ("", output_);
+}
+
 typedef VCDiffInterleavedCrossDecoderTest
     VCDiffInterleavedCrossDecoderTestByteByByte;
 
@@ -781,6 +886,18 @@ TEST_F(VCDiffInterleavedCrossDecoderTestByteByByte, Decode) {
   EXPECT_EQ(expected_target_.c_str(), output_);
 }
 
+TEST_F(VCDiffInterleavedCrossDecoderTestByteByByte, DecodeTrusted) {
+  ComputeAndAddChecksum();
+  InitializeDeltaFile();
+  decoder_.SetTrustedInput(true);
+  decoder_.StartDecoding(dictionary_.data(), dictionary_.size());
+  for (size_t i = 0; i < delta_file_.size(); ++i) {
+    EXPECT_TRUE(decoder_.DecodeChunk(&delta_file_[i], 1, &output_));
+  }
+  EXPECT_TRUE(decoder_.FinishDecoding());
+  EXPECT_EQ(expected_target_.c_str(), output_);
+}
+
 TEST_F(VCDiffInterleavedCrossDecoderTestByteByByte, DecodeWithChecksum) {
   ComputeAndAddChecksum();
   InitializeDeltaFile();
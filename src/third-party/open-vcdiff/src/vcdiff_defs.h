@@ -94,6 +94,12 @@ typedef struct DeltaFileHeader {
 //
 const unsigned char VCD_DECOMPRESS = 0x01;
 const unsigned char VCD_CODETABLE = 0x02;
+// If this flag is set, an application-defined code table is used as with
+// VCD_CODETABLE, but instead of the code table itself, the header contains
+// the near and same cache sizes followed by the Adler32 checksum of the code
+// table, which the decoder must already know.  Not part of the RFC draft
+// standard: only valid in the extended ('S') format.
+const unsigned char VCD_CODETABLE_FINGERPRINT = 0x04;
 
 // The possible values for the Win_Indicator field, as described
 // in section 4.2 of the RFC:
@@ -15,48 +15,362 @@
 #include <config.h>
 #include "vcdiffengine.h"
 #include <stdint.h>  // uint32_t
-#include <string.h>  // memcpy
+#include <string.h>  // memcmp, memcpy
+#include <time.h>  // clock, clock_gettime
+#include <algorithm>  // std::max, std::min
+#include <string>
+#include <vector>
 #include "blockhash.h"
 #include "codetablewriter_interface.h"
+#include "encodetable.h"
+#include "google/output_string.h"
+#include "large_page.h"
 #include "logging.h"
 #include "rolling_hash.h"
+#include "varint_bigendian.h"
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>  // gettimeofday
+#endif  // HAVE_SYS_TIME_H
+
+#ifdef HAVE_WINDOWS_H
+#include <windows.h>  // QueryPerformanceCounter
+#endif  // HAVE_WINDOWS_H
 
 namespace open_vcdiff {
 
+// Returns the current time in microseconds.  Only the difference between
+// two values returned by this function is meaningful.  A monotonic clock is
+// preferred: steps of the wall clock, e.g. by NTP, would otherwise disable
+// the encode time limit or make it expire early.
+static int64_t CurrentTimeInUsec() {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+#elif defined(HAVE_GETTIMEOFDAY)
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_usec;
+#elif defined(HAVE_QUERYPERFORMANCECOUNTER)
+  LARGE_INTEGER frequency, now;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&now);
+  return static_cast<int64_t>(
+      static_cast<double>(now.QuadPart) * 1000000.0
+          / static_cast<double>(frequency.QuadPart));
+#else
+  return static_cast<int64_t>(clock()) * 1000000 / CLOCKS_PER_SEC;
+#endif
+}
+
 VCDiffEngine::VCDiffEngine(const char* dictionary, size_t dictionary_size)
     // If dictionary_size == 0, then dictionary could be NULL.  Guard against
     // using a NULL value.
-    : dictionary_((dictionary_size > 0) ? new char[dictionary_size] : ""),
+    : dictionary_((dictionary_size > 0) ?
+                      static_cast<char*>(AllocateLargePages(dictionary_size)) :
+                      ""),
       dictionary_size_(dictionary_size),
-      hashed_dictionary_(NULL) {
+      hash_type_(VCD_HASH_POLYNOMIAL),
+      hashed_dictionary_(NULL),
+      segments_initialized_(false),
+      one_shot_tables_(NULL) {
   if (dictionary_size > 0) {
     memcpy(const_cast<char*>(dictionary_), dictionary, dictionary_size);
   }
 }
 
+VCDiffEngine::VCDiffEngine(const char* dictionary,
+                           size_t dictionary_size,
+                           VCDiffHashType hash_type)
+    : dictionary_((dictionary_size > 0) ?
+                      static_cast<char*>(AllocateLargePages(dictionary_size)) :
+                      ""),
+      dictionary_size_(dictionary_size),
+      hash_type_(hash_type),
+      hashed_dictionary_(NULL),
+      segments_initialized_(false),
+      one_shot_tables_(NULL) {
+  if (dictionary_size > 0) {
+    memcpy(const_cast<char*>(dictionary_), dictionary, dictionary_size);
+  }
+}
+
+VCDiffEngine::VCDiffEngine(const char* dictionary,
+                           size_t dictionary_size,
+                           BlockHashTables* tables)
+    : dictionary_((dictionary_size > 0) ? dictionary : ""),
+      dictionary_size_(dictionary_size),
+      hash_type_(VCD_HASH_POLYNOMIAL),
+      hashed_dictionary_(NULL),
+      segments_initialized_(false),
+      one_shot_tables_(tables) { }
+
+// Returns the total size of the dictionaries of segments.
+static size_t TotalSegmentSize(const VCDiffEngine* const* segments,
+                               size_t segment_count) {
+  size_t total_size = 0;
+  for (size_t i = 0; i < segment_count; ++i) {
+    total_size += segments[i]->dictionary_size();
+  }
+  return total_size;
+}
+
+VCDiffEngine::VCDiffEngine(const VCDiffEngine* const* segments,
+                           size_t segment_count)
+    : dictionary_(NULL),
+      dictionary_size_(TotalSegmentSize(segments, segment_count)),
+      hash_type_((segment_count > 0) ? segments[0]->hash_type()
+                                     : VCD_HASH_POLYNOMIAL),
+      hashed_dictionary_(NULL),
+      segments_initialized_(false),
+      one_shot_tables_(NULL) {
+  size_t offset = 0;
+  for (size_t i = 0; i < segment_count; ++i) {
+    const VCDiffEngine* segment = segments[i];
+    if (segment->segments_.empty()) {
+      segments_.push_back(segment);
+      segment_offsets_.push_back(offset);
+    } else {
+      // Flatten nested segments, so that Encode() only searches one level.
+      for (size_t j = 0; j < segment->segments_.size(); ++j) {
+        segments_.push_back(segment->segments_[j]);
+        segment_offsets_.push_back(offset + segment->segment_offsets_[j]);
+      }
+    }
+    offset += segment->dictionary_size();
+  }
+  if (segments_.empty()) {
+    // No segments at all: behave like an empty contiguous dictionary.
+    dictionary_ = "";
+  }
+}
+
 VCDiffEngine::~VCDiffEngine() {
   delete hashed_dictionary_;
-  if (dictionary_size_ > 0) {
-    delete[] dictionary_;
+  if (segments_.empty() && !one_shot_tables_ && (dictionary_size_ > 0)) {
+    FreeLargePages(const_cast<char*>(dictionary_));
   }
 }
 
 bool VCDiffEngine::Init() {
-  if (hashed_dictionary_) {
+  if (initialized()) {
     VCD_DFATAL << "Init() called twice for same VCDiffEngine object"
                << VCD_ENDL;
     return false;
   }
-  hashed_dictionary_ = BlockHash::CreateDictionaryHash(dictionary_,
-                                                       dictionary_size());
+  if (!segments_.empty()) {
+    for (size_t i = 0; i < segments_.size(); ++i) {
+      if (!segments_[i]->hashed_dictionary_) {
+        VCD_DFATAL << "Dictionary segment " << i
+                   << " was not initialized" << VCD_ENDL;
+        return false;
+      }
+      // The target data is hashed only once for all the segments.
+      if (segments_[i]->hash_type_ != hash_type_) {
+        VCD_ERROR << "Dictionary segment " << i
+                  << " was hashed with a different hash type" << VCD_ENDL;
+        return false;
+      }
+    }
+    segments_initialized_ = true;
+    return true;
+  }
+  if (one_shot_tables_) {
+    hashed_dictionary_ = BlockHash::CreateOneShotDictionaryHash(
+        dictionary_, dictionary_size(), one_shot_tables_, hash_type_);
+  } else {
+    hashed_dictionary_ = BlockHash::CreateDictionaryHash(dictionary_,
+                                                         dictionary_size(),
+                                                         hash_type_);
+  }
+  if (!hashed_dictionary_) {
+    VCD_DFATAL << "Creation of dictionary hash failed" << VCD_ENDL;
+    return false;
+  }
+  return true;
+}
+
+bool VCDiffEngine::InitFromBase(const VCDiffEngine& base) {
+  if (!segments_.empty() || !base.segments_.empty() || one_shot_tables_) {
+    // There is nothing to reuse between segmented dictionaries, and a
+    // one-shot dictionary always builds its own lighter hash.
+    return Init();
+  }
+  if (initialized()) {
+    VCD_DFATAL << "InitFromBase() called for initialized VCDiffEngine object"
+               << VCD_ENDL;
+    return false;
+  }
+  if (!base.hashed_dictionary_) {
+    VCD_DFATAL << "InitFromBase() called with uninitialized base"
+               << VCD_ENDL;
+    return false;
+  }
+  if ((base.hash_type_ != hash_type_) ||
+      (base.dictionary_size() > dictionary_size()) ||
+      (memcmp(base.dictionary_, dictionary_, base.dictionary_size()) != 0)) {
+    return Init();
+  }
+  hashed_dictionary_ =
+      BlockHash::CreateExtendedDictionaryHash(*base.hashed_dictionary_,
+                                              dictionary_,
+                                              dictionary_size());
   if (!hashed_dictionary_) {
     VCD_DFATAL << "Creation of dictionary hash failed" << VCD_ENDL;
     return false;
   }
-  RollingHash<BlockHash::kBlockSize>::Init();
   return true;
 }
 
+void VCDiffEngine::AppendDictionary(size_t offset,
+                                    size_t size,
+                                    std::string* out) const {
+  if (segments_.empty()) {
+    out->append(dictionary_ + offset, size);
+    return;
+  }
+  for (size_t i = 0; (i < segments_.size()) && (size > 0); ++i) {
+    const size_t segment_end =
+        segment_offsets_[i] + segments_[i]->dictionary_size();
+    if (offset >= segment_end) {
+      continue;
+    }
+    const size_t piece_size = std::min(size, segment_end - offset);
+    out->append(segments_[i]->dictionary_ + (offset - segment_offsets_[i]),
+                piece_size);
+    offset += piece_size;
+    size -= piece_size;
+  }
+}
+
+bool VCDiffEngine::VerifyDictionary(
+    const CodeTableWriterInterface& coder) const {
+  if (segments_.empty()) {
+    return coder.VerifyDictionary(dictionary_, dictionary_size_);
+  }
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    if (!coder.VerifyDictionary(segments_[i]->dictionary_,
+                                segments_[i]->dictionary_size_)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void VCDiffEngine::FindBestSegmentMatch(
+    uint32_t hash_value,
+    const char* target_candidate_start,
+    const char* unencoded_target_start,
+    size_t unencoded_target_size,
+    BlockHash::Match* best_match) const {
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    // The segment hashes report offsets within their own segment.
+    BlockHash::Match segment_match;
+    segments_[i]->hashed_dictionary_->FindBestMatch(hash_value,
+                                                    target_candidate_start,
+                                                    unencoded_target_start,
+                                                    unencoded_target_size,
+                                                    &segment_match);
+    best_match->ReplaceIfBetterMatch(
+        segment_match.size(),
+        segment_match.source_offset()
+            + static_cast<int>(segment_offsets_[i]),
+        segment_match.target_offset());
+  }
+}
+
+inline void VCDiffEngine::PrefetchHashTableEntries(uint32_t hash_value) const {
+  if (segments_.empty()) {
+    hashed_dictionary_->PrefetchHashTableEntry(hash_value);
+    return;
+  }
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    segments_[i]->hashed_dictionary_->PrefetchHashTableEntry(hash_value);
+  }
+}
+
+inline void VCDiffEngine::PrefetchFirstBlocks(uint32_t hash_value) const {
+  if (segments_.empty()) {
+    hashed_dictionary_->PrefetchFirstBlock(hash_value);
+    return;
+  }
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    segments_[i]->hashed_dictionary_->PrefetchFirstBlock(hash_value);
+  }
+}
+
+// Returns true if encoding target_size bytes of target data into
+// encoded_size bytes exceeds the ratio given by
+// EncodeOptions::max_delta_ratio.
+static inline bool IsEncodingTooLarge(size_t encoded_size,
+                                      size_t target_size,
+                                      double max_delta_ratio) {
+  return static_cast<double>(encoded_size) >
+      max_delta_ratio * static_cast<double>(target_size);
+}
+
+// The instructions that the greedy parse finds are passed to the code table
+// writer through these functions.  A CodeTableWriterInterface gets virtual
+// calls; a VCDiffCodeTableWriter is called directly, so that its inline
+// Add() and Copy() are expanded in the match loop.
+static inline void WriteAdd(CodeTableWriterInterface* coder,
+                            const char* data,
+                            size_t size) {
+  coder->Add(data, size);
+}
+
+static inline void WriteAdd(VCDiffCodeTableWriter* coder,
+                            const char* data,
+                            size_t size) {
+  coder->VCDiffCodeTableWriter::Add(data, size);
+}
+
+static inline void WriteCopy(CodeTableWriterInterface* coder,
+                             int32_t offset,
+                             size_t size) {
+  coder->Copy(offset, size);
+}
+
+static inline void WriteCopy(VCDiffCodeTableWriter* coder,
+                             int32_t offset,
+                             size_t size) {
+  coder->VCDiffCodeTableWriter::Copy(offset, size);
+}
+
+template<bool look_for_target_matches>
+inline void VCDiffEngine::FindBestMatch(
+    uint32_t hash_value,
+    const char* target_candidate_start,
+    const char* unencoded_target_start,
+    size_t unencoded_target_size,
+    const BlockHash* target_hash,
+    BlockHash::Match* best_match) const {
+  // First look for a match in the dictionary.
+  if (segments_.empty()) {
+    hashed_dictionary_->FindBestMatch(hash_value,
+                                      target_candidate_start,
+                                      unencoded_target_start,
+                                      unencoded_target_size,
+                                      best_match);
+  } else {
+    FindBestSegmentMatch(hash_value,
+                         target_candidate_start,
+                         unencoded_target_start,
+                         unencoded_target_size,
+                         best_match);
+  }
+  // If target matching is enabled, then see if there is a better match
+  // within the target data that has been encoded so far.
+  if (look_for_target_matches) {
+    target_hash->FindBestMatch(hash_value,
+                               target_candidate_start,
+                               unencoded_target_start,
+                               unencoded_target_size,
+                               best_match);
+  }
+}
+
 // This helper function tries to find an appropriate match within
 // hashed_dictionary_ for the block starting at the current target position.
 // If target_hash is not NULL, this function will also look for a match
@@ -71,35 +385,27 @@ bool VCDiffEngine::Init() {
 //
 // The first four parameters are input parameters which are passed
 // directly to BlockHash::FindBestMatch; please see that function
-// for a description of their allowable values.
-template<bool look_for_target_matches>
+// for a description of their allowable values.  The estimated size of
+// any instructions that are generated is added to *encoded_size_estimate.
+template<class CodeTableWriter, bool look_for_target_matches>
 inline size_t VCDiffEngine::EncodeCopyForBestMatch(
     uint32_t hash_value,
     const char* target_candidate_start,
     const char* unencoded_target_start,
     size_t unencoded_target_size,
     const BlockHash* target_hash,
-    CodeTableWriterInterface* coder) const {
+    CodeTableWriter* coder,
+    size_t* encoded_size_estimate) const {
   // When FindBestMatch() comes up with a match for a candidate block,
   // it will populate best_match with the size, source offset,
   // and target offset of the match.
   BlockHash::Match best_match;
-
-  // First look for a match in the dictionary.
-  hashed_dictionary_->FindBestMatch(hash_value,
-                                    target_candidate_start,
-                                    unencoded_target_start,
-                                    unencoded_target_size,
-                                    &best_match);
-  // If target matching is enabled, then see if there is a better match
-  // within the target data that has been encoded so far.
-  if (look_for_target_matches) {
-    target_hash->FindBestMatch(hash_value,
-                               target_candidate_start,
-                               unencoded_target_start,
-                               unencoded_target_size,
-                               &best_match);
-  }
+  FindBestMatch<look_for_target_matches>(hash_value,
+                                         target_candidate_start,
+                                         unencoded_target_start,
+                                         unencoded_target_size,
+                                         target_hash,
+                                         &best_match);
   if (!ShouldGenerateCopyInstructionForMatchOfSize(best_match.size())) {
     return 0;
   }
@@ -107,9 +413,12 @@ inline size_t VCDiffEngine::EncodeCopyForBestMatch(
     // Create an ADD instruction to encode all target bytes
     // from the end of the last COPY match, if any, up to
     // the beginning of this COPY match.
-    coder->Add(unencoded_target_start, best_match.target_offset());
+    WriteAdd(coder, unencoded_target_start, best_match.target_offset());
+    *encoded_size_estimate +=
+        kEstimatedAddOverhead + best_match.target_offset();
   }
-  coder->Copy(best_match.source_offset(), best_match.size());
+  WriteCopy(coder, best_match.source_offset(), best_match.size());
+  *encoded_size_estimate += kEstimatedCopyOverhead;
   return best_match.target_offset()  // ADD size
        + best_match.size();          // + COPY size
 }
@@ -129,36 +438,34 @@ inline void VCDiffEngine::AddUnmatchedRemainder(
   }
 }
 
-template<bool look_for_target_matches>
-void VCDiffEngine::EncodeInternal(const char* target_data,
-                                  size_t target_size,
-                                  OutputStringInterface* diff,
-                                  CodeTableWriterInterface* coder) const {
-  if (!hashed_dictionary_) {
-    VCD_DFATAL << "Internal error: VCDiffEngine::Encode() "
-                  "called before VCDiffEngine::Init()" << VCD_ENDL;
-    return;
-  }
-  if (target_size == 0) {
-    return;  // Do nothing for empty target
-  }
-  // Special case for really small input
-  if (target_size < static_cast<size_t>(BlockHash::kBlockSize)) {
-    AddUnmatchedRemainder(target_data, target_size, coder);
-    coder->Output(diff);
-    return;
-  }
-  RollingHash<BlockHash::kBlockSize> hasher;
+template<class Hasher, class CodeTableWriter, bool look_for_target_matches,
+         bool prefetch>
+VCDiffEncodeStatusFlags VCDiffEngine::EncodeInternal(
+    const char* target_data,
+    size_t target_size,
+    const EncodeOptions& options,
+    OutputStringInterface* diff,
+    CodeTableWriter* coder) const {
+  VCDiffEncodeStatusFlags status = VCD_ENCODE_OK;
+  // A deadline of zero means that there is no time limit.
+  const int64_t deadline = (options.time_limit_usec > 0) ?
+      CurrentTimeInUsec() + options.time_limit_usec : 0;
+  int positions_until_limit_check = kPositionsPerLimitCheck;
+  // The size of the delta window produced by the instructions generated so
+  // far, as estimated by EncodeCopyForBestMatch().
+  size_t encoded_size_estimate = 0;
+  Hasher hasher;
   BlockHash* target_hash = NULL;
   if (look_for_target_matches) {
     // Check matches against previously encoded target data
     // in this same target window, as well as against the dictionary
     target_hash = BlockHash::CreateTargetHash(target_data,
                                               target_size,
-                                              dictionary_size());
+                                              dictionary_size(),
+                                              hash_type_);
     if (!target_hash) {
       VCD_DFATAL << "Instantiation of target hash failed" << VCD_ENDL;
-      return;
+      return status;
     }
   }
   const char* const target_end = target_data + target_size;
@@ -169,16 +476,47 @@ void VCDiffEngine::EncodeInternal(const char* target_data,
   // candidate_pos points to the start of the kBlockSize-byte block that may
   // begin a match with the dictionary or previously encoded target data.
   const char* candidate_pos = target_data;
-  uint32_t hash_value = hasher.Hash(candidate_pos);
+  // The hash values of the positions from candidate_pos through hashed_pos,
+  // which stays less than kPrefetchDistance positions ahead (or at
+  // candidate_pos without prefetching).  The hash value of the position at
+  // offset i from target_data is in ahead_hashes[i & (kPrefetchDistance - 1)].
+  uint32_t ahead_hashes[kPrefetchDistance];
+  const char* hashed_pos = candidate_pos;
+  ahead_hashes[0] = hasher.Hash(candidate_pos);
+  if (prefetch) {
+    PrefetchHashTableEntries(ahead_hashes[0]);
+  }
+  uint32_t hash_value = ahead_hashes[0];
   while (1) {
+    if (--positions_until_limit_check == 0) {
+      // If a limit has been reached, stop looking for matches and let
+      // AddUnmatchedRemainder() ADD everything that is left.
+      if (deadline && (CurrentTimeInUsec() >= deadline)) {
+        status |= VCD_ENCODE_TIME_LIMIT_REACHED;
+        break;
+      }
+      if (options.max_delta_ratio > 0.0) {
+        const size_t bytes_searched = candidate_pos - target_data;
+        if ((bytes_searched >= target_size / 4) &&
+            IsEncodingTooLarge(encoded_size_estimate
+                                   + (candidate_pos - next_encode),
+                               bytes_searched,
+                               options.max_delta_ratio)) {
+          status |= VCD_ENCODE_TARGET_INCOMPRESSIBLE;
+          break;
+        }
+      }
+      positions_until_limit_check = kPositionsPerLimitCheck;
+    }
     const size_t bytes_encoded =
-        EncodeCopyForBestMatch<look_for_target_matches>(
+        EncodeCopyForBestMatch<CodeTableWriter, look_for_target_matches>(
             hash_value,
             candidate_pos,
             next_encode,
             (target_end - next_encode),
             target_hash,
-            coder);
+            coder,
+            &encoded_size_estimate);
     if (bytes_encoded > 0) {
       next_encode += bytes_encoded;  // Advance past COPYed data
       candidate_pos = next_encode;
@@ -186,8 +524,17 @@ void VCDiffEngine::EncodeInternal(const char* target_data,
         break;  // Reached end of target data
       }
       // candidate_pos has jumped ahead by bytes_encoded bytes, so UpdateHash
-      // can't be used to calculate the hash value at its new position.
-      hash_value = hasher.Hash(candidate_pos);
+      // can't be used to calculate the hash value at its new position,
+      // unless that position was already hashed ahead.
+      if (candidate_pos > hashed_pos) {
+        hashed_pos = candidate_pos;
+        const uint32_t jump_hash_value = hasher.Hash(candidate_pos);
+        ahead_hashes[(candidate_pos - target_data) & (kPrefetchDistance - 1)] =
+            jump_hash_value;
+        if (prefetch) {
+          PrefetchHashTableEntries(jump_hash_value);
+        }
+      }
       if (look_for_target_matches) {
         // Update the target hash for the ADDed and COPYed data
         target_hash->AddAllBlocksThroughIndex(
@@ -204,15 +551,362 @@ void VCDiffEngine::EncodeInternal(const char* target_data,
             static_cast<int>(candidate_pos - target_data),
             hash_value);
       }
-      hash_value = hasher.UpdateHash(hash_value,
-                                     candidate_pos[0],
-                                     candidate_pos[BlockHash::kBlockSize]);
       ++candidate_pos;
     }
+    // Hash the positions up to kPrefetchDistance - 1 ahead, and prefetch the
+    // dictionary entries for them.
+    const char* const hash_limit =
+        std::min(candidate_pos + (prefetch ? (kPrefetchDistance - 1) : 0),
+                 start_of_last_block);
+    while (hashed_pos < hash_limit) {
+      const uint32_t next_hash_value = hasher.UpdateHash(
+          ahead_hashes[(hashed_pos - target_data) & (kPrefetchDistance - 1)],
+          hashed_pos[0],
+          hashed_pos[BlockHash::kBlockSize]);
+      ++hashed_pos;
+      ahead_hashes[(hashed_pos - target_data) & (kPrefetchDistance - 1)] =
+          next_hash_value;
+      if (prefetch) {
+        PrefetchHashTableEntries(next_hash_value);
+      }
+    }
+    if (prefetch) {
+      const char* const halfway_pos = candidate_pos + kPrefetchDistance / 2;
+      if (halfway_pos <= hashed_pos) {
+        PrefetchFirstBlocks(ahead_hashes[(halfway_pos - target_data)
+                                         & (kPrefetchDistance - 1)]);
+      }
+    }
+    hash_value =
+        ahead_hashes[(candidate_pos - target_data) & (kPrefetchDistance - 1)];
   }
   AddUnmatchedRemainder(next_encode, target_end - next_encode, coder);
   coder->Output(diff);
   delete target_hash;
+  if ((options.max_delta_ratio > 0.0) &&
+      IsEncodingTooLarge(encoded_size_estimate + kEstimatedAddOverhead
+                             + (target_end - next_encode),
+                         target_size,
+                         options.max_delta_ratio)) {
+    status |= VCD_ENCODE_TARGET_INCOMPRESSIBLE;
+  }
+  return status;
+}
+
+// The longest match known to start at a position of a target segment, for
+// VCDiffEngine::EncodeOptimal().  A size of 0 means that there is none.
+struct OptimalParseMatch {
+  OptimalParseMatch() : size(0), address(0) { }
+
+  size_t size;
+  int32_t address;
+};
+
+// The largest ADD size that the default code table puts in the opcode of
+// the instruction; a larger ADD is followed by the varint of its size.
+static const size_t kOptimalParseMaxAddSizeInOpcode = 17;
+
+// The cost of a position that cannot begin a COPY.
+static const uint32_t kOptimalParseNoCopy = 0xFFFFFFFF;
+
+// The value of a SuffixCostTree node that covers no position yet.
+static const uint64_t kOptimalParseNoEntry = ~static_cast<uint64_t>(0);
+
+// A segment tree over the estimated sizes of the encodings of the suffixes
+// of a target segment, which finds the cheapest position at which to end an
+// instruction among all the sizes that it may have.
+class SuffixCostTree {
+ public:
+  explicit SuffixCostTree(size_t size) : leaves_(1) {
+    while (leaves_ < size) {
+      leaves_ <<= 1;
+    }
+    nodes_.assign(2 * leaves_, kOptimalParseNoEntry);
+  }
+
+  // Sets the estimated size of the encoding of the suffix at position.
+  void Set(size_t position, uint32_t cost) {
+    size_t node = leaves_ + position;
+    nodes_[node] = (static_cast<uint64_t>(cost) << 32)
+        | (0xFFFFFFFFU - static_cast<uint32_t>(position));
+    for (node >>= 1; node > 0; node >>= 1) {
+      nodes_[node] = std::min(nodes_[2 * node], nodes_[2 * node + 1]);
+    }
+  }
+
+  // Finds the position from first through last whose suffix has the
+  // smallest estimated size.  Of several such positions, the last one is
+  // taken, so that instructions are as long as they can be.  Returns false
+  // if none of the positions has been Set().
+  bool FindCheapest(size_t first, size_t last, size_t* position) const {
+    uint64_t cheapest = kOptimalParseNoEntry;
+    for (first += leaves_, last += leaves_ + 1; first < last;
+         first >>= 1, last >>= 1) {
+      if (first & 1) {
+        cheapest = std::min(cheapest, nodes_[first++]);
+      }
+      if (last & 1) {
+        cheapest = std::min(cheapest, nodes_[--last]);
+      }
+    }
+    if (cheapest == kOptimalParseNoEntry) {
+      return false;
+    }
+    *position = 0xFFFFFFFFU - static_cast<uint32_t>(cheapest & 0xFFFFFFFFU);
+    return true;
+  }
+
+ private:
+  size_t leaves_;
+
+  // A binary heap: node n has children 2n and 2n + 1, and leaves_ + p is the
+  // leaf of position p.  Each node holds the estimated size in its upper 32
+  // bits and the complement of the position in its lower 32 bits, so that the
+  // smallest value is the cheapest and then the last position.
+  std::vector<uint64_t> nodes_;
+};
+
+// Chooses the sequence of ADD and COPY instructions with the smallest
+// estimated size for the segment_size bytes at segment_data, given the
+// longest match that starts at each of them, and passes it to coder.  here
+// is the address of segment_data in the concatenation of the dictionary and
+// the target window.  Returns the estimated size of the instructions.
+//
+// The estimated size of an instruction counts its opcode and the varint of
+// its size, which the default code table puts in the opcode instead for
+// ADDs of up to kOptimalParseMaxAddSizeInOpcode bytes, but never for COPYs
+// of kMinimumMatchSize bytes or more.  An ADD also counts its data, and a
+// COPY the varint of the smaller of its VCD_SELF and VCD_HERE addresses.
+// The near and same caches of the address cache can only make it smaller.
+//
+// The sizes that fit in the opcode cost the same, and so do all the sizes
+// from class_first to (class_first << 7) - 1, whose varints have the same
+// length; for each such class only the cheapest place to end an
+// instruction needs to be considered.  An ADD is followed by a COPY
+// or by the end of the segment, since two ADDs cost more than one.
+static size_t WriteOptimalParse(const char* segment_data,
+                                size_t segment_size,
+                                int32_t here,
+                                const std::vector<OptimalParseMatch>& matches,
+                                CodeTableWriterInterface* coder) {
+  // For each position, the smallest estimated size of the encoding of the
+  // data from there on (start_costs); the estimated size of that encoding
+  // and the size of its first instruction if it begins with a COPY
+  // (copy_costs and copy_sizes); and the size of the first instruction of
+  // the cheapest encoding that begins with an ADD (add_sizes).
+  std::vector<uint32_t> start_costs(segment_size + 1, 0);
+  std::vector<uint32_t> copy_costs(segment_size, kOptimalParseNoCopy);
+  std::vector<uint32_t> copy_sizes(segment_size, 0);
+  std::vector<uint32_t> add_sizes(segment_size, 0);
+  // The cheapest place to end a COPY is found among the start_costs, and
+  // that to end an ADD among the copy_costs plus the position, which
+  // accounts for the data of the ADD.
+  SuffixCostTree suffix_costs(segment_size + 1);
+  SuffixCostTree add_end_costs(segment_size + 1);
+  suffix_costs.Set(segment_size, 0);
+  add_end_costs.Set(segment_size, static_cast<uint32_t>(segment_size));
+  for (size_t i = segment_size; i-- > 0; ) {
+    const OptimalParseMatch& match = matches[i];
+    uint32_t copy_cost = kOptimalParseNoCopy;
+    if (match.size >= VCDiffEngine::kMinimumMatchSize) {
+      const int32_t address = match.address;
+      const int32_t here_offset = here + static_cast<int32_t>(i) - address;
+      const uint32_t address_cost =
+          std::min(VarintBE<int32_t>::Length(address),
+                   VarintBE<int32_t>::Length(here_offset));
+      uint32_t size_cost = 1;
+      for (size_t class_first = 1; class_first <= match.size;
+           class_first <<= 7, ++size_cost) {
+        const size_t first =
+            (class_first > VCDiffEngine::kMinimumMatchSize) ?
+                class_first : VCDiffEngine::kMinimumMatchSize;
+        const size_t last = std::min((class_first << 7) - 1, match.size);
+        size_t end;
+        if ((first > last) ||
+            !suffix_costs.FindCheapest(i + first, i + last, &end)) {
+          continue;
+        }
+        const uint32_t cost =
+            1 + size_cost + address_cost + start_costs[end];
+        if (cost <= copy_cost) {
+          copy_cost = cost;
+          copy_sizes[i] = static_cast<uint32_t>(end - i);
+        }
+      }
+    }
+    copy_costs[i] = copy_cost;
+    uint32_t add_cost = kOptimalParseNoCopy;
+    const size_t add_size_limit = segment_size - i;
+    uint32_t size_cost = 0;
+    for (size_t first = 1, last = kOptimalParseMaxAddSizeInOpcode;
+         first <= add_size_limit;
+         first = last + 1, last = (last < 127) ? 127 : ((last << 7) | 127),
+             ++size_cost) {
+      size_t end;
+      if (!add_end_costs.FindCheapest(i + first,
+                                      i + std::min(last, add_size_limit),
+                                      &end)) {
+        continue;
+      }
+      const uint32_t cost = 1 + size_cost + static_cast<uint32_t>(end - i) +
+          ((end < segment_size) ? copy_costs[end] : 0);
+      if (cost < add_cost) {
+        add_cost = cost;
+        add_sizes[i] = static_cast<uint32_t>(end - i);
+      }
+    }
+    start_costs[i] = std::min(add_cost, copy_cost);
+    suffix_costs.Set(i, start_costs[i]);
+    if (copy_cost != kOptimalParseNoCopy) {
+      add_end_costs.Set(i, copy_cost + static_cast<uint32_t>(i));
+    }
+  }
+  // Follow the choices made above from the start of the segment.  An ADD
+  // was costed with a COPY after it, so that COPY is taken even where
+  // another ADD would look as cheap on its own.
+  bool after_add = false;
+  size_t i = 0;
+  while (i < segment_size) {
+    if (after_add || (copy_costs[i] <= start_costs[i])) {
+      coder->Copy(matches[i].address, copy_sizes[i]);
+      i += copy_sizes[i];
+      after_add = false;
+    } else {
+      coder->Add(segment_data + i, add_sizes[i]);
+      i += add_sizes[i];
+      after_add = true;
+    }
+  }
+  return start_costs[0];
+}
+
+// Looks for the longest match at every position of the target window, one
+// segment of at most kOptimalParseSegmentSize bytes at a time, and lets
+// WriteOptimalParse() choose the instructions for the segment.  Each search
+// may extend a match backwards by up to kBlockSize - 1 bytes, which finds
+// the matches that start at a position whose block is not aligned in the
+// dictionary.  A match at a position also gives a match for each of the
+// following positions that it covers, by dropping its first bytes.
+template<class Hasher, bool look_for_target_matches>
+VCDiffEncodeStatusFlags VCDiffEngine::EncodeOptimal(
+    const char* target_data,
+    size_t target_size,
+    const EncodeOptions& options,
+    OutputStringInterface* diff,
+    CodeTableWriterInterface* coder) const {
+  VCDiffEncodeStatusFlags status = VCD_ENCODE_OK;
+  // A deadline of zero means that there is no time limit.
+  const int64_t deadline = (options.time_limit_usec > 0) ?
+      CurrentTimeInUsec() + options.time_limit_usec : 0;
+  int positions_until_limit_check = kPositionsPerLimitCheck;
+  size_t encoded_size_estimate = 0;
+  Hasher hasher;
+  BlockHash* target_hash = NULL;
+  if (look_for_target_matches) {
+    target_hash = BlockHash::CreateTargetHash(target_data,
+                                              target_size,
+                                              dictionary_size(),
+                                              hash_type_);
+    if (!target_hash) {
+      VCD_DFATAL << "Instantiation of target hash failed" << VCD_ENDL;
+      return status;
+    }
+  }
+  const char* const target_end = target_data + target_size;
+  const char* const start_of_last_block = target_end - BlockHash::kBlockSize;
+  std::vector<OptimalParseMatch> matches;
+  bool searching = true;
+  uint32_t hash_value = hasher.Hash(target_data);
+  for (const char* segment_data = target_data; segment_data < target_end;
+       segment_data += kOptimalParseSegmentSize) {
+    if (!searching) {
+      // A limit has been reached: ADD everything that is left.
+      AddUnmatchedRemainder(segment_data, target_end - segment_data, coder);
+      encoded_size_estimate +=
+          kEstimatedAddOverhead + (target_end - segment_data);
+      break;
+    }
+    const size_t bytes_left = target_end - segment_data;
+    const size_t segment_size = (bytes_left < kOptimalParseSegmentSize) ?
+        bytes_left : kOptimalParseSegmentSize;
+    const char* const segment_end = segment_data + segment_size;
+    matches.assign(segment_size, OptimalParseMatch());
+    // The end of the longest match found so far in this segment.
+    const char* match_end = segment_data;
+    for (const char* pos = segment_data;
+         (pos < segment_end) && (pos <= start_of_last_block); ++pos) {
+      if (searching && (--positions_until_limit_check == 0)) {
+        if (deadline && (CurrentTimeInUsec() >= deadline)) {
+          status |= VCD_ENCODE_TIME_LIMIT_REACHED;
+          searching = false;
+        }
+        positions_until_limit_check = kPositionsPerLimitCheck;
+      }
+      // The block at pos must lie within the segment.
+      if (searching && (pos + BlockHash::kBlockSize <= segment_end) &&
+          (pos + kOptimalParseLongMatchSize > match_end)) {
+        const char* const search_start =
+            std::max(segment_data, pos - (BlockHash::kBlockSize - 1));
+        BlockHash::Match best_match;
+        FindBestMatch<look_for_target_matches>(hash_value,
+                                               pos,
+                                               search_start,
+                                               segment_end - search_start,
+                                               target_hash,
+                                               &best_match);
+        if (ShouldGenerateCopyInstructionForMatchOfSize(best_match.size())) {
+          const char* const match_start =
+              search_start + best_match.target_offset();
+          OptimalParseMatch* match = &matches[match_start - segment_data];
+          if (best_match.size() > match->size) {
+            match->size = best_match.size();
+            match->address = best_match.source_offset();
+          }
+          match_end = std::max(match_end, match_start + best_match.size());
+        }
+      }
+      if (look_for_target_matches) {
+        target_hash->AddOneIndexHash(static_cast<int>(pos - target_data),
+                                     hash_value);
+      }
+      if (pos < start_of_last_block) {
+        hash_value = hasher.UpdateHash(hash_value,
+                                       pos[0],
+                                       pos[BlockHash::kBlockSize]);
+      }
+    }
+    for (size_t i = 1; i < segment_size; ++i) {
+      if (matches[i - 1].size > matches[i].size + 1) {
+        matches[i].size = matches[i - 1].size - 1;
+        matches[i].address = matches[i - 1].address + 1;
+      }
+    }
+    encoded_size_estimate += WriteOptimalParse(
+        segment_data,
+        segment_size,
+        static_cast<int32_t>(dictionary_size() + (segment_data - target_data)),
+        matches,
+        coder);
+    if (searching && (options.max_delta_ratio > 0.0)) {
+      const size_t bytes_searched = segment_end - target_data;
+      if ((bytes_searched >= target_size / 4) &&
+          IsEncodingTooLarge(encoded_size_estimate,
+                             bytes_searched,
+                             options.max_delta_ratio)) {
+        status |= VCD_ENCODE_TARGET_INCOMPRESSIBLE;
+        searching = false;
+      }
+    }
+  }
+  coder->Output(diff);
+  delete target_hash;
+  if ((options.max_delta_ratio > 0.0) &&
+      IsEncodingTooLarge(encoded_size_estimate,
+                         target_size,
+                         options.max_delta_ratio)) {
+    status |= VCD_ENCODE_TARGET_INCOMPRESSIBLE;
+  }
+  return status;
 }
 
 void VCDiffEngine::Encode(const char* target_data,
@@ -220,11 +914,135 @@ void VCDiffEngine::Encode(const char* target_data,
                           bool look_for_target_matches,
                           OutputStringInterface* diff,
                           CodeTableWriterInterface* coder) const {
-  if (look_for_target_matches) {
-    EncodeInternal<true>(target_data, target_size, diff, coder);
+  EncodeOptions options;
+  options.look_for_target_matches = look_for_target_matches;
+  Encode(target_data, target_size, options, diff, coder);
+}
+
+template<class CodeTableWriter>
+VCDiffEncodeStatusFlags VCDiffEngine::EncodeWithWriter(
+    const char* target_data,
+    size_t target_size,
+    const EncodeOptions& options,
+    OutputStringInterface* diff,
+    CodeTableWriter* coder) const {
+  if (!initialized()) {
+    VCD_DFATAL << "Internal error: VCDiffEngine::Encode() "
+                  "called before VCDiffEngine::Init()" << VCD_ENDL;
+    return VCD_ENCODE_OK;
+  }
+  if (target_size == 0) {
+    return VCD_ENCODE_OK;  // Do nothing for empty target
+  }
+  // Special case for really small input
+  if (target_size < static_cast<size_t>(BlockHash::kBlockSize)) {
+    AddUnmatchedRemainder(target_data, target_size, coder);
+    coder->Output(diff);
+    return VCD_ENCODE_OK;
+  }
+  if (hash_type_ == VCD_HASH_GEAR) {
+    typedef GearHash<BlockHash::kBlockSize> Hasher;
+    return EncodeWithHasher<Hasher, CodeTableWriter>(
+        target_data, target_size, options, diff, coder);
+  }
+  typedef RollingHash<BlockHash::kBlockSize> Hasher;
+  return EncodeWithHasher<Hasher, CodeTableWriter>(
+      target_data, target_size, options, diff, coder);
+}
+
+template<class Hasher, class CodeTableWriter>
+VCDiffEncodeStatusFlags VCDiffEngine::EncodeWithHasher(
+    const char* target_data,
+    size_t target_size,
+    const EncodeOptions& options,
+    OutputStringInterface* diff,
+    CodeTableWriter* coder) const {
+  if (options.optimal_parse) {
+    return EncodeOptimalOrGreedy<Hasher, CodeTableWriter>(
+        target_data, target_size, options, diff, coder);
+  }
+  const bool prefetch = (dictionary_size() >= kMinPrefetchDictionarySize);
+  if (options.look_for_target_matches) {
+    if (prefetch) {
+      return EncodeInternal<Hasher, CodeTableWriter, true, true>(
+          target_data, target_size, options, diff, coder);
+    }
+    return EncodeInternal<Hasher, CodeTableWriter, true, false>(
+        target_data, target_size, options, diff, coder);
+  } else {
+    if (prefetch) {
+      return EncodeInternal<Hasher, CodeTableWriter, false, true>(
+          target_data, target_size, options, diff, coder);
+    }
+    return EncodeInternal<Hasher, CodeTableWriter, false, false>(
+        target_data, target_size, options, diff, coder);
+  }
+}
+
+template<class Hasher, class CodeTableWriter>
+VCDiffEncodeStatusFlags VCDiffEngine::EncodeOptimalOrGreedy(
+    const char* target_data,
+    size_t target_size,
+    const EncodeOptions& options,
+    OutputStringInterface* diff,
+    CodeTableWriter* coder) const {
+  const int64_t start_time =
+      (options.time_limit_usec > 0) ? CurrentTimeInUsec() : 0;
+  EncodeOptions greedy_options = options;
+  greedy_options.optimal_parse = false;
+  std::string greedy_window;
+  OutputString<std::string> greedy_output(&greedy_window);
+  const VCDiffEncodeStatusFlags greedy_status =
+      EncodeWithHasher<Hasher, CodeTableWriter>(target_data, target_size,
+                                                greedy_options,
+                                                &greedy_output, coder);
+  // The optimal parse gets what is left of the time limit.
+  EncodeOptions optimal_options = options;
+  if (options.time_limit_usec > 0) {
+    optimal_options.time_limit_usec -= CurrentTimeInUsec() - start_time;
+    if (optimal_options.time_limit_usec <= 0) {
+      diff->append(greedy_window.data(), greedy_window.size());
+      return greedy_status | VCD_ENCODE_TIME_LIMIT_REACHED;
+    }
+  }
+  // The optimal parse spends its time searching for matches, not writing
+  // instructions, so it always goes through CodeTableWriterInterface.
+  std::string optimal_window;
+  OutputString<std::string> optimal_output(&optimal_window);
+  VCDiffEncodeStatusFlags optimal_status;
+  if (options.look_for_target_matches) {
+    optimal_status = EncodeOptimal<Hasher, true>(target_data, target_size,
+                                                 optimal_options,
+                                                 &optimal_output, coder);
   } else {
-    EncodeInternal<false>(target_data, target_size, diff, coder);
+    optimal_status = EncodeOptimal<Hasher, false>(target_data, target_size,
+                                                  optimal_options,
+                                                  &optimal_output, coder);
+  }
+  if (greedy_window.size() < optimal_window.size()) {
+    diff->append(greedy_window.data(), greedy_window.size());
+    return greedy_status;
   }
+  diff->append(optimal_window.data(), optimal_window.size());
+  return optimal_status;
+}
+
+VCDiffEncodeStatusFlags VCDiffEngine::Encode(
+    const char* target_data,
+    size_t target_size,
+    const EncodeOptions& options,
+    OutputStringInterface* diff,
+    CodeTableWriterInterface* coder) const {
+  return EncodeWithWriter(target_data, target_size, options, diff, coder);
+}
+
+VCDiffEncodeStatusFlags VCDiffEngine::EncodeToVCDiffWriter(
+    const char* target_data,
+    size_t target_size,
+    const EncodeOptions& options,
+    OutputStringInterface* diff,
+    VCDiffCodeTableWriter* coder) const {
+  return EncodeWithWriter(target_data, target_size, options, diff, coder);
 }
 
 }  // namespace open_vcdiff
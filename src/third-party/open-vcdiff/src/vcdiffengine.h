@@ -17,13 +17,17 @@
 
 #include <config.h>
 #include <stddef.h>  // size_t
-#include <stdint.h>  // uint32_t
+#include <stdint.h>  // int64_t, uint32_t
+#include <string>
+#include <vector>
+#include "blockhash.h"  // BlockHash::Match
+#include "google/vcencoder.h"  // VCDiffEncodeStatusFlags
 
 namespace open_vcdiff {
 
-class BlockHash;
 class OutputStringInterface;
 class CodeTableWriterInterface;
+class VCDiffCodeTableWriter;
 
 // The VCDiffEngine class is used to find the optimal encoding (in terms of COPY
 // and ADD instructions) for a given dictionary and target window.  To write the
@@ -37,8 +41,105 @@ class VCDiffEngine {
   // aligned on block boundaries in the dictionary text.
   static const size_t kMinimumMatchSize = 32;
 
+  // The number of candidate positions that the encoder examines between two
+  // checks of the limits given in EncodeOptions.
+  static const int kPositionsPerLimitCheck = 1024;
+
+  // The encoder computes the hash values of the candidate positions up to
+  // this many positions ahead of the current one, and prefetches the
+  // dictionary hash table elements for them as soon as they are known.
+  // Halfway there, it prefetches the first block of their chains.  This way
+  // the lookups at the current position rarely wait for memory.  It must be
+  // a power of two.
+  static const int kPrefetchDistance = 16;
+
+  // Prefetching is only done for dictionaries of at least this size.  The
+  // hash and the data of smaller dictionaries mostly stay in the processor
+  // caches, and there the extra work costs more than it saves.
+  static const size_t kMinPrefetchDictionarySize = 16 << 20;
+
+  // Rough estimates of the number of bytes, in addition to any ADD data,
+  // that an ADD or COPY instruction adds to the delta window.  They are
+  // used to estimate the size of the encoding for
+  // EncodeOptions::max_delta_ratio.
+  static const size_t kEstimatedAddOverhead = 2;
+  static const size_t kEstimatedCopyOverhead = 4;
+
+  // With EncodeOptions::optimal_parse, the target window is parsed in
+  // pieces of at most this many bytes, which bounds the working memory to
+  // about 100 bytes per byte of a piece.  Matches never span two pieces.
+  static const size_t kOptimalParseSegmentSize = 256 << 10;
+
+  // With EncodeOptions::optimal_parse, positions that are covered by the
+  // tail of a match found earlier, at least this long, are not searched
+  // again: the tail is taken as their longest match.
+  static const size_t kOptimalParseLongMatchSize = 256;
+
+  // Optional settings for Encode().  A default-constructed EncodeOptions
+  // object produces the same output as the simpler form of Encode() with
+  // look_for_target_matches set to false.
+  struct EncodeOptions {
+    EncodeOptions()
+        : look_for_target_matches(false),
+          time_limit_usec(0),
+          max_delta_ratio(0.0),
+          optimal_parse(false) { }
+
+    // Please see vcencoder.h for a full explanation of this parameter.
+    bool look_for_target_matches;
+
+    // If greater than zero, the maximum time in microseconds that Encode()
+    // may spend searching for matches in a target window.  Once it has
+    // expired, the rest of the window is encoded as a single ADD.
+    int64_t time_limit_usec;
+
+    // If greater than zero, the largest acceptable ratio between the size
+    // of the encoded window and the size of the target window.  Once at
+    // least a quarter of the window has been searched, the encoder gives up
+    // on it as soon as the encoding so far is larger than this ratio allows,
+    // and encodes the rest of the window as a single ADD.
+    double max_delta_ratio;
+
+    // If true, Encode() finds the longest match at every position of the
+    // window, not just where the previous instruction ends, and chooses the
+    // sequence of ADD and COPY instructions with the smallest size, as
+    // estimated from the lengths of their opcodes and of the varints that
+    // encode their sizes and COPY addresses.  The window is also encoded
+    // with the default greedy parse, and the smaller encoding is kept, as
+    // the estimate ignores the address caches.  It is meant for deltas that
+    // are encoded once and then served many times, since it takes tens of
+    // times as long as the greedy parse alone.  The limits above are
+    // honored: once one is reached, no more matches are searched for, so the
+    // rest of the window is ADDed.
+    bool optimal_parse;
+  };
+
   VCDiffEngine(const char* dictionary, size_t dictionary_size);
 
+  // The same, but the dictionary and the target data are hashed with
+  // hash_type instead of VCD_HASH_POLYNOMIAL.
+  VCDiffEngine(const char* dictionary,
+               size_t dictionary_size,
+               VCDiffHashType hash_type);
+
+  // Creates an engine for a dictionary that will be used to encode a single
+  // target.  The dictionary is not copied, so it must remain valid for the
+  // lifetime of this object, and Init() builds the lighter hash described in
+  // BlockHash::CreateOneShotDictionaryHash() using the memory of *tables.
+  VCDiffEngine(const char* dictionary,
+               size_t dictionary_size,
+               BlockHashTables* tables);
+
+  // Creates an engine whose dictionary is the concatenation of the
+  // dictionaries of segments[0 .. segment_count - 1], in that order.
+  // Nothing is copied or hashed again: Encode() searches the hash of each
+  // segment, and reports COPY addresses relative to the start of the
+  // concatenation.  Matches never span two segments.  A segment may itself
+  // be made of segments.  The segments must remain valid for the lifetime of
+  // this object, and must have been initialized before Init() is called.
+  // Init() fails unless they all have the same hash_type().
+  VCDiffEngine(const VCDiffEngine* const* segments, size_t segment_count);
+
   ~VCDiffEngine();
 
   // Initializes the object before use.
@@ -52,10 +153,30 @@ class VCDiffEngine {
   // as non-const.
   bool Init();
 
+  // May be called instead of Init() when the dictionary of this object
+  // starts with the whole dictionary of base, which must have been
+  // initialized.  The hashed blocks of base are reused, so that only the
+  // appended part of the dictionary is hashed.  If the dictionary of base
+  // is not a prefix of this one, or base has a different hash_type(), this is
+  // equivalent to Init().
+  bool InitFromBase(const VCDiffEngine& base);
+
+  // Returns NULL if the dictionary is made of segments, since its contents
+  // are not stored contiguously.  Use AppendDictionary() in that case.
   const char *dictionary() const { return dictionary_; }
 
   size_t dictionary_size() const { return dictionary_size_; }
 
+  // The rolling hash with which the dictionary was hashed.
+  VCDiffHashType hash_type() const { return hash_type_; }
+
+  // Appends size bytes of the dictionary, starting at offset, to *out.
+  // offset + size must not exceed dictionary_size().
+  void AppendDictionary(size_t offset, size_t size, std::string* out) const;
+
+  // Returns true if coder accepts the contents of the dictionary.
+  bool VerifyDictionary(const CodeTableWriterInterface& coder) const;
+
   // Main worker function.  Finds the best matches between the dictionary
   // (source) and target data, and uses the coder to write a
   // delta file window into *diff.
@@ -75,45 +196,156 @@ class VCDiffEngine {
               OutputStringInterface* diff,
               CodeTableWriterInterface* coder) const;
 
+  // The same as the function above, but also honors the limits given in
+  // options.  Returns a combination of VCDiffEncodeStatusFlagValues that
+  // describes any shortcuts taken while encoding this window.
+  VCDiffEncodeStatusFlags Encode(const char* target_data,
+                                 size_t target_size,
+                                 const EncodeOptions& options,
+                                 OutputStringInterface* diff,
+                                 CodeTableWriterInterface* coder) const;
+
+  // The same as the function above, for a coder that is exactly a
+  // VCDiffCodeTableWriter and not an object of a subclass of it.  Its Add()
+  // and Copy() methods are called directly instead of through
+  // CodeTableWriterInterface, so that they are inlined into the loop that
+  // looks for matches.  VCDiffStreamingEncoder uses this for every format
+  // but JSON.
+  VCDiffEncodeStatusFlags EncodeToVCDiffWriter(
+      const char* target_data,
+      size_t target_size,
+      const EncodeOptions& options,
+      OutputStringInterface* diff,
+      VCDiffCodeTableWriter* coder) const;
+
  private:
   static bool ShouldGenerateCopyInstructionForMatchOfSize(size_t size) {
     return size >= kMinimumMatchSize;
   }
 
+  // The implementation of both forms of Encode() that take options.
+  // CodeTableWriter is CodeTableWriterInterface or VCDiffCodeTableWriter.
+  template<class CodeTableWriter>
+  VCDiffEncodeStatusFlags EncodeWithWriter(const char* target_data,
+                                           size_t target_size,
+                                           const EncodeOptions& options,
+                                           OutputStringInterface* diff,
+                                           CodeTableWriter* coder) const;
+
   // The following two functions use templates to produce two different
   // versions of the code depending on the value of the option
   // look_for_target_matches.  This approach saves a test-and-branch instruction
-  // within the inner loop of EncodeCopyForBestMatch.
+  // within the inner loop of EncodeCopyForBestMatch.  Likewise for prefetch,
+  // which enables the prefetching described for kPrefetchDistance, for
+  // Hasher, which is the rolling hash class for hash_type_, and for
+  // CodeTableWriter, as described for EncodeToVCDiffWriter().
+  template<class Hasher, class CodeTableWriter>
+  VCDiffEncodeStatusFlags EncodeWithHasher(
+      const char* target_data,
+      size_t target_size,
+      const EncodeOptions& options,
+      OutputStringInterface* diff,
+      CodeTableWriter* coder) const;
+
+  template<class Hasher, class CodeTableWriter, bool look_for_target_matches,
+           bool prefetch>
+  VCDiffEncodeStatusFlags EncodeInternal(const char* target_data,
+                                         size_t target_size,
+                                         const EncodeOptions& options,
+                                         OutputStringInterface* diff,
+                                         CodeTableWriter* coder) const;
+
+  // Encodes the target window both with EncodeInternal() and with
+  // EncodeOptimal(), and appends the smaller of the two to diff.
+  template<class Hasher, class CodeTableWriter>
+  VCDiffEncodeStatusFlags EncodeOptimalOrGreedy(
+      const char* target_data,
+      size_t target_size,
+      const EncodeOptions& options,
+      OutputStringInterface* diff,
+      CodeTableWriter* coder) const;
+
+  // The version of EncodeInternal() for EncodeOptions::optimal_parse.
+  template<class Hasher, bool look_for_target_matches>
+  VCDiffEncodeStatusFlags EncodeOptimal(const char* target_data,
+                                        size_t target_size,
+                                        const EncodeOptions& options,
+                                        OutputStringInterface* diff,
+                                        CodeTableWriterInterface* coder) const;
+
+  // Looks for a match in the dictionary and, if look_for_target_matches is
+  // true, in target_hash, and replaces best_match with the longest one.
+  // The other parameters are those of BlockHash::FindBestMatch().
   template<bool look_for_target_matches>
-  void EncodeInternal(const char* target_data,
-                      size_t target_size,
-                      OutputStringInterface* diff,
-                      CodeTableWriterInterface* coder) const;
+  void FindBestMatch(uint32_t hash_value,
+                     const char* target_candidate_start,
+                     const char* unencoded_target_start,
+                     size_t unencoded_target_size,
+                     const BlockHash* target_hash,
+                     BlockHash::Match* best_match) const;
 
   // If look_for_target_matches is true, then target_hash must point to a valid
   // BlockHash object, and cannot be NULL.  If look_for_target_matches is
   // false, then the value of target_hash is ignored.
-  template<bool look_for_target_matches>
+  template<class CodeTableWriter, bool look_for_target_matches>
   size_t EncodeCopyForBestMatch(uint32_t hash_value,
                                 const char* target_candidate_start,
                                 const char* unencoded_target_start,
                                 size_t unencoded_target_size,
                                 const BlockHash* target_hash,
-                                CodeTableWriterInterface* coder) const;
+                                CodeTableWriter* coder,
+                                size_t* encoded_size_estimate) const;
 
   void AddUnmatchedRemainder(const char* unencoded_target_start,
                              size_t unencoded_target_size,
                              CodeTableWriterInterface* coder) const;
 
-  const char* dictionary_;  // A copy of the dictionary contents
+  // Looks for a match in the hash of every segment, and replaces best_match
+  // with the longest one.  The parameters are those of
+  // BlockHash::FindBestMatch().
+  void FindBestSegmentMatch(uint32_t hash_value,
+                            const char* target_candidate_start,
+                            const char* unencoded_target_start,
+                            size_t unencoded_target_size,
+                            BlockHash::Match* best_match) const;
+
+  // Calls BlockHash::PrefetchHashTableEntry() or
+  // BlockHash::PrefetchFirstBlock() for the hash of the dictionary or of
+  // every segment.
+  void PrefetchHashTableEntries(uint32_t hash_value) const;
+  void PrefetchFirstBlocks(uint32_t hash_value) const;
+
+  bool initialized() const {
+    return (hashed_dictionary_ != NULL) || segments_initialized_;
+  }
+
+  // A copy of the dictionary contents, or the caller's own dictionary for a
+  // one-shot engine.
+  const char* dictionary_;
 
   const size_t dictionary_size_;
 
+  // The hash of the dictionary or, if it is made of segments, of every
+  // segment.
+  VCDiffHashType hash_type_;
+
   // A hash that contains one element for every kBlockSize bytes of dictionary_.
   // This can be reused to encode many different target strings using the
   // same dictionary, without the need to compute the hash values each time.
   const BlockHash* hashed_dictionary_;
 
+  // If the dictionary is made of segments, these are the engines of the
+  // segments (which are never made of segments themselves) and the offsets
+  // of the segments within the dictionary.  In that case dictionary_ is NULL
+  // and hashed_dictionary_ is never set; the segments' hashes are used.
+  std::vector<const VCDiffEngine*> segments_;
+  std::vector<size_t> segment_offsets_;
+  bool segments_initialized_;
+
+  // The memory lent to the dictionary hash of a one-shot engine; otherwise
+  // NULL.
+  BlockHashTables* const one_shot_tables_;
+
   // Making these private avoids implicit copy constructor & assignment operator
   VCDiffEngine(const VCDiffEngine&);
   void operator=(const VCDiffEngine&);
@@ -918,5 +918,27 @@ TEST_F(WeaselsToMoonpiesTest, EngineEncodeCompressibleWithTargetMatching) {
   VerifySizes();
 }
 
+TEST_F(WeaselsToMoonpiesTest, EncodeToVCDiffWriterMatchesEncode) {
+  for (int i = 0; i < 4; ++i) {
+    const bool interleaved = (i & 1) != 0;
+    VCDiffEngine::EncodeOptions options;
+    options.look_for_target_matches = (i & 2) != 0;
+    string generic_diff;
+    OutputString<string> generic_output(&generic_diff);
+    VCDiffCodeTableWriter generic_coder(interleaved);
+    generic_coder.Init(engine_.dictionary_size());
+    engine_.Encode(target_, strlen(target_), options, &generic_output,
+                   static_cast<CodeTableWriterInterface*>(&generic_coder));
+    string direct_diff;
+    OutputString<string> direct_output(&direct_diff);
+    VCDiffCodeTableWriter direct_coder(interleaved);
+    direct_coder.Init(engine_.dictionary_size());
+    engine_.EncodeToVCDiffWriter(target_, strlen(target_), options,
+                                 &direct_output, &direct_coder);
+    EXPECT_FALSE(direct_diff.empty());
+    EXPECT_EQ(generic_diff, direct_diff);
+  }
+}
+
 }  //  anonymous namespace
 }  //  namespace open-vcdiff
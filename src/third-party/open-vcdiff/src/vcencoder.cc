@@ -27,13 +27,19 @@
 // encoders or accepted by other decoders.
 
 #include <config.h>
+#include <string.h>  // memcpy
+#include <algorithm>  // std::min
+#include <vector>
+#include "addrcache.h"
 #include "checksum.h"
+#include "codetable.h"
 #include "encodetable.h"
 #include "google/output_string.h"
 #include "google/vcencoder.h"
 #include "jsonwriter.h"
 #include "logging.h"
 #include "unique_ptr.h" // auto_ptr, unique_ptr
+#include "vcdiff_defs.h"  // VCD_MAX_MODES
 #include "vcdiffengine.h"
 
 namespace open_vcdiff {
@@ -42,15 +48,44 @@ HashedDictionary::HashedDictionary(const char* dictionary_contents,
                                    size_t dictionary_size)
     : engine_(new VCDiffEngine(dictionary_contents, dictionary_size)) { }
 
+HashedDictionary::HashedDictionary(const char* dictionary_contents,
+                                   size_t dictionary_size,
+                                   VCDiffHashType hash_type)
+    : engine_(new VCDiffEngine(dictionary_contents,
+                               dictionary_size,
+                               hash_type)) { }
+
+static const VCDiffEngine* CreateSegmentedEngine(
+    const std::vector<const HashedDictionary*>& segments) {
+  std::vector<const VCDiffEngine*> engines;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    engines.push_back(segments[i]->engine());
+  }
+  return new VCDiffEngine(engines.empty() ? NULL : &engines[0],
+                          engines.size());
+}
+
+HashedDictionary::HashedDictionary(
+    const std::vector<const HashedDictionary*>& segments)
+    : engine_(CreateSegmentedEngine(segments)) { }
+
 HashedDictionary::~HashedDictionary() { delete engine_; }
 
 bool HashedDictionary::Init() {
   return const_cast<VCDiffEngine*>(engine_)->Init();
 }
 
+bool HashedDictionary::InitFromBase(const HashedDictionary& base) {
+  return const_cast<VCDiffEngine*>(engine_)->InitFromBase(*base.engine_);
+}
+
+VCDiffHashType HashedDictionary::hash_type() const {
+  return engine_->hash_type();
+}
+
 class VCDiffStreamingEncoderImpl {
  public:
-  VCDiffStreamingEncoderImpl(const HashedDictionary* dictionary,
+  VCDiffStreamingEncoderImpl(const VCDiffEngine* engine,
                              VCDiffFormatExtensionFlags format_extensions,
                              bool look_for_target_matches);
 
@@ -62,17 +97,80 @@ class VCDiffStreamingEncoderImpl {
 
   bool FinishEncoding(OutputStringInterface* out);
 
+  void SetMaximumEncodeTime(int64_t maximum_encode_time_usec) {
+    encode_options_.time_limit_usec = maximum_encode_time_usec;
+  }
+
+  void SetMaximumDeltaRatio(double maximum_delta_ratio) {
+    encode_options_.max_delta_ratio = maximum_delta_ratio;
+  }
+
+  void SetOptimalParsing(bool optimal_parsing) {
+    encode_options_.optimal_parse = optimal_parsing;
+  }
+
+  void SetMaximumWindowSize(size_t maximum_window_size) {
+    maximum_window_size_ = maximum_window_size;
+  }
+
+  bool SetCodeTable(const char* code_table,
+                    size_t code_table_size,
+                    bool embed_code_table);
+
+  bool SetAddressCacheSizes(int near_cache_size, int same_cache_size);
+
+  VCDiffEncodeStatusFlags EncodeStatus() const { return encode_status_; }
+
  private:
   const VCDiffEngine* engine_;
 
+  // Encodes data[0,len-1] as a single delta window.
+  void EncodeWindow(const char* data, size_t len, OutputStringInterface* out);
+
+  // Checks that the code table or the cache sizes may be changed now.
+  bool CanChangeCodeTable(const char* function_name) const;
+
+  // Replaces coder_ with a writer that uses *code_table, which it takes,
+  // and the given cache sizes, or the default code table and cache sizes
+  // if *code_table is NULL.
+  void UseCodeTable(UNIQUE_PTR<VCDiffCodeTableData>* code_table,
+                    int near_cache_size,
+                    int same_cache_size,
+                    bool embed_code_table);
+
   UNIQUE_PTR<CodeTableWriterInterface> coder_;
 
+  // coder_ itself if it is a VCDiffCodeTableWriter, which the engine can call
+  // directly, or NULL for the JSON format.
+  VCDiffCodeTableWriter* vcdiff_coder_;
+
+  // The code table that coder_ refers to, either given to SetCodeTable() or
+  // built for the cache sizes given to SetAddressCacheSizes().  NULL if the
+  // default code table is used.
+  UNIQUE_PTR<VCDiffCodeTableData> code_table_;
+
+  // True if code_table_ was given to SetCodeTable().
+  bool custom_code_table_;
+
+  bool embed_code_table_;
+
+  int near_cache_size_;
+  int same_cache_size_;
+
   const VCDiffFormatExtensionFlags format_extensions_;
 
   // Determines whether to look for matches within the previously encoded
-  // target data, or just within the source (dictionary) data.  Please see
-  // vcencoder.h for a full explanation of this parameter.
-  const bool look_for_target_matches_;
+  // target data, or just within the source (dictionary) data, and when to
+  // give up doing so.  Please see vcencoder.h for a full
+  // explanation of these parameters.
+  VCDiffEngine::EncodeOptions encode_options_;
+
+  // The largest window that EncodeChunk() writes, or 0 for no limit.
+  size_t maximum_window_size_;
+
+  // The combined status flags returned by the engine for every chunk
+  // encoded since StartEncoding() was called.
+  VCDiffEncodeStatusFlags encode_status_;
 
   // This state variable is used to ensure that StartEncoding(), EncodeChunk(),
   // and FinishEncoding() are called in the correct order.  It will be true
@@ -87,24 +185,134 @@ class VCDiffStreamingEncoderImpl {
 };
 
 inline VCDiffStreamingEncoderImpl::VCDiffStreamingEncoderImpl(
-    const HashedDictionary* dictionary,
+    const VCDiffEngine* engine,
     VCDiffFormatExtensionFlags format_extensions,
     bool look_for_target_matches)
-    : engine_(dictionary->engine()),
+    : engine_(engine),
+      vcdiff_coder_(NULL),
+      custom_code_table_(false),
+      embed_code_table_(true),
+      near_cache_size_(VCDiffAddressCache::kDefaultNearCacheSize),
+      same_cache_size_(VCDiffAddressCache::kDefaultSameCacheSize),
       format_extensions_(format_extensions),
-      look_for_target_matches_(look_for_target_matches),
+      maximum_window_size_(0),
+      encode_status_(VCD_ENCODE_OK),
       encode_chunk_allowed_(false) {
+  encode_options_.look_for_target_matches = look_for_target_matches;
   if (format_extensions & VCD_FORMAT_JSON) {
     coder_.reset(new JSONCodeTableWriter());
   } else {
-    // This implementation of the encoder uses the default
-    // code table.  A VCDiffCodeTableWriter could also be constructed
-    // using a custom code table.
-    coder_.reset(new VCDiffCodeTableWriter(
-        (format_extensions & VCD_FORMAT_INTERLEAVED) != 0));
+    // The default code table is used unless SetCodeTable() or
+    // SetAddressCacheSizes() is called.
+    vcdiff_coder_ = new VCDiffCodeTableWriter(
+        (format_extensions & VCD_FORMAT_INTERLEAVED) != 0);
+    coder_.reset(vcdiff_coder_);
   }
 }
 
+bool VCDiffStreamingEncoderImpl::CanChangeCodeTable(
+    const char* function_name) const {
+  if (encode_chunk_allowed_) {
+    VCD_ERROR << function_name << " called between StartEncoding and "
+                 "FinishEncoding" << VCD_ENDL;
+    return false;
+  }
+  if (format_extensions_ & VCD_FORMAT_JSON) {
+    VCD_ERROR << "A code table cannot be used with the JSON format" << VCD_ENDL;
+    return false;
+  }
+  return true;
+}
+
+void VCDiffStreamingEncoderImpl::UseCodeTable(
+    UNIQUE_PTR<VCDiffCodeTableData>* code_table,
+    int near_cache_size,
+    int same_cache_size,
+    bool embed_code_table) {
+  const bool interleaved = (format_extensions_ & VCD_FORMAT_INTERLEAVED) != 0;
+  if (!code_table->get()) {
+    vcdiff_coder_ = new VCDiffCodeTableWriter(interleaved);
+  } else {
+    VCDiffCodeTableWriter* coder = new VCDiffCodeTableWriter(
+        interleaved,
+        near_cache_size,
+        same_cache_size,
+        **code_table,
+        static_cast<unsigned char>(near_cache_size + same_cache_size + 1));
+    if (!embed_code_table) {
+      coder->UseCodeTableFingerprint();
+    }
+    vcdiff_coder_ = coder;
+  }
+  coder_.reset(vcdiff_coder_);
+  // The old writer may refer to the old code table, which is freed with
+  // *code_table.
+  code_table_.swap(*code_table);
+  near_cache_size_ = near_cache_size;
+  same_cache_size_ = same_cache_size;
+}
+
+bool VCDiffStreamingEncoderImpl::SetCodeTable(const char* code_table,
+                                              size_t code_table_size,
+                                              bool embed_code_table) {
+  if (!CanChangeCodeTable("SetCodeTable")) {
+    return false;
+  }
+  if (code_table_size != sizeof(VCDiffCodeTableData)) {
+    VCD_ERROR << "Code table size (" << code_table_size
+              << ") does not match size of a code table ("
+              << sizeof(VCDiffCodeTableData) << ")" << VCD_ENDL;
+    return false;
+  }
+  UNIQUE_PTR<VCDiffCodeTableData> new_code_table(new VCDiffCodeTableData);
+  memcpy(new_code_table.get(), code_table, code_table_size);
+  if (!new_code_table->Validate(static_cast<unsigned char>(
+          near_cache_size_ + same_cache_size_ + 1))) {
+    return false;
+  }
+  UseCodeTable(&new_code_table, near_cache_size_, same_cache_size_,
+               embed_code_table);
+  custom_code_table_ = true;
+  embed_code_table_ = embed_code_table;
+  return true;
+}
+
+bool VCDiffStreamingEncoderImpl::SetAddressCacheSizes(int near_cache_size,
+                                                      int same_cache_size) {
+  if (!CanChangeCodeTable("SetAddressCacheSizes")) {
+    return false;
+  }
+  UNIQUE_PTR<VCDiffCodeTableData> new_code_table;
+  bool embed_code_table = embed_code_table_;
+  if (custom_code_table_) {
+    if ((near_cache_size < 0) || (same_cache_size < 0) ||
+        (near_cache_size + same_cache_size > VCD_MAX_MODES - 2)) {
+      VCD_ERROR << "Invalid cache sizes " << near_cache_size << " and "
+                << same_cache_size << VCD_ENDL;
+      return false;
+    }
+    new_code_table.reset(new VCDiffCodeTableData(*code_table_));
+    if (!new_code_table->Validate(static_cast<unsigned char>(
+            near_cache_size + same_cache_size + 1))) {
+      return false;
+    }
+  } else if ((near_cache_size != VCDiffAddressCache::kDefaultNearCacheSize) ||
+             (same_cache_size != VCDiffAddressCache::kDefaultSameCacheSize)) {
+    new_code_table.reset(new VCDiffCodeTableData);
+    if (!VCDiffCodeTableData::BuildForCacheSizes(near_cache_size,
+                                                 same_cache_size,
+                                                 new_code_table.get())) {
+      return false;
+    }
+    // A decoder can build the same code table from the cache sizes, but only
+    // a delta file that already uses the format extensions may rely on it.
+    embed_code_table = (format_extensions_ == VCD_STANDARD_FORMAT);
+  }
+  UseCodeTable(&new_code_table, near_cache_size, same_cache_size,
+               embed_code_table);
+  return true;
+}
+
 inline bool VCDiffStreamingEncoderImpl::StartEncoding(
     OutputStringInterface* out) {
   if (!coder_->Init(engine_->dictionary_size())) {
@@ -112,12 +320,12 @@ inline bool VCDiffStreamingEncoderImpl::StartEncoding(
                   "Initialization of code table writer failed" << VCD_ENDL;
     return false;
   }
-  if (!coder_->VerifyDictionary(engine_->dictionary(),
-                                engine_->dictionary_size())) {
+  if (!engine_->VerifyDictionary(*coder_)) {
     VCD_ERROR << "Dictionary not valid for writer" << VCD_ENDL;
     return false;
   }
   coder_->WriteHeader(out, format_extensions_);
+  encode_status_ = VCD_ENCODE_OK;
   encode_chunk_allowed_ = true;
   return true;
 }
@@ -134,11 +342,30 @@ inline bool VCDiffStreamingEncoderImpl::EncodeChunk(
     VCD_ERROR << "Target chunk not valid for writer" << VCD_ENDL;
     return false;
   }
+  if ((maximum_window_size_ == 0) || (len <= maximum_window_size_)) {
+    EncodeWindow(data, len, out);
+    return true;
+  }
+  for (size_t pos = 0; pos < len; pos += maximum_window_size_) {
+    EncodeWindow(data + pos, std::min(maximum_window_size_, len - pos), out);
+  }
+  return true;
+}
+
+inline void VCDiffStreamingEncoderImpl::EncodeWindow(
+    const char* data,
+    size_t len,
+    OutputStringInterface* out) {
   if ((format_extensions_ & VCD_FORMAT_CHECKSUM) != 0) {
     coder_->AddChecksum(ComputeAdler32(data, len));
   }
-  engine_->Encode(data, len, look_for_target_matches_, out, coder_.get());
-  return true;
+  if (vcdiff_coder_) {
+    encode_status_ |= engine_->EncodeToVCDiffWriter(data, len, encode_options_,
+                                                    out, vcdiff_coder_);
+  } else {
+    encode_status_ |= engine_->Encode(data, len, encode_options_, out,
+                                      coder_.get());
+  }
 }
 
 inline bool VCDiffStreamingEncoderImpl::FinishEncoding(
@@ -156,7 +383,7 @@ VCDiffStreamingEncoder::VCDiffStreamingEncoder(
     const HashedDictionary* dictionary,
     VCDiffFormatExtensionFlags format_extensions,
     bool look_for_target_matches)
-    : impl_(new VCDiffStreamingEncoderImpl(dictionary,
+    : impl_(new VCDiffStreamingEncoderImpl(dictionary->engine(),
                                            format_extensions,
                                            look_for_target_matches)) { }
 
@@ -179,6 +406,38 @@ bool VCDiffStreamingEncoder::FinishEncodingToInterface(
   return impl_->FinishEncoding(out);
 }
 
+void VCDiffStreamingEncoder::SetMaximumEncodeTime(
+    int64_t maximum_encode_time_usec) {
+  impl_->SetMaximumEncodeTime(maximum_encode_time_usec);
+}
+
+void VCDiffStreamingEncoder::SetMaximumDeltaRatio(double maximum_delta_ratio) {
+  impl_->SetMaximumDeltaRatio(maximum_delta_ratio);
+}
+
+void VCDiffStreamingEncoder::SetOptimalParsing(bool optimal_parsing) {
+  impl_->SetOptimalParsing(optimal_parsing);
+}
+
+void VCDiffStreamingEncoder::SetMaximumWindowSize(size_t maximum_window_size) {
+  impl_->SetMaximumWindowSize(maximum_window_size);
+}
+
+bool VCDiffStreamingEncoder::SetCodeTable(const char* code_table,
+                                          size_t code_table_size,
+                                          bool embed_code_table) {
+  return impl_->SetCodeTable(code_table, code_table_size, embed_code_table);
+}
+
+bool VCDiffStreamingEncoder::SetAddressCacheSizes(int near_cache_size,
+                                                  int same_cache_size) {
+  return impl_->SetAddressCacheSizes(near_cache_size, same_cache_size);
+}
+
+VCDiffEncodeStatusFlags VCDiffStreamingEncoder::EncodeStatus() const {
+  return impl_->EncodeStatus();
+}
+
 bool VCDiffEncoder::EncodeToInterface(const char* target_data,
                                       size_t target_len,
                                       OutputStringInterface* out) {
@@ -201,4 +460,33 @@ bool VCDiffEncoder::EncodeToInterface(const char* target_data,
   return encoder_->FinishEncodingToInterface(out);
 }
 
+VCDiffOneShotEncoder::VCDiffOneShotEncoder()
+    : tables_(new BlockHashTables),
+      flags_(VCD_STANDARD_FORMAT),
+      look_for_target_matches_(true) { }
+
+VCDiffOneShotEncoder::~VCDiffOneShotEncoder() { delete tables_; }
+
+bool VCDiffOneShotEncoder::EncodeToInterface(const char* source_data,
+                                             size_t source_len,
+                                             const char* target_data,
+                                             size_t target_len,
+                                             OutputStringInterface* out) {
+  out->clear();
+  VCDiffEngine engine(source_data, source_len, tables_);
+  if (!engine.Init()) {
+    VCD_ERROR << "Error initializing one-shot dictionary" << VCD_ENDL;
+    return false;
+  }
+  VCDiffStreamingEncoderImpl encoder(&engine, flags_,
+                                     look_for_target_matches_);
+  if (!encoder.StartEncoding(out)) {
+    return false;
+  }
+  if (!encoder.EncodeChunk(target_data, target_len, out)) {
+    return false;
+  }
+  return encoder.FinishEncoding(out);
+}
+
 }  // namespace open_vcdiff
@@ -19,10 +19,13 @@
 #include <algorithm>
 #include <string>
 #include <vector>
+#include "addrcache.h"
 #include "blockhash.h"
 #include "checksum.h"
 #include "testing.h"
+#include "unique_ptr.h"  // auto_ptr, unique_ptr
 #include "varint_bigendian.h"
+#include "vcdiffengine.h"
 #include "google/vcdecoder.h"
 #include "vcdiff_defs.h"
 
@@ -499,6 +502,404 @@ TEST_F(VCDiffEncoderTest, EncodeDecodeStreamOfChunks) {
   }
 }
 
+// Every window of a chunk split by SetMaximumWindowSize() can be decoded
+// on its own.  They are decoded here from last to first.
+TEST_F(VCDiffEncoderTest, MaximumWindowSizeWritesIndependentWindows) {
+  const size_t kWindowSize = 16;
+  const size_t target_size = strlen(kTarget);
+  encoder_.SetMaximumWindowSize(kWindowSize);
+  string delta;
+  EXPECT_TRUE(encoder_.StartEncoding(&delta));
+  EXPECT_TRUE(encoder_.EncodeChunk(kTarget, target_size, &delta));
+  EXPECT_TRUE(encoder_.FinishEncoding(&delta));
+  std::vector<VCDiffWindowInfo> windows;
+  decoder_.StartDecoding(kDictionary, sizeof(kDictionary));
+  EXPECT_TRUE(decoder_.IndexWindows(delta.data(), delta.size(), &windows));
+  ASSERT_EQ((target_size + kWindowSize - 1) / kWindowSize, windows.size());
+  EXPECT_EQ(delta.size(),
+            windows.back().delta_offset + windows.back().delta_length);
+  for (size_t i = windows.size(); i-- > 0; ) {
+    EXPECT_EQ(i * kWindowSize, windows[i].target_offset);
+    result_target_.clear();
+    EXPECT_TRUE(decoder_.DecodeChunk(delta.data() + windows[i].delta_offset,
+                                     windows[i].delta_length,
+                                     &result_target_));
+    EXPECT_EQ(string(kTarget).substr(windows[i].target_offset,
+                                     windows[i].target_length),
+              result_target_);
+  }
+  EXPECT_TRUE(decoder_.FinishDecoding());
+}
+
+// Builds a target that begins with a long run of pseudo-random bytes (so that
+// the encoder has to examine nearly every position of it) and ends with a
+// copy of kDictionary.
+static void MakeSlowTarget(const char* dictionary,
+                           size_t dictionary_size,
+                           std::string* target) {
+  srand(1);
+  for (int i = 0; i < (1 << 20); ++i) {
+    target->push_back(static_cast<char>(rand() & 0xFF));
+  }
+  target->append(dictionary, dictionary_size);
+}
+
+TEST_F(VCDiffEncoderTest, EncodeStatusWithoutTimeLimit) {
+  string target;
+  MakeSlowTarget(kDictionary, sizeof(kDictionary), &target);
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_TRUE(encoder_.EncodeChunk(target.data(), target.size(), delta()));
+  EXPECT_TRUE(encoder_.FinishEncoding(delta()));
+  EXPECT_EQ(VCD_ENCODE_OK, encoder_.EncodeStatus());
+  // The copy of the dictionary at the end was found.
+  EXPECT_GT(target.size(), delta_size());
+}
+
+TEST_F(VCDiffEncoderTest, TimeLimitReachedProducesValidDelta) {
+  string target;
+  MakeSlowTarget(kDictionary, sizeof(kDictionary), &target);
+  encoder_.SetMaximumEncodeTime(1);
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_TRUE(encoder_.EncodeChunk(target.data(), target.size(), delta()));
+  EXPECT_TRUE(encoder_.FinishEncoding(delta()));
+  EXPECT_EQ(VCD_ENCODE_TIME_LIMIT_REACHED, encoder_.EncodeStatus());
+  // The encoder gave up before it reached the copy of the dictionary.
+  EXPECT_LT(target.size(), delta_size());
+  decoder_.StartDecoding(kDictionary, sizeof(kDictionary));
+  EXPECT_TRUE(decoder_.DecodeChunk(delta_data(),
+                                   delta_size(),
+                                   &result_target_));
+  EXPECT_TRUE(decoder_.FinishDecoding());
+  EXPECT_EQ(target, result_target_);
+  // StartEncoding() resets the status.
+  encoder_.SetMaximumEncodeTime(0);
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_TRUE(encoder_.EncodeChunk(kTarget, strlen(kTarget), delta()));
+  EXPECT_EQ(VCD_ENCODE_OK, encoder_.EncodeStatus());
+}
+
+TEST_F(VCDiffEncoderTest, IncompressibleTargetIsAddedWhole) {
+  string target;
+  srand(2);
+  for (int i = 0; i < (1 << 16); ++i) {
+    target.push_back(static_cast<char>(rand() & 0xFF));
+  }
+  encoder_.SetMaximumDeltaRatio(1.0);
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_TRUE(encoder_.EncodeChunk(target.data(), target.size(), delta()));
+  EXPECT_TRUE(encoder_.FinishEncoding(delta()));
+  EXPECT_EQ(VCD_ENCODE_TARGET_INCOMPRESSIBLE, encoder_.EncodeStatus());
+  EXPECT_GE(target.size() + kFileHeaderSize + kWindowHeaderSize + 4,
+            delta_size());
+  decoder_.StartDecoding(kDictionary, sizeof(kDictionary));
+  EXPECT_TRUE(decoder_.DecodeChunk(delta_data(),
+                                   delta_size(),
+                                   &result_target_));
+  EXPECT_TRUE(decoder_.FinishDecoding());
+  EXPECT_EQ(target, result_target_);
+}
+
+TEST_F(VCDiffEncoderTest, CompressibleTargetWithinDeltaRatio) {
+  encoder_.SetMaximumDeltaRatio(1.0);
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_TRUE(encoder_.EncodeChunk(kDictionary, sizeof(kDictionary), delta()));
+  EXPECT_TRUE(encoder_.FinishEncoding(delta()));
+  EXPECT_EQ(VCD_ENCODE_OK, encoder_.EncodeStatus());
+  EXPECT_GT(sizeof(kDictionary), delta_size());
+}
+
+// Makes a dictionary of random words from a small vocabulary, and a target of
+// more than VCDiffEngine::kOptimalParseSegmentSize bytes made of pieces of
+// it, each with a few changed letters.  Every block of the target then
+// matches many places of the dictionary, of which the greedy parse takes
+// the first long enough one.
+static void MakeEditedTarget(std::string* dictionary, std::string* target) {
+  static const char* const kWords[] = {
+    "the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ",
+    "and ", "then ", "runs ", "away ", "from ", "a ", "big ", "cat "
+  };
+  srand(3);
+  while (dictionary->size() < (1 << 16)) {
+    dictionary->append(kWords[rand() % (sizeof(kWords) / sizeof(kWords[0]))]);
+  }
+  while (target->size() < 300 * 1024) {
+    std::string piece =
+        dictionary->substr(rand() % (dictionary->size() - 1024),
+                           100 + rand() % 900);
+    for (int i = 0; i < 3; ++i) {
+      piece[rand() % piece.size()] = static_cast<char>('A' + rand() % 26);
+    }
+    target->append(piece);
+  }
+}
+
+TEST_F(VCDiffEncoderTest, OptimalParsingIsNotLargerThanGreedy) {
+  std::string dictionary, target;
+  MakeEditedTarget(&dictionary, &target);
+  HashedDictionary hashed_dictionary(dictionary.data(), dictionary.size());
+  EXPECT_TRUE(hashed_dictionary.Init());
+  for (int target_matches = 0; target_matches < 2; ++target_matches) {
+    std::string greedy_delta, optimal_delta;
+    VCDiffStreamingEncoder greedy(&hashed_dictionary, VCD_STANDARD_FORMAT,
+                                  target_matches != 0);
+    EXPECT_TRUE(greedy.StartEncoding(&greedy_delta));
+    EXPECT_TRUE(greedy.EncodeChunk(target.data(), target.size(),
+                                   &greedy_delta));
+    EXPECT_TRUE(greedy.FinishEncoding(&greedy_delta));
+    VCDiffStreamingEncoder optimal(&hashed_dictionary, VCD_STANDARD_FORMAT,
+                                   target_matches != 0);
+    optimal.SetOptimalParsing(true);
+    EXPECT_TRUE(optimal.StartEncoding(&optimal_delta));
+    EXPECT_TRUE(optimal.EncodeChunk(target.data(), target.size(),
+                                    &optimal_delta));
+    EXPECT_TRUE(optimal.FinishEncoding(&optimal_delta));
+    EXPECT_EQ(VCD_ENCODE_OK, optimal.EncodeStatus());
+    EXPECT_LE(optimal_delta.size(), greedy_delta.size());
+    if (target_matches) {
+      EXPECT_GT(greedy_delta.size() * 19 / 20, optimal_delta.size());
+    }
+    result_target_.clear();
+    EXPECT_TRUE(simple_decoder_.Decode(dictionary.data(), dictionary.size(),
+                                       optimal_delta, &result_target_));
+    EXPECT_EQ(target, result_target_);
+  }
+}
+
+TEST_F(VCDiffEncoderTest, OptimalParsingEncodesEveryChunk) {
+  encoder_.SetOptimalParsing(true);
+  TestWithFixedChunkSize(&encoder_, &decoder_, 31);
+  TestWithFixedChunkSize(&encoder_, &decoder_, strlen(kTarget));
+}
+
+TEST_F(VCDiffEncoderTest, OptimalParsingHonorsTimeLimit) {
+  string target;
+  MakeSlowTarget(kDictionary, sizeof(kDictionary), &target);
+  encoder_.SetOptimalParsing(true);
+  encoder_.SetMaximumEncodeTime(1);
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_TRUE(encoder_.EncodeChunk(target.data(), target.size(), delta()));
+  EXPECT_TRUE(encoder_.FinishEncoding(delta()));
+  EXPECT_EQ(VCD_ENCODE_TIME_LIMIT_REACHED, encoder_.EncodeStatus());
+  EXPECT_LT(target.size(), delta_size());
+  decoder_.StartDecoding(kDictionary, sizeof(kDictionary));
+  EXPECT_TRUE(decoder_.DecodeChunk(delta_data(),
+                                   delta_size(),
+                                   &result_target_));
+  EXPECT_TRUE(decoder_.FinishDecoding());
+  EXPECT_EQ(target, result_target_);
+}
+
+// Makes a target like a page filled from a template: the fields of each of
+// its rows are copied from the same places of the dictionary, one after the
+// other, with different values in between.  The COPY addresses then cycle
+// through as many regions of the dictionary as there are fields.
+static void MakeTemplatedTarget(int fields,
+                                std::string* dictionary,
+                                std::string* target) {
+  srand(5);
+  while (dictionary->size() < (1 << 15)) {
+    dictionary->push_back(static_cast<char>('a' + rand() % 26));
+  }
+  const size_t region_size = dictionary->size() / fields;
+  for (int row = 0; row < 400; ++row) {
+    for (int field = 0; field < fields; ++field) {
+      target->append(*dictionary, field * region_size + (row % 8) * 40, 32);
+      target->push_back(static_cast<char>('0' + rand() % 10));
+    }
+  }
+}
+
+TEST_F(VCDiffEncoderTest, AddressCacheSizes) {
+  std::string dictionary, target;
+  MakeTemplatedTarget(8, &dictionary, &target);
+  HashedDictionary hashed_dictionary(dictionary.data(), dictionary.size());
+  EXPECT_TRUE(hashed_dictionary.Init());
+  const VCDiffFormatExtensionFlags kFormats[] = {
+    VCD_STANDARD_FORMAT, VCD_FORMAT_INTERLEAVED | VCD_FORMAT_CHECKSUM
+  };
+  for (size_t i = 0; i < sizeof(kFormats) / sizeof(kFormats[0]); ++i) {
+    std::string default_delta, near_delta;
+    VCDiffStreamingEncoder default_encoder(&hashed_dictionary, kFormats[i],
+                                           false);
+    EXPECT_TRUE(default_encoder.StartEncoding(&default_delta));
+    EXPECT_TRUE(default_encoder.EncodeChunk(target.data(), target.size(),
+                                            &default_delta));
+    EXPECT_TRUE(default_encoder.FinishEncoding(&default_delta));
+    VCDiffStreamingEncoder near_encoder(&hashed_dictionary, kFormats[i],
+                                        false);
+    EXPECT_TRUE(near_encoder.SetAddressCacheSizes(8, 3));
+    EXPECT_TRUE(near_encoder.StartEncoding(&near_delta));
+    EXPECT_TRUE(near_encoder.EncodeChunk(target.data(), target.size(),
+                                         &near_delta));
+    EXPECT_TRUE(near_encoder.FinishEncoding(&near_delta));
+    // Even with the code table in the header.
+    EXPECT_GT(default_delta.size(), near_delta.size());
+    result_target_.clear();
+    EXPECT_TRUE(simple_decoder_.Decode(dictionary.data(), dictionary.size(),
+                                       near_delta, &result_target_));
+    EXPECT_EQ(target, result_target_);
+  }
+}
+
+TEST_F(VCDiffEncoderTest, DefaultAddressCacheSizesWriteNoCodeTable) {
+  std::string default_delta;
+  EXPECT_TRUE(encoder_.StartEncoding(&default_delta));
+  EXPECT_TRUE(encoder_.EncodeChunk(kTarget, strlen(kTarget), &default_delta));
+  EXPECT_TRUE(encoder_.FinishEncoding(&default_delta));
+  EXPECT_TRUE(encoder_.SetAddressCacheSizes(0, 0));
+  EXPECT_TRUE(encoder_.SetAddressCacheSizes(
+      VCDiffAddressCache::kDefaultNearCacheSize,
+      VCDiffAddressCache::kDefaultSameCacheSize));
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_TRUE(encoder_.EncodeChunk(kTarget, strlen(kTarget), delta()));
+  EXPECT_TRUE(encoder_.FinishEncoding(delta()));
+  EXPECT_EQ(default_delta, delta_as_const());
+}
+
+TEST_F(VCDiffEncoderTest, InvalidAddressCacheSizes) {
+  EXPECT_FALSE(encoder_.SetAddressCacheSizes(-1, 3));
+  EXPECT_FALSE(encoder_.SetAddressCacheSizes(200, 100));
+  EXPECT_FALSE(json_encoder_.SetAddressCacheSizes(8, 3));
+  EXPECT_TRUE(encoder_.StartEncoding(delta()));
+  EXPECT_FALSE(encoder_.SetAddressCacheSizes(8, 3));
+  EXPECT_TRUE(encoder_.FinishEncoding(delta()));
+}
+
+// A dictionary derived from hashed_dictionary_ by appending kTarget must
+// produce the same encoding as one hashed from scratch.
+TEST_F(VCDiffEncoderTest, ExtendedDictionaryEncodesLikeFullDictionary) {
+  const std::string extended_text =
+      std::string(kDictionary, sizeof(kDictionary)) + kTarget;
+  HashedDictionary full(extended_text.data(), extended_text.size());
+  EXPECT_TRUE(full.Init());
+  HashedDictionary extended(extended_text.data(), extended_text.size());
+  EXPECT_TRUE(extended.InitFromBase(hashed_dictionary_));
+  std::string full_delta, extended_delta;
+  VCDiffStreamingEncoder full_streaming(&full, VCD_STANDARD_FORMAT, true);
+  VCDiffStreamingEncoder extended_streaming(&extended, VCD_STANDARD_FORMAT,
+                                            true);
+  EXPECT_TRUE(full_streaming.StartEncoding(&full_delta));
+  EXPECT_TRUE(full_streaming.EncodeChunk(kTarget, strlen(kTarget),
+                                         &full_delta));
+  EXPECT_TRUE(full_streaming.FinishEncoding(&full_delta));
+  EXPECT_TRUE(extended_streaming.StartEncoding(&extended_delta));
+  EXPECT_TRUE(extended_streaming.EncodeChunk(kTarget, strlen(kTarget),
+                                             &extended_delta));
+  EXPECT_TRUE(extended_streaming.FinishEncoding(&extended_delta));
+  EXPECT_EQ(full_delta, extended_delta);
+  // The whole target is now a single COPY from the dictionary.
+  EXPECT_GT(strlen(kTarget) / 4, extended_delta.size());
+}
+
+TEST_F(VCDiffEncoderTest, InitFromBaseWithUnrelatedBase) {
+  HashedDictionary unrelated(kTarget, strlen(kTarget));
+  EXPECT_TRUE(unrelated.InitFromBase(hashed_dictionary_));
+  VCDiffStreamingEncoder encoder(&unrelated, VCD_STANDARD_FORMAT, true);
+  std::string delta;
+  EXPECT_TRUE(encoder.StartEncoding(&delta));
+  EXPECT_TRUE(encoder.EncodeChunk(kTarget, strlen(kTarget), &delta));
+  EXPECT_TRUE(encoder.FinishEncoding(&delta));
+  EXPECT_TRUE(simple_decoder_.Decode(kTarget, strlen(kTarget), delta,
+                                     &result_target_));
+  EXPECT_EQ(kTarget, result_target_);
+  EXPECT_GT(strlen(kTarget) / 4, delta.size());
+}
+
+// The gear hash finds the same blocks as the default hash, so the encoding
+// is the same.
+TEST_F(VCDiffEncoderTest, GearHashEncodesLikePolynomialHash) {
+  HashedDictionary gear(kDictionary, sizeof(kDictionary), VCD_HASH_GEAR);
+  EXPECT_TRUE(gear.Init());
+  EXPECT_EQ(VCD_HASH_POLYNOMIAL, hashed_dictionary_.hash_type());
+  EXPECT_EQ(VCD_HASH_GEAR, gear.hash_type());
+  VCDiffStreamingEncoder gear_encoder(&gear, VCD_STANDARD_FORMAT, true);
+  std::string gear_delta;
+  EXPECT_TRUE(gear_encoder.StartEncoding(&gear_delta));
+  EXPECT_TRUE(gear_encoder.EncodeChunk(kTarget, strlen(kTarget),
+                                       &gear_delta));
+  EXPECT_TRUE(gear_encoder.FinishEncoding(&gear_delta));
+  VCDiffStreamingEncoder encoder(&hashed_dictionary_, VCD_STANDARD_FORMAT,
+                                 true);
+  EXPECT_TRUE(encoder.StartEncoding(delta()));
+  EXPECT_TRUE(encoder.EncodeChunk(kTarget, strlen(kTarget), delta()));
+  EXPECT_TRUE(encoder.FinishEncoding(delta()));
+  EXPECT_EQ(delta_as_const(), gear_delta);
+  EXPECT_TRUE(simple_decoder_.Decode(kDictionary, sizeof(kDictionary),
+                                     gear_delta, &result_target_));
+  EXPECT_EQ(kTarget, result_target_);
+}
+
+// A base built with another hash cannot be reused, but it does no harm.
+TEST_F(VCDiffEncoderTest, InitFromBaseWithDifferentHashType) {
+  const std::string extended_text =
+      std::string(kDictionary, sizeof(kDictionary)) + kTarget;
+  HashedDictionary extended(extended_text.data(), extended_text.size(),
+                            VCD_HASH_GEAR);
+  EXPECT_TRUE(extended.InitFromBase(hashed_dictionary_));
+  EXPECT_EQ(VCD_HASH_GEAR, extended.hash_type());
+  VCDiffStreamingEncoder encoder(&extended, VCD_STANDARD_FORMAT, true);
+  std::string delta;
+  EXPECT_TRUE(encoder.StartEncoding(&delta));
+  EXPECT_TRUE(encoder.EncodeChunk(kTarget, strlen(kTarget), &delta));
+  EXPECT_TRUE(encoder.FinishEncoding(&delta));
+  EXPECT_TRUE(simple_decoder_.Decode(extended_text.data(),
+                                     extended_text.size(), delta,
+                                     &result_target_));
+  EXPECT_EQ(kTarget, result_target_);
+  EXPECT_GT(strlen(kTarget) / 4, delta.size());
+}
+
+TEST_F(VCDiffEncoderTest, OneShotEncoderEncodesLikeVCDiffEncoder) {
+  VCDiffOneShotEncoder one_shot_encoder;
+  one_shot_encoder.SetFormatFlags(VCD_FORMAT_INTERLEAVED);
+  simple_encoder_.SetFormatFlags(VCD_FORMAT_INTERLEAVED);
+  EXPECT_TRUE(simple_encoder_.Encode(kTarget, strlen(kTarget), delta()));
+  std::string one_shot_delta;
+  EXPECT_TRUE(one_shot_encoder.Encode(kDictionary, sizeof(kDictionary),
+                                      kTarget, strlen(kTarget),
+                                      &one_shot_delta));
+  EXPECT_EQ(delta_as_const(), one_shot_delta);
+}
+
+TEST_F(VCDiffEncoderTest, OneShotEncoderIsReusable) {
+  VCDiffOneShotEncoder one_shot_encoder;
+  std::string one_shot_delta("garbage");
+  // The second source is smaller than the first, and the third is empty.
+  const char* const sources[] = { kTarget, kDictionary, "" };
+  const size_t source_sizes[] = { strlen(kTarget), sizeof(kDictionary), 0 };
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(one_shot_encoder.Encode(sources[i], source_sizes[i],
+                                        kTarget, strlen(kTarget),
+                                        &one_shot_delta));
+    EXPECT_TRUE(simple_decoder_.Decode(sources[i], source_sizes[i],
+                                       one_shot_delta, &result_target_));
+    EXPECT_EQ(kTarget, result_target_);
+  }
+}
+
+// Dictionaries of at least VCDiffEngine::kMinPrefetchDictionarySize bytes
+// are encoded with prefetching, which must not change what is found.
+TEST_F(VCDiffEncoderTest, LargeDictionaryFindsSameMatches) {
+  std::string large_source(kDictionary, sizeof(kDictionary));
+  large_source.resize(16 << 20, '\0');
+  VCDiffOneShotEncoder one_shot_encoder;
+  std::string small_delta;
+  EXPECT_TRUE(one_shot_encoder.Encode(kDictionary, sizeof(kDictionary),
+                                      kTarget, strlen(kTarget),
+                                      &small_delta));
+  std::string large_delta;
+  EXPECT_TRUE(one_shot_encoder.Encode(large_source.data(),
+                                      large_source.size(),
+                                      kTarget, strlen(kTarget),
+                                      &large_delta));
+  EXPECT_TRUE(simple_decoder_.Decode(large_source.data(), large_source.size(),
+                                     large_delta, &result_target_));
+  EXPECT_EQ(kTarget, result_target_);
+  // The same COPYs, give or take a few bytes for their addresses and the
+  // larger source segment size.
+  EXPECT_LE(large_delta.size(), small_delta.size() + 8);
+}
+
 // Verify that HashedDictionary stores a copy of the dictionary text,
 // rather than just storing a pointer to it.  If the dictionary buffer
 // is overwritten after creating a HashedDictionary from it, it shouldn't
@@ -705,6 +1106,158 @@ TEST_F(VCDiffEncoderTest, ShouldNotReadPastBeginningOfBuffer) {
 }
 #endif  // HAVE_MPROTECT && (HAVE_MEMALIGN || HAVE_POSIX_MEMALIGN)
 
+class VCDiffSegmentedDictionaryTest : public testing::Test {
+ protected:
+  typedef std::string string;
+
+  static const char kBase[];
+  static const char kSite[];
+
+  VCDiffSegmentedDictionaryTest()
+      : base_(kBase, strlen(kBase)),
+        site_(kSite, strlen(kSite)),
+        whole_text_(string(kBase) + kSite),
+        whole_(whole_text_.data(), whole_text_.size()) {
+    EXPECT_TRUE(base_.Init());
+    EXPECT_TRUE(site_.Init());
+    EXPECT_TRUE(whole_.Init());
+    std::vector<const HashedDictionary*> segments;
+    segments.push_back(&base_);
+    segments.push_back(&site_);
+    segmented_.reset(new HashedDictionary(segments));
+    EXPECT_TRUE(segmented_->Init());
+  }
+
+  static string Encode(const HashedDictionary* dictionary,
+                       const string& target) {
+    VCDiffStreamingEncoder encoder(dictionary, VCD_STANDARD_FORMAT, false);
+    string delta;
+    EXPECT_TRUE(encoder.StartEncoding(&delta));
+    EXPECT_TRUE(encoder.EncodeChunk(target.data(), target.size(), &delta));
+    EXPECT_TRUE(encoder.FinishEncoding(&delta));
+    return delta;
+  }
+
+  // Decodes delta against the given pieces of the whole dictionary.
+  static string DecodeWithSegments(const std::vector<string>& pieces,
+                                   const string& delta) {
+    std::vector<const char*> ptrs;
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+      ptrs.push_back(pieces[i].data());
+      sizes.push_back(pieces[i].size());
+    }
+    VCDiffStreamingDecoder decoder;
+    decoder.StartDecodingWithSegments(&ptrs[0], &sizes[0], pieces.size());
+    string result;
+    EXPECT_TRUE(decoder.DecodeChunk(delta.data(), delta.size(), &result));
+    EXPECT_TRUE(decoder.FinishDecoding());
+    return result;
+  }
+
+  std::vector<string> BaseAndSite() const {
+    std::vector<string> pieces;
+    pieces.push_back(kBase);
+    pieces.push_back(kSite);
+    return pieces;
+  }
+
+  HashedDictionary base_;
+  HashedDictionary site_;
+  const string whole_text_;
+  HashedDictionary whole_;
+  UNIQUE_PTR<HashedDictionary> segmented_;
+};
+
+const char VCDiffSegmentedDictionaryTest::kBase[] =
+    "\"Just the place for a Snark!\" the Bellman cried,\n"
+    "As he landed his crew with care;\n"
+    "Supporting each man on the top of the tide\n"
+    "By a finger entwined in his hair.\n";
+
+const char VCDiffSegmentedDictionaryTest::kSite[] =
+    "\"Just the place for a Snark! I have said it twice:\n"
+    "That alone should encourage the crew.\n"
+    "Just the place for a Snark! I have said it thrice:\n"
+    "What I tell you three times is true.\"\n";
+
+TEST_F(VCDiffSegmentedDictionaryTest, SizeIsTheSumOfSegments) {
+  EXPECT_EQ(whole_text_.size(), segmented_->engine()->dictionary_size());
+  string contents;
+  segmented_->engine()->AppendDictionary(0, whole_text_.size(), &contents);
+  EXPECT_EQ(whole_text_, contents);
+}
+
+TEST_F(VCDiffSegmentedDictionaryTest, CopiesFromEverySegment) {
+  const string target = string("Supporting each man on the top of the tide") +
+      "That alone should encourage the crew.\n";
+  const string delta = Encode(segmented_.get(), target);
+  EXPECT_GT(target.size() / 2, delta.size());
+  // The delta is valid against the concatenation of the segments...
+  VCDiffDecoder decoder;
+  string result;
+  EXPECT_TRUE(decoder.Decode(whole_text_.data(), whole_text_.size(), delta,
+                             &result));
+  EXPECT_EQ(target, result);
+  // ... and against the segments themselves.
+  EXPECT_EQ(target, DecodeWithSegments(BaseAndSite(), delta));
+}
+
+TEST_F(VCDiffSegmentedDictionaryTest, SameOutputAsConcatenation) {
+  // No match here spans the two segments.
+  const string target = string(kSite) + "By a finger entwined in his hair.\n";
+  EXPECT_EQ(Encode(&whole_, target), Encode(segmented_.get(), target));
+}
+
+TEST_F(VCDiffSegmentedDictionaryTest, NestedSegments) {
+  HashedDictionary empty("", 0);
+  EXPECT_TRUE(empty.Init());
+  std::vector<const HashedDictionary*> segments;
+  segments.push_back(&empty);
+  segments.push_back(segmented_.get());
+  segments.push_back(&base_);
+  HashedDictionary nested(segments);
+  EXPECT_TRUE(nested.Init());
+  const string target = string(kBase) + kSite + kBase;
+  const string delta = Encode(&nested, target);
+  EXPECT_GT(target.size() / 4, delta.size());
+  std::vector<string> pieces = BaseAndSite();
+  pieces.insert(pieces.begin(), "");
+  pieces.push_back(kBase);
+  EXPECT_EQ(target, DecodeWithSegments(pieces, delta));
+}
+
+TEST_F(VCDiffSegmentedDictionaryTest, DecodeCopiesAcrossSegments) {
+  // Encoded against the contiguous dictionary, the whole target is a single
+  // COPY which spans all of the pieces below.
+  const string target = whole_text_.substr(10, whole_text_.size() - 20);
+  const string delta = Encode(&whole_, target);
+  std::vector<string> pieces;
+  pieces.push_back(whole_text_.substr(0, 20));
+  pieces.push_back(whole_text_.substr(20, 1));
+  pieces.push_back("");
+  pieces.push_back(whole_text_.substr(21, 100));
+  pieces.push_back(whole_text_.substr(121));
+  EXPECT_EQ(target, DecodeWithSegments(pieces, delta));
+}
+
+TEST_F(VCDiffSegmentedDictionaryTest, SegmentsWithDifferentHashTypes) {
+  HashedDictionary gear_site(kSite, strlen(kSite), VCD_HASH_GEAR);
+  EXPECT_TRUE(gear_site.Init());
+  std::vector<const HashedDictionary*> segments;
+  segments.push_back(&base_);
+  segments.push_back(&gear_site);
+  HashedDictionary mixed(segments);
+  EXPECT_FALSE(mixed.Init());
+  segments[0] = &gear_site;
+  HashedDictionary gear_only(segments);
+  EXPECT_TRUE(gear_only.Init());
+  EXPECT_EQ(VCD_HASH_GEAR, gear_only.hash_type());
+  const string target = string(kSite) + kSite;
+  EXPECT_EQ(target, DecodeWithSegments(std::vector<string>(2, kSite),
+                                       Encode(&gear_only, target)));
+}
+
 class VCDiffHTML1Test : public VerifyEncodedBytesTest {
  protected:
   static const char kDictionary[];
@@ -0,0 +1,109 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#include "vcd_code_table_trainer.h"
+
+#include <string>
+
+#include <node_buffer.h>
+
+#include "third-party/open-vcdiff/src/google/code_table_trainer.h"
+#include "vcd_hashed_dictionary.h"
+
+VcdCodeTableTrainer::VcdCodeTableTrainer(
+    v8::Isolate* isolate,
+    v8::Local<v8::Object> hashed_dictionary,
+    std::unique_ptr<open_vcdiff::CodeTableTrainer> trainer)
+    : trainer_(std::move(trainer)),
+      hashed_dictionary_(isolate, hashed_dictionary) {
+}
+
+VcdCodeTableTrainer::~VcdCodeTableTrainer() {
+  hashed_dictionary_.Reset();
+}
+
+// static
+void VcdCodeTableTrainer::Init(v8::Handle<v8::Object> exports) {
+  v8::Isolate* isolate = exports->GetIsolate();
+
+  v8::Local<v8::String> className = v8::String::NewFromUtf8(isolate, "CodeTableTrainer", v8::String::kInternalizedString);
+  v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(isolate, New);
+  tpl->SetClassName(className);
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  NODE_SET_PROTOTYPE_METHOD(tpl, "analyze", Analyze);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "build", Build);
+
+  exports->Set(className, tpl->GetFunction());
+}
+
+// static
+void VcdCodeTableTrainer::New(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args.Length() == 4 && args[0]->IsObject() &&
+         "new CodeTableTrainer(hashedDictionary, targetMatches, "
+         "nearCacheSize, sameCacheSize)");
+  v8::Isolate* isolate = args.GetIsolate();
+  auto hashed_dict = Unwrap<VcdHashedDictionary>(args[0]->ToObject());
+  std::unique_ptr<open_vcdiff::CodeTableTrainer> trainer(
+      new open_vcdiff::CodeTableTrainer(hashed_dict->hashed_dictionary(),
+                                        args[1]->BooleanValue()));
+  if (!trainer->SetAddressCacheSizes(args[2]->Int32Value(),
+                                     args[3]->Int32Value())) {
+    isolate->ThrowException(v8::Exception::Error(
+        v8::String::NewFromUtf8(isolate, "Invalid address cache sizes")));
+    return;
+  }
+  auto obj = new VcdCodeTableTrainer(
+      isolate, args[0]->ToObject(), std::move(trainer));
+  obj->Wrap(args.This());
+}
+
+// static
+void VcdCodeTableTrainer::Analyze(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args.Length() == 1 && node::Buffer::HasInstance(args[0]) &&
+         "analyze(buffer)");
+  VcdCodeTableTrainer* obj = Unwrap<VcdCodeTableTrainer>(args.Holder());
+  bool ok = obj->trainer_->AnalyzeTarget(node::Buffer::Data(args[0]),
+                                         node::Buffer::Length(args[0]));
+  args.GetReturnValue().Set(ok);
+}
+
+// static
+void VcdCodeTableTrainer::Stats(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  VcdCodeTableTrainer* obj = Unwrap<VcdCodeTableTrainer>(args.Holder());
+  const open_vcdiff::CodeTableTrainer& trainer = *obj->trainer_;
+
+  v8::Local<v8::Object> stats = v8::Object::New(isolate);
+  stats->Set(v8::String::NewFromUtf8(isolate, "targets"),
+             v8::Number::New(isolate, trainer.targets_analyzed()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "targetSize"),
+             v8::Number::New(isolate, trainer.total_target_size()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "encodedSize"),
+             v8::Number::New(isolate, trainer.total_encoded_size()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "instructions"),
+             v8::Number::New(isolate, trainer.instructions_recorded()));
+  args.GetReturnValue().Set(stats);
+}
+
+// static
+// Returns [codeTable, estimatedSaving].
+void VcdCodeTableTrainer::Build(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  VcdCodeTableTrainer* obj = Unwrap<VcdCodeTableTrainer>(args.Holder());
+  std::string code_table;
+  uint64_t saving = obj->trainer_->BuildCodeTable(&code_table);
+  v8::Local<v8::Array> result = v8::Array::New(isolate, 2);
+  result->Set(0, node::Buffer::Copy(
+      isolate, code_table.data(), code_table.size()).ToLocalChecked());
+  result->Set(1, v8::Number::New(isolate, static_cast<double>(saving)));
+  args.GetReturnValue().Set(result);
+}
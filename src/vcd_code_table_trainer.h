@@ -0,0 +1,46 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#ifndef VCD_CODE_TABLE_TRAINER_H_
+#define VCD_CODE_TABLE_TRAINER_H_
+
+#include <memory>
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <v8.h>
+
+namespace open_vcdiff {
+class CodeTableTrainer;
+}
+
+// Offline tool: encodes a corpus against a HashedDictionary, counts the
+// instructions of the deltas, and builds a code table that gives them
+// single-byte opcodes. Everything runs synchronously.
+class VcdCodeTableTrainer : public node::ObjectWrap {
+ public:
+  VcdCodeTableTrainer(
+      v8::Isolate* isolate,
+      v8::Local<v8::Object> hashed_dictionary,
+      std::unique_ptr<open_vcdiff::CodeTableTrainer> trainer);
+  virtual ~VcdCodeTableTrainer();
+
+  static void Init(v8::Handle<v8::Object> exports);
+
+ private:
+  static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Analyze(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Stats(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Build(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+  std::unique_ptr<open_vcdiff::CodeTableTrainer> trainer_;
+  v8::Persistent<v8::Object> hashed_dictionary_;
+
+  VcdCodeTableTrainer(const VcdCodeTableTrainer& other) = delete;
+  VcdCodeTableTrainer& operator=(const VcdCodeTableTrainer& other) = delete;
+};
+
+#endif  // VCD_CODE_TABLE_TRAINER_H_
@@ -15,16 +15,31 @@ VcdDecoder::VcdDecoder(
     v8::Local<v8::Object> dictionary_handle,
     std::unique_ptr<open_vcdiff::VCDiffStreamingDecoder> decoder)
     : decoder_(std::move(decoder)),
-      dictionary_handle_(isolate, dictionary_handle),
-      dictionary_buffer_(node::Buffer::Data(dictionary_handle)),
-      dictionary_len_(node::Buffer::Length(dictionary_handle)) {
+      dictionary_handle_(isolate, dictionary_handle) {
+  if (dictionary_handle->IsArray()) {
+    v8::Local<v8::Array> segments =
+        v8::Local<v8::Array>::Cast(dictionary_handle);
+    for (uint32_t i = 0; i < segments->Length(); ++i) {
+      v8::Local<v8::Value> segment = segments->Get(i);
+      assert(node::Buffer::HasInstance(segment) &&
+             "dictionary segments should be Buffers");
+      dictionary_buffers_.push_back(node::Buffer::Data(segment));
+      dictionary_lens_.push_back(node::Buffer::Length(segment));
+    }
+  } else {
+    dictionary_buffers_.push_back(node::Buffer::Data(dictionary_handle));
+    dictionary_lens_.push_back(node::Buffer::Length(dictionary_handle));
+  }
 }
 
 VcdDecoder::~VcdDecoder() {
+  dictionary_handle_.Reset();
 }
 
 VcdCtx::Error VcdDecoder::Start(open_vcdiff::OutputStringInterface* out) {
-  decoder_->StartDecoding(dictionary_buffer_, dictionary_len_);
+  decoder_->StartDecodingWithSegments(dictionary_buffers_.data(),
+                                      dictionary_lens_.data(),
+                                      dictionary_buffers_.size());
   return VcdCtx::Error::OK;
 }
 
@@ -8,6 +8,7 @@
 #define VCD_DECODER_H_
 
 #include <memory>
+#include <vector>
 
 #include <v8.h>
 
@@ -37,10 +38,11 @@ class VcdDecoder : public VcdCtx::Coder {
  private:
   std::unique_ptr<open_vcdiff::VCDiffStreamingDecoder> decoder_;
 
-  // Store it to prevent GCing.
+  // Store it to prevent GCing. Either a Buffer or an Array of Buffers
+  // whose concatenation is the dictionary.
   v8::Persistent<v8::Object> dictionary_handle_;
-  const char* dictionary_buffer_;
-  size_t dictionary_len_;
+  std::vector<const char*> dictionary_buffers_;
+  std::vector<size_t> dictionary_lens_;
 
   VcdDecoder(const VcdDecoder& other) = delete;
   VcdDecoder& operator=(const VcdDecoder& other) = delete;
@@ -0,0 +1,115 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#include "vcd_dictionary_analyzer.h"
+
+#include <string>
+
+#include <node_buffer.h>
+
+#include "third-party/open-vcdiff/src/google/dictionary_analyzer.h"
+#include "vcd_hashed_dictionary.h"
+
+VcdDictionaryAnalyzer::VcdDictionaryAnalyzer(
+    v8::Isolate* isolate,
+    v8::Local<v8::Object> hashed_dictionary,
+    std::unique_ptr<open_vcdiff::DictionaryAnalyzer> analyzer)
+    : analyzer_(std::move(analyzer)),
+      hashed_dictionary_(isolate, hashed_dictionary) {
+}
+
+VcdDictionaryAnalyzer::~VcdDictionaryAnalyzer() {
+  hashed_dictionary_.Reset();
+}
+
+// static
+void VcdDictionaryAnalyzer::Init(v8::Handle<v8::Object> exports) {
+  v8::Isolate* isolate = exports->GetIsolate();
+
+  v8::Local<v8::String> className = v8::String::NewFromUtf8(isolate, "DictionaryAnalyzer", v8::String::kInternalizedString);
+  v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(isolate, New);
+  tpl->SetClassName(className);
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  NODE_SET_PROTOTYPE_METHOD(tpl, "analyze", Analyze);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "estimate", Estimate);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "compact", Compact);
+
+  exports->Set(className, tpl->GetFunction());
+}
+
+// static
+void VcdDictionaryAnalyzer::New(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args.Length() == 2 && args[0]->IsObject() &&
+         "new DictionaryAnalyzer(hashedDictionary, targetMatches)");
+  v8::Isolate* isolate = args.GetIsolate();
+  auto hashed_dict = Unwrap<VcdHashedDictionary>(args[0]->ToObject());
+  std::unique_ptr<open_vcdiff::DictionaryAnalyzer> analyzer(
+      new open_vcdiff::DictionaryAnalyzer(hashed_dict->hashed_dictionary(),
+                                          args[1]->BooleanValue()));
+  auto obj = new VcdDictionaryAnalyzer(
+      isolate, args[0]->ToObject(), std::move(analyzer));
+  obj->Wrap(args.This());
+}
+
+// static
+void VcdDictionaryAnalyzer::Analyze(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args.Length() == 1 && node::Buffer::HasInstance(args[0]) &&
+         "analyze(buffer)");
+  VcdDictionaryAnalyzer* obj = Unwrap<VcdDictionaryAnalyzer>(args.Holder());
+  bool ok = obj->analyzer_->AnalyzeTarget(node::Buffer::Data(args[0]),
+                                          node::Buffer::Length(args[0]));
+  args.GetReturnValue().Set(ok);
+}
+
+// static
+void VcdDictionaryAnalyzer::Stats(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  VcdDictionaryAnalyzer* obj = Unwrap<VcdDictionaryAnalyzer>(args.Holder());
+  const open_vcdiff::DictionaryAnalyzer& analyzer = *obj->analyzer_;
+
+  v8::Local<v8::Object> stats = v8::Object::New(isolate);
+  stats->Set(v8::String::NewFromUtf8(isolate, "targets"),
+             v8::Number::New(isolate, analyzer.targets_analyzed()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "targetSize"),
+             v8::Number::New(isolate, analyzer.total_target_size()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "encodedSize"),
+             v8::Number::New(isolate, analyzer.total_encoded_size()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "copiedSize"),
+             v8::Number::New(isolate, analyzer.total_copied_size()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "dictionarySize"),
+             v8::Number::New(isolate, analyzer.dictionary_size()));
+  stats->Set(v8::String::NewFromUtf8(isolate, "usedSize"),
+             v8::Number::New(isolate, analyzer.used_size()));
+  args.GetReturnValue().Set(stats);
+}
+
+// static
+void VcdDictionaryAnalyzer::Estimate(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args.Length() == 1 && args[0]->IsNumber() && "estimate(maxSize)");
+  VcdDictionaryAnalyzer* obj = Unwrap<VcdDictionaryAnalyzer>(args.Holder());
+  uint64_t size = obj->analyzer_->EstimateEncodedSize(
+      static_cast<size_t>(args[0]->NumberValue()));
+  args.GetReturnValue().Set(static_cast<double>(size));
+}
+
+// static
+void VcdDictionaryAnalyzer::Compact(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args.Length() == 1 && args[0]->IsNumber() && "compact(maxSize)");
+  v8::Isolate* isolate = args.GetIsolate();
+  VcdDictionaryAnalyzer* obj = Unwrap<VcdDictionaryAnalyzer>(args.Holder());
+  std::string compacted;
+  obj->analyzer_->CompactDictionary(
+      static_cast<size_t>(args[0]->NumberValue()), &compacted);
+  args.GetReturnValue().Set(node::Buffer::Copy(
+      isolate, compacted.data(), compacted.size()).ToLocalChecked());
+}
@@ -0,0 +1,47 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#ifndef VCD_DICTIONARY_ANALYZER_H_
+#define VCD_DICTIONARY_ANALYZER_H_
+
+#include <memory>
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <v8.h>
+
+namespace open_vcdiff {
+class DictionaryAnalyzer;
+}
+
+// Offline tool: encodes a corpus against a HashedDictionary, records which
+// dictionary bytes COPY instructions use, and produces a compacted
+// dictionary without the unused ones. Everything runs synchronously.
+class VcdDictionaryAnalyzer : public node::ObjectWrap {
+ public:
+  VcdDictionaryAnalyzer(
+      v8::Isolate* isolate,
+      v8::Local<v8::Object> hashed_dictionary,
+      std::unique_ptr<open_vcdiff::DictionaryAnalyzer> analyzer);
+  virtual ~VcdDictionaryAnalyzer();
+
+  static void Init(v8::Handle<v8::Object> exports);
+
+ private:
+  static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Analyze(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Stats(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Estimate(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Compact(const v8::FunctionCallbackInfo<v8::Value>& args);
+
+  std::unique_ptr<open_vcdiff::DictionaryAnalyzer> analyzer_;
+  v8::Persistent<v8::Object> hashed_dictionary_;
+
+  VcdDictionaryAnalyzer(const VcdDictionaryAnalyzer& other) = delete;
+  VcdDictionaryAnalyzer& operator=(const VcdDictionaryAnalyzer& other) = delete;
+};
+
+#endif  // VCD_DICTIONARY_ANALYZER_H_
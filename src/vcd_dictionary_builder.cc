@@ -0,0 +1,347 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#include "vcd_dictionary_builder.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <unordered_set>
+
+#include <node_buffer.h>
+
+namespace {
+
+// Same as open_vcdiff::BlockHash::kBlockSize: blocks shorter than that are
+// never found by the encoder, whatever the dictionary.
+const size_t kBlockSize = 16;
+
+// Same as open_vcdiff::VCDiffEngine::kMinimumMatchSize: shorter segments
+// would never be worth a COPY.
+const size_t kMinSegmentSize = 32;
+
+// Block frequencies are kept in a table of 2^kCountTableBits counters.
+// Collisions only ever overestimate a frequency.
+const int kCountTableBits = 20;
+const size_t kCountTableSize = static_cast<size_t>(1) << kCountTableBits;
+
+const unsigned kMaxThreads = 8;
+
+// One block in every kCoverageSampleRate (chosen by content, so that the
+// same blocks are sampled wherever they occur) is used to detect segments
+// that mostly repeat what the dictionary already has.
+const uint64_t kCoverageSampleRate = 8;
+
+// Polynomial rolling hash over kBlockSize-byte windows.
+class BlockRoller {
+ public:
+  static const uint64_t kMult = 0x100000001b3ULL;
+
+  BlockRoller() : remove_mult_(1) {
+    for (size_t i = 0; i < kBlockSize; ++i)
+      remove_mult_ *= kMult;
+  }
+
+  uint64_t Hash(const unsigned char* block) const {
+    uint64_t h = 0;
+    for (size_t i = 0; i < kBlockSize; ++i)
+      h = h * kMult + block[i] + 1;
+    return h;
+  }
+
+  uint64_t Update(uint64_t h, unsigned char old_byte,
+                  unsigned char new_byte) const {
+    return h * kMult + new_byte + 1 - remove_mult_ * (old_byte + 1);
+  }
+
+ private:
+  uint64_t remove_mult_;
+};
+
+inline size_t Slot(uint64_t h) {
+  return static_cast<size_t>((h * 0x9e3779b97f4a7c15ULL) >>
+                             (64 - kCountTableBits));
+}
+
+uint64_t ContentHash(const char* data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325ULL;  // FNV-1a
+  for (size_t i = 0; i < size; ++i) {
+    h ^= static_cast<unsigned char>(data[i]);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+// Calls fn(h) for the hash of every block of the sample, in order.
+template<class Fn>
+void ForEachBlock(const VcdDictionaryBuilder::Sample& sample, Fn fn) {
+  if (sample.second < kBlockSize)
+    return;
+  static const BlockRoller roller;
+  const unsigned char* data =
+      reinterpret_cast<const unsigned char*>(sample.first);
+  const size_t last = sample.second - kBlockSize;
+  uint64_t h = roller.Hash(data);
+  for (size_t pos = 0; ; ++pos) {
+    fn(pos, h);
+    if (pos == last)
+      break;
+    h = roller.Update(h, data[pos], data[pos + kBlockSize]);
+  }
+}
+
+}  // namespace
+
+struct VcdDictionaryBuilder::BuildRequest {
+  uv_work_t work_req;
+  v8::Isolate* isolate;
+  v8::Persistent<v8::Value> samples_handle;  // keeps the samples alive
+  v8::Persistent<v8::Function> callback;
+  std::unique_ptr<VcdDictionaryBuilder> builder;
+  std::string dictionary;
+};
+
+VcdDictionaryBuilder::VcdDictionaryBuilder(std::vector<Sample> samples,
+                                           const Options& options)
+    : samples_(std::move(samples)),
+      options_(options) {
+  num_threads_ = options_.num_threads;
+  if (num_threads_ == 0)
+    num_threads_ = std::min(std::max(std::thread::hardware_concurrency(), 1u),
+                            kMaxThreads);
+  num_threads_ = std::max(
+      std::min(num_threads_, static_cast<unsigned>(samples_.size())), 1u);
+}
+
+template<class Fn>
+void VcdDictionaryBuilder::RunOnThreads(Fn fn) const {
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < num_threads_; ++t)
+    threads.emplace_back(fn, t);
+  fn(0);
+  for (auto& thread : threads)
+    thread.join();
+}
+
+std::string VcdDictionaryBuilder::Build() {
+  // 1. Count in how many samples each block occurs.
+  std::vector<std::vector<uint32_t>> counts(num_threads_);
+  RunOnThreads([this, &counts](unsigned t) {
+    CountBlocks(t, num_threads_, &counts[t]);
+  });
+  frequencies_.assign(kCountTableSize, 0);
+  for (const auto& thread_counts : counts) {
+    for (size_t i = 0; i < kCountTableSize; ++i)
+      frequencies_[i] += thread_counts[i];
+  }
+  counts.clear();
+
+  // 2. Turn runs of frequent blocks into candidate segments.
+  std::vector<std::vector<Candidate>> thread_candidates(num_threads_);
+  RunOnThreads([this, &thread_candidates](unsigned t) {
+    FindCandidates(t, num_threads_, &thread_candidates[t]);
+  });
+  std::vector<Candidate> candidates;
+  for (auto& c : thread_candidates)
+    candidates.insert(candidates.end(), c.begin(), c.end());
+  thread_candidates.clear();
+  // Ties are broken by position, so that the result does not depend on
+  // the number of threads.
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              if (a.score != b.score)
+                return a.score > b.score;
+              if (a.sample != b.sample)
+                return a.sample < b.sample;
+              return a.offset < b.offset;
+            });
+
+  // 3. Greedily take the best segments that still add something new.
+  std::unordered_set<uint64_t> seen_content;
+  std::unordered_set<uint64_t> covered_blocks;
+  std::vector<Candidate> chosen;
+  size_t remaining = options_.max_size;
+  for (const Candidate& c : candidates) {
+    if (remaining < kMinSegmentSize)
+      break;
+    if (c.size > remaining || !seen_content.insert(c.content_hash).second)
+      continue;
+    Sample segment(samples_[c.sample].first + c.offset, c.size);
+    size_t sampled = 0;
+    size_t covered = 0;
+    ForEachBlock(segment, [&](size_t, uint64_t h) {
+      if (h % kCoverageSampleRate == 0) {
+        ++sampled;
+        covered += covered_blocks.count(h);
+      }
+    });
+    if (covered * 2 > sampled)
+      continue;
+    ForEachBlock(segment, [&](size_t, uint64_t h) {
+      if (h % kCoverageSampleRate == 0)
+        covered_blocks.insert(h);
+    });
+    chosen.push_back(c);
+    remaining -= c.size;
+  }
+
+  // 4. Hottest content first.
+  std::stable_sort(chosen.begin(), chosen.end(),
+                   [](const Candidate& a, const Candidate& b) {
+                     return a.score * b.size > b.score * a.size;
+                   });
+  std::string dictionary;
+  dictionary.reserve(options_.max_size - remaining);
+  for (const Candidate& c : chosen)
+    dictionary.append(samples_[c.sample].first + c.offset, c.size);
+  return dictionary;
+}
+
+void VcdDictionaryBuilder::CountBlocks(size_t first_sample,
+                                       size_t sample_step,
+                                       std::vector<uint32_t>* counts) const {
+  counts->assign(kCountTableSize, 0);
+  // Remembers the last sample that bumped each counter, so that a block is
+  // counted once per sample however often it repeats there.
+  std::vector<uint32_t> last_sample(kCountTableSize, 0);
+  for (size_t i = first_sample; i < samples_.size(); i += sample_step) {
+    const uint32_t sample_tag = static_cast<uint32_t>(i + 1);
+    ForEachBlock(samples_[i], [&](size_t, uint64_t h) {
+      size_t slot = Slot(h);
+      if (last_sample[slot] != sample_tag) {
+        last_sample[slot] = sample_tag;
+        ++(*counts)[slot];
+      }
+    });
+  }
+}
+
+void VcdDictionaryBuilder::FindCandidates(
+    size_t first_sample,
+    size_t sample_step,
+    std::vector<Candidate>* candidates) const {
+  for (size_t i = first_sample; i < samples_.size(); i += sample_step) {
+    const Sample& sample = samples_[i];
+    size_t run_start = 0;
+    size_t run_blocks = 0;
+    uint64_t run_score = 0;
+    auto end_run = [&]() {
+      size_t size = run_blocks + kBlockSize - 1;
+      if (run_blocks > 0 && size >= kMinSegmentSize) {
+        Candidate c = {
+          i, run_start, size, run_score,
+          ContentHash(sample.first + run_start, size) };
+        candidates->push_back(c);
+      }
+      run_blocks = 0;
+      run_score = 0;
+    };
+    ForEachBlock(sample, [&](size_t pos, uint64_t h) {
+      uint32_t frequency = frequencies_[Slot(h)];
+      if (frequency < options_.min_frequency) {
+        end_run();
+        return;
+      }
+      if (run_blocks == 0)
+        run_start = pos;
+      ++run_blocks;
+      run_score += frequency;
+    });
+    end_run();
+  }
+}
+
+// static
+void VcdDictionaryBuilder::Init(v8::Handle<v8::Object> exports) {
+  NODE_SET_METHOD(exports, "buildDictionarySync", BuildSync);
+  NODE_SET_METHOD(exports, "buildDictionary", BuildAsync);
+}
+
+// static
+// args: (samples array of Buffers, maxSize, minFrequency, numThreads[, cb])
+VcdDictionaryBuilder::BuildRequest* VcdDictionaryBuilder::ParseArgs(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  assert(args[0]->IsArray() && "samples should be an Array of Buffers");
+  v8::Local<v8::Array> array = v8::Local<v8::Array>::Cast(args[0]);
+
+  std::vector<Sample> samples;
+  samples.reserve(array->Length());
+  for (uint32_t i = 0; i < array->Length(); ++i) {
+    v8::Local<v8::Value> sample = array->Get(i);
+    assert(node::Buffer::HasInstance(sample) && "sample should be a Buffer");
+    samples.push_back(Sample(node::Buffer::Data(sample),
+                             node::Buffer::Length(sample)));
+  }
+
+  Options options;
+  options.max_size = static_cast<size_t>(args[1]->NumberValue());
+  options.min_frequency = args[2]->Uint32Value();
+  options.num_threads = args[3]->Uint32Value();
+
+  BuildRequest* request = new BuildRequest;
+  request->isolate = isolate;
+  request->samples_handle.Reset(isolate, array);
+  request->builder.reset(new VcdDictionaryBuilder(std::move(samples),
+                                                  options));
+  return request;
+}
+
+// static
+void VcdDictionaryBuilder::BuildSync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  std::unique_ptr<BuildRequest> request(ParseArgs(args));
+  std::string dictionary = request->builder->Build();
+  request->samples_handle.Reset();
+  args.GetReturnValue().Set(node::Buffer::Copy(
+      isolate, dictionary.data(), dictionary.size()).ToLocalChecked());
+}
+
+// static
+void VcdDictionaryBuilder::BuildAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args[4]->IsFunction() && "callback should be a Function");
+  BuildRequest* request = ParseArgs(args);
+  request->callback.Reset(args.GetIsolate(),
+                          v8::Local<v8::Function>::Cast(args[4]));
+  request->work_req.data = request;
+  uv_queue_work(uv_default_loop(),
+                &request->work_req,
+                BuildShim,
+                AfterBuildShim);
+  args.GetReturnValue().Set(v8::Undefined(args.GetIsolate()));
+}
+
+// static
+// thread pool!
+void VcdDictionaryBuilder::BuildShim(uv_work_t* work_req) {
+  BuildRequest* request = static_cast<BuildRequest*>(work_req->data);
+  request->dictionary = request->builder->Build();
+}
+
+// static
+void VcdDictionaryBuilder::AfterBuildShim(uv_work_t* work_req, int status) {
+  assert(status == 0);
+
+  std::unique_ptr<BuildRequest> request(
+      static_cast<BuildRequest*>(work_req->data));
+  v8::Isolate* isolate = request->isolate;
+  v8::HandleScope handle_scope(isolate);
+
+  v8::Local<v8::Value> args[2] = {
+    v8::Null(isolate),
+    node::Buffer::Copy(isolate,
+                       request->dictionary.data(),
+                       request->dictionary.size()).ToLocalChecked(),
+  };
+  v8::Local<v8::Function> callback =
+      v8::Local<v8::Function>::New(isolate, request->callback);
+  node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(),
+                     callback, 2, args);
+  request->samples_handle.Reset();
+  request->callback.Reset();
+}
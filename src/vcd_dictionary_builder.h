@@ -0,0 +1,82 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#ifndef VCD_DICTIONARY_BUILDER_H_
+#define VCD_DICTIONARY_BUILDER_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <node.h>
+#include <uv.h>
+#include <v8.h>
+
+// Builds an SDCH dictionary out of a corpus of sample responses.
+//
+// Every 16-byte block (the BlockHash block size) of every sample is counted
+// once per sample it occurs in. Runs of blocks that occur in at least
+// |min_frequency| samples become candidate segments, which are picked in
+// order of score (frequency times length) until the size budget is used up.
+// The segments are then laid out hottest first, because low dictionary
+// offsets get the cheapest COPY addresses.
+//
+// Counting and candidate extraction are spread over |num_threads| threads.
+class VcdDictionaryBuilder {
+ public:
+  typedef std::pair<const char*, size_t> Sample;
+
+  struct Options {
+    size_t max_size = 64 * 1024;
+    size_t min_frequency = 2;
+    unsigned num_threads = 0;  // 0 means one per core, up to 8
+  };
+
+  VcdDictionaryBuilder(std::vector<Sample> samples, const Options& options);
+
+  // Thread-safe with respect to the samples: they are only read.
+  std::string Build();
+
+  static void Init(v8::Handle<v8::Object> exports);
+
+ private:
+  struct Candidate {
+    size_t sample;
+    size_t offset;
+    size_t size;
+    uint64_t score;
+    uint64_t content_hash;
+  };
+
+  struct BuildRequest;
+
+  void CountBlocks(size_t first_sample,
+                   size_t sample_step,
+                   std::vector<uint32_t>* counts) const;
+  void FindCandidates(size_t first_sample,
+                      size_t sample_step,
+                      std::vector<Candidate>* candidates) const;
+  template<class Fn>
+  void RunOnThreads(Fn fn) const;
+
+  static void BuildSync(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void BuildAsync(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static BuildRequest* ParseArgs(
+      const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void BuildShim(uv_work_t* work_req);
+  static void AfterBuildShim(uv_work_t* work_req, int status);
+
+  const std::vector<Sample> samples_;
+  const Options options_;
+  unsigned num_threads_;
+  std::vector<uint32_t> frequencies_;
+
+  VcdDictionaryBuilder(const VcdDictionaryBuilder& other) = delete;
+  VcdDictionaryBuilder& operator=(const VcdDictionaryBuilder& other) = delete;
+};
+
+#endif  // VCD_DICTIONARY_BUILDER_H_
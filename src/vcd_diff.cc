@@ -0,0 +1,131 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#include "vcd_diff.h"
+
+#include <memory>
+
+#include <node_buffer.h>
+
+#include "third-party/open-vcdiff/src/google/vcencoder.h"
+
+struct VcdDiff::DiffRequest {
+  uv_work_t work_req;
+  v8::Isolate* isolate;
+  v8::Persistent<v8::Value> source_handle;  // keeps the buffers alive
+  v8::Persistent<v8::Value> target_handle;
+  v8::Persistent<v8::Function> callback;
+  const char* source;
+  size_t source_len;
+  const char* target;
+  size_t target_len;
+  open_vcdiff::VCDiffFormatExtensionFlags flags;
+  bool target_matches;
+  bool ok;
+  std::string delta;
+};
+
+// static
+void VcdDiff::Init(v8::Handle<v8::Object> exports) {
+  NODE_SET_METHOD(exports, "diffSync", DiffSync);
+  NODE_SET_METHOD(exports, "diff", DiffAsync);
+}
+
+// static
+// args: (source Buffer, target Buffer, flags, targetMatches[, cb])
+VcdDiff::DiffRequest* VcdDiff::ParseArgs(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(node::Buffer::HasInstance(args[0]) && "source should be a Buffer");
+  assert(node::Buffer::HasInstance(args[1]) && "target should be a Buffer");
+
+  DiffRequest* request = new DiffRequest;
+  request->isolate = args.GetIsolate();
+  request->source_handle.Reset(request->isolate, args[0]);
+  request->target_handle.Reset(request->isolate, args[1]);
+  request->source = node::Buffer::Data(args[0]);
+  request->source_len = node::Buffer::Length(args[0]);
+  request->target = node::Buffer::Data(args[1]);
+  request->target_len = node::Buffer::Length(args[1]);
+  request->flags = args[2]->Uint32Value();
+  request->target_matches = args[3]->BooleanValue();
+  return request;
+}
+
+// static
+bool VcdDiff::Diff(DiffRequest* request) {
+  thread_local open_vcdiff::VCDiffOneShotEncoder encoder;
+  encoder.SetFormatFlags(request->flags);
+  encoder.SetTargetMatching(request->target_matches);
+  return encoder.Encode(request->source, request->source_len,
+                        request->target, request->target_len,
+                        &request->delta);
+}
+
+// static
+void VcdDiff::DiffSync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  std::unique_ptr<DiffRequest> request(ParseArgs(args));
+  bool ok = Diff(request.get());
+  request->source_handle.Reset();
+  request->target_handle.Reset();
+  if (!ok) {
+    isolate->ThrowException(v8::Exception::Error(
+        v8::String::NewFromUtf8(isolate, "Vcdiff encode error")));
+    return;
+  }
+  args.GetReturnValue().Set(node::Buffer::Copy(
+      isolate, request->delta.data(), request->delta.size()).ToLocalChecked());
+}
+
+// static
+void VcdDiff::DiffAsync(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args[4]->IsFunction() && "callback should be a Function");
+  DiffRequest* request = ParseArgs(args);
+  request->callback.Reset(args.GetIsolate(),
+                          v8::Local<v8::Function>::Cast(args[4]));
+  request->work_req.data = request;
+  uv_queue_work(uv_default_loop(),
+                &request->work_req,
+                DiffShim,
+                AfterDiffShim);
+  args.GetReturnValue().Set(v8::Undefined(args.GetIsolate()));
+}
+
+// static
+// thread pool!
+void VcdDiff::DiffShim(uv_work_t* work_req) {
+  DiffRequest* request = static_cast<DiffRequest*>(work_req->data);
+  request->ok = Diff(request);
+}
+
+// static
+void VcdDiff::AfterDiffShim(uv_work_t* work_req, int status) {
+  assert(status == 0);
+
+  std::unique_ptr<DiffRequest> request(
+      static_cast<DiffRequest*>(work_req->data));
+  v8::Isolate* isolate = request->isolate;
+  v8::HandleScope handle_scope(isolate);
+
+  v8::Local<v8::Value> args[2];
+  if (!request->ok) {
+    args[0] = v8::Exception::Error(
+        v8::String::NewFromUtf8(isolate, "Vcdiff encode error"));
+    args[1] = v8::Undefined(isolate);
+  } else {
+    args[0] = v8::Null(isolate);
+    args[1] = node::Buffer::Copy(isolate,
+                                 request->delta.data(),
+                                 request->delta.size()).ToLocalChecked();
+  }
+  v8::Local<v8::Function> callback =
+      v8::Local<v8::Function>::New(isolate, request->callback);
+  node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(),
+                     callback, 2, args);
+  request->source_handle.Reset();
+  request->target_handle.Reset();
+  request->callback.Reset();
+}
@@ -0,0 +1,39 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#ifndef VCD_DIFF_H_
+#define VCD_DIFF_H_
+
+#include <string>
+
+#include <node.h>
+#include <uv.h>
+#include <v8.h>
+
+// One-shot diffs between two versions of a document: the old version is
+// the dictionary, but it is used only once, so instead of a HashedDictionary
+// it gets the lighter open_vcdiff::VCDiffOneShotEncoder index. Each thread
+// (the main one and those of the libuv pool) keeps its own encoder, so that
+// the memory of the index is reused from one diff to the next.
+class VcdDiff {
+ public:
+  static void Init(v8::Handle<v8::Object> exports);
+
+ private:
+  struct DiffRequest;
+
+  static void DiffSync(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void DiffAsync(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static DiffRequest* ParseArgs(
+      const v8::FunctionCallbackInfo<v8::Value>& args);
+  static bool Diff(DiffRequest* request);
+  static void DiffShim(uv_work_t* work_req);
+  static void AfterDiffShim(uv_work_t* work_req, int status);
+
+  VcdDiff() = delete;
+};
+
+#endif  // VCD_DIFF_H_
@@ -0,0 +1,303 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#include "vcd_encode_cache.h"
+
+#include <cstring>
+
+#include "third-party/open-vcdiff/src/google/output_string.h"
+
+namespace {
+
+// Rough per-entry bookkeeping cost: list node, hash map node and the
+// shared string control block.
+const size_t kEntryOverhead = 128;
+
+// MurmurHash64A by Austin Appleby (public domain). Eight bytes per round,
+// which is a tiny fraction of what encoding the same bytes costs.
+uint64_t Hash64(const char* data, size_t len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+
+  const char* end = data + (len & ~static_cast<size_t>(7));
+  for (const char* p = data; p != end; p += 8) {
+    uint64_t k;
+    std::memcpy(&k, p, sizeof(k));
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  const unsigned char* tail = reinterpret_cast<const unsigned char*>(end);
+  switch (len & 7) {
+    case 7: h ^= static_cast<uint64_t>(tail[6]) << 48;
+            // Fall through.
+    case 6: h ^= static_cast<uint64_t>(tail[5]) << 40;
+            // Fall through.
+    case 5: h ^= static_cast<uint64_t>(tail[4]) << 32;
+            // Fall through.
+    case 4: h ^= static_cast<uint64_t>(tail[3]) << 24;
+            // Fall through.
+    case 3: h ^= static_cast<uint64_t>(tail[2]) << 16;
+            // Fall through.
+    case 2: h ^= static_cast<uint64_t>(tail[1]) << 8;
+            // Fall through.
+    case 1: h ^= static_cast<uint64_t>(tail[0]);
+            h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+}  // namespace
+
+v8::Persistent<v8::FunctionTemplate> VcdEncodeCache::constructor_template;
+
+bool VcdEncodeCache::Key::operator==(const Key& other) const {
+  return dictionary_id == other.dictionary_id &&
+         settings == other.settings &&
+         window_size == other.window_size &&
+         code_table_hash == other.code_table_hash &&
+         target_hash == other.target_hash &&
+         target_size == other.target_size;
+}
+
+size_t VcdEncodeCache::KeyHash::operator()(const Key& key) const {
+  return static_cast<size_t>(key.target_hash ^ key.dictionary_id);
+}
+
+VcdEncodeCache::VcdEncodeCache(size_t max_bytes)
+    : max_bytes_(max_bytes) {
+  uv_mutex_init(&mutex_);
+}
+
+VcdEncodeCache::~VcdEncodeCache() {
+  uv_mutex_destroy(&mutex_);
+}
+
+// static
+VcdEncodeCache::Key VcdEncodeCache::MakeKey(uint64_t dictionary_id,
+                                            uint64_t settings,
+                                            uint64_t window_size,
+                                            uint64_t code_table_hash,
+                                            const std::string& target) {
+  Key key;
+  key.dictionary_id = dictionary_id;
+  key.settings = settings;
+  key.window_size = window_size;
+  key.code_table_hash = code_table_hash;
+  key.target_hash = Hash64(target.data(), target.size(), 0);
+  key.target_size = target.size();
+  return key;
+}
+
+// static
+uint64_t VcdEncodeCache::CodeTableHash(const char* code_table, size_t size) {
+  // Never 0, which stands for the default code table.
+  return Hash64(code_table, size, 0) | 1;
+}
+
+std::shared_ptr<const std::string> VcdEncodeCache::Lookup(
+    const Key& key,
+    const std::string& target) {
+  std::shared_ptr<const std::string> result;
+  uv_mutex_lock(&mutex_);
+  auto it = index_.find(key);
+  // Anyone who controls a target can make its hash collide with that of
+  // another, so the hash alone must not decide what the output is.
+  if (it == index_.end() || it->second->target != target) {
+    ++misses_;
+  } else {
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    result = it->second->encoded;
+  }
+  uv_mutex_unlock(&mutex_);
+  return result;
+}
+
+void VcdEncodeCache::Insert(const Key& key,
+                            std::string target,
+                            std::string encoded) {
+  Entry entry = {
+    key,
+    std::move(target),
+    std::make_shared<const std::string>(std::move(encoded)) };
+  size_t size = EntrySize(entry);
+  if (size > max_bytes_)
+    return;
+
+  uv_mutex_lock(&mutex_);
+  // Another encoder may have raced us to it. A colliding target is left
+  // out rather than taking the place of the one already there.
+  if (index_.find(key) == index_.end()) {
+    EvictLocked(max_bytes_ - size);
+    lru_.push_front(std::move(entry));
+    index_[key] = lru_.begin();
+    bytes_ += size;
+  }
+  uv_mutex_unlock(&mutex_);
+}
+
+// static
+size_t VcdEncodeCache::EntrySize(const Entry& entry) {
+  return entry.target.size() + entry.encoded->size() + kEntryOverhead;
+}
+
+void VcdEncodeCache::EvictLocked(size_t max_bytes) {
+  while (bytes_ > max_bytes && !lru_.empty()) {
+    const Entry& victim = lru_.back();
+    bytes_ -= EntrySize(victim);
+    index_.erase(victim.key);
+    lru_.pop_back();
+    ++evictions_;
+  }
+}
+
+// static
+void VcdEncodeCache::Init(v8::Handle<v8::Object> exports) {
+  v8::Isolate* isolate = exports->GetIsolate();
+
+  v8::Local<v8::String> className = v8::String::NewFromUtf8(isolate, "EncodeCache", v8::String::kInternalizedString);
+  v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(isolate, New);
+  tpl->SetClassName(className);
+  tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+  NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
+  NODE_SET_PROTOTYPE_METHOD(tpl, "clear", Clear);
+
+  constructor_template.Reset(isolate, tpl);
+  exports->Set(className, tpl->GetFunction());
+}
+
+// static
+bool VcdEncodeCache::HasInstance(v8::Isolate* isolate,
+                                 v8::Local<v8::Value> value) {
+  return v8::Local<v8::FunctionTemplate>::New(
+      isolate, constructor_template)->HasInstance(value);
+}
+
+// static
+void VcdEncodeCache::New(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args.Length() == 1 && args[0]->IsNumber() &&
+         "new EncodeCache(maxBytes)");
+  auto cache = new VcdEncodeCache(
+      static_cast<size_t>(args[0]->NumberValue()));
+  cache->Wrap(args.This());
+}
+
+// static
+void VcdEncodeCache::Stats(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  VcdEncodeCache* cache = Unwrap<VcdEncodeCache>(args.Holder());
+
+  uv_mutex_lock(&cache->mutex_);
+  double hits = static_cast<double>(cache->hits_);
+  double misses = static_cast<double>(cache->misses_);
+  double evictions = static_cast<double>(cache->evictions_);
+  double entries = static_cast<double>(cache->lru_.size());
+  double bytes = static_cast<double>(cache->bytes_);
+  uv_mutex_unlock(&cache->mutex_);
+
+  v8::Local<v8::Object> stats = v8::Object::New(isolate);
+  stats->Set(v8::String::NewFromUtf8(isolate, "hits"),
+             v8::Number::New(isolate, hits));
+  stats->Set(v8::String::NewFromUtf8(isolate, "misses"),
+             v8::Number::New(isolate, misses));
+  stats->Set(v8::String::NewFromUtf8(isolate, "evictions"),
+             v8::Number::New(isolate, evictions));
+  stats->Set(v8::String::NewFromUtf8(isolate, "entries"),
+             v8::Number::New(isolate, entries));
+  stats->Set(v8::String::NewFromUtf8(isolate, "bytes"),
+             v8::Number::New(isolate, bytes));
+  stats->Set(v8::String::NewFromUtf8(isolate, "maxBytes"),
+             v8::Number::New(isolate, static_cast<double>(cache->max_bytes_)));
+  args.GetReturnValue().Set(stats);
+}
+
+// static
+void VcdEncodeCache::Clear(const v8::FunctionCallbackInfo<v8::Value>& args) {
+  VcdEncodeCache* cache = Unwrap<VcdEncodeCache>(args.Holder());
+  uv_mutex_lock(&cache->mutex_);
+  cache->index_.clear();
+  cache->lru_.clear();
+  cache->bytes_ = 0;
+  uv_mutex_unlock(&cache->mutex_);
+  args.GetReturnValue().Set(v8::Undefined(args.GetIsolate()));
+}
+
+VcdCachingEncoder::VcdCachingEncoder(v8::Isolate* isolate,
+                                     v8::Local<v8::Object> cache_handle,
+                                     uint64_t dictionary_id,
+                                     uint64_t settings,
+                                     uint64_t window_size,
+                                     uint64_t code_table_hash,
+                                     std::unique_ptr<VcdCtx::Coder> encoder)
+    : cache_handle_(isolate, cache_handle),
+      cache_(node::ObjectWrap::Unwrap<VcdEncodeCache>(cache_handle)),
+      dictionary_id_(dictionary_id),
+      settings_(settings),
+      window_size_(window_size),
+      code_table_hash_(code_table_hash),
+      encoder_(std::move(encoder)) {
+}
+
+VcdCachingEncoder::~VcdCachingEncoder() {
+  cache_handle_.Reset();
+}
+
+VcdCtx::Error VcdCachingEncoder::Start(
+    open_vcdiff::OutputStringInterface* out) {
+  return VcdCtx::Error::OK;
+}
+
+VcdCtx::Error VcdCachingEncoder::Process(
+    const char* data,
+    size_t len,
+    open_vcdiff::OutputStringInterface* out) {
+  target_.append(data, len);
+  return VcdCtx::Error::OK;
+}
+
+VcdCtx::Error VcdCachingEncoder::Finish(
+    open_vcdiff::OutputStringInterface* out) {
+  VcdEncodeCache::Key key =
+      VcdEncodeCache::MakeKey(dictionary_id_, settings_, window_size_,
+                              code_table_hash_, target_);
+  std::shared_ptr<const std::string> cached = cache_->Lookup(key, target_);
+  if (cached) {
+    out->append(cached->data(), cached->size());
+    return VcdCtx::Error::OK;
+  }
+
+  // Same sequence of calls VcdCtx would have made, as a single window.
+  std::string encoded;
+  open_vcdiff::OutputString<std::string> encoded_out(&encoded);
+  VcdCtx::Error err = encoder_->Start(&encoded_out);
+  if (err == VcdCtx::Error::OK)
+    err = encoder_->Process(target_.data(), target_.size(), &encoded_out);
+  if (err == VcdCtx::Error::OK)
+    err = encoder_->Finish(&encoded_out);
+  if (err != VcdCtx::Error::OK)
+    return err;
+
+  out->append(encoded.data(), encoded.size());
+  // Output cut short by a time or ratio limit is not what a later request
+  // with more luck would get, so it is not worth keeping.
+  if (encoder_->Status() == 0)
+    cache_->Insert(key, std::move(target_), std::move(encoded));
+  return VcdCtx::Error::OK;
+}
+
+int VcdCachingEncoder::Status() const {
+  return encoder_->Status();
+}
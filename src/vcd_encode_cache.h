@@ -0,0 +1,137 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#ifndef VCD_ENCODE_CACHE_H_
+#define VCD_ENCODE_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <uv.h>
+#include <v8.h>
+
+#include "vcdiff.h"
+
+// LRU cache of complete encoder outputs, shared by all the encoders it is
+// passed to. Entries are keyed by the dictionary, the encoder settings and
+// a hash of the whole target, so a hit skips encoding entirely. The hash is
+// not collision resistant, so each entry also keeps its target, which must
+// be equal for a hit. Lookups and insertions happen on the thread pool,
+// hence the lock.
+class VcdEncodeCache : public node::ObjectWrap {
+ public:
+  struct Key {
+    uint64_t dictionary_id;
+    uint64_t settings;  // everything else that affects the output
+    uint64_t window_size;  // 0 when windows are not limited
+    uint64_t code_table_hash;  // 0 for the default code table
+    uint64_t target_hash;
+    size_t target_size;
+
+    bool operator==(const Key& other) const;
+  };
+
+  explicit VcdEncodeCache(size_t max_bytes);
+  virtual ~VcdEncodeCache();
+
+  static Key MakeKey(uint64_t dictionary_id,
+                     uint64_t settings,
+                     uint64_t window_size,
+                     uint64_t code_table_hash,
+                     const std::string& target);
+
+  // Identifies a custom code table in the key.
+  static uint64_t CodeTableHash(const char* code_table, size_t size);
+
+  // Both are thread-safe.
+  std::shared_ptr<const std::string> Lookup(const Key& key,
+                                            const std::string& target);
+  void Insert(const Key& key, std::string target, std::string encoded);
+
+  static void Init(v8::Handle<v8::Object> exports);
+  static bool HasInstance(v8::Isolate* isolate, v8::Local<v8::Value> value);
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  struct Entry {
+    Key key;
+    std::string target;  // compared on lookup, as keys may collide
+    std::shared_ptr<const std::string> encoded;
+  };
+
+  typedef std::list<Entry> LruList;
+
+  static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Stats(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void Clear(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
+
+  // Memory accounted for one entry.
+  static size_t EntrySize(const Entry& entry);
+  void EvictLocked(size_t max_bytes);
+
+  const size_t max_bytes_;
+  uv_mutex_t mutex_;
+  LruList lru_;  // most recently used first
+  std::unordered_map<Key, LruList::iterator, KeyHash> index_;
+  size_t bytes_ = 0;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+
+  VcdEncodeCache(const VcdEncodeCache& other) = delete;
+  VcdEncodeCache& operator=(const VcdEncodeCache& other) = delete;
+};
+
+// Coder that serves the whole output of |encoder| from |cache| when the
+// same target has been encoded before with the same dictionary and
+// settings. The input is collected until Finish(), so nothing is output
+// before the last write.
+class VcdCachingEncoder : public VcdCtx::Coder {
+ public:
+  VcdCachingEncoder(v8::Isolate* isolate,
+                    v8::Local<v8::Object> cache_handle,
+                    uint64_t dictionary_id,
+                    uint64_t settings,
+                    uint64_t window_size,
+                    uint64_t code_table_hash,
+                    std::unique_ptr<VcdCtx::Coder> encoder);
+  ~VcdCachingEncoder();
+
+  // VcdCtx::Coder implementation:
+  virtual VcdCtx::Error Start(
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual VcdCtx::Error Process(
+      const char* data,
+      size_t len,
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual VcdCtx::Error Finish(
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual int Status() const override;
+
+ private:
+  v8::Persistent<v8::Object> cache_handle_;
+  VcdEncodeCache* cache_;
+  const uint64_t dictionary_id_;
+  const uint64_t settings_;
+  const uint64_t window_size_;
+  const uint64_t code_table_hash_;
+  std::unique_ptr<VcdCtx::Coder> encoder_;
+  std::string target_;
+
+  VcdCachingEncoder(const VcdCachingEncoder& other) = delete;
+  VcdCachingEncoder& operator=(const VcdCachingEncoder& other) = delete;
+};
+
+#endif  // VCD_ENCODE_CACHE_H_
@@ -37,3 +37,7 @@ VcdCtx::Error VcdEncoder::Finish(open_vcdiff::OutputStringInterface* out) {
   encoder_->FinishEncodingToInterface(out);
   return VcdCtx::Error::OK;
 }
+
+int VcdEncoder::Status() const {
+  return encoder_->EncodeStatus();
+}
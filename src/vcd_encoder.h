@@ -33,6 +33,7 @@ class VcdEncoder : public VcdCtx::Coder {
       open_vcdiff::OutputStringInterface* out) override;
   virtual VcdCtx::Error Finish(
       open_vcdiff::OutputStringInterface* out) override;
+  virtual int Status() const override;
 
  private:
   std::unique_ptr<open_vcdiff::VCDiffStreamingEncoder> encoder_;
@@ -6,18 +6,25 @@
 
 #include "vcd_hashed_dictionary.h"
 
+#include <string>
+#include <vector>
+
 #include <node_buffer.h>
 
 #include "third-party/open-vcdiff/src/google/vcencoder.h"
 
 v8::Persistent<v8::Function> VcdHashedDictionary::constructor;
+v8::Persistent<v8::FunctionTemplate> VcdHashedDictionary::constructor_template;
+uint64_t VcdHashedDictionary::next_id_ = 1;
 
 VcdHashedDictionary::VcdHashedDictionary(
     std::unique_ptr<open_vcdiff::HashedDictionary> hashed_dictionary)
-    : hashed_dictionary_(std::move(hashed_dictionary)) {
+    : hashed_dictionary_(std::move(hashed_dictionary)),
+      id_(next_id_++) {
 }
 
 VcdHashedDictionary::~VcdHashedDictionary() {
+  segments_.Reset();
 }
 
 // static
@@ -29,25 +36,110 @@ void VcdHashedDictionary::Init(v8::Handle<v8::Object> exports) {
   tpl->SetClassName(className);
   tpl->InstanceTemplate()->SetInternalFieldCount(1);
 
+  constructor_template.Reset(isolate, tpl);
   exports->Set(className, tpl->GetFunction());
 }
 
+// static
+bool VcdHashedDictionary::HasInstance(v8::Isolate* isolate,
+                                      v8::Local<v8::Value> value) {
+  return v8::Local<v8::FunctionTemplate>::New(
+      isolate, constructor_template)->HasInstance(value);
+}
+
 // static
 void VcdHashedDictionary::New(const v8::FunctionCallbackInfo<v8::Value>& args) {
-  assert(args.Length() == 1 && "new HashedDictionary(buffer)");
+  assert(args.Length() >= 1 &&
+         "new HashedDictionary(buffer[, base][, hash]) or "
+         "new HashedDictionary(array)");
+
+  v8::Isolate *isolate = args.GetIsolate();
+
+  if (args[0]->IsArray()) {
+    NewSegmented(args);
+    return;
+  }
+
   assert(node::Buffer::HasInstance(args[0]) &&
          "should pass Buffer to constructor");
 
-  v8::Isolate *isolate = args.GetIsolate();
+  // A previous version of the dictionary that the new one extends, and the
+  // name of the rolling hash to use, in that order.  Either may be omitted.
+  VcdHashedDictionary* base = nullptr;
+  open_vcdiff::VCDiffHashType hash_type = open_vcdiff::VCD_HASH_POLYNOMIAL;
+  for (int i = 1; i < args.Length() && i < 3; ++i) {
+    if (args[i]->IsUndefined()) {
+      continue;
+    }
+    if (args[i]->IsString()) {
+      v8::String::Utf8Value hash_name(args[i]);
+      const std::string name(*hash_name);
+      if (name == "gear") {
+        hash_type = open_vcdiff::VCD_HASH_GEAR;
+      } else if (name != "polynomial") {
+        isolate->ThrowException(v8::Exception::TypeError(
+            v8::String::NewFromUtf8(isolate,
+                "hash should be 'polynomial' or 'gear'")));
+        return;
+      }
+      continue;
+    }
+    if (i != 1 || !HasInstance(isolate, args[i])) {
+      isolate->ThrowException(v8::Exception::TypeError(
+          v8::String::NewFromUtf8(isolate,
+              "base should be a HashedDictionary instance")));
+      return;
+    }
+    base = Unwrap<VcdHashedDictionary>(args[i]->ToObject());
+  }
 
   std::unique_ptr<open_vcdiff::HashedDictionary> dictionary(
       new open_vcdiff::HashedDictionary(node::Buffer::Data(args[0]),
-                                        node::Buffer::Length(args[0])));
+                                        node::Buffer::Length(args[0]),
+                                        hash_type));
+  bool ok = base ?
+      dictionary->InitFromBase(*base->hashed_dictionary()) :
+      dictionary->Init();
+  if (!ok) {
+    isolate->ThrowException(v8::String::NewFromUtf8(isolate,
+        "Error initializing hashed dictionary"));
+    return;
+  }
+  auto vcd_hashed_dict = new VcdHashedDictionary(std::move(dictionary));
+  vcd_hashed_dict->Wrap(args.This());
+}
+
+// static
+void VcdHashedDictionary::NewSegmented(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate *isolate = args.GetIsolate();
+
+  // Copy the array so that later changes to it by the caller do not release
+  // segments the dictionary still refers to.
+  v8::Local<v8::Array> array = v8::Local<v8::Array>::Cast(args[0]);
+  v8::Local<v8::Array> segments = v8::Array::New(isolate, array->Length());
+  std::vector<const open_vcdiff::HashedDictionary*> hashed_segments;
+  for (uint32_t i = 0; i < array->Length(); ++i) {
+    v8::Local<v8::Value> segment = array->Get(i);
+    if (!HasInstance(isolate, segment)) {
+      isolate->ThrowException(v8::Exception::TypeError(
+          v8::String::NewFromUtf8(isolate,
+              "segments should be HashedDictionary instances")));
+      return;
+    }
+    segments->Set(i, segment);
+    hashed_segments.push_back(
+        Unwrap<VcdHashedDictionary>(segment->ToObject())->hashed_dictionary());
+  }
+
+  std::unique_ptr<open_vcdiff::HashedDictionary> dictionary(
+      new open_vcdiff::HashedDictionary(hashed_segments));
   if (!dictionary->Init()) {
     isolate->ThrowException(v8::String::NewFromUtf8(isolate,
         "Error initializing hashed dictionary"));
     return;
   }
   auto vcd_hashed_dict = new VcdHashedDictionary(std::move(dictionary));
+  vcd_hashed_dict->segments_.Reset(isolate, segments);
   vcd_hashed_dict->Wrap(args.This());
 }
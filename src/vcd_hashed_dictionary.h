@@ -7,6 +7,7 @@
 #ifndef VCD_HASHED_DICTIONARY_H_
 #define VCD_HASHED_DICTIONARY_H_
 
+#include <cstdint>
 #include <memory>
 
 #include <node.h>
@@ -27,13 +28,26 @@ class VcdHashedDictionary : public node::ObjectWrap {
     return hashed_dictionary_.get();
   }
 
+  // Unique for the lifetime of the process, unlike the object's address.
+  uint64_t id() const { return id_; }
+
   static void Init(v8::Handle<v8::Object> exports);
+  static bool HasInstance(v8::Isolate* isolate, v8::Local<v8::Value> value);
 
  private:
   static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void NewSegmented(const v8::FunctionCallbackInfo<v8::Value>& args);
   static v8::Persistent<v8::Function> constructor;
+  static v8::Persistent<v8::FunctionTemplate> constructor_template;
 
   std::unique_ptr<open_vcdiff::HashedDictionary> hashed_dictionary_;
+  const uint64_t id_;
+
+  // The segments of a segmented dictionary, kept from GCing since the
+  // dictionary refers to their hash tables.
+  v8::Persistent<v8::Array> segments_;
+
+  static uint64_t next_id_;
 
   VcdHashedDictionary(const VcdHashedDictionary& other) = delete;
   VcdHashedDictionary& operator=(const VcdHashedDictionary& other) = delete;
@@ -0,0 +1,270 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#include "vcd_range_decoder.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <node_buffer.h>
+
+#include "third-party/open-vcdiff/src/google/vcdecoder.h"
+
+struct VcdRangeDecoder::RangeRequest {
+  uv_work_t work_req;
+  v8::Isolate* isolate;
+  v8::Persistent<v8::Value> delta_handle;  // keeps the buffers alive
+  v8::Persistent<v8::Value> dictionary_handle;
+  v8::Persistent<v8::Function> callback;
+  const char* delta;
+  size_t delta_len;
+  std::vector<const char*> dictionary_buffers;
+  std::vector<size_t> dictionary_lens;
+  std::string code_table;  // empty for the default one
+  size_t max_file_size;
+  size_t max_window_size;
+  size_t start;
+  size_t end;
+  bool ok;
+  std::string target;
+  size_t target_skip;  // bytes of |target| before |start|
+};
+
+namespace {
+
+// Lists the windows of the delta in |windows|, leaving |decoder| ready to
+// decode any of them.
+bool StartDecoding(const char* delta,
+                   size_t delta_len,
+                   const std::vector<const char*>& dictionary_buffers,
+                   const std::vector<size_t>& dictionary_lens,
+                   const std::string& code_table,
+                   open_vcdiff::VCDiffStreamingDecoder* decoder,
+                   std::vector<open_vcdiff::VCDiffWindowInfo>* windows) {
+  decoder->SetAllowVcdTarget(false);
+  if (!code_table.empty() &&
+      !decoder->SetKnownCodeTable(code_table.data(), code_table.size())) {
+    return false;
+  }
+  decoder->StartDecodingWithSegments(dictionary_buffers.data(),
+                                     dictionary_lens.data(),
+                                     dictionary_buffers.size());
+  return decoder->IndexWindows(delta, delta_len, windows);
+}
+
+void GetDictionarySegments(v8::Local<v8::Value> dictionary,
+                           std::vector<const char*>* buffers,
+                           std::vector<size_t>* lens) {
+  if (dictionary->IsArray()) {
+    v8::Local<v8::Array> segments = v8::Local<v8::Array>::Cast(dictionary);
+    for (uint32_t i = 0; i < segments->Length(); ++i) {
+      v8::Local<v8::Value> segment = segments->Get(i);
+      assert(node::Buffer::HasInstance(segment) &&
+             "dictionary segments should be Buffers");
+      buffers->push_back(node::Buffer::Data(segment));
+      lens->push_back(node::Buffer::Length(segment));
+    }
+  } else {
+    buffers->push_back(node::Buffer::Data(dictionary));
+    lens->push_back(node::Buffer::Length(dictionary));
+  }
+}
+
+std::string GetCodeTable(v8::Local<v8::Value> code_table) {
+  if (!node::Buffer::HasInstance(code_table))
+    return std::string();
+  return std::string(node::Buffer::Data(code_table),
+                     node::Buffer::Length(code_table));
+}
+
+}  // namespace
+
+// static
+void VcdRangeDecoder::Init(v8::Handle<v8::Object> exports) {
+  NODE_SET_METHOD(exports, "indexDelta", IndexDelta);
+  NODE_SET_METHOD(exports, "decodeRangeSync", DecodeRangeSync);
+  NODE_SET_METHOD(exports, "decodeRange", DecodeRangeAsync);
+}
+
+// static
+// args: (delta Buffer, dictionary Buffer or Array, codeTable)
+// Returns [headerLength, deltaOffset, deltaLength, targetOffset,
+// targetLength, ...] with four numbers per window.
+void VcdRangeDecoder::IndexDelta(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(node::Buffer::HasInstance(args[0]) && "delta should be a Buffer");
+  assert((node::Buffer::HasInstance(args[1]) || args[1]->IsArray()) &&
+         "Buffer or Array of Buffers required for dictionary");
+  v8::Isolate* isolate = args.GetIsolate();
+  const char* delta = node::Buffer::Data(args[0]);
+  size_t delta_len = node::Buffer::Length(args[0]);
+  std::vector<const char*> dictionary_buffers;
+  std::vector<size_t> dictionary_lens;
+  GetDictionarySegments(args[1], &dictionary_buffers, &dictionary_lens);
+
+  open_vcdiff::VCDiffStreamingDecoder decoder;
+  std::vector<open_vcdiff::VCDiffWindowInfo> windows;
+  if (!StartDecoding(delta, delta_len, dictionary_buffers, dictionary_lens,
+                     GetCodeTable(args[2]), &decoder, &windows)) {
+    isolate->ThrowException(v8::Exception::Error(
+        v8::String::NewFromUtf8(isolate, "Vcdiff decode error")));
+    return;
+  }
+
+  std::vector<double> numbers;
+  numbers.push_back(windows.empty() ? delta_len : windows[0].delta_offset);
+  for (const open_vcdiff::VCDiffWindowInfo& window : windows) {
+    numbers.push_back(window.delta_offset);
+    numbers.push_back(window.delta_length);
+    numbers.push_back(window.target_offset);
+    numbers.push_back(window.target_length);
+  }
+  v8::Local<v8::Array> result = v8::Array::New(isolate, numbers.size());
+  for (uint32_t i = 0; i < numbers.size(); ++i)
+    result->Set(i, v8::Number::New(isolate, numbers[i]));
+  args.GetReturnValue().Set(result);
+}
+
+// static
+// args: (delta Buffer, dictionary Buffer or Array, start, end,
+//        maxTargetFileSize, maxTargetWindowSize, codeTable[, cb])
+VcdRangeDecoder::RangeRequest* VcdRangeDecoder::ParseArgs(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(node::Buffer::HasInstance(args[0]) && "delta should be a Buffer");
+  assert((node::Buffer::HasInstance(args[1]) || args[1]->IsArray()) &&
+         "Buffer or Array of Buffers required for dictionary");
+
+  RangeRequest* request = new RangeRequest;
+  request->isolate = args.GetIsolate();
+  request->delta_handle.Reset(request->isolate, args[0]);
+  request->dictionary_handle.Reset(request->isolate, args[1]);
+  request->delta = node::Buffer::Data(args[0]);
+  request->delta_len = node::Buffer::Length(args[0]);
+  GetDictionarySegments(args[1], &request->dictionary_buffers,
+                        &request->dictionary_lens);
+  request->start = static_cast<size_t>(args[2]->NumberValue());
+  request->end = static_cast<size_t>(args[3]->NumberValue());
+  request->max_file_size = args[4]->Uint32Value();
+  request->max_window_size = args[5]->Uint32Value();
+  request->code_table = GetCodeTable(args[6]);
+  request->target_skip = 0;
+  return request;
+}
+
+// static
+void VcdRangeDecoder::ReleaseHandles(RangeRequest* request) {
+  request->delta_handle.Reset();
+  request->dictionary_handle.Reset();
+  request->callback.Reset();
+}
+
+// static
+bool VcdRangeDecoder::DecodeRange(RangeRequest* request) {
+  open_vcdiff::VCDiffStreamingDecoder decoder;
+  decoder.SetMaximumTargetFileSize(request->max_file_size);
+  decoder.SetMaximumTargetWindowSize(request->max_window_size);
+  std::vector<open_vcdiff::VCDiffWindowInfo> windows;
+  if (!StartDecoding(request->delta, request->delta_len,
+                     request->dictionary_buffers, request->dictionary_lens,
+                     request->code_table, &decoder, &windows)) {
+    return false;
+  }
+
+  // Past the end of the target is like in Buffer.slice(): clamped.
+  size_t target_size = 0;
+  if (!windows.empty()) {
+    const open_vcdiff::VCDiffWindowInfo& last = windows.back();
+    target_size = last.target_offset + last.target_length;
+  }
+  request->end = std::min(request->end, target_size);
+  request->start = std::min(request->start, request->end);
+
+  bool decoded_any = false;
+  for (const open_vcdiff::VCDiffWindowInfo& window : windows) {
+    if (window.target_offset >= request->end)
+      break;
+    if (window.target_offset + window.target_length <= request->start)
+      continue;
+    if (!decoded_any) {
+      request->target_skip = request->start - window.target_offset;
+      decoded_any = true;
+    }
+    if (!decoder.DecodeChunk(request->delta + window.delta_offset,
+                             window.delta_length,
+                             &request->target)) {
+      return false;
+    }
+  }
+  return decoder.FinishDecoding();
+}
+
+// static
+void VcdRangeDecoder::DecodeRangeSync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  v8::Isolate* isolate = args.GetIsolate();
+  std::unique_ptr<RangeRequest> request(ParseArgs(args));
+  bool ok = DecodeRange(request.get());
+  ReleaseHandles(request.get());
+  if (!ok) {
+    isolate->ThrowException(v8::Exception::Error(
+        v8::String::NewFromUtf8(isolate, "Vcdiff decode error")));
+    return;
+  }
+  args.GetReturnValue().Set(node::Buffer::Copy(
+      isolate,
+      request->target.data() + request->target_skip,
+      request->end - request->start).ToLocalChecked());
+}
+
+// static
+void VcdRangeDecoder::DecodeRangeAsync(
+    const v8::FunctionCallbackInfo<v8::Value>& args) {
+  assert(args[7]->IsFunction() && "callback should be a Function");
+  RangeRequest* request = ParseArgs(args);
+  request->callback.Reset(args.GetIsolate(),
+                          v8::Local<v8::Function>::Cast(args[7]));
+  request->work_req.data = request;
+  uv_queue_work(uv_default_loop(),
+                &request->work_req,
+                DecodeRangeShim,
+                AfterDecodeRangeShim);
+  args.GetReturnValue().Set(v8::Undefined(args.GetIsolate()));
+}
+
+// static
+// thread pool!
+void VcdRangeDecoder::DecodeRangeShim(uv_work_t* work_req) {
+  RangeRequest* request = static_cast<RangeRequest*>(work_req->data);
+  request->ok = DecodeRange(request);
+}
+
+// static
+void VcdRangeDecoder::AfterDecodeRangeShim(uv_work_t* work_req, int status) {
+  assert(status == 0);
+
+  std::unique_ptr<RangeRequest> request(
+      static_cast<RangeRequest*>(work_req->data));
+  v8::Isolate* isolate = request->isolate;
+  v8::HandleScope handle_scope(isolate);
+
+  v8::Local<v8::Value> args[2];
+  if (!request->ok) {
+    args[0] = v8::Exception::Error(
+        v8::String::NewFromUtf8(isolate, "Vcdiff decode error"));
+    args[1] = v8::Undefined(isolate);
+  } else {
+    args[0] = v8::Null(isolate);
+    args[1] = node::Buffer::Copy(
+        isolate,
+        request->target.data() + request->target_skip,
+        request->end - request->start).ToLocalChecked();
+  }
+  v8::Local<v8::Function> callback =
+      v8::Local<v8::Function>::New(isolate, request->callback);
+  node::MakeCallback(isolate, isolate->GetCurrentContext()->Global(),
+                     callback, 2, args);
+  ReleaseHandles(request.get());
+}
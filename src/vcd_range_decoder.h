@@ -0,0 +1,41 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#ifndef VCD_RANGE_DECODER_H_
+#define VCD_RANGE_DECODER_H_
+
+#include <string>
+
+#include <node.h>
+#include <uv.h>
+#include <v8.h>
+
+// Random access to the target of a delta file whose windows can be decoded
+// on their own, such as those written with the encodeWindowSize option: the
+// windows are listed with open_vcdiff::VCDiffStreamingDecoder::IndexWindows()
+// and only those that overlap the requested range are decoded.
+class VcdRangeDecoder {
+ public:
+  static void Init(v8::Handle<v8::Object> exports);
+
+ private:
+  struct RangeRequest;
+
+  static void IndexDelta(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void DecodeRangeSync(const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void DecodeRangeAsync(
+      const v8::FunctionCallbackInfo<v8::Value>& args);
+  static RangeRequest* ParseArgs(
+      const v8::FunctionCallbackInfo<v8::Value>& args);
+  static void ReleaseHandles(RangeRequest* request);
+  static bool DecodeRange(RangeRequest* request);
+  static void DecodeRangeShim(uv_work_t* work_req);
+  static void AfterDecodeRangeShim(uv_work_t* work_req, int status);
+
+  VcdRangeDecoder() = delete;
+};
+
+#endif  // VCD_RANGE_DECODER_H_
@@ -0,0 +1,159 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#include "vcd_zlib.h"
+
+#include <cstring>
+
+#include "third-party/open-vcdiff/src/google/output_string.h"
+
+namespace {
+
+// Size of the on-stack buffer zlib output goes through.
+const size_t kZlibChunkSize = 16 * 1024;
+
+// zlib picks the container from windowBits: 8..15 is the zlib format,
+// +16 is gzip and +32 (inflate only) detects either of them.
+const int kWindowBits = 15;
+const int kGzipWindowBits = kWindowBits + 16;
+const int kAutoDetectWindowBits = kWindowBits + 32;
+const int kMemLevel = 8;
+
+}  // namespace
+
+VcdDeflater::VcdDeflater(std::unique_ptr<VcdCtx::Coder> encoder,
+                         VcdCtx::Compression compression,
+                         int level)
+    : encoder_(std::move(encoder)),
+      compression_(compression),
+      level_(level) {
+  std::memset(&stream_, 0, sizeof(stream_));
+}
+
+VcdDeflater::~VcdDeflater() {
+  if (stream_initialized_)
+    deflateEnd(&stream_);
+}
+
+VcdCtx::Error VcdDeflater::Start(open_vcdiff::OutputStringInterface* out) {
+  int window_bits = compression_ == VcdCtx::Compression::GZIP ?
+      kGzipWindowBits : kWindowBits;
+  if (deflateInit2(&stream_, level_, Z_DEFLATED, window_bits, kMemLevel,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return VcdCtx::Error::ZLIB_ERROR;
+  }
+  stream_initialized_ = true;
+
+  open_vcdiff::OutputString<std::string> encoded(&encoded_);
+  VcdCtx::Error err = encoder_->Start(&encoded);
+  if (err != VcdCtx::Error::OK)
+    return err;
+  // The header is tiny, keep it in the deflate stream with the first window.
+  return Deflate(Z_NO_FLUSH, out);
+}
+
+VcdCtx::Error VcdDeflater::Process(const char* data,
+                                   size_t len,
+                                   open_vcdiff::OutputStringInterface* out) {
+  open_vcdiff::OutputString<std::string> encoded(&encoded_);
+  VcdCtx::Error err = encoder_->Process(data, len, &encoded);
+  if (err != VcdCtx::Error::OK)
+    return err;
+  // Sync flush, so that each write() yields everything encoded so far,
+  // just like the plain encoder does.
+  return Deflate(Z_SYNC_FLUSH, out);
+}
+
+VcdCtx::Error VcdDeflater::Finish(open_vcdiff::OutputStringInterface* out) {
+  open_vcdiff::OutputString<std::string> encoded(&encoded_);
+  VcdCtx::Error err = encoder_->Finish(&encoded);
+  if (err != VcdCtx::Error::OK)
+    return err;
+  return Deflate(Z_FINISH, out);
+}
+
+int VcdDeflater::Status() const {
+  return encoder_->Status();
+}
+
+VcdCtx::Error VcdDeflater::Deflate(int flush,
+                                   open_vcdiff::OutputStringInterface* out) {
+  char chunk[kZlibChunkSize];
+  stream_.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(encoded_.data()));
+  stream_.avail_in = static_cast<uInt>(encoded_.size());
+  int ret;
+  do {
+    stream_.next_out = reinterpret_cast<Bytef*>(chunk);
+    stream_.avail_out = sizeof(chunk);
+    ret = deflate(&stream_, flush);
+    if (ret == Z_STREAM_ERROR)
+      return VcdCtx::Error::ZLIB_ERROR;
+    out->append(chunk, sizeof(chunk) - stream_.avail_out);
+  } while (stream_.avail_out == 0);
+  encoded_.clear();
+  if (flush == Z_FINISH && ret != Z_STREAM_END)
+    return VcdCtx::Error::ZLIB_ERROR;
+  return VcdCtx::Error::OK;
+}
+
+VcdInflater::VcdInflater(std::unique_ptr<VcdCtx::Coder> decoder)
+    : decoder_(std::move(decoder)) {
+  std::memset(&stream_, 0, sizeof(stream_));
+}
+
+VcdInflater::~VcdInflater() {
+  if (stream_initialized_)
+    inflateEnd(&stream_);
+}
+
+VcdCtx::Error VcdInflater::Start(open_vcdiff::OutputStringInterface* out) {
+  if (inflateInit2(&stream_, kAutoDetectWindowBits) != Z_OK)
+    return VcdCtx::Error::ZLIB_ERROR;
+  stream_initialized_ = true;
+  return decoder_->Start(out);
+}
+
+VcdCtx::Error VcdInflater::Process(const char* data,
+                                   size_t len,
+                                   open_vcdiff::OutputStringInterface* out) {
+  if (len == 0)
+    return VcdCtx::Error::OK;
+  if (stream_ended_)
+    return VcdCtx::Error::ZLIB_ERROR;  // trailing garbage
+
+  char chunk[kZlibChunkSize];
+  stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream_.avail_in = static_cast<uInt>(len);
+  do {
+    stream_.next_out = reinterpret_cast<Bytef*>(chunk);
+    stream_.avail_out = sizeof(chunk);
+    int ret = inflate(&stream_, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+      return VcdCtx::Error::ZLIB_ERROR;
+    // Each inflated piece goes straight to the decoder, no need to collect
+    // the whole decompressed chunk first.
+    size_t have = sizeof(chunk) - stream_.avail_out;
+    if (have > 0) {
+      VcdCtx::Error err = decoder_->Process(chunk, have, out);
+      if (err != VcdCtx::Error::OK)
+        return err;
+    }
+    if (ret == Z_STREAM_END) {
+      stream_ended_ = true;
+      if (stream_.avail_in != 0)
+        return VcdCtx::Error::ZLIB_ERROR;
+      break;
+    }
+  } while (stream_.avail_in != 0 || stream_.avail_out == 0);
+  return VcdCtx::Error::OK;
+}
+
+VcdCtx::Error VcdInflater::Finish(open_vcdiff::OutputStringInterface* out) {
+  if (!stream_ended_)
+    return VcdCtx::Error::ZLIB_ERROR;  // truncated input
+  return decoder_->Finish(out);
+}
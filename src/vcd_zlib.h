@@ -0,0 +1,80 @@
+// node-vcdiff
+// https://github.com/baranov1ch/node-vcdiff
+//
+// Copyright 2014 Alexey Baranov <me@kotiki.cc>
+// Released under the MIT license
+
+#ifndef VCD_ZLIB_H_
+#define VCD_ZLIB_H_
+
+#include <memory>
+#include <string>
+
+#include <zlib.h>
+
+#include "vcdiff.h"
+
+// Runs the output of a vcdiff encoder through deflate on the same worker
+// thread, producing e.g. the body of a "Content-Encoding: sdch, gzip"
+// response in one pass.
+class VcdDeflater : public VcdCtx::Coder {
+ public:
+  VcdDeflater(std::unique_ptr<VcdCtx::Coder> encoder,
+              VcdCtx::Compression compression,
+              int level);
+  ~VcdDeflater();
+
+  // VcdCtx::Coder implementation:
+  virtual VcdCtx::Error Start(
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual VcdCtx::Error Process(
+      const char* data,
+      size_t len,
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual VcdCtx::Error Finish(
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual int Status() const override;
+
+ private:
+  // Compresses whatever |encoder_| has left in |encoded_| into |out|.
+  VcdCtx::Error Deflate(int flush, open_vcdiff::OutputStringInterface* out);
+
+  std::unique_ptr<VcdCtx::Coder> encoder_;
+  const VcdCtx::Compression compression_;
+  const int level_;
+  z_stream stream_;
+  bool stream_initialized_ = false;
+  std::string encoded_;
+
+  VcdDeflater(const VcdDeflater& other) = delete;
+  VcdDeflater& operator=(const VcdDeflater& other) = delete;
+};
+
+// The client side of VcdDeflater: inflates its input (either zlib or gzip
+// format is accepted) and feeds the result to a vcdiff decoder.
+class VcdInflater : public VcdCtx::Coder {
+ public:
+  explicit VcdInflater(std::unique_ptr<VcdCtx::Coder> decoder);
+  ~VcdInflater();
+
+  // VcdCtx::Coder implementation:
+  virtual VcdCtx::Error Start(
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual VcdCtx::Error Process(
+      const char* data,
+      size_t len,
+      open_vcdiff::OutputStringInterface* out) override;
+  virtual VcdCtx::Error Finish(
+      open_vcdiff::OutputStringInterface* out) override;
+
+ private:
+  std::unique_ptr<VcdCtx::Coder> decoder_;
+  z_stream stream_;
+  bool stream_initialized_ = false;
+  bool stream_ended_ = false;
+
+  VcdInflater(const VcdInflater& other) = delete;
+  VcdInflater& operator=(const VcdInflater& other) = delete;
+};
+
+#endif  // VCD_ZLIB_H_
@@ -12,9 +12,16 @@
 
 #include "third-party/open-vcdiff/src/google/vcdecoder.h"
 #include "third-party/open-vcdiff/src/google/vcencoder.h"
+#include "vcd_code_table_trainer.h"
 #include "vcd_decoder.h"
+#include "vcd_diff.h"
+#include "vcd_dictionary_analyzer.h"
+#include "vcd_dictionary_builder.h"
+#include "vcd_encode_cache.h"
 #include "vcd_encoder.h"
 #include "vcd_hashed_dictionary.h"
+#include "vcd_range_decoder.h"
+#include "vcd_zlib.h"
 #include "vcdiff.h"
 
 v8::Persistent<v8::Function> VcdCtx::constructor;
@@ -57,16 +64,80 @@ void VcdCtx::New(const v8::FunctionCallbackInfo<v8::Value>& args) {
             hashed_dict->hashed_dictionary(),
             args[3]->Uint32Value(),
             args[2]->BooleanValue()));
+    encoder->SetMaximumEncodeTime(args[4]->IntegerValue());
+    encoder->SetMaximumDeltaRatio(args[5]->NumberValue());
+    encoder->SetOptimalParsing(args[9]->BooleanValue());
+    size_t window_size = static_cast<size_t>(args[14]->NumberValue());
+    encoder->SetMaximumWindowSize(window_size);
+    // Before the code table, which must have opcodes for every mode.
+    int near_cache_size = args[12]->Int32Value();
+    int same_cache_size = args[13]->Int32Value();
+    if (!encoder->SetAddressCacheSizes(near_cache_size, same_cache_size)) {
+      isolate->ThrowException(v8::Exception::Error(
+          v8::String::NewFromUtf8(isolate, "Invalid address cache sizes")));
+      return;
+    }
+    uint64_t code_table_hash = 0;
+    bool embed_code_table = false;
+    if (node::Buffer::HasInstance(args[10])) {
+      const char* code_table = node::Buffer::Data(args[10]);
+      size_t code_table_size = node::Buffer::Length(args[10]);
+      embed_code_table = args[11]->BooleanValue();
+      if (!encoder->SetCodeTable(code_table,
+                                 code_table_size,
+                                 embed_code_table)) {
+        isolate->ThrowException(v8::Exception::Error(
+            v8::String::NewFromUtf8(isolate, "Invalid code table")));
+        return;
+      }
+      code_table_hash =
+          VcdEncodeCache::CodeTableHash(code_table, code_table_size);
+    }
     coder.reset(new VcdEncoder(isolate, args[1]->ToObject(), std::move(encoder)));
+    Compression compression = static_cast<Compression>(args[6]->Int32Value());
+    if (compression != Compression::NONE) {
+      coder.reset(new VcdDeflater(std::move(coder),
+                                  compression,
+                                  args[7]->Int32Value()));
+    }
+    if (VcdEncodeCache::HasInstance(isolate, args[8])) {
+      // Everything that changes the output for a given target must be part
+      // of the cache key. Limits are not: limited output is never cached.
+      uint64_t settings = static_cast<uint64_t>(args[3]->Uint32Value()) |
+          static_cast<uint64_t>(args[2]->BooleanValue()) << 32 |
+          static_cast<uint64_t>(compression) << 33 |
+          static_cast<uint64_t>(args[7]->Int32Value() + 1) << 40 |
+          static_cast<uint64_t>(args[9]->BooleanValue()) << 44 |
+          static_cast<uint64_t>(embed_code_table) << 45 |
+          static_cast<uint64_t>(near_cache_size) << 46 |
+          static_cast<uint64_t>(same_cache_size) << 54;
+      coder.reset(new VcdCachingEncoder(isolate,
+                                        args[8]->ToObject(),
+                                        hashed_dict->id(),
+                                        settings,
+                                        window_size,
+                                        code_table_hash,
+                                        std::move(coder)));
+    }
   } else {
-    assert(node::Buffer::HasInstance(args[1]) &&
-           "Buffer required for decoder");
+    assert((node::Buffer::HasInstance(args[1]) || args[1]->IsArray()) &&
+           "Buffer or Array of Buffers required for decoder");
     std::unique_ptr<open_vcdiff::VCDiffStreamingDecoder> decoder(
         new open_vcdiff::VCDiffStreamingDecoder());
     decoder->SetAllowVcdTarget(args[2]->BooleanValue());
     decoder->SetMaximumTargetFileSize(args[3]->Uint32Value());
     decoder->SetMaximumTargetWindowSize(args[4]->Uint32Value());
+    decoder->SetTrustedInput(args[7]->BooleanValue());
+    if (node::Buffer::HasInstance(args[6]) &&
+        !decoder->SetKnownCodeTable(node::Buffer::Data(args[6]),
+                                    node::Buffer::Length(args[6]))) {
+      isolate->ThrowException(v8::Exception::Error(
+          v8::String::NewFromUtf8(isolate, "Invalid code table")));
+      return;
+    }
     coder.reset(new VcdDecoder(isolate, args[1]->ToObject(), std::move(decoder)));
+    if (args[5]->BooleanValue())
+      coder.reset(new VcdInflater(std::move(coder)));
   }
 
   auto ctx = new VcdCtx(std::move(coder));
@@ -133,9 +204,10 @@ v8::Local<v8::Object> VcdCtx::Write(
 v8::Local<v8::Array> VcdCtx::FinishWrite(v8::Isolate* isolate) {
   write_in_progress_ = false;
   in_buffer_.Reset();
-  v8::Local<v8::Array> result = v8::Array::New(isolate, 2);
+  v8::Local<v8::Array> result = v8::Array::New(isolate, 3);
   result->Set(0, GetOutputBuffer(isolate));
   result->Set(1, v8::Boolean::New(isolate, state_ == State::DONE));
+  result->Set(2, v8::Integer::New(isolate, coder_->Status()));
   output_buffer_.clear();
   return result;
 }
@@ -238,11 +310,12 @@ void VcdCtx::AfterShim(uv_work_t* work_req, int status) {
     return;
 
   v8::Local<v8::Array> result = ctx->FinishWrite(isolate);
-  v8::Local<v8::Value> args[2] = {
+  v8::Local<v8::Value> args[3] = {
     result->Get(0),
     result->Get(1),
+    result->Get(2),
   };
-  node::MakeCallback(isolate, ctx->handle(), "callback", 2, args);
+  node::MakeCallback(isolate, ctx->handle(), "callback", 3, args);
 
   if (ctx->pending_close_)
     ctx->Close();
@@ -257,6 +330,8 @@ const char* VcdCtx::GetErrorString(VcdCtx::Error err) {
       return "Vcdiff encode error";
     case Error::DECODE_ERROR:
       return "Vcdiff decode error";
+    case Error::ZLIB_ERROR:
+      return "Vcdiff zlib error";
     default:
       return "Vcdiff unknown error";
   }
@@ -290,6 +365,12 @@ void VcdCtx::Init(v8::Handle<v8::Object> exports) {
   NODE_SET_CONSTANT_FROM_ENUM(exports, INIT_ERROR, Error::INIT_ERROR);
   NODE_SET_CONSTANT_FROM_ENUM(exports, ENCODE_ERROR, Error::ENCODE_ERROR);
   NODE_SET_CONSTANT_FROM_ENUM(exports, DECODE_ERROR, Error::DECODE_ERROR);
+  NODE_SET_CONSTANT_FROM_ENUM(exports, ZLIB_ERROR, Error::ZLIB_ERROR);
+  NODE_SET_CONSTANT_FROM_ENUM(exports, COMPRESSION_NONE, Compression::NONE);
+  NODE_SET_CONSTANT_FROM_ENUM(exports,
+                              COMPRESSION_DEFLATE,
+                              Compression::DEFLATE);
+  NODE_SET_CONSTANT_FROM_ENUM(exports, COMPRESSION_GZIP, Compression::GZIP);
   NODE_SET_CONSTANT_FROM_ENUM(exports,
                               VCD_STANDARD_FORMAT,
                               open_vcdiff::VCD_STANDARD_FORMAT);
@@ -302,12 +383,24 @@ void VcdCtx::Init(v8::Handle<v8::Object> exports) {
   NODE_SET_CONSTANT_FROM_ENUM(exports,
                               VCD_FORMAT_JSON,
                               open_vcdiff::VCD_FORMAT_JSON);
+  NODE_SET_CONSTANT_FROM_ENUM(exports,
+                              VCD_ENCODE_TIME_LIMIT_REACHED,
+                              open_vcdiff::VCD_ENCODE_TIME_LIMIT_REACHED);
+  NODE_SET_CONSTANT_FROM_ENUM(exports,
+                              VCD_ENCODE_TARGET_INCOMPRESSIBLE,
+                              open_vcdiff::VCD_ENCODE_TARGET_INCOMPRESSIBLE);
 #undef NODE_SET_CONSTANT_FROM_ENUM
 }
 
 void InitVcdiff(v8::Handle<v8::Object> exports) {
   VcdCtx::Init(exports);
   VcdHashedDictionary::Init(exports);
+  VcdDictionaryAnalyzer::Init(exports);
+  VcdCodeTableTrainer::Init(exports);
+  VcdEncodeCache::Init(exports);
+  VcdDictionaryBuilder::Init(exports);
+  VcdDiff::Init(exports);
+  VcdRangeDecoder::Init(exports);
 }
 
 NODE_MODULE(vcdiff, InitVcdiff)
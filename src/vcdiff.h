@@ -31,6 +31,14 @@ class VcdCtx : public node::ObjectWrap {
     INIT_ERROR,
     ENCODE_ERROR,
     DECODE_ERROR,
+    ZLIB_ERROR,
+  };
+
+  // Optional zlib stage fused with the coder, see vcd_zlib.h.
+  enum class Compression {
+    NONE,
+    DEFLATE,
+    GZIP,
   };
 
   class Coder {
@@ -40,7 +48,11 @@ class VcdCtx : public node::ObjectWrap {
                           size_t len,
                           open_vcdiff::OutputStringInterface* out) = 0;
     virtual Error Finish(open_vcdiff::OutputStringInterface* out) = 0;
-    
+
+    // Returns open_vcdiff::VCDiffEncodeStatusFlags describing the shortcuts
+    // taken so far. Only encoders ever take any.
+    virtual int Status() const { return 0; }
+
     virtual ~Coder() {}
   };
 